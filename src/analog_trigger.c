@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "analog_trigger.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define RING_MASK               (ANALOG_RING_SAMPLES - 1)
+#define RING_HALF               (ANALOG_RING_SAMPLES / 2)
+#define COUNTS_MAX              (4095)
+#define ADC_CLOCK_NS            (40)    // PCLK2 / 4 = 25 MHz
+#define CONVERSION_CYCLES       (12)    // after the sampling, 12 bit
+#define CROSSING_SEARCH_MAX     (256)   // samples back from the interrupt
+#define BASELINE_STRIDE         (4)     // every 4th sample of a half goes into the baseline
+#define BASELINE_WEIGHT         (8)     // of the previous halves, against the new one
+
+typedef enum window_state {
+    WINDOW_FREE = 0,
+    WINDOW_PENDING,                     // press seen, waiting for the samples after it
+    WINDOW_READY,
+} window_state_t;
+
+typedef struct analog_rate_config {
+    uint32_t sampling_time;
+    uint32_t sampling_cycles;
+} analog_rate_config_t;
+
+static const analog_rate_config_t rate_configs[ANALOG_RATE_MAX] = {
+    [ANALOG_RATE_1667K] = { ADC_SAMPLETIME_3CYCLES, 3 },
+    [ANALOG_RATE_625K]  = { ADC_SAMPLETIME_28CYCLES, 28 },
+    [ANALOG_RATE_160K]  = { ADC_SAMPLETIME_144CYCLES, 144 },
+    [ANALOG_RATE_51K]   = { ADC_SAMPLETIME_480CYCLES, 480 },
+};
+
+static uint16_t ring[ANALOG_RING_SAMPLES] __attribute__((aligned(32)));
+static uint16_t window[ANALOG_WINDOW_SAMPLES];
+
+static bool running = false;
+static analog_mode_t mode = ANALOG_MODE_THRESHOLD;
+static analog_rate_t rate = ANALOG_RATE_1667K;
+static bool rising = true;
+static uint32_t threshold = 0;          // counts
+static uint32_t hysteresis = 0;
+static volatile bool pressed = false;
+static volatile uint32_t halves = 0;    // half transfers completed
+static volatile uint32_t presses = 0;
+static volatile uint32_t releases = 0;
+static volatile uint32_t overruns = 0;
+static volatile bool overrun_pending = false;
+
+// Photodiode mode, the levels in counts x16
+static int32_t baseline = 0;
+static int32_t noise = 0;               // mean deviation from the baseline
+static uint32_t min_step = 0;           // counts
+static volatile bool settling = false;  // watchdog open, no baseline
+static uint32_t settle_until = 0;       // absolute sample number
+static uint32_t step_level = 0;         // counts
+static volatile uint32_t steps = 0;
+static bool click_down = false;
+static bool click_scheduled = false;
+static uint32_t click_down_ms = 0;
+static uint32_t click_next_ms = 0;
+
+static volatile window_state_t window_state = WINDOW_FREE;
+static uint32_t window_crossing = 0;    // absolute sample number
+static uint32_t window_press_us = 0;
+
+uint32_t analog_counts_to_mv(uint32_t counts)
+{
+    return (counts * ANALOG_FULL_SCALE_MV + COUNTS_MAX / 2) / COUNTS_MAX;
+}
+
+uint32_t analog_mv_to_counts(uint32_t mv)
+{
+    uint32_t counts = (mv * COUNTS_MAX + ANALOG_FULL_SCALE_MV / 2) / ANALOG_FULL_SCALE_MV;
+    return (counts > COUNTS_MAX) ? COUNTS_MAX : counts;
+}
+
+static uint32_t period_cycles(void)
+{
+    return rate_configs[rate].sampling_cycles + CONVERSION_CYCLES;
+}
+
+// Watchdog window that is left at the next press, or at the next release
+static void watchdog_arm(bool for_press)
+{
+    uint32_t high = COUNTS_MAX;
+    uint32_t low = 0;
+
+    if (rising) {
+        if (for_press) {
+            high = threshold;
+        } else {
+            low = (threshold > hysteresis) ? threshold - hysteresis : 0;
+        }
+    } else {
+        if (for_press) {
+            low = threshold;
+        } else {
+            high = (threshold + hysteresis < COUNTS_MAX) ? threshold + hysteresis : COUNTS_MAX;
+        }
+    }
+    hadc2.Instance->HTR = high;
+    hadc2.Instance->LTR = low;
+}
+
+// Watchdog window around the baseline, in photodiode mode
+static void photodiode_arm(void)
+{
+    int32_t level = baseline / 16;
+    int32_t delta = noise * ANALOG_PHOTODIODE_NOISE_X / 16;
+    if (delta < (int32_t)min_step) {
+        delta = (int32_t)min_step;
+    }
+    hadc2.Instance->HTR = (level + delta < COUNTS_MAX) ? (uint32_t)(level + delta) : COUNTS_MAX;
+    hadc2.Instance->LTR = (level > delta) ? (uint32_t)(level - delta) : 0;
+}
+
+static uint32_t settle_samples(void)
+{
+    return ANALOG_PHOTODIODE_SETTLE_MS * 1000000UL / analog_trigger_sample_ns();
+}
+
+// Outside the current watchdog window, like the watchdog sees it
+static bool is_past(uint32_t sample)
+{
+    return (sample > hadc2.Instance->HTR) || (sample < hadc2.Instance->LTR);
+}
+
+// Samples written so far, also while a transfer interrupt is still pending behind this one
+static uint32_t samples_written(void)
+{
+    uint32_t pos = ANALOG_RING_SAMPLES - __HAL_DMA_GET_COUNTER(&hdma_adc2);
+    uint32_t done = halves;
+    uint32_t base = (done / 2) * ANALOG_RING_SAMPLES;
+
+    if ((done & 1) && (pos < RING_HALF)) {
+        base += ANALOG_RING_SAMPLES;
+    }
+    return base + pos;
+}
+
+static void window_start(uint32_t crossing, uint32_t timestamp_us)
+{
+    if (window_state == WINDOW_FREE) {
+        window_crossing = crossing;
+        window_press_us = timestamp_us;
+        window_state = WINDOW_PENDING;
+    }
+}
+
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef *hadc)
+{
+    uint32_t now_us = xlat_counter_1mhz_get();
+    bool for_press = !pressed;
+    uint32_t written = samples_written();
+    (void)hadc;
+
+    // The crossing sample is the oldest one past the threshold, usually the newest in the ring
+    SCB_InvalidateDCache_by_Addr((uint32_t *)ring, sizeof(ring));
+    uint32_t crossing = written;
+    for (size_t n = 0; (n < CROSSING_SEARCH_MAX) && is_past(ring[(crossing - 1) & RING_MASK]); n++) {
+        crossing--;
+    }
+
+    // Its age: the newest sample just finished converting, and the input is held during the sampling.
+    // Between the crossing sample and the one before it, the threshold is passed proportionally.
+    uint32_t age_cycles = CONVERSION_CYCLES + rate_configs[rate].sampling_cycles / 2;
+    if (crossing < written) {
+        age_cycles += (written - 1 - crossing) * period_cycles();
+
+        int32_t cur = ring[crossing & RING_MASK];
+        int32_t prev = ring[(crossing - 1) & RING_MASK];
+        uint32_t level = ((uint32_t)cur > hadc2.Instance->HTR) ? hadc2.Instance->HTR : hadc2.Instance->LTR;
+        if ((cur != prev) && !is_past(prev)) {
+            age_cycles += (uint32_t)(((int32_t)level - cur) * (int32_t)period_cycles() / (prev - cur));
+        }
+        step_level = level;
+    }
+    uint32_t timestamp_us = now_us - (age_cycles * ADC_CLOCK_NS + 500) / 1000;
+
+    if (mode == ANALOG_MODE_PHOTODIODE) {
+        // Screen change: open the window until the new level has settled
+        hadc2.Instance->HTR = COUNTS_MAX;
+        hadc2.Instance->LTR = 0;
+        settle_until = crossing + settle_samples();
+        settling = true;
+        steps++;
+        xlat_photon_from_isr(timestamp_us);
+        window_start(crossing, timestamp_us);
+        return;
+    }
+
+    pressed = for_press;
+    watchdog_arm(!for_press);
+    xlat_trigger_edge_from_isr(ANALOG_TRIGGER_CHANNEL, for_press, timestamp_us);
+
+    if (for_press) {
+        presses++;
+        window_start(crossing, timestamp_us);
+    } else {
+        releases++;
+    }
+}
+
+// Baseline and noise from the half of the ring just written, in photodiode mode
+static void baseline_update(uint32_t half_start)
+{
+    const uint16_t *samples = &ring[half_start & RING_MASK];
+    uint32_t count = RING_HALF / BASELINE_STRIDE;
+    uint32_t sum = 0;
+    uint32_t deviation = 0;
+
+    SCB_InvalidateDCache_by_Addr((uint32_t *)samples, RING_HALF * sizeof(ring[0]));
+    for (size_t i = 0; i < RING_HALF; i += BASELINE_STRIDE) {
+        sum += samples[i];
+    }
+    int32_t mean = (int32_t)(sum * 16 / count);
+    for (size_t i = 0; i < RING_HALF; i += BASELINE_STRIDE) {
+        int32_t d = (int32_t)samples[i] * 16 - mean;
+        deviation += (d < 0) ? -d : d;
+    }
+    int32_t mean_deviation = (int32_t)(deviation / count);
+
+    // The first half after a change starts from the new level
+    if (settling) {
+        baseline = mean;
+        noise = mean_deviation;
+        settling = false;
+    } else {
+        baseline += (mean - baseline) / BASELINE_WEIGHT;
+        noise += (mean_deviation - noise) / BASELINE_WEIGHT;
+    }
+    photodiode_arm();
+}
+
+static void transfer_done(void)
+{
+    halves++;
+
+    // The baseline follows slow changes of the brightness, and restarts once a change has settled
+    uint32_t half_start = (halves - 1) * RING_HALF;
+    if ((mode == ANALOG_MODE_PHOTODIODE) && (!settling || ((int32_t)(half_start - settle_until) >= 0))) {
+        baseline_update(half_start);
+    }
+
+    // Copy the window once the samples after the crossing are in, well before they are overwritten
+    if ((window_state == WINDOW_PENDING) &&
+        ((int32_t)(halves * RING_HALF - (window_crossing + ANALOG_POST_SAMPLES)) >= 0)) {
+        SCB_InvalidateDCache_by_Addr((uint32_t *)ring, sizeof(ring));
+        for (size_t i = 0; i < ANALOG_WINDOW_SAMPLES; i++) {
+            window[i] = ring[(window_crossing - ANALOG_PRE_SAMPLES + i) & RING_MASK];
+        }
+        window_state = WINDOW_READY;
+    }
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    (void)hadc;
+    transfer_done();
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    (void)hadc;
+    transfer_done();
+}
+
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef *hadc)
+{
+    // An overrun stops the DMA requests, the tick restarts the conversions
+    (void)hadc;
+    overruns++;
+    overrun_pending = true;
+}
+
+static bool hw_start(void)
+{
+    ADC_ChannelConfTypeDef channel_config = {0};
+    channel_config.Channel = ADC_CHANNEL_0;
+    channel_config.Rank = ADC_REGULAR_RANK_1;
+    channel_config.SamplingTime = rate_configs[rate].sampling_time;
+    if (HAL_ADC_ConfigChannel(&hadc2, &channel_config) != HAL_OK) {
+        return false;
+    }
+
+    ADC_AnalogWDGConfTypeDef watchdog_config = {0};
+    watchdog_config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+    watchdog_config.Channel = ADC_CHANNEL_0;
+    watchdog_config.ITMode = ENABLE;
+    watchdog_config.HighThreshold = COUNTS_MAX;
+    watchdog_config.LowThreshold = 0;
+    if (HAL_ADC_AnalogWDGConfig(&hadc2, &watchdog_config) != HAL_OK) {
+        return false;
+    }
+    // In photodiode mode the window stays open until the first half of the ring gives the baseline
+    pressed = false;
+    settling = (mode == ANALOG_MODE_PHOTODIODE);
+    settle_until = 0;
+    if (mode == ANALOG_MODE_THRESHOLD) {
+        watchdog_arm(true);
+    }
+
+    halves = 0;
+    window_state = WINDOW_FREE;
+    overrun_pending = false;
+    return (HAL_ADC_Start_DMA(&hadc2, (uint32_t *)ring, ANALOG_RING_SAMPLES) == HAL_OK);
+}
+
+static bool start(analog_rate_t sample_rate)
+{
+    rate = sample_rate;
+    presses = 0;
+    releases = 0;
+    overruns = 0;
+
+    if (!hw_start()) {
+        HAL_ADC_Stop_DMA(&hadc2);
+        printf("Analog trigger: ADC start failed\n");
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+bool analog_trigger_start(uint32_t threshold_mv, bool rising_edge, analog_rate_t sample_rate)
+{
+    if (running || (sample_rate >= ANALOG_RATE_MAX)) {
+        return false;
+    }
+    mode = ANALOG_MODE_THRESHOLD;
+    rising = rising_edge;
+    threshold = analog_mv_to_counts(threshold_mv);
+    hysteresis = analog_mv_to_counts(ANALOG_HYSTERESIS_MV);
+
+    if (!start(sample_rate)) {
+        return false;
+    }
+    printf("Analog trigger: A0 %s %lu mV, %lu ns per sample\n", rising ? "rising past" : "falling past",
+           analog_counts_to_mv(threshold), analog_trigger_sample_ns());
+    return true;
+}
+
+bool analog_trigger_start_photodiode(analog_rate_t sample_rate)
+{
+    if (running || (sample_rate >= ANALOG_RATE_MAX)) {
+        return false;
+    }
+    mode = ANALOG_MODE_PHOTODIODE;
+    min_step = analog_mv_to_counts(ANALOG_PHOTODIODE_MIN_STEP_MV);
+    baseline = 0;
+    noise = 0;
+    step_level = 0;
+    steps = 0;
+    click_down = false;
+    click_scheduled = false;
+
+    if (!start(sample_rate)) {
+        return false;
+    }
+    printf("Analog trigger: photodiode on A0, %lu ns per sample\n", analog_trigger_sample_ns());
+    return true;
+}
+
+// Self-driven clicks in photodiode mode, each press once the screen has settled
+static void photodiode_click(uint32_t now_ms)
+{
+    if (click_down) {
+        if (!running || (now_ms - click_down_ms >= ANALOG_PHOTODIODE_PRESS_MS)) {
+            xlat_auto_trigger_set(false);
+            click_down = false;
+        }
+        return;
+    }
+    if (!running || settling) {
+        return;
+    }
+    if (!click_scheduled) {
+        click_next_ms = now_ms;
+        click_scheduled = true;
+    }
+    if ((int32_t)(now_ms - click_next_ms) >= 0) {
+        xlat_auto_trigger_set(true);
+        click_down = true;
+        click_down_ms = now_ms;
+        // The jitter keeps the clicks from locking to the refresh rate
+        click_next_ms = now_ms + ANALOG_PHOTODIODE_CLICK_MS + rand() % 17;
+    }
+}
+
+void analog_trigger_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    HAL_ADC_Stop_DMA(&hadc2);
+    running = false;
+    if (mode == ANALOG_MODE_PHOTODIODE) {
+        photodiode_click(0);
+        printf("Analog trigger: %lu screen changes, %lu overruns\n", steps, overruns);
+    } else {
+        printf("Analog trigger: %lu presses, %lu releases, %lu overruns\n", presses, releases, overruns);
+    }
+}
+
+bool analog_trigger_is_running(void)
+{
+    return running;
+}
+
+analog_mode_t analog_trigger_mode(void)
+{
+    return mode;
+}
+
+bool analog_trigger_is_gpio_source(void)
+{
+    return running && (mode == ANALOG_MODE_THRESHOLD);
+}
+
+void analog_trigger_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+    if (overrun_pending) {
+        HAL_ADC_Stop_DMA(&hadc2);
+        if (!hw_start()) {
+            HAL_ADC_Stop_DMA(&hadc2);
+            running = false;
+            printf("Analog trigger: ADC restart failed\n");
+        }
+    }
+    if (mode == ANALOG_MODE_PHOTODIODE) {
+        photodiode_click(now_ms);
+    }
+}
+
+uint32_t analog_trigger_threshold_mv(void)
+{
+    return analog_counts_to_mv((mode == ANALOG_MODE_PHOTODIODE) ? step_level : threshold);
+}
+
+bool analog_trigger_is_rising(void)
+{
+    return rising;
+}
+
+uint32_t analog_trigger_sample_ns(void)
+{
+    return period_cycles() * ADC_CLOCK_NS;
+}
+
+uint32_t analog_trigger_level_mv(void)
+{
+    if (!running) {
+        return 0;
+    }
+    uint32_t newest = (samples_written() - 1) & RING_MASK;
+    SCB_InvalidateDCache_by_Addr((uint32_t *)&ring[newest & ~15u], 32);
+    return analog_counts_to_mv(ring[newest]);
+}
+
+bool analog_trigger_is_pressed(void)
+{
+    return pressed;
+}
+
+uint32_t analog_trigger_press_count(void)
+{
+    return presses;
+}
+
+uint32_t analog_trigger_release_count(void)
+{
+    return releases;
+}
+
+uint32_t analog_trigger_overrun_count(void)
+{
+    return overruns;
+}
+
+uint32_t analog_trigger_baseline_mv(void)
+{
+    return analog_counts_to_mv((uint32_t)(baseline + 8) / 16);
+}
+
+uint32_t analog_trigger_noise_mv(void)
+{
+    return analog_counts_to_mv((uint32_t)(noise + 8) / 16);
+}
+
+bool analog_trigger_is_settling(void)
+{
+    return settling;
+}
+
+uint32_t analog_trigger_step_count(void)
+{
+    return steps;
+}
+
+const uint16_t * analog_trigger_window(uint32_t *press_us)
+{
+    if (window_state != WINDOW_READY) {
+        return NULL;
+    }
+    if (press_us) {
+        *press_us = window_press_us;
+    }
+    return window;
+}
+
+void analog_trigger_window_release(void)
+{
+    if (window_state == WINDOW_READY) {
+        window_state = WINDOW_FREE;
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANALOG_TRIGGER_H
+#define ANALOG_TRIGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Analog trigger source on A0 for hall-effect and optical switches: the sensor voltage instead of
+// a GPIO edge. ADC2 converts continuously into a circular DMA ring and its analog watchdog raises an
+// interrupt on the first sample past the threshold, so nothing polls the samples. The interrupt looks
+// back in the ring for the crossing, interpolates between the two samples around it and gives the
+// press of channel 0 that time on the time base. Going back past the threshold by the hysteresis is
+// the release, and arms the next press. The waveform around a press is kept for display.
+//
+// In photodiode mode the sensor watches a patch of the screen instead, and channel 0 keeps its GPIO
+// input. The watchdog window follows the brightness: a baseline and its noise (mean deviation) are
+// tracked from every half of the ring, and leaving the baseline by 6 times the noise (at least 20 mV)
+// either way is a screen change. After a change the window stays open until the level has settled,
+// then the baseline restarts from the new level. The trigger output clicks by itself, and the time
+// from each press to the next screen change is the click -> photon latency.
+#define ANALOG_TRIGGER_CHANNEL          (0)
+#define ANALOG_RING_SAMPLES             (4096)  // power of two
+#define ANALOG_PRE_SAMPLES              (512)   // kept before the crossing
+#define ANALOG_POST_SAMPLES             (1024)  // and from it
+#define ANALOG_WINDOW_SAMPLES           (ANALOG_PRE_SAMPLES + ANALOG_POST_SAMPLES)
+#define ANALOG_FULL_SCALE_MV            (3300)
+#define ANALOG_HYSTERESIS_MV            (100)
+#define ANALOG_PHOTODIODE_NOISE_X       (6)     // step size, in mean deviations of the baseline
+#define ANALOG_PHOTODIODE_MIN_STEP_MV   (20)
+#define ANALOG_PHOTODIODE_SETTLE_MS     (10)
+#define ANALOG_PHOTODIODE_CLICK_MS      (300)   // click period, plus up to 16 ms of jitter
+#define ANALOG_PHOTODIODE_PRESS_MS      (100)
+
+typedef enum analog_mode {
+    ANALOG_MODE_THRESHOLD = 0,          // switch sensor, replaces the GPIO input of channel 0
+    ANALOG_MODE_PHOTODIODE,             // screen patch, for the click -> photon latency
+    ANALOG_MODE_MAX,
+} analog_mode_t;
+
+typedef enum analog_rate {
+    ANALOG_RATE_1667K = 0,              // 3 cycle sampling, low impedance sources only
+    ANALOG_RATE_625K,
+    ANALOG_RATE_160K,
+    ANALOG_RATE_51K,                    // 480 cycle sampling, for high impedance sensors
+    ANALOG_RATE_MAX,
+} analog_rate_t;
+
+bool analog_trigger_start(uint32_t threshold_mv, bool rising, analog_rate_t rate);
+bool analog_trigger_start_photodiode(analog_rate_t rate);
+void analog_trigger_stop(void);
+bool analog_trigger_is_running(void);
+analog_mode_t analog_trigger_mode(void);
+// Running in threshold mode, the presses of channel 0 come from the ADC
+bool analog_trigger_is_gpio_source(void);
+
+// Gfx task: restarts the conversions after an overrun, and clicks in photodiode mode.
+// Call it every 10 ms.
+void analog_trigger_tick(uint32_t now_ms);
+
+// Threshold, or in photodiode mode the level passed by the last screen change
+uint32_t analog_trigger_threshold_mv(void);
+bool analog_trigger_is_rising(void);
+uint32_t analog_trigger_sample_ns(void);
+uint32_t analog_trigger_level_mv(void);
+bool analog_trigger_is_pressed(void);
+uint32_t analog_trigger_press_count(void);
+uint32_t analog_trigger_release_count(void);
+uint32_t analog_trigger_overrun_count(void);
+uint32_t analog_trigger_baseline_mv(void);
+uint32_t analog_trigger_noise_mv(void);
+bool analog_trigger_is_settling(void);
+uint32_t analog_trigger_step_count(void);
+
+// Waveform around a press: the crossing is at ANALOG_PRE_SAMPLES. A new window is only captured
+// after the previous one was released.
+const uint16_t * analog_trigger_window(uint32_t *press_us);
+void analog_trigger_window_release(void);
+
+uint32_t analog_counts_to_mv(uint32_t counts);
+uint32_t analog_mv_to_counts(uint32_t mv);
+
+#endif //ANALOG_TRIGGER_H
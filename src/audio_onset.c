@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "audio_onset.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define HALF_FRAMES             (AUDIO_ONSET_BUFFER_FRAMES / 2)
+#define BLOCKS_PER_HALF         (HALF_FRAMES / AUDIO_ONSET_BLOCK_FRAMES)
+#define FLOOR_SHIFT             (6)     // noise floor follows over 64 blocks (21 ms)
+#define FLOOR_MIN               (AUDIO_ONSET_BLOCK_FRAMES * 2 * 16)  // about 4 LSB rms
+#define HOLDOFF_BLOCKS          (AUDIO_ONSET_HOLDOFF_MS * (AUDIO_ONSET_FREQ / 1000) / AUDIO_ONSET_BLOCK_FRAMES)
+#define FULL_SCALE_ENERGY       (2ULL * 32768 * 32768)  // per frame
+
+extern SAI_HandleTypeDef haudio_in_sai;
+
+static uint32_t buffer[AUDIO_ONSET_BUFFER_FRAMES] __attribute__((aligned(32)));
+
+static bool running = false;
+static uint32_t ratio = 16;             // onset at this multiple of the noise floor energy
+static uint64_t floor_energy = 0;       // per block
+static bool floor_valid = false;
+static uint32_t holdoff_blocks = 0;
+static volatile uint32_t onsets = 0;
+static volatile uint32_t errors = 0;
+static volatile uint32_t last_onset_us = 0;
+static volatile uint64_t last_onset_energy = 0;
+
+uint64_t audio_block_energy(const uint32_t *frames, size_t n)
+{
+    uint64_t energy = 0;
+
+    // SMLALD: left * left + right * right of one frame into a 64 bit sum, no overflow at full scale
+    for (size_t i = 0; i + 4 <= n; i += 4) {
+        energy = __SMLALD(frames[i], frames[i], energy);
+        energy = __SMLALD(frames[i + 1], frames[i + 1], energy);
+        energy = __SMLALD(frames[i + 2], frames[i + 2], energy);
+        energy = __SMLALD(frames[i + 3], frames[i + 3], energy);
+    }
+    for (size_t i = n & ~3u; i < n; i++) {
+        energy = __SMLALD(frames[i], frames[i], energy);
+    }
+    return energy;
+}
+
+// Duration of a number of frames
+static uint32_t frames_to_us(uint32_t frames)
+{
+    return (uint32_t)(((uint64_t)frames * 1000000 + AUDIO_ONSET_FREQ / 2) / AUDIO_ONSET_FREQ);
+}
+
+static void scan_half(const uint32_t *half, uint32_t end)
+{
+    uint32_t now_us = xlat_counter_1mhz_get();
+
+    // Frames received since the end of this half, the last one of it came in that long ago
+    uint32_t pos = (2 * AUDIO_ONSET_BUFFER_FRAMES - __HAL_DMA_GET_COUNTER(haudio_in_sai.hdmarx)) / 2;
+    uint32_t late = (pos + AUDIO_ONSET_BUFFER_FRAMES - end) % AUDIO_ONSET_BUFFER_FRAMES;
+
+    SCB_InvalidateDCache_by_Addr((uint32_t *)half, HALF_FRAMES * sizeof(uint32_t));
+
+    for (size_t block = 0; block < BLOCKS_PER_HALF; block++) {
+        const uint32_t *frames = &half[block * AUDIO_ONSET_BLOCK_FRAMES];
+        uint64_t energy = audio_block_energy(frames, AUDIO_ONSET_BLOCK_FRAMES);
+
+        if (holdoff_blocks) {
+            holdoff_blocks--;
+            continue;
+        }
+        if (!floor_valid) {
+            floor_energy = energy;
+            floor_valid = true;
+            continue;
+        }
+        uint64_t level = (floor_energy > FLOOR_MIN) ? floor_energy : FLOOR_MIN;
+
+        if (energy > level * ratio) {
+            // The first frame above the onset level, per frame
+            uint64_t frame_level = level * ratio / AUDIO_ONSET_BLOCK_FRAMES;
+            size_t frame = 0;
+            while ((frame < AUDIO_ONSET_BLOCK_FRAMES - 1) && (__SMLALD(frames[frame], frames[frame], 0) <= frame_level)) {
+                frame++;
+            }
+            uint32_t age = late + (HALF_FRAMES - 1 - (block * AUDIO_ONSET_BLOCK_FRAMES + frame));
+            uint32_t timestamp_us = now_us - frames_to_us(age);
+
+            last_onset_us = timestamp_us;
+            last_onset_energy = energy;
+            onsets++;
+            holdoff_blocks = HOLDOFF_BLOCKS;
+            xlat_audio_onset_from_isr(timestamp_us);
+            continue;
+        }
+
+        // Exponential average, the clicks themselves stay out of it
+        if (energy > floor_energy) {
+            floor_energy += (energy - floor_energy) >> FLOOR_SHIFT;
+        } else {
+            floor_energy -= (floor_energy - energy) >> FLOOR_SHIFT;
+        }
+    }
+}
+
+void BSP_AUDIO_IN_HalfTransfer_CallBack(void)
+{
+    scan_half(&buffer[0], HALF_FRAMES);
+}
+
+void BSP_AUDIO_IN_TransferComplete_CallBack(void)
+{
+    scan_half(&buffer[HALF_FRAMES], AUDIO_ONSET_BUFFER_FRAMES);
+}
+
+void BSP_AUDIO_IN_Error_CallBack(void)
+{
+    errors++;
+}
+
+// Replaces the BSP one: the DMA interrupt runs above the tasks, and the codec interrupt line
+// (EXTI15_10) is left alone, it is the one of input channel 0.
+void BSP_AUDIO_IN_MspInit(SAI_HandleTypeDef *hsai, void *Params)
+{
+    static DMA_HandleTypeDef hdma_sai_rx;
+    GPIO_InitTypeDef gpio_init_structure = {0};
+    (void)Params;
+
+    AUDIO_IN_SAIx_CLK_ENABLE();
+
+    AUDIO_IN_SAIx_SD_ENABLE();
+    gpio_init_structure.Pin = AUDIO_IN_SAIx_SD_PIN;
+    gpio_init_structure.Mode = GPIO_MODE_AF_PP;
+    gpio_init_structure.Pull = GPIO_NOPULL;
+    gpio_init_structure.Speed = GPIO_SPEED_FAST;
+    gpio_init_structure.Alternate = AUDIO_IN_SAIx_SD_AF;
+    HAL_GPIO_Init(AUDIO_IN_SAIx_SD_GPIO_PORT, &gpio_init_structure);
+
+    AUDIO_IN_SAIx_DMAx_CLK_ENABLE();
+    if (hsai->Instance == AUDIO_IN_SAIx) {
+        hdma_sai_rx.Init.Channel = AUDIO_IN_SAIx_DMAx_CHANNEL;
+        hdma_sai_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+        hdma_sai_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+        hdma_sai_rx.Init.MemInc = DMA_MINC_ENABLE;
+        hdma_sai_rx.Init.PeriphDataAlignment = AUDIO_IN_SAIx_DMAx_PERIPH_DATA_SIZE;
+        hdma_sai_rx.Init.MemDataAlignment = AUDIO_IN_SAIx_DMAx_MEM_DATA_SIZE;
+        hdma_sai_rx.Init.Mode = DMA_CIRCULAR;
+        hdma_sai_rx.Init.Priority = DMA_PRIORITY_HIGH;
+        hdma_sai_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+        hdma_sai_rx.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+        hdma_sai_rx.Init.MemBurst = DMA_MBURST_SINGLE;
+        hdma_sai_rx.Init.PeriphBurst = DMA_MBURST_SINGLE;
+        hdma_sai_rx.Instance = AUDIO_IN_SAIx_DMAx_STREAM;
+        __HAL_LINKDMA(hsai, hdmarx, hdma_sai_rx);
+        HAL_DMA_DeInit(&hdma_sai_rx);
+        HAL_DMA_Init(&hdma_sai_rx);
+    }
+
+    HAL_NVIC_SetPriority(AUDIO_IN_SAIx_DMAx_IRQ, 5, 0);
+    HAL_NVIC_EnableIRQ(AUDIO_IN_SAIx_DMAx_IRQ);
+}
+
+bool audio_onset_start(audio_onset_input_t input, uint32_t sensitivity_db)
+{
+    if (running || (input >= AUDIO_ONSET_INPUT_MAX)) {
+        return false;
+    }
+
+    // Energy ratio of the onset level, 3 dB steps are close enough to doubling
+    ratio = 1;
+    for (uint32_t db = 3; db <= sensitivity_db; db += 3) {
+        ratio *= 2;
+    }
+    floor_valid = false;
+    holdoff_blocks = 0;
+    onsets = 0;
+    errors = 0;
+    last_onset_energy = 0;
+
+    uint16_t device = (input == AUDIO_ONSET_INPUT_LINE) ? INPUT_DEVICE_INPUT_LINE_1 : INPUT_DEVICE_DIGITAL_MICROPHONE_2;
+    if (BSP_AUDIO_IN_InitEx(device, AUDIO_ONSET_FREQ, DEFAULT_AUDIO_IN_BIT_RESOLUTION,
+                            DEFAULT_AUDIO_IN_CHANNEL_NBR) != AUDIO_OK) {
+        printf("Audio onset: codec init failed\n");
+        return false;
+    }
+    memset(buffer, 0, sizeof(buffer));
+    SCB_CleanInvalidateDCache_by_Addr(buffer, sizeof(buffer));
+    if (BSP_AUDIO_IN_Record((uint16_t *)buffer, 2 * AUDIO_ONSET_BUFFER_FRAMES) != AUDIO_OK) {
+        printf("Audio onset: record failed\n");
+        return false;
+    }
+    running = true;
+    printf("Audio onset: %s, onset %lu dB above the noise floor\n",
+           (input == AUDIO_ONSET_INPUT_LINE) ? "line in" : "microphones", sensitivity_db);
+    return true;
+}
+
+void audio_onset_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    BSP_AUDIO_IN_Stop(CODEC_PDWN_SW);
+    running = false;
+    printf("Audio onset: %lu onsets, %lu errors\n", onsets, errors);
+}
+
+bool audio_onset_is_running(void)
+{
+    return running;
+}
+
+uint32_t audio_onset_count(void)
+{
+    return onsets;
+}
+
+uint32_t audio_onset_last_us(void)
+{
+    return last_onset_us;
+}
+
+uint32_t audio_onset_error_count(void)
+{
+    return errors;
+}
+
+// dB below full scale of a block energy, 3 dB per halving
+static uint32_t energy_dbfs(uint64_t energy)
+{
+    uint64_t full_scale = FULL_SCALE_ENERGY * AUDIO_ONSET_BLOCK_FRAMES;
+    uint32_t db = 0;
+
+    if (energy == 0) {
+        return 99;
+    }
+    while ((energy < full_scale) && (db < 99)) {
+        energy *= 2;
+        db += 3;
+    }
+    return db;
+}
+
+uint32_t audio_onset_floor_dbfs(void)
+{
+    return floor_valid ? energy_dbfs(floor_energy) : 99;
+}
+
+uint32_t audio_onset_peak_dbfs(void)
+{
+    return energy_dbfs(last_onset_energy);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_ONSET_H
+#define AUDIO_ONSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Audio stimulus source: the click of the device under test picked up by a (contact) microphone,
+// for devices that can't be wired up. The WM8994 codec records continuously through SAI2 into a
+// DMA double buffer at 48 kHz. Each half is scanned in the DMA interrupt: the energy of short blocks
+// (both channels, with the DSP dual multiply-accumulate) against a slowly tracked noise floor finds
+// the click, and the first frame above the onset level inside the block gives its time on the time
+// base at sample resolution. Onsets go into the audio -> USB latency of channel 0.
+// The fixed delay of the codec's ADC filter is included in the measured latency.
+#define AUDIO_ONSET_FREQ            (48000)
+#define AUDIO_ONSET_BUFFER_FRAMES   (1024)  // stereo, two halves of 10.7 ms
+#define AUDIO_ONSET_BLOCK_FRAMES    (16)    // 333 us energy blocks
+#define AUDIO_ONSET_HOLDOFF_MS      (100)   // one onset per click, the ringing is ignored
+
+typedef enum audio_onset_input {
+    AUDIO_ONSET_INPUT_LINE = 0,             // line in jack, a contact microphone with preamp
+    AUDIO_ONSET_INPUT_MIC,                  // the digital microphones on the board
+    AUDIO_ONSET_INPUT_MAX,
+} audio_onset_input_t;
+
+bool audio_onset_start(audio_onset_input_t input, uint32_t sensitivity_db);
+void audio_onset_stop(void);
+bool audio_onset_is_running(void);
+
+uint32_t audio_onset_count(void);
+uint32_t audio_onset_last_us(void);
+uint32_t audio_onset_error_count(void);
+// Levels in dB below full scale (per frame energy), of the noise floor and the last onset block
+uint32_t audio_onset_floor_dbfs(void);
+uint32_t audio_onset_peak_dbfs(void);
+
+// Energy kernel, for two 16 bit channels packed in each frame
+uint64_t audio_block_energy(const uint32_t *frames, size_t n);
+
+#endif //AUDIO_ONSET_H
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "bounce_capture.h"
+#include "logic_capture.h"
+#include "calibration.h"
+#include "usb_reference.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define ARM_TIMEOUT_MS          (1000)  // no edge after an auto-trigger click
+
+typedef enum bounce_state {
+    BOUNCE_IDLE = 0,        // gap before the next press
+    BOUNCE_ARMED,           // waiting for the first edge
+    BOUNCE_CAPTURING,       // in the window after the first edge
+} bounce_state_t;
+
+static uint32_t *buffer = NULL;
+static size_t edges_max = 0;
+
+static bool running = false;
+static bounce_state_t state = BOUNCE_IDLE;
+static bool auto_click = false;
+static bool click_pressed = false;
+static bool idle_high = false;
+static uint32_t presses_total = 0;
+static uint32_t state_ms = 0;
+static uint32_t click_ms = 0;
+static bounce_result_t result;
+
+static uint32_t trace[BOUNCE_TRACE_MAX];
+static size_t trace_count = 0;
+static bool trace_idle_high = false;
+
+uint32_t bounce_needed_us(const uint32_t *timestamps, size_t n)
+{
+    // Even edges after the first go the same way as the press
+    size_t last = (n >= 3) ? ((n - 1) & ~1u) : 0;
+    return timestamps[last] - timestamps[0];
+}
+
+uint32_t bounce_safe_holdoff_us(uint32_t needed_us)
+{
+    if (needed_us == 0) {
+        return BOUNCE_HOLDOFF_MIN_US;
+    }
+    uint32_t margin_us = needed_us * BOUNCE_MARGIN_PCT / 100;
+    margin_us = (margin_us < BOUNCE_MARGIN_MIN_US) ? BOUNCE_MARGIN_MIN_US : margin_us;
+
+    // In steps of 100 us
+    uint32_t holdoff_us = (needed_us + margin_us + 99) / 100 * 100;
+    return (holdoff_us < BOUNCE_HOLDOFF_MIN_US) ? BOUNCE_HOLDOFF_MIN_US : holdoff_us;
+}
+
+static void hw_stop(void)
+{
+    __HAL_TIM_DISABLE_DMA(&XLAT_TIMx_handle, TIM_DMA_CC1);
+    TIM_CCxChannelCmd(XLAT_TIMx_handle.Instance, TIM_CHANNEL_1, TIM_CCx_DISABLE);
+    HAL_DMA_Abort(&hdma_tim2_ch1);
+}
+
+static bool arm(void)
+{
+    hw_stop();
+    SCB_InvalidateDCache_by_Addr(buffer, edges_max * sizeof(uint32_t));
+
+    idle_high = (HAL_GPIO_ReadPin(ARDUINO_PWM_D9_GPIO_Port, ARDUINO_PWM_D9_Pin) == GPIO_PIN_SET);
+    __HAL_TIM_CLEAR_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC1 | TIM_FLAG_CC1OF);
+    if (HAL_DMA_Start(&hdma_tim2_ch1, (uint32_t)&XLAT_TIMx->CCR1, (uint32_t)buffer, edges_max) != HAL_OK) {
+        return false;
+    }
+    __HAL_TIM_ENABLE_DMA(&XLAT_TIMx_handle, TIM_DMA_CC1);
+    TIM_CCxChannelCmd(XLAT_TIMx_handle.Instance, TIM_CHANNEL_1, TIM_CCx_ENABLE);
+    return true;
+}
+
+static void press_done(void)
+{
+    size_t n = edges_max - __HAL_DMA_GET_COUNTER(&hdma_tim2_ch1);
+    bool overrun = __HAL_TIM_GET_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC1OF);
+    hw_stop();
+    SCB_InvalidateDCache_by_Addr(buffer, edges_max * sizeof(uint32_t));
+
+    // The edges are TIM2 captures of the 1 MHz time base, the same unit as the EXTI hold-off
+    uint32_t needed_us = bounce_needed_us(buffer, n);
+    uint32_t active_us = buffer[n - 1] - buffer[0];
+
+    result.presses++;
+    result.overruns += overrun;
+    result.needed_sum_us += needed_us;
+    result.edges_max = (n > result.edges_max) ? n : result.edges_max;
+    result.active_us = (active_us > result.active_us) ? active_us : result.active_us;
+    printf("[bounce] press %lu: %u edges, hold-off %luus, active %luus%s\n", result.presses, (unsigned int)n, needed_us,
+           active_us, overrun ? ", edges lost" : "");
+
+    // The worst press so far is kept for the plot
+    if ((result.presses == 1) || (needed_us > result.needed_us)) {
+        result.needed_us = needed_us;
+        trace_count = (n < BOUNCE_TRACE_MAX) ? n : BOUNCE_TRACE_MAX;
+        for (size_t i = 0; i < trace_count; i++) {
+            trace[i] = buffer[i] - buffer[0];
+        }
+        trace_idle_high = idle_high;
+    }
+    result.holdoff_us = bounce_safe_holdoff_us(result.needed_us);
+}
+
+static void finish(void)
+{
+    running = false;
+    state = BOUNCE_IDLE;
+
+    if (result.presses == 0) {
+        printf("[bounce] no presses captured\n");
+        return;
+    }
+    printf("[bounce] %lu presses, %lu missed, %lu with lost edges, up to %lu edges\n", result.presses,
+           result.missed, result.overruns, result.edges_max);
+    printf("[bounce] hold-off needed %luus (mean %luus), active up to %luus\n", result.needed_us,
+           result.needed_sum_us / result.presses, result.active_us);
+
+    // With lost edges the even/odd order is not known, better keep the current hold-off
+    if (result.overruns) {
+        printf("[bounce] hold-off not applied\n");
+        return;
+    }
+    xlat_set_gpio_irq_holdoff_us(0, result.holdoff_us);
+}
+
+bool bounce_capture_init(void *buf, size_t size)
+{
+    // The DMA counter is 16 bit
+    edges_max = size / sizeof(uint32_t);
+    edges_max = (edges_max > 65535) ? 65535 : edges_max;
+    buffer = (uint32_t *)buf;
+    return (edges_max > 0);
+}
+
+bool bounce_capture_start(uint32_t presses, bool with_click)
+{
+    if ((buffer == NULL) || running || (logic_capture_get_state() == LOGIC_CAPTURE_RUNNING) ||
+        calibration_is_running() || usb_reference_is_running()) {
+        return false;
+    }
+    memset(&result, 0, sizeof(result));
+    trace_count = 0;
+    presses_total = presses ? presses : 1;
+    auto_click = with_click;
+    click_pressed = false;
+    state = BOUNCE_IDLE;
+    state_ms = 0;
+    running = true;
+    printf("Bounce capture: %lu presses on D9%s\n", presses_total, auto_click ? ", auto-trigger" : "");
+    return true;
+}
+
+void bounce_capture_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    hw_stop();
+    if (click_pressed) {
+        xlat_auto_trigger_set(false);
+        click_pressed = false;
+    }
+    finish();
+}
+
+bool bounce_capture_is_running(void)
+{
+    return running;
+}
+
+const bounce_result_t * bounce_capture_result(void)
+{
+    return &result;
+}
+
+void bounce_capture_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+
+    // The click is held like a normal auto-trigger press
+    if (click_pressed && (now_ms - click_ms >= AUTO_TRIGGER_PRESS_MS)) {
+        xlat_auto_trigger_set(false);
+        click_pressed = false;
+    }
+
+    switch (state) {
+        case BOUNCE_IDLE:
+            if (now_ms - state_ms < BOUNCE_GAP_MS) {
+                break;
+            }
+            if (result.presses + result.missed >= presses_total) {
+                finish();
+                break;
+            }
+            if (!arm()) {
+                bounce_capture_stop();
+                break;
+            }
+            if (auto_click) {
+                xlat_auto_trigger_set(true);
+                click_pressed = true;
+                click_ms = now_ms;
+            }
+            state_ms = now_ms;
+            state = BOUNCE_ARMED;
+            break;
+
+        case BOUNCE_ARMED:
+            if (__HAL_DMA_GET_COUNTER(&hdma_tim2_ch1) != edges_max) {
+                state_ms = now_ms;
+                state = BOUNCE_CAPTURING;
+            } else if (auto_click && (now_ms - state_ms >= ARM_TIMEOUT_MS)) {
+                printf("[bounce] no edge on D9 after the click\n");
+                hw_stop();
+                result.missed++;
+                state_ms = now_ms;
+                state = BOUNCE_IDLE;
+            }
+            break;
+
+        case BOUNCE_CAPTURING:
+            if ((now_ms - state_ms >= BOUNCE_WINDOW_MS) || (__HAL_DMA_GET_COUNTER(&hdma_tim2_ch1) == 0)) {
+                press_done();
+                state_ms = now_ms;
+                state = BOUNCE_IDLE;
+            }
+            break;
+    }
+}
+
+size_t bounce_capture_trace_count(void)
+{
+    return trace_count;
+}
+
+uint32_t bounce_capture_trace_us(size_t edge)
+{
+    return (edge < trace_count) ? trace[edge] : 0;
+}
+
+bool bounce_capture_trace_idle_high(void)
+{
+    return trace_idle_high;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOUNCE_CAPTURE_H
+#define BOUNCE_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Switch bounce characterisation on D9, wired to the same switch line as D12.
+// TIM2 channel 1 captures both edges on the time base and DMA stores every capture, so
+// nothing is lost to interrupts or a hold-off. After each press the edges of the next few
+// hundred milliseconds are kept. The first edge is the press, every second edge after it goes
+// the same way and would trigger a new measurement: the last of those, over all presses, is the
+// hold-off the channel needs (bounce of mechanical switches, or the pulse train of optical
+// switches while pressed). A small margin is added and the result applied to channel 0.
+#define BOUNCE_WINDOW_MS        (300)
+#define BOUNCE_GAP_MS           (200)   // between presses
+#define BOUNCE_TRACE_MAX        (512)   // edges of the worst press, for the plot
+#define BOUNCE_MARGIN_PCT       (10)
+#define BOUNCE_MARGIN_MIN_US    (500)
+#define BOUNCE_HOLDOFF_MIN_US   (1000)  // the hold-off timer counts in ms
+
+typedef struct bounce_result {
+    uint32_t presses;
+    uint32_t missed;        // no edge after an auto-trigger click
+    uint32_t overruns;      // presses with edges too close to capture them all
+    uint32_t edges_max;     // in one press
+    uint32_t needed_us;     // last repeated press edge after the first, worst press
+    uint32_t needed_sum_us;
+    uint32_t active_us;     // last edge of any kind, worst press
+    uint32_t holdoff_us;    // safe hold-off, 0 before the first press
+} bounce_result_t;
+
+bool bounce_capture_init(void *buffer, size_t size);
+bool bounce_capture_start(uint32_t presses, bool auto_click);
+void bounce_capture_stop(void);
+bool bounce_capture_is_running(void);
+const bounce_result_t * bounce_capture_result(void);
+
+// Gfx task: clicks, ends the window of a press and arms the next one, call it every few ms
+void bounce_capture_tick(uint32_t now_ms);
+
+// Edges of the worst press, from its first edge, and the line level before it
+size_t bounce_capture_trace_count(void);
+uint32_t bounce_capture_trace_us(size_t edge);
+bool bounce_capture_trace_idle_high(void);
+
+// Hold-off needed for a press: the last edge going the same way as the first one (even index)
+uint32_t bounce_needed_us(const uint32_t *timestamps, size_t n);
+uint32_t bounce_safe_holdoff_us(uint32_t needed_us);
+
+#endif //BOUNCE_CAPTURE_H
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "calibration.h"
+#include "bounce_capture.h"
+#include "usb_reference.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+typedef enum calibration_state {
+    CALIBRATION_IDLE = 0,   // gap before the next press
+    CALIBRATION_PRESSED,    // D11 pressed, capture armed
+} calibration_state_t;
+
+static bool running = false;
+static calibration_state_t state = CALIBRATION_IDLE;
+static uint32_t cycles_total = 0;
+static uint32_t state_ms = 0;
+static uint32_t press_count = 0;        // GPIO press count of channel 0 before the press
+static calibration_result_t result;
+
+int32_t calibration_offset_mean_ns(const offset_stats_t *offset)
+{
+    return offset_stats_mean_ns(offset, XLAT_TIMx_TICK_NS);
+}
+
+uint32_t calibration_offset_stdev_ns(const offset_stats_t *offset)
+{
+    return offset_stats_stdev_ns(offset, XLAT_TIMx_TICK_NS);
+}
+
+// Jitter of the timestamp itself: each offset is the difference of two whole ticks, which adds
+// a variance of tick^2 / 6 to the one measured
+static float jitter_variance_ns2(const offset_stats_t *offset)
+{
+    float tick = XLAT_TIMx_TICK_NS;
+    float variance = offset_stats_variance(offset) * tick * tick - tick * tick / 6.0f;
+    return (variance > 0.0f) ? variance : 0.0f;
+}
+
+static void hw_stop(void)
+{
+    TIM_CCxChannelCmd(XLAT_TIMx_handle.Instance, TIM_CHANNEL_1, TIM_CCx_DISABLE);
+}
+
+static void press(uint32_t now_ms)
+{
+    uint32_t timestamp_us;
+
+    // The capture register alone, no DMA: there is one edge per press on a clean loopback
+    __HAL_TIM_CLEAR_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC1 | TIM_FLAG_CC1OF);
+    TIM_CCxChannelCmd(XLAT_TIMx_handle.Instance, TIM_CHANNEL_1, TIM_CCx_ENABLE);
+
+    press_count = xlat_get_gpio_press(0, &timestamp_us);
+    xlat_auto_trigger_set(true);
+    state_ms = now_ms;
+    state = CALIBRATION_PRESSED;
+}
+
+static void press_done(uint32_t now_ms)
+{
+    uint32_t timestamp_us;
+    bool captured = __HAL_TIM_GET_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC1);
+    bool overcapture = __HAL_TIM_GET_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC1OF);
+    uint32_t edge_us = XLAT_TIMx->CCR1;
+    uint32_t count = xlat_get_gpio_press(0, &timestamp_us);
+
+    xlat_auto_trigger_set(false);
+    hw_stop();
+    result.cycles++;
+
+    // Exactly one edge on D9 and one press on D12
+    int32_t offset = (int32_t)(timestamp_us - edge_us);
+    if (!captured || overcapture || ((uint8_t)(count - press_count) != 1) ||
+        (offset < 0) || (offset > CALIBRATION_GPIO_MAX_US)) {
+        result.missed++;
+    } else {
+        offset_stats_add(&result.gpio, offset);
+    }
+    state_ms = now_ms;
+    state = CALIBRATION_IDLE;
+}
+
+static void finish(void)
+{
+    running = false;
+    state = CALIBRATION_IDLE;
+
+    printf("[calibration] %lu cycles, %lu missed, %lu reports (%lu unmatched)\n", result.cycles, result.missed,
+           result.usb.count, result.usb_unmatched);
+    if (result.gpio.count < CALIBRATION_SAMPLES_MIN) {
+        printf("[calibration] too few loopback edges, is D11 wired to D12 and D9? Not applied\n");
+        return;
+    }
+
+    xlat_calibration_t calibration = {0};
+    float tick = XLAT_TIMx_TICK_NS;
+    float gpio_variance = jitter_variance_ns2(&result.gpio);
+    float usb_variance = 0.0f;
+
+    calibration.cycles = result.cycles;
+    calibration.gpio_offset_ns = calibration_offset_mean_ns(&result.gpio);
+    calibration.gpio_jitter_ns = (uint32_t)(sqrtf(gpio_variance) + 0.5f);
+    if (result.usb.count >= CALIBRATION_SAMPLES_MIN) {
+        usb_variance = jitter_variance_ns2(&result.usb);
+        calibration.usb_offset_ns = calibration_offset_mean_ns(&result.usb);
+        calibration.usb_jitter_ns = (uint32_t)(sqrtf(usb_variance) + 0.5f);
+    } else {
+        printf("[calibration] too few reports, no device clicked by D11? USB end not calibrated\n");
+    }
+    // Both ends of a latency are whole ticks: tick^2 / 6 for their difference
+    calibration.bound_ns = (uint32_t)(2.0f * sqrtf(gpio_variance + usb_variance + tick * tick / 6.0f) + 0.5f);
+
+    printf("[calibration] gpio offset %ld ns (%ld..%ld ticks), jitter %lu ns\n", calibration.gpio_offset_ns,
+           result.gpio.min, result.gpio.max, calibration.gpio_jitter_ns);
+    printf("[calibration] usb offset %ld ns (%ld..%ld ticks), jitter %lu ns\n", calibration.usb_offset_ns,
+           result.usb.min, result.usb.max, calibration.usb_jitter_ns);
+    printf("[calibration] tick %d ns, bound +-%lu ns (2 sigma)\n", XLAT_TIMx_TICK_NS, calibration.bound_ns);
+
+    // The loopback clicks were measured without the correction, start over with it
+    xlat_set_calibration(&calibration);
+    xlat_reset_latency();
+}
+
+bool calibration_start(uint32_t cycles)
+{
+    if (running || bounce_capture_is_running() || usb_reference_is_running()) {
+        return false;
+    }
+    memset(&result, 0, sizeof(result));
+    cycles_total = cycles ? cycles : 1;
+    state = CALIBRATION_IDLE;
+    state_ms = 0;
+    running = true;
+    printf("Calibration: %lu loopback cycles, D11 to D12 and D9\n", cycles_total);
+    return true;
+}
+
+void calibration_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    if (state == CALIBRATION_PRESSED) {
+        xlat_auto_trigger_set(false);
+        hw_stop();
+    }
+    finish();
+}
+
+bool calibration_is_running(void)
+{
+    return running;
+}
+
+uint32_t calibration_cycles_total(void)
+{
+    return cycles_total;
+}
+
+const calibration_result_t * calibration_result(void)
+{
+    return &result;
+}
+
+void calibration_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+
+    switch (state) {
+        case CALIBRATION_IDLE:
+            // The next press has to come after the hold-off of D12
+            if (now_ms - state_ms < xlat_get_gpio_irq_holdoff_us(0) / 1000 + CALIBRATION_GAP_MS) {
+                break;
+            }
+            if (result.cycles >= cycles_total) {
+                finish();
+                break;
+            }
+            press(now_ms);
+            break;
+
+        case CALIBRATION_PRESSED:
+            if (now_ms - state_ms >= CALIBRATION_PRESS_MS) {
+                press_done(now_ms);
+            }
+            break;
+    }
+}
+
+void calibration_usb_report(uint32_t timestamp_us, uint32_t urb_timestamp_us)
+{
+    int32_t delay = (int32_t)(timestamp_us - urb_timestamp_us);
+    if ((delay < 0) || (delay > CALIBRATION_USB_MAX_US)) {
+        result.usb_unmatched++;
+        return;
+    }
+    offset_stats_add(&result.usb, delay);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "offset_stats.h"
+
+// Self-calibration of the instrument with the trigger output looped back: D11 wired to D12 (and to
+// the device's switch, as for auto-trigger), and to D9 as for the bounce capture. Each cycle presses
+// D11; TIM2 channel 1 captures the edge on D9 in hardware, and the EXTI timestamp of the same edge on
+// D12 is later by the GPIO capture offset. The reports the clicks cause give the USB end: the report
+// timestamp is taken in the host thread, later than the transfer interrupt by the thread offset.
+// Both timestamps are whole time base ticks, a latency is off by up to one tick from that.
+// At the end the mean offsets are applied to the following latencies, with the error bound.
+#define CALIBRATION_PRESS_MS        (20)    // like an auto-trigger press
+#define CALIBRATION_GAP_MS          (30)    // after the hold-off of channel 0
+#define CALIBRATION_GPIO_MAX_US     (1000)  // later: not the edge of this press
+#define CALIBRATION_USB_MAX_US      (1000)  // later: not the interrupt of this report
+#define CALIBRATION_SAMPLES_MIN     (100)
+
+typedef struct calibration_result {
+    uint32_t cycles;            // loopback presses made
+    uint32_t missed;            // no capture on D9, or no EXTI press on D12
+    uint32_t usb_unmatched;     // reports without their transfer interrupt
+    offset_stats_t gpio;        // EXTI timestamp - D9 capture, ticks
+    offset_stats_t usb;         // report timestamp - transfer interrupt, ticks
+} calibration_result_t;
+
+bool calibration_start(uint32_t cycles);
+// Stops early, and applies the result if there are enough samples
+void calibration_stop(void);
+bool calibration_is_running(void);
+uint32_t calibration_cycles_total(void);
+const calibration_result_t * calibration_result(void);
+
+// Gfx task: presses and reads the loopback, call it every 10 ms
+void calibration_tick(uint32_t now_ms);
+// USB thread: timestamps of every report while running
+void calibration_usb_report(uint32_t timestamp_us, uint32_t urb_timestamp_us);
+
+// Offsets in ticks to ns
+int32_t calibration_offset_mean_ns(const offset_stats_t *offset);
+uint32_t calibration_offset_stdev_ns(const offset_stats_t *offset);
+
+#endif //CALIBRATION_H
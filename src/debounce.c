@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "debounce.h"
+
+// Time the edge spent in the device, less three standard errors of its mean
+static int32_t device_us(const latency_stats_t *edge, uint32_t poll_wait_us, int32_t *margin_us)
+{
+    *margin_us = (int32_t)(3.0f * sqrtf((float)edge->variance / edge->count));
+    return (int32_t)edge->mean_us - (int32_t)poll_wait_us;
+}
+
+static bool is_held(int32_t us, int32_t margin_us)
+{
+    return us - margin_us > DEBOUNCE_HELD_MIN_US;
+}
+
+debounce_scheme_t debounce_classify(const latency_stats_t *press, const latency_stats_t *release,
+                                    uint32_t poll_wait_us, uint32_t *window_us)
+{
+    int32_t press_margin;
+    int32_t release_margin;
+
+    if (window_us) {
+        *window_us = 0;
+    }
+    if ((press->count < DEBOUNCE_MIN_SAMPLES) || (release->count < DEBOUNCE_MIN_SAMPLES)) {
+        return DEBOUNCE_SCHEME_UNKNOWN;
+    }
+
+    int32_t press_us = device_us(press, poll_wait_us, &press_margin);
+    int32_t release_us = device_us(release, poll_wait_us, &release_margin);
+    bool press_held = is_held(press_us, press_margin);
+    bool release_held = is_held(release_us, release_margin);
+
+    debounce_scheme_t scheme;
+    int32_t window;
+    if (press_held && release_held) {
+        scheme = DEBOUNCE_SCHEME_DEFERRED;
+        window = (press_us < release_us) ? press_us : release_us;
+    } else if (press_held) {
+        // Scan and processing are the same for both edges, their difference is the window
+        scheme = DEBOUNCE_SCHEME_EAGER_RELEASE;
+        window = press_us - release_us;
+    } else if (release_held) {
+        scheme = DEBOUNCE_SCHEME_EAGER_PRESS;
+        window = release_us - press_us;
+    } else {
+        scheme = DEBOUNCE_SCHEME_EAGER;
+        window = 0;
+    }
+
+    if (window_us) {
+        *window_us = (window > 0) ? (uint32_t)window : 0;
+    }
+    return scheme;
+}
+
+const char * debounce_scheme_name(debounce_scheme_t scheme)
+{
+    switch (scheme) {
+        case DEBOUNCE_SCHEME_EAGER:
+            return "eager";
+        case DEBOUNCE_SCHEME_DEFERRED:
+            return "deferred";
+        case DEBOUNCE_SCHEME_EAGER_PRESS:
+            return "eager press";
+        case DEBOUNCE_SCHEME_EAGER_RELEASE:
+            return "eager release";
+        default:
+            return "unknown";
+    }
+}
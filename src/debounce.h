@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+#include "latency_stats.h"
+
+// Debounce scheme of the device under test, from the press and release latencies.
+// Each edge is classified on its own: what is left of its mean latency after the expected wait
+// for the host's poll is the time spent in the device (scan, processing and any debounce). An
+// edge sent on the first transition gets through within a scan period plus processing; one held
+// back until the contact is stable spends the debounce window on top of that.
+#define DEBOUNCE_MIN_SAMPLES    (20)
+#define DEBOUNCE_HELD_MIN_US    (1500)  // above a 1 ms scan plus fast processing, below common windows
+
+typedef enum debounce_scheme {
+    DEBOUNCE_SCHEME_UNKNOWN = 0,    // not enough press and release measurements yet
+    DEBOUNCE_SCHEME_EAGER,          // both edges sent on the first transition, the bounces after it ignored
+    DEBOUNCE_SCHEME_DEFERRED,       // both edges held back until the contact is stable for the window
+    DEBOUNCE_SCHEME_EAGER_PRESS,    // press sent on the first edge, release held back by the window
+    DEBOUNCE_SCHEME_EAGER_RELEASE,  // press held back by the window, release sent on the first edge
+} debounce_scheme_t;
+
+// poll_wait_us is the mean wait for the poll (half the poll bracket). window_us, if not NULL, gets
+// the estimated window: the difference of the edges when only one is held back, the device time of
+// the faster edge (an upper bound, processing included) when both are, 0 when neither is.
+debounce_scheme_t debounce_classify(const latency_stats_t *press, const latency_stats_t *release,
+                                    uint32_t poll_wait_us, uint32_t *window_us);
+const char * debounce_scheme_name(debounce_scheme_t scheme);
+
+#endif //DEBOUNCE_H
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_analog.h"
+#include "lvgl/lvgl.h"
+#include "analog_trigger.h"
+#include "gfx_audio.h"
+#include "xlat.h"
+
+#define ANALOG_TICK_PERIOD      (10)  // ms, paces the photodiode clicks
+#define ANALOG_PAGE_PERIOD      (250) // ms
+#define ANALOG_CHART_POINTS     (192) // the window is 8 samples per point
+
+static lv_obj_t *analog_screen = NULL;
+static lv_obj_t *analog_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *window_label;
+static lv_obj_t *photon_label;
+static lv_obj_t *threshold_dropdown;
+static lv_obj_t *direction_dropdown;
+static lv_obj_t *rate_dropdown;
+static lv_obj_t *mode_dropdown;
+static lv_obj_t *analog_chart;
+static lv_obj_t *start_label;
+static lv_chart_series_t *wave_series;
+static lv_chart_series_t *threshold_series;
+static lv_timer_t *page_timer = NULL;
+static lv_timer_t *analog_tick_timer = NULL;
+
+static const uint32_t threshold_options[] = { 500, 1000, 1500, 2000, 2500, 3000 };
+#define THRESHOLD_OPTIONS "0.5 V\n1.0 V\n1.5 V\n2.0 V\n2.5 V\n3.0 V"
+#define DIRECTION_OPTIONS "Rising\nFalling"
+#define RATE_OPTIONS "1.67 MHz\n625 kHz\n160 kHz\n51 kHz"
+#define MODE_OPTIONS "Threshold\nPhotodiode"
+
+static void chart_update(const uint16_t *window, uint32_t press_us)
+{
+    uint32_t per_point = ANALOG_WINDOW_SAMPLES / ANALOG_CHART_POINTS;
+    uint32_t sample_ns = analog_trigger_sample_ns();
+
+    // Mean of the samples of each point
+    for (size_t point = 0; point < ANALOG_CHART_POINTS; point++) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < per_point; i++) {
+            sum += window[point * per_point + i];
+        }
+        wave_series->y_points[point] = (lv_coord_t)analog_counts_to_mv(sum / per_point);
+    }
+    lv_chart_set_all_value(analog_chart, threshold_series, (lv_coord_t)analog_trigger_threshold_mv());
+    lv_chart_refresh(analog_chart);
+
+    uint32_t pre_us = ANALOG_PRE_SAMPLES * sample_ns / 1000;
+    uint32_t post_us = ANALOG_POST_SAMPLES * sample_ns / 1000;
+    lv_label_set_text_fmt(window_label, "-%lu us .. crossing @ %lu (time base) .. +%lu us", pre_us, press_us, post_us);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    uint32_t press_us;
+    const uint16_t *window;
+    (void)timer;
+
+    if (analog_trigger_is_running() && (analog_trigger_mode() == ANALOG_MODE_PHOTODIODE)) {
+        lv_label_set_text_fmt(status_label, "A0 %lu mV, baseline %lu +- %lu mV%s, %lu changes",
+                              analog_trigger_level_mv(), analog_trigger_baseline_mv(), analog_trigger_noise_mv(),
+                              analog_trigger_is_settling() ? " (settling)" : "", analog_trigger_step_count());
+    } else if (analog_trigger_is_running()) {
+        lv_label_set_text_fmt(status_label, "A0 %lu mV, %s, %lu presses, %lu releases, last %lu us",
+                              analog_trigger_level_mv(), analog_trigger_is_pressed() ? "pressed" : "released",
+                              analog_trigger_press_count(), analog_trigger_release_count(),
+                              xlat_get_latency_us(ANALOG_TRIGGER_CHANNEL, LATENCY_GPIO_TO_USB));
+    } else {
+        lv_label_set_text(status_label, "Idle, sensor output on A0 (0 - 3.3 V)");
+    }
+    lv_label_set_text(start_label, analog_trigger_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    const latency_stats_t *stats = xlat_get_latency_stats(0, LATENCY_CLICK_TO_PHOTON);
+    if (stats->count > 0) {
+        lv_label_set_text_fmt(photon_label, "Click -> photon: %lu, last %lu us, mean %lu us, stdev %lu us, max %lu us",
+                              stats->count, stats->last_us, stats->mean_us, stats->stdev_us, stats->max_us);
+    }
+
+    window = analog_trigger_window(&press_us);
+    if (window) {
+        chart_update(window, press_us);
+        analog_trigger_window_release();
+    }
+}
+
+static void analog_tick_callback(lv_timer_t *timer)
+{
+    analog_trigger_tick(lv_tick_get());
+
+    if (!analog_trigger_is_running()) {
+        lv_timer_del(timer);
+        analog_tick_timer = NULL;
+    }
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (analog_trigger_is_running()) {
+        analog_trigger_stop();
+        if (analog_tick_timer) {
+            lv_timer_del(analog_tick_timer);
+            analog_tick_timer = NULL;
+        }
+    } else {
+        uint16_t threshold = lv_dropdown_get_selected(threshold_dropdown);
+        analog_rate_t sample_rate = (analog_rate_t)lv_dropdown_get_selected(rate_dropdown);
+        bool started;
+
+        if (lv_dropdown_get_selected(mode_dropdown) == ANALOG_MODE_PHOTODIODE) {
+            started = analog_trigger_start_photodiode(sample_rate);
+        } else {
+            started = analog_trigger_start((threshold < sizeof(threshold_options) / sizeof(threshold_options[0])) ?
+                                               threshold_options[threshold] : 1500,
+                                           lv_dropdown_get_selected(direction_dropdown) == 0, sample_rate);
+        }
+        // The measurement goes on after leaving the page, the tick timer outlives it
+        if (started && (analog_tick_timer == NULL)) {
+            analog_tick_timer = lv_timer_create(analog_tick_callback, ANALOG_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void audio_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_audio_create_page(analog_screen);
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (analog_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(analog_prev_screen);
+            lv_obj_del(analog_screen);
+            analog_screen = NULL;
+        }
+    }
+}
+
+void gfx_analog_create_page(lv_obj_t *previous_screen)
+{
+    analog_prev_screen = previous_screen;
+    analog_screen = lv_obj_create(NULL);
+    lv_scr_load(analog_screen);
+
+    lv_obj_t *title_label = lv_label_create(analog_screen);
+    lv_label_set_text(title_label, "Analog trigger for hall-effect and optical switches");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(analog_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    threshold_dropdown = lv_dropdown_create(analog_screen);
+    lv_dropdown_set_options(threshold_dropdown, THRESHOLD_OPTIONS);
+    lv_obj_set_width(threshold_dropdown, 90);
+    lv_obj_align(threshold_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+    lv_dropdown_set_selected(threshold_dropdown, 2);
+
+    direction_dropdown = lv_dropdown_create(analog_screen);
+    lv_dropdown_set_options(direction_dropdown, DIRECTION_OPTIONS);
+    lv_obj_set_width(direction_dropdown, 100);
+    lv_obj_align_to(direction_dropdown, threshold_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+
+    rate_dropdown = lv_dropdown_create(analog_screen);
+    lv_dropdown_set_options(rate_dropdown, RATE_OPTIONS);
+    lv_obj_set_width(rate_dropdown, 110);
+    lv_obj_align_to(rate_dropdown, direction_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(rate_dropdown, ANALOG_RATE_160K);
+
+    // Photodiode on a patch of the screen, threshold and direction do not apply then
+    mode_dropdown = lv_dropdown_create(analog_screen);
+    lv_dropdown_set_options(mode_dropdown, MODE_OPTIONS);
+    lv_obj_set_width(mode_dropdown, 120);
+    lv_obj_align_to(mode_dropdown, rate_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+
+    // The waveform around the last press, with the threshold
+    analog_chart = lv_chart_create(analog_screen);
+    lv_obj_set_size(analog_chart, 460, 100);
+    lv_obj_align(analog_chart, LV_ALIGN_TOP_LEFT, 10, 96);
+    lv_obj_set_style_size(analog_chart, 0, LV_PART_INDICATOR);
+    lv_chart_set_div_line_count(analog_chart, 3, 0);
+    lv_chart_set_range(analog_chart, LV_CHART_AXIS_PRIMARY_Y, 0, ANALOG_FULL_SCALE_MV);
+    lv_chart_set_point_count(analog_chart, ANALOG_CHART_POINTS);
+    wave_series = lv_chart_add_series(analog_chart, lv_palette_main(LV_PALETTE_LIGHT_BLUE), LV_CHART_AXIS_PRIMARY_Y);
+    threshold_series = lv_chart_add_series(analog_chart, lv_palette_main(LV_PALETTE_RED), LV_CHART_AXIS_PRIMARY_Y);
+    lv_chart_set_all_value(analog_chart, wave_series, LV_CHART_POINT_NONE);
+    lv_chart_set_all_value(analog_chart, threshold_series, LV_CHART_POINT_NONE);
+
+    window_label = lv_label_create(analog_screen);
+    lv_obj_set_style_text_font(window_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(window_label, LV_ALIGN_TOP_LEFT, 10, 200);
+    lv_label_set_text(window_label, "");
+
+    photon_label = lv_label_create(analog_screen);
+    lv_obj_set_style_text_font(photon_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(photon_label, LV_ALIGN_TOP_LEFT, 10, 216);
+    lv_label_set_text(photon_label, "");
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(analog_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the presses go into the channel 0 statistics like GPIO presses
+    lv_obj_t *btn_start = lv_btn_create(analog_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    // Audio trigger button, the other source for devices that can't be wired up
+    lv_obj_t *btn_audio = lv_btn_create(analog_screen);
+    lv_obj_set_size(btn_audio, 80, 30);
+    lv_obj_align(btn_audio, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_audio, audio_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *audio_label = lv_label_create(btn_audio);
+    lv_label_set_text(audio_label, "AUDIO");
+    lv_obj_center(audio_label);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, ANALOG_PAGE_PERIOD, NULL);
+}
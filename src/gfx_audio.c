@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_audio.h"
+#include "lvgl/lvgl.h"
+#include "audio_onset.h"
+#include "xlat.h"
+
+#define AUDIO_PAGE_PERIOD       (250) // ms
+
+static lv_obj_t *audio_screen = NULL;
+static lv_obj_t *audio_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *input_dropdown;
+static lv_obj_t *sensitivity_dropdown;
+static lv_obj_t *start_label;
+static lv_timer_t *page_timer = NULL;
+
+static const uint32_t sensitivity_options[] = { 9, 12, 15, 18, 24 };
+#define INPUT_OPTIONS "Line in\nBoard mics"
+#define SENSITIVITY_OPTIONS "+9 dB\n+12 dB\n+15 dB\n+18 dB\n+24 dB"
+
+static void page_update(lv_timer_t *timer)
+{
+    const latency_stats_t *stats = xlat_get_latency_stats(0, LATENCY_AUDIO_TO_USB);
+    (void)timer;
+
+    if (audio_onset_is_running()) {
+        lv_label_set_text_fmt(status_label, "Listening, noise -%lu dBFS, %lu onsets, last -%lu dBFS @ %lu",
+                              audio_onset_floor_dbfs(), audio_onset_count(), audio_onset_peak_dbfs(),
+                              audio_onset_last_us());
+    } else {
+        lv_label_set_text(status_label, "Idle, onset level above the noise floor:");
+    }
+    lv_label_set_text(start_label, audio_onset_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    if (stats->count == 0) {
+        lv_label_set_text(result_label, "Audio -> USB: no measurements");
+        return;
+    }
+    lv_label_set_text_fmt(result_label,
+                          "Audio -> USB: %lu clicks\n"
+                          "last %lu us, mean %lu us, stdev %lu us\n"
+                          "min %lu us, max %lu us\n"
+                          "(includes the fixed delay of the codec's ADC filter)",
+                          stats->count, stats->last_us, stats->mean_us, stats->stdev_us, stats->min_us,
+                          stats->max_us);
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (audio_onset_is_running()) {
+        audio_onset_stop();
+    } else {
+        // Keeps listening after leaving the page, the onsets are scanned in the DMA interrupt
+        uint16_t sensitivity = lv_dropdown_get_selected(sensitivity_dropdown);
+        audio_onset_start((audio_onset_input_t)lv_dropdown_get_selected(input_dropdown),
+                          (sensitivity < sizeof(sensitivity_options) / sizeof(sensitivity_options[0])) ?
+                              sensitivity_options[sensitivity] : 12);
+    }
+    page_update(NULL);
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (audio_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(audio_prev_screen);
+            lv_obj_del(audio_screen);
+            audio_screen = NULL;
+        }
+    }
+}
+
+void gfx_audio_create_page(lv_obj_t *previous_screen)
+{
+    audio_prev_screen = previous_screen;
+    audio_screen = lv_obj_create(NULL);
+    lv_scr_load(audio_screen);
+
+    lv_obj_t *title_label = lv_label_create(audio_screen);
+    lv_label_set_text(title_label, "Audio trigger: click sound to USB report");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(audio_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    input_dropdown = lv_dropdown_create(audio_screen);
+    lv_dropdown_set_options(input_dropdown, INPUT_OPTIONS);
+    lv_obj_set_width(input_dropdown, 130);
+    lv_obj_align(input_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+
+    sensitivity_dropdown = lv_dropdown_create(audio_screen);
+    lv_dropdown_set_options(sensitivity_dropdown, SENSITIVITY_OPTIONS);
+    lv_obj_set_width(sensitivity_dropdown, 100);
+    lv_obj_align_to(sensitivity_dropdown, input_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(sensitivity_dropdown, 1);
+
+    result_label = lv_label_create(audio_screen);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 100);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(audio_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, every onset is printed to the console with the report it goes with
+    lv_obj_t *btn_start = lv_btn_create(audio_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, AUDIO_PAGE_PERIOD, NULL);
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_bounce.h"
+#include "lvgl/lvgl.h"
+#include "bounce_capture.h"
+#include "gfx_calibration.h"
+
+#define BOUNCE_TICK_PERIOD      (2)   // ms
+#define BOUNCE_PAGE_PERIOD      (250) // ms
+#define BOUNCE_CHART_POINTS     (200)
+#define BOUNCE_CHART_MIN_US     (1000)
+
+static lv_obj_t *bounce_screen = NULL;
+static lv_obj_t *bounce_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *span_label;
+static lv_obj_t *presses_dropdown;
+static lv_obj_t *click_dropdown;
+static lv_obj_t *bounce_chart;
+static lv_obj_t *start_label;
+static lv_chart_series_t *line_series;
+static lv_timer_t *page_timer = NULL;
+static lv_timer_t *bounce_tick_timer = NULL;
+static uint32_t presses_shown = 0;
+
+static const uint32_t presses_options[] = { 10, 20, 50 };
+#define PRESSES_OPTIONS "10 presses\n20 presses\n50 presses"
+#define CLICK_OPTIONS "Click D11\nManual"
+
+static void chart_update(void)
+{
+    size_t count = bounce_capture_trace_count();
+    bool high = bounce_capture_trace_idle_high();
+    uint32_t span_us = count ? bounce_capture_trace_us(count - 1) : 0;
+    size_t edge = 0;
+
+    // Some idle time on both sides of the edges
+    span_us = span_us * 5 / 4;
+    span_us = (span_us < BOUNCE_CHART_MIN_US) ? BOUNCE_CHART_MIN_US : span_us;
+    uint32_t start_us = span_us / 10;
+
+    // Level at the end of each point, a pulse inside a point shows as its other level
+    for (size_t point = 0; point < BOUNCE_CHART_POINTS; point++) {
+        uint32_t end_us = (uint32_t)((uint64_t)(point + 1) * span_us / BOUNCE_CHART_POINTS);
+        bool start_high = high;
+        bool toggled = false;
+        for (; (edge < count) && (start_us + bounce_capture_trace_us(edge) < end_us); edge++) {
+            high = !high;
+            toggled = true;
+        }
+        bool shown = (toggled && (start_high == high)) ? !high : high;
+        line_series->y_points[point] = shown ? 1 : 0;
+    }
+    lv_chart_refresh(bounce_chart);
+    lv_label_set_text_fmt(span_label, "%lu.%lu ms", span_us / 1000, (span_us % 1000) / 100);
+}
+
+static void result_update(void)
+{
+    const bounce_result_t *result = bounce_capture_result();
+
+    if (result->presses == 0) {
+        lv_label_set_text(result_label, "");
+        return;
+    }
+    lv_label_set_text_fmt(result_label,
+                          "Worst press: %lu edges, repeated press edge at %lu.%02lu ms, active %lu.%02lu ms\n"
+                          "Mean over %lu presses: %lu.%02lu ms, %lu missed, %lu with lost edges\n"
+                          "Safe hold-off %lu.%lu ms %s, up to %lu presses/s",
+                          result->edges_max, result->needed_us / 1000, (result->needed_us % 1000) / 10,
+                          result->active_us / 1000, (result->active_us % 1000) / 10, result->presses,
+                          result->needed_sum_us / result->presses / 1000,
+                          (result->needed_sum_us / result->presses % 1000) / 10, result->missed, result->overruns,
+                          result->holdoff_us / 1000, (result->holdoff_us % 1000) / 100,
+                          (result->overruns || bounce_capture_is_running()) ? "(not applied)" : "(applied)",
+                          1000000 / result->holdoff_us);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    const bounce_result_t *result = bounce_capture_result();
+    (void)timer;
+
+    lv_label_set_text_fmt(status_label, "%s, %lu presses captured", bounce_capture_is_running() ? "Capturing" : "Idle",
+                          result->presses);
+    lv_label_set_text(start_label, bounce_capture_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    if (result->presses != presses_shown) {
+        presses_shown = result->presses;
+        chart_update();
+    }
+    result_update();
+}
+
+static void bounce_tick_callback(lv_timer_t *timer)
+{
+    bounce_capture_tick(lv_tick_get());
+
+    if (!bounce_capture_is_running()) {
+        lv_timer_del(timer);
+        bounce_tick_timer = NULL;
+    }
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (bounce_capture_is_running()) {
+        bounce_capture_stop();
+        if (bounce_tick_timer) {
+            lv_timer_del(bounce_tick_timer);
+            bounce_tick_timer = NULL;
+        }
+    } else {
+        uint16_t presses = lv_dropdown_get_selected(presses_dropdown);
+        presses_shown = 0;
+        if (bounce_capture_start((presses < sizeof(presses_options) / sizeof(presses_options[0])) ?
+                                     presses_options[presses] : 10,
+                                 lv_dropdown_get_selected(click_dropdown) == 0) &&
+            (bounce_tick_timer == NULL)) {
+            bounce_tick_timer = lv_timer_create(bounce_tick_callback, BOUNCE_TICK_PERIOD, NULL);
+        }
+        chart_update();
+    }
+    page_update(NULL);
+}
+
+static void calibrate_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_calibration_create_page(bounce_screen);
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (bounce_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(bounce_prev_screen);
+            lv_obj_del(bounce_screen);
+            bounce_screen = NULL;
+        }
+    }
+}
+
+void gfx_bounce_create_page(lv_obj_t *previous_screen)
+{
+    bounce_prev_screen = previous_screen;
+    bounce_screen = lv_obj_create(NULL);
+    lv_scr_load(bounce_screen);
+
+    lv_obj_t *title_label = lv_label_create(bounce_screen);
+    lv_label_set_text(title_label, "Switch bounce on D9 (wired to D12)");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(bounce_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    presses_dropdown = lv_dropdown_create(bounce_screen);
+    lv_dropdown_set_options(presses_dropdown, PRESSES_OPTIONS);
+    lv_obj_set_width(presses_dropdown, 140);
+    lv_obj_align(presses_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+    lv_dropdown_set_selected(presses_dropdown, 1);
+
+    click_dropdown = lv_dropdown_create(bounce_screen);
+    lv_dropdown_set_options(click_dropdown, CLICK_OPTIONS);
+    lv_obj_set_width(click_dropdown, 120);
+    lv_obj_align_to(click_dropdown, presses_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+
+    // Line level of the worst press, from just before its first edge
+    bounce_chart = lv_chart_create(bounce_screen);
+    lv_obj_set_size(bounce_chart, 460, 80);
+    lv_obj_align(bounce_chart, LV_ALIGN_TOP_LEFT, 10, 96);
+    lv_obj_set_style_size(bounce_chart, 0, LV_PART_INDICATOR);
+    lv_chart_set_div_line_count(bounce_chart, 0, 0);
+    lv_chart_set_range(bounce_chart, LV_CHART_AXIS_PRIMARY_Y, 0, 1);
+    lv_chart_set_point_count(bounce_chart, BOUNCE_CHART_POINTS);
+    line_series = lv_chart_add_series(bounce_chart, lv_palette_main(LV_PALETTE_LIGHT_BLUE), LV_CHART_AXIS_PRIMARY_Y);
+
+    span_label = lv_label_create(bounce_screen);
+    lv_obj_set_style_text_font(span_label, &lv_font_montserrat_12, 0);
+    lv_obj_align_to(span_label, bounce_chart, LV_ALIGN_OUT_BOTTOM_RIGHT, 0, 2);
+
+    result_label = lv_label_create(bounce_screen);
+    lv_obj_set_style_text_font(result_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 196);
+    lv_label_set_text(result_label, "");
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(bounce_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the hold-off of channel 0 is set at the end
+    lv_obj_t *btn_start = lv_btn_create(bounce_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    // Calibration button, it uses the same wiring
+    lv_obj_t *btn_calibrate = lv_btn_create(bounce_screen);
+    lv_obj_set_size(btn_calibrate, 120, 30);
+    lv_obj_align(btn_calibrate, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_calibrate, calibrate_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *calibrate_label = lv_label_create(btn_calibrate);
+    lv_label_set_text(calibrate_label, "CALIBRATE");
+    lv_obj_center(calibrate_label);
+
+    presses_shown = 0;
+    chart_update();
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, BOUNCE_PAGE_PERIOD, NULL);
+}
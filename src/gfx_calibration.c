@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_calibration.h"
+#include "lvgl/lvgl.h"
+#include "calibration.h"
+#include "gfx_proxy.h"
+#include "gfx_reference.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define CALIBRATION_TICK_PERIOD (10)  // ms
+#define CALIBRATION_PAGE_PERIOD (250) // ms
+
+static lv_obj_t *calibration_screen = NULL;
+static lv_obj_t *calibration_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *applied_label;
+static lv_obj_t *cycles_dropdown;
+static lv_obj_t *start_label;
+static lv_timer_t *page_timer = NULL;
+static lv_timer_t *calibration_tick_timer = NULL;
+
+static const uint32_t cycles_options[] = { 1000, 5000, 10000, 20000 };
+#define CYCLES_OPTIONS "1000 cycles\n5000 cycles\n10000 cycles\n20000 cycles"
+
+static void result_update(void)
+{
+    const calibration_result_t *result = calibration_result();
+
+    if (result->gpio.count == 0) {
+        lv_label_set_text(result_label, "");
+    } else {
+        lv_label_set_text_fmt(result_label,
+                              "GPIO capture: %ld ns, stdev %lu ns, %ld .. %ld ticks (%lu edges)\n"
+                              "USB host thread: %ld ns, stdev %lu ns, %ld .. %ld ticks (%lu reports)\n"
+                              "Time base: %d ns per tick, +-1 tick per latency",
+                              calibration_offset_mean_ns(&result->gpio), calibration_offset_stdev_ns(&result->gpio),
+                              result->gpio.min, result->gpio.max, result->gpio.count,
+                              calibration_offset_mean_ns(&result->usb), calibration_offset_stdev_ns(&result->usb),
+                              result->usb.min, result->usb.max, result->usb.count, XLAT_TIMx_TICK_NS);
+    }
+
+    const xlat_calibration_t *calibration = xlat_get_calibration();
+    if (calibration == NULL) {
+        lv_label_set_text(applied_label, "Not calibrated, the latencies include the timestamp offsets");
+        return;
+    }
+    lv_label_set_text_fmt(applied_label,
+                          "Applied: GPIO offset %ld ns, USB offset %ld ns, jitter %lu / %lu ns\n"
+                          "Error bound +-%lu ns (2 sigma), from %lu cycles",
+                          calibration->gpio_offset_ns, calibration->usb_offset_ns, calibration->gpio_jitter_ns,
+                          calibration->usb_jitter_ns, calibration->bound_ns, calibration->cycles);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    const calibration_result_t *result = calibration_result();
+    (void)timer;
+
+    lv_label_set_text_fmt(status_label, "%s, %lu / %lu cycles, %lu missed",
+                          calibration_is_running() ? "Running" : "Idle", result->cycles, calibration_cycles_total(),
+                          result->missed);
+    lv_label_set_text(start_label, calibration_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+    result_update();
+}
+
+static void calibration_tick_callback(lv_timer_t *timer)
+{
+    calibration_tick(lv_tick_get());
+
+    if (!calibration_is_running()) {
+        lv_timer_del(timer);
+        calibration_tick_timer = NULL;
+    }
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (calibration_is_running()) {
+        calibration_stop();
+        if (calibration_tick_timer) {
+            lv_timer_del(calibration_tick_timer);
+            calibration_tick_timer = NULL;
+        }
+    } else {
+        uint16_t cycles = lv_dropdown_get_selected(cycles_dropdown);
+        if (calibration_start((cycles < sizeof(cycles_options) / sizeof(cycles_options[0])) ?
+                                  cycles_options[cycles] : 5000) &&
+            (calibration_tick_timer == NULL)) {
+            calibration_tick_timer = lv_timer_create(calibration_tick_callback, CALIBRATION_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void clear_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if ((code == LV_EVENT_CLICKED) && !calibration_is_running()) {
+        xlat_clear_calibration();
+        page_update(NULL);
+    }
+}
+
+static void proxy_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_proxy_create_page(calibration_screen);
+    }
+}
+
+static void selftest_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_reference_create_page(calibration_screen);
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (calibration_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(calibration_prev_screen);
+            lv_obj_del(calibration_screen);
+            calibration_screen = NULL;
+        }
+    }
+}
+
+void gfx_calibration_create_page(lv_obj_t *previous_screen)
+{
+    calibration_prev_screen = previous_screen;
+    calibration_screen = lv_obj_create(NULL);
+    lv_scr_load(calibration_screen);
+
+    lv_obj_t *title_label = lv_label_create(calibration_screen);
+    lv_label_set_text(title_label, "Calibration, D11 looped back to D12 and D9");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(calibration_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    cycles_dropdown = lv_dropdown_create(calibration_screen);
+    lv_dropdown_set_options(cycles_dropdown, CYCLES_OPTIONS);
+    lv_obj_set_width(cycles_dropdown, 150);
+    lv_obj_align(cycles_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+    lv_dropdown_set_selected(cycles_dropdown, 1);
+
+    result_label = lv_label_create(calibration_screen);
+    lv_obj_set_style_text_font(result_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 100);
+    lv_label_set_text(result_label, "");
+
+    applied_label = lv_label_create(calibration_screen);
+    lv_obj_set_style_text_font(applied_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(applied_label, LV_ALIGN_TOP_LEFT, 10, 170);
+
+    // Clear button, back to the raw latencies
+    lv_obj_t *btn_clear = lv_btn_create(calibration_screen);
+    lv_obj_set_size(btn_clear, 80, 30);
+    lv_obj_align(btn_clear, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_clear, clear_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *clear_label = lv_label_create(btn_clear);
+    lv_label_set_text(clear_label, "CLEAR");
+    lv_obj_center(clear_label);
+
+    // HID proxy button, the forwarding delay of the board itself
+    lv_obj_t *btn_proxy = lv_btn_create(calibration_screen);
+    lv_obj_set_size(btn_proxy, 80, 30);
+    lv_obj_align_to(btn_proxy, btn_clear, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_proxy, proxy_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *proxy_label = lv_label_create(btn_proxy);
+    lv_label_set_text(proxy_label, "PROXY");
+    lv_obj_center(proxy_label);
+
+    // Self-test button, the reference mouse of known latency
+    lv_obj_t *btn_selftest = lv_btn_create(calibration_screen);
+    lv_obj_set_size(btn_selftest, 90, 30);
+    lv_obj_align_to(btn_selftest, btn_proxy, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_selftest, selftest_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *selftest_label = lv_label_create(btn_selftest);
+    lv_label_set_text(selftest_label, "SELFTEST");
+    lv_obj_center(selftest_label);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(calibration_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the result is applied at the end
+    lv_obj_t *btn_start = lv_btn_create(calibration_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, CALIBRATION_PAGE_PERIOD, NULL);
+}
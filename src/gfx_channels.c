@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_channels.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+#include "hardware_config.h"
+
+#define CHANNELS_ROW_HEIGHT     (48)
+#define CHANNELS_FIRST_ROW_Y    (35)
+#define CHANNELS_STATS_PERIOD   (500) // ms
+
+static lv_obj_t *channels_screen;
+static lv_obj_t *channels_prev_screen = NULL;
+static lv_obj_t *stats_labels[XLAT_CHANNEL_MAX];
+static lv_timer_t *stats_timer = NULL;
+
+// Same hold-off choices as the settings page
+static const uint32_t holdoff_ms[] = { 20, 100, 200, 500, 1000 };
+
+static void stats_update(lv_timer_t *timer)
+{
+    (void)timer;
+
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        lv_label_set_text_fmt(stats_labels[ch], "#%lu avg %luus\nstdev %luus",
+                              xlat_get_latency_count(ch, LATENCY_GPIO_TO_USB),
+                              xlat_get_average_latency(ch, LATENCY_GPIO_TO_USB),
+                              xlat_get_latency_standard_deviation(ch, LATENCY_GPIO_TO_USB));
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (channels_prev_screen) {
+            lv_timer_del(stats_timer);
+            stats_timer = NULL;
+            lv_scr_load(channels_prev_screen);
+            lv_obj_del(channels_screen);
+        }
+    }
+}
+
+static void enable_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    size_t ch = (size_t)lv_event_get_user_data(e);
+    hw_config_input_channel_enable(ch, lv_obj_has_state(obj, LV_STATE_CHECKED));
+}
+
+static void usage_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    size_t ch = (size_t)lv_event_get_user_data(e);
+    xlat_set_channel_usage(ch, lv_dropdown_get_selected(obj) + 1);
+}
+
+static void edge_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    size_t ch = (size_t)lv_event_get_user_data(e);
+    hw_config_input_trigger(ch, lv_dropdown_get_selected(obj));
+}
+
+static void holdoff_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    size_t ch = (size_t)lv_event_get_user_data(e);
+    uint16_t sel = lv_dropdown_get_selected(obj);
+    if (sel < sizeof(holdoff_ms) / sizeof(holdoff_ms[0])) {
+        xlat_set_gpio_irq_holdoff_us(ch, holdoff_ms[sel] * 1000);
+    }
+}
+
+static lv_obj_t * channel_dropdown_create(lv_coord_t x, lv_coord_t y, lv_coord_t width, const char *options,
+                                          lv_event_cb_t event_cb, size_t ch)
+{
+    lv_obj_t *dropdown = lv_dropdown_create(channels_screen);
+    lv_dropdown_set_options(dropdown, options);
+    lv_obj_set_width(dropdown, width);
+    lv_obj_align(dropdown, LV_ALIGN_TOP_LEFT, x, y);
+    lv_obj_add_event_cb(dropdown, event_cb, LV_EVENT_VALUE_CHANGED, (void *)ch);
+    return dropdown;
+}
+
+void gfx_channels_create_page(lv_obj_t *previous_screen)
+{
+    channels_prev_screen = previous_screen;
+    channels_screen = lv_obj_create(NULL);
+    lv_scr_load(channels_screen);
+
+    // Column headers
+    static const struct {
+        lv_coord_t x;
+        const char *text;
+    } headers[] = {
+        { 10,  "Input" },
+        { 90,  "Usage" },
+        { 195, "Edge" },
+        { 285, "Hold-off" },
+        { 375, "Press latency" },
+    };
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+        lv_obj_t *header = lv_label_create(channels_screen);
+        lv_label_set_text(header, headers[i].text);
+        lv_obj_align(header, LV_ALIGN_TOP_LEFT, headers[i].x, 10);
+    }
+
+    // One row per input channel: enable, HID usage, edge, hold-off and the press statistics
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        lv_coord_t y = CHANNELS_FIRST_ROW_Y + ch * CHANNELS_ROW_HEIGHT;
+
+        lv_obj_t *enable_cb = lv_checkbox_create(channels_screen);
+        lv_checkbox_set_text(enable_cb, hw_input_channel_name(ch));
+        lv_obj_align(enable_cb, LV_ALIGN_TOP_LEFT, 10, y + 8);
+        if (hw_config_input_channel_is_enabled(ch)) {
+            lv_obj_add_state(enable_cb, LV_STATE_CHECKED);
+        }
+
+        if (ch == 0) {
+            // Channel 0 is the main input, it is always on and follows the usage picker
+            lv_obj_add_state(enable_cb, LV_STATE_DISABLED);
+
+            lv_obj_t *usage_label = lv_label_create(channels_screen);
+            lv_label_set_text(usage_label, "Picker");
+            lv_obj_align(usage_label, LV_ALIGN_TOP_LEFT, 100, y + 8);
+        } else {
+            lv_obj_add_event_cb(enable_cb, enable_event_handler, LV_EVENT_VALUE_CHANGED, (void *)ch);
+
+            lv_obj_t *usage_dropdown = channel_dropdown_create(90, y, 100,
+                    "Button 1\nButton 2\nButton 3\nButton 4\nButton 5\nButton 6\nButton 7\nButton 8",
+                    usage_event_handler, ch);
+            uint16_t usage = xlat_get_channel_usage(ch);
+            if (usage > 0) {
+                lv_dropdown_set_selected(usage_dropdown, usage - 1);
+            }
+        }
+
+        lv_obj_t *edge_dropdown = channel_dropdown_create(195, y, 85, "Falling\nRising", edge_event_handler, ch);
+        lv_dropdown_set_selected(edge_dropdown, hw_config_input_trigger_is_rising_edge(ch));
+
+        lv_obj_t *holdoff_dropdown = channel_dropdown_create(285, y, 85, "20ms\n100ms\n200ms\n500ms\n1000ms",
+                                                             holdoff_event_handler, ch);
+        uint32_t holdoff = xlat_get_gpio_irq_holdoff_us(ch) / 1000;
+        for (size_t i = 0; i < sizeof(holdoff_ms) / sizeof(holdoff_ms[0]); i++) {
+            if (holdoff_ms[i] == holdoff) {
+                lv_dropdown_set_selected(holdoff_dropdown, i);
+            }
+        }
+
+        stats_labels[ch] = lv_label_create(channels_screen);
+        lv_obj_align(stats_labels[ch], LV_ALIGN_TOP_LEFT, 375, y);
+    }
+
+    stats_update(NULL);
+    stats_timer = lv_timer_create(stats_update, CHANNELS_STATS_PERIOD, NULL);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(channels_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+}
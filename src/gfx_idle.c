@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_idle.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+
+#define IDLE_STATS_PERIOD   (500) // ms
+
+static lv_obj_t *idle_screen;
+static lv_obj_t *idle_prev_screen = NULL;
+static lv_obj_t *idle_table;
+static lv_obj_t *limit_dropdowns[XLAT_IDLE_BUCKET_MAX - 1];
+static lv_timer_t *idle_timer = NULL;
+
+// Idle bucket limit choices
+static const uint32_t limit_ms[] = { 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000, 60000 };
+#define LIMIT_OPTIONS "50ms\n100ms\n200ms\n500ms\n1s\n2s\n5s\n10s\n30s\n60s"
+
+static void format_ms(char *buf, size_t len, uint32_t ms)
+{
+    if ((ms >= 1000) && (ms % 1000 == 0)) {
+        snprintf(buf, len, "%lus", ms / 1000);
+    } else {
+        snprintf(buf, len, "%lums", ms);
+    }
+}
+
+static void idle_table_update(lv_timer_t *timer)
+{
+    (void)timer;
+
+    for (size_t bucket = 0; bucket < XLAT_IDLE_BUCKET_MAX; bucket++) {
+        char limit[12];
+        uint16_t row = bucket + 1;
+
+        if (bucket < XLAT_IDLE_BUCKET_MAX - 1) {
+            format_ms(limit, sizeof(limit), xlat_get_idle_bucket_limit_ms(bucket));
+            lv_table_set_cell_value_fmt(idle_table, row, 0, "< %s", limit);
+        } else {
+            format_ms(limit, sizeof(limit), xlat_get_idle_bucket_limit_ms(bucket - 1));
+            lv_table_set_cell_value_fmt(idle_table, row, 0, "Deep (>= %s)", limit);
+        }
+        lv_table_set_cell_value_fmt(idle_table, row, 1, "%lu", xlat_get_idle_latency_count(0, bucket));
+        lv_table_set_cell_value_fmt(idle_table, row, 2, "%luus", xlat_get_idle_average_latency(0, bucket));
+        lv_table_set_cell_value_fmt(idle_table, row, 3, "%luus", xlat_get_idle_latency_standard_deviation(0, bucket));
+        lv_table_set_cell_value_fmt(idle_table, row, 4, "%luus", xlat_get_idle_latency_percentile(0, bucket, 99.0f));
+    }
+}
+
+static void limit_dropdowns_update(void)
+{
+    for (size_t bucket = 0; bucket < XLAT_IDLE_BUCKET_MAX - 1; bucket++) {
+        uint32_t ms = xlat_get_idle_bucket_limit_ms(bucket);
+        for (size_t i = 0; i < sizeof(limit_ms) / sizeof(limit_ms[0]); i++) {
+            if (limit_ms[i] == ms) {
+                lv_dropdown_set_selected(limit_dropdowns[bucket], i);
+            }
+        }
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (idle_prev_screen) {
+            lv_timer_del(idle_timer);
+            idle_timer = NULL;
+            lv_scr_load(idle_prev_screen);
+            lv_obj_del(idle_screen);
+        }
+    }
+}
+
+static void limit_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    size_t bucket = (size_t)lv_event_get_user_data(e);
+    uint16_t sel = lv_dropdown_get_selected(obj);
+
+    if ((sel >= sizeof(limit_ms) / sizeof(limit_ms[0])) || !xlat_set_idle_bucket_limit_ms(bucket, limit_ms[sel])) {
+        // Rejected, show the limits in use again
+        limit_dropdowns_update();
+    }
+    idle_table_update(NULL);
+}
+
+static void gaps_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    xlat_set_auto_trigger_idle_gaps(lv_obj_has_state(obj, LV_STATE_CHECKED));
+}
+
+void gfx_idle_create_page(lv_obj_t *previous_screen)
+{
+    idle_prev_screen = previous_screen;
+    idle_screen = lv_obj_create(NULL);
+    lv_scr_load(idle_screen);
+
+    lv_obj_t *title_label = lv_label_create(idle_screen);
+    lv_label_set_text(title_label, "Wake-from-idle latency (D12)");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    // Bucket limits
+    lv_obj_t *limits_label = lv_label_create(idle_screen);
+    lv_label_set_text(limits_label, "Bucket limits:");
+    lv_obj_align(limits_label, LV_ALIGN_TOP_LEFT, 10, 48);
+
+    for (size_t bucket = 0; bucket < XLAT_IDLE_BUCKET_MAX - 1; bucket++) {
+        limit_dropdowns[bucket] = lv_dropdown_create(idle_screen);
+        lv_dropdown_set_options(limit_dropdowns[bucket], LIMIT_OPTIONS);
+        lv_obj_set_width(limit_dropdowns[bucket], 85);
+        lv_obj_align(limit_dropdowns[bucket], LV_ALIGN_TOP_LEFT, 130 + bucket * 95, 38);
+        lv_obj_add_event_cb(limit_dropdowns[bucket], limit_event_handler, LV_EVENT_VALUE_CHANGED, (void *)bucket);
+    }
+    limit_dropdowns_update();
+
+    // One row per bucket: press latency count, average and standard deviation
+    idle_table = lv_table_create(idle_screen);
+    lv_table_set_col_cnt(idle_table, 5);
+    lv_table_set_row_cnt(idle_table, XLAT_IDLE_BUCKET_MAX + 1);
+    lv_table_set_col_width(idle_table, 0, 140);
+    lv_table_set_col_width(idle_table, 1, 60);
+    lv_table_set_col_width(idle_table, 2, 85);
+    lv_table_set_col_width(idle_table, 3, 85);
+    lv_table_set_col_width(idle_table, 4, 85);
+    lv_obj_set_style_pad_ver(idle_table, 4, LV_PART_ITEMS);
+    lv_table_set_cell_value(idle_table, 0, 0, "Idle");
+    lv_table_set_cell_value(idle_table, 0, 1, "#");
+    lv_table_set_cell_value(idle_table, 0, 2, "Avg");
+    lv_table_set_cell_value(idle_table, 0, 3, "Stdev");
+    lv_table_set_cell_value(idle_table, 0, 4, "P99");
+    lv_obj_set_size(idle_table, 460, 140);
+    lv_obj_align(idle_table, LV_ALIGN_TOP_LEFT, 10, 85);
+
+    idle_table_update(NULL);
+    idle_timer = lv_timer_create(idle_table_update, IDLE_STATS_PERIOD, NULL);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(idle_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Auto-trigger idle gaps: cycle the trigger period through the buckets
+    lv_obj_t *gaps_cb = lv_checkbox_create(idle_screen);
+    lv_checkbox_set_text(gaps_cb, "Auto-trigger with idle gaps");
+    lv_obj_align_to(gaps_cb, btn_back, LV_ALIGN_OUT_RIGHT_MID, 20, 0);
+    if (xlat_get_auto_trigger_idle_gaps()) {
+        lv_obj_add_state(gaps_cb, LV_STATE_CHECKED);
+    }
+    lv_obj_add_event_cb(gaps_cb, gaps_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_logic.h"
+#include "lvgl/lvgl.h"
+#include "hardware_config.h"
+#include "logic_capture.h"
+
+#define LOGIC_TICK_PERIOD       (2)   // ms
+#define LOGIC_PAGE_PERIOD       (250) // ms
+#define LOGIC_CHART_POINTS      (200)
+#define LOGIC_LANES_MAX         (5)
+#define LOGIC_EDGES_SHOWN       (6)
+
+static lv_obj_t *logic_screen = NULL;
+static lv_obj_t *logic_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *lanes_label;
+static lv_obj_t *edges_label;
+static lv_obj_t *port_dropdown;
+static lv_obj_t *rate_dropdown;
+static lv_obj_t *click_dropdown;
+static lv_obj_t *logic_chart;
+static lv_obj_t *start_label;
+static lv_chart_series_t *lanes[LOGIC_LANES_MAX];
+static lv_timer_t *page_timer = NULL;
+static lv_timer_t *logic_tick_timer = NULL;
+static bool chart_valid = false;
+
+static const uint32_t rate_options[] = { 1, 2, 5, 10 };
+#define RATE_OPTIONS "1 MHz\n2 MHz\n5 MHz\n10 MHz"
+#define CLICK_OPTIONS "No click\nClick D11"
+
+static const lv_palette_t lane_colors[LOGIC_LANES_MAX] = {
+    LV_PALETTE_LIGHT_BLUE, LV_PALETTE_GREEN, LV_PALETTE_ORANGE, LV_PALETTE_PINK, LV_PALETTE_YELLOW,
+};
+
+// Header pins of the port, top lane first
+static size_t lane_pins(size_t port, uint8_t *pins)
+{
+    size_t count = 0;
+    for (size_t pin = 0; (pin < 16) && (count < LOGIC_LANES_MAX); pin++) {
+        if (hw_capture_pin_name(port, pin)) {
+            pins[count++] = pin;
+        }
+    }
+    return count;
+}
+
+static void chart_update(void)
+{
+    uint8_t pins[LOGIC_LANES_MAX];
+    size_t port = logic_capture_port();
+    size_t count = lane_pins(port, pins);
+    uint32_t samples = logic_capture_sample_count();
+    uint16_t level = logic_capture_initial_level();
+    size_t edge = 0;
+    char text[64];
+    int len = 0;
+
+    lv_chart_set_range(logic_chart, LV_CHART_AXIS_PRIMARY_Y, 0, LOGIC_LANES_MAX * 3);
+    for (size_t lane = 0; lane < LOGIC_LANES_MAX; lane++) {
+        lv_chart_set_all_value(logic_chart, lanes[lane], LV_CHART_POINT_NONE);
+    }
+
+    // Level at the end of each point, a pulse that starts and ends inside a point shows as its other level
+    for (size_t point = 0; point < LOGIC_CHART_POINTS; point++) {
+        uint32_t end = (uint32_t)((uint64_t)(point + 1) * samples / LOGIC_CHART_POINTS);
+        uint16_t start_level = level;
+        uint16_t toggled = 0;
+        for (; edge < logic_capture_edge_count(); edge++) {
+            const logic_edge_t *e = logic_capture_get_edge(edge);
+            if (e->sample >= end) {
+                break;
+            }
+            toggled |= e->rising | e->falling;
+            level = (level | e->rising) & ~e->falling;
+        }
+        for (size_t lane = 0; lane < count; lane++) {
+            uint16_t bit = 1 << pins[lane];
+            bool high = (level & bit) != 0;
+            if ((toggled & bit) && !((start_level ^ level) & bit)) {
+                high = !high;
+            }
+            lanes[lane]->y_points[point] = (lv_coord_t)((LOGIC_LANES_MAX - 1 - lane) * 3 + (high ? 2 : 0));
+        }
+    }
+    lv_chart_refresh(logic_chart);
+
+    for (size_t lane = 0; lane < count; lane++) {
+        len += snprintf(text + len, sizeof(text) - len, "%s%s", lane ? "\n" : "", hw_capture_pin_name(port, pins[lane]));
+    }
+    lv_label_set_text(lanes_label, text);
+}
+
+static void edges_update(void)
+{
+    char text[256];
+    int len = 0;
+    size_t shown = 0;
+    size_t port = logic_capture_port();
+
+    len += snprintf(text, sizeof(text), "%u edges in %lu ms%s", logic_capture_edge_count(),
+                    logic_capture_sample_offset_ns(logic_capture_sample_count()) / 1000000,
+                    logic_capture_edges_dropped() ? ", more not kept" : "");
+    for (size_t i = 0; (i < logic_capture_edge_count()) && (shown < LOGIC_EDGES_SHOWN); i++) {
+        const logic_edge_t *edge = logic_capture_get_edge(i);
+        uint32_t ns = logic_capture_sample_offset_ns(edge->sample);
+        for (size_t pin = 0; (pin < 16) && (shown < LOGIC_EDGES_SHOWN); pin++) {
+            uint16_t bit = 1 << pin;
+            if ((edge->rising | edge->falling) & bit) {
+                len += snprintf(text + len, sizeof(text) - len, "%s%s %s +%lu.%02luus", (shown % 2) ? ",  " : "\n",
+                                hw_capture_pin_name(port, pin), (edge->rising & bit) ? "rise" : "fall",
+                                ns / 1000, (ns % 1000) / 10);
+                shown++;
+            }
+        }
+    }
+    lv_label_set_text(edges_label, text);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    logic_capture_state_t state = logic_capture_get_state();
+    (void)timer;
+
+    lv_label_set_text_fmt(status_label, "%s, %lu samples from %lu (time base)",
+                          (state == LOGIC_CAPTURE_RUNNING) ? "Capturing" : ((state == LOGIC_CAPTURE_DONE) ? "Done" : "Idle"),
+                          logic_capture_sample_count(), logic_capture_start_us());
+    lv_label_set_text(start_label, (state == LOGIC_CAPTURE_RUNNING) ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    if ((state == LOGIC_CAPTURE_DONE) && !chart_valid) {
+        chart_update();
+        edges_update();
+        chart_valid = true;
+    }
+}
+
+static void logic_tick_callback(lv_timer_t *timer)
+{
+    logic_capture_tick(lv_tick_get());
+
+    if (logic_capture_get_state() != LOGIC_CAPTURE_RUNNING) {
+        lv_timer_del(timer);
+        logic_tick_timer = NULL;
+    }
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (logic_capture_get_state() == LOGIC_CAPTURE_RUNNING) {
+        logic_capture_stop();
+        if (logic_tick_timer) {
+            lv_timer_del(logic_tick_timer);
+            logic_tick_timer = NULL;
+        }
+    } else {
+        uint16_t rate = lv_dropdown_get_selected(rate_dropdown);
+        chart_valid = false;
+        if (logic_capture_start(lv_dropdown_get_selected(port_dropdown),
+                                (rate < sizeof(rate_options) / sizeof(rate_options[0])) ? rate_options[rate] : 1,
+                                lv_dropdown_get_selected(click_dropdown) == 1) &&
+            (logic_tick_timer == NULL)) {
+            logic_tick_timer = lv_timer_create(logic_tick_callback, LOGIC_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (logic_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(logic_prev_screen);
+            lv_obj_del(logic_screen);
+            logic_screen = NULL;
+        }
+    }
+}
+
+void gfx_logic_create_page(lv_obj_t *previous_screen)
+{
+    char options[64];
+    int len = 0;
+
+    logic_prev_screen = previous_screen;
+    logic_screen = lv_obj_create(NULL);
+    lv_scr_load(logic_screen);
+
+    lv_obj_t *title_label = lv_label_create(logic_screen);
+    lv_label_set_text(title_label, "Logic capture of the header pins on a port");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(logic_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    for (size_t port = 0; port < HW_CAPTURE_PORT_MAX; port++) {
+        len += snprintf(options + len, sizeof(options) - len, "%s%s", port ? "\n" : "", hw_capture_port_name(port));
+    }
+    port_dropdown = lv_dropdown_create(logic_screen);
+    lv_dropdown_set_options(port_dropdown, options);
+    lv_obj_set_width(port_dropdown, 110);
+    lv_obj_align(port_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+
+    rate_dropdown = lv_dropdown_create(logic_screen);
+    lv_dropdown_set_options(rate_dropdown, RATE_OPTIONS);
+    lv_obj_set_width(rate_dropdown, 100);
+    lv_obj_align_to(rate_dropdown, port_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(rate_dropdown, 3);
+
+    click_dropdown = lv_dropdown_create(logic_screen);
+    lv_dropdown_set_options(click_dropdown, CLICK_OPTIONS);
+    lv_obj_set_width(click_dropdown, 120);
+    lv_obj_align_to(click_dropdown, rate_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(click_dropdown, 1);
+
+    // One lane per header pin, the whole capture from left to right
+    logic_chart = lv_chart_create(logic_screen);
+    lv_obj_set_size(logic_chart, 410, 100);
+    lv_obj_align(logic_chart, LV_ALIGN_TOP_LEFT, 60, 96);
+    lv_obj_set_style_size(logic_chart, 0, LV_PART_INDICATOR);
+    lv_chart_set_div_line_count(logic_chart, 0, 0);
+    lv_chart_set_point_count(logic_chart, LOGIC_CHART_POINTS);
+    for (size_t lane = 0; lane < LOGIC_LANES_MAX; lane++) {
+        lanes[lane] = lv_chart_add_series(logic_chart, lv_palette_main(lane_colors[lane]), LV_CHART_AXIS_PRIMARY_Y);
+    }
+
+    lanes_label = lv_label_create(logic_screen);
+    lv_obj_set_style_text_font(lanes_label, &lv_font_montserrat_12, 0);
+    lv_obj_set_style_text_line_space(lanes_label, 5, 0); // one lane every 20 px
+    lv_obj_align(lanes_label, LV_ALIGN_TOP_LEFT, 10, 100);
+    lv_label_set_text(lanes_label, "");
+
+    edges_label = lv_label_create(logic_screen);
+    lv_obj_set_style_text_font(edges_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(edges_label, LV_ALIGN_TOP_LEFT, 10, 200);
+    lv_label_set_text(edges_label, "");
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(logic_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, all edges are printed to the console at the end
+    lv_obj_t *btn_start = lv_btn_create(logic_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    chart_valid = false;
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, LOGIC_PAGE_PERIOD, NULL);
+}
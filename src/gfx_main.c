@@ -24,16 +24,27 @@
 #include "gfx_settings.h"
 #include "stdio_glue.h"
 #include "usb_host.h"
+#include "soak.h"
+#include "phase_sweep.h"
+#include "usb_reference.h"
 
 #define Y_CHART_SIZE_X 410
-#define Y_CHART_SIZE_Y 130
+#define Y_CHART_SIZE_Y 110
 
 #define X_CHART_RANGE 1000
 #define Y_CHART_RANGE 2000
 
+// Distribution view, shown instead of the chart after tapping it
+#define DIST_BINS 64
+#define DIST_UPDATE_MS 500
+
 lv_color_t lv_color_lightblue = LV_COLOR_MAKE(0xa6, 0xd1, 0xd1);
 
 static lv_obj_t * chart;
+static lv_obj_t * dist_chart;
+static lv_obj_t * dist_label;
+static lv_chart_cursor_t * dist_cursors[LATENCY_MODES_MAX];
+static uint32_t dist_last_update = 0;
 static lv_obj_t * latency_label;
 static lv_obj_t * productname_label;
 static lv_obj_t * manufacturer_label;
@@ -46,19 +57,81 @@ static size_t chart_point_count = 0;
 static lv_coord_t chart_y_range = 0;
 
 static lv_timer_t * trigger_timer = NULL;
+static uint32_t trigger_fired = 0;
 
 static void chart_reset(void);
+static void dist_chart_update(void);
 
 LV_IMG_DECLARE(xlat_logo);
 
 static void latency_label_update(void)
 {
-    lv_label_set_text_fmt(latency_label, "#%lu: %ldus, avg %ldus, stdev %ldus",
-                          xlat_get_latency_count(LATENCY_GPIO_TO_USB),
-                          xlat_get_latency_us(LATENCY_GPIO_TO_USB),
-                          xlat_get_average_latency(LATENCY_GPIO_TO_USB),
-                          xlat_get_latency_standard_deviation(LATENCY_GPIO_TO_USB)
-                          );
+    // The statistics are cached on every sample, nothing is recomputed here
+    const latency_stats_t *press = xlat_get_latency_stats(0, LATENCY_GPIO_TO_USB);
+    const latency_stats_t *release = xlat_get_latency_stats(0, LATENCY_GPIO_TO_USB_RELEASE);
+    const latency_stats_t *raw = xlat_get_raw_latency_stats(0, LATENCY_GPIO_TO_USB);
+
+    // First line: the clean numbers, and the raw ones next to them once outliers were kept out
+    char press_str[96];
+    uint32_t outliers = xlat_get_outlier_count(0, LATENCY_GPIO_TO_USB);
+    if (outliers == 0) {
+        snprintf(press_str, sizeof(press_str), "#%lu: %luus, avg %luus, stdev %luus",
+                 raw->count, raw->last_us, press->mean_us, press->stdev_us);
+    } else {
+        snprintf(press_str, sizeof(press_str), "#%lu: %luus, avg %luus (raw %lu), stdev %luus (raw %lu), %lu outliers",
+                 raw->count, raw->last_us, press->mean_us, raw->mean_us, press->stdev_us, raw->stdev_us, outliers);
+    }
+
+    // The lines are put together in one buffer, the optional ones only when there is data for them
+    char text[480];
+    size_t len = 0;
+
+    // The calibration the numbers are corrected with, and what is left of the error
+    const xlat_calibration_t *calibration = xlat_get_calibration();
+    if (calibration) {
+        len += snprintf(text, sizeof(text), "Calibrated: +-%lu.%02lu us (2 sigma)\n",
+                        calibration->bound_ns / 1000, (calibration->bound_ns % 1000) / 10);
+    }
+    len += snprintf(text + len, sizeof(text) - len, "%s", press_str);
+
+    // The percentiles come from the histogram, one pass over its buckets
+    uint32_t pct[XLAT_PERCENTILE_MAX];
+    xlat_get_latency_percentiles(0, LATENCY_GPIO_TO_USB, pct);
+    len += snprintf(text + len, sizeof(text) - len, "\nP50 %luus, P90 %luus, P99 %luus, P99.9 %luus, max %luus",
+                    pct[0], pct[1], pct[2], pct[3], press->max_us);
+
+    // Recent samples against the whole session, to spot drift
+    latency_window_result_t window;
+    xlat_get_window_stats(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_SAMPLES, &window);
+    len += snprintf(text + len, sizeof(text) - len, "\nLast %lu: avg %luus, stdev %luus, P99 %luus, trend %s",
+                    window.count, window.mean_us, window.stdev_us, window.p99_us,
+                    xlat_get_trend_name(xlat_get_window_trend(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_SAMPLES)));
+
+    // Device processing estimate, without the wait for the host's poll
+    const latency_stats_t *device = xlat_get_latency_stats(0, LATENCY_DEVICE_PROCESSING);
+    if (device->count) {
+        len += snprintf(text + len, sizeof(text) - len, "\nDevice: avg %luus, stdev %luus, P99 %luus, poll ~%luus",
+                        device->mean_us, device->stdev_us,
+                        xlat_get_latency_percentile(0, LATENCY_DEVICE_PROCESSING, 99.0f),
+                        xlat_get_poll_bracket_stats()->mean_us);
+    }
+
+    if (release->count) {
+        // Release numbers and the debounce fingerprint
+        uint32_t window_us;
+        enum debounce_scheme scheme = xlat_get_debounce_scheme(0, &window_us);
+        char debounce_str[32];
+        if (window_us) {
+            snprintf(debounce_str, sizeof(debounce_str), "%s, ~%luus",
+                     xlat_get_debounce_scheme_name(scheme), window_us);
+        } else {
+            snprintf(debounce_str, sizeof(debounce_str), "%s", xlat_get_debounce_scheme_name(scheme));
+        }
+        len += snprintf(text + len, sizeof(text) - len, "\nRelease #%lu: avg %ldus, stdev %ldus, debounce %s",
+                        release->count, release->mean_us, release->stdev_us, debounce_str);
+    }
+
+    lv_label_set_text(latency_label, text);
     lv_obj_align_to(latency_label, chart, LV_ALIGN_OUT_TOP_MID, 0, 0);
 }
 
@@ -81,6 +154,7 @@ static void btn_clear_event_cb(lv_event_t * e)
         // reset latency numbers
         xlat_reset_latency();
         chart_reset();
+        dist_chart_update();
         latency_label_update();
     }
 }
@@ -118,18 +192,42 @@ void auto_trigger_callback(lv_timer_t * timer)
 {
     char label[20];
     size_t * count = timer->user_data;
+    const xlat_early_stop_t *stop = xlat_get_early_stop();
+    uint32_t half_width_us = 0;
+    uint32_t samples = 0;
+    bool have_ci = false;
+    bool converged = false;
 
     xlat_auto_trigger_action();
+    trigger_fired++;
+
+    // Early stop, once the confidence interval of this series is narrow enough and built on enough
+    // measured samples (a click can be missed, or its report filtered out)
+    if (stop->target_us) {
+        have_ci = xlat_get_confidence_interval(0, LATENCY_GPIO_TO_USB, stop->statistic, stop->confidence_pct,
+                                               &half_width_us, &samples);
+        converged = have_ci && (samples >= stop->min_samples) && (half_width_us <= stop->target_us);
+    }
 
     *count = (*count) - 1;
-    if (*count) {
-        sprintf(label, "%lu", (long)*count);
+    if (*count && !converged) {
+        if (have_ci) {
+            // Live confidence interval width instead of the remaining clicks
+            sprintf(label, "%lu +-%lu", (long)trigger_fired, half_width_us);
+        } else {
+            sprintf(label, "%lu", (long)*count);
+        }
         lv_label_set_text(trigger_label, label);    /*Set the labels text*/
         lv_obj_center(trigger_label);
 
-        // Restart the timer with a random period added to the base period
-        lv_timer_set_period(timer, AUTO_TRIGGER_PERIOD_MS + (rand() % 10));
+        // Restart the timer with a random period added to the base period (or the next idle gap)
+        lv_timer_set_period(timer, xlat_auto_trigger_period_ms() + (rand() % 10));
     } else {
+        if (converged) {
+            printf("AutoTrigger converged after %lu clicks, %lu samples: +-%luus (target +-%luus)\n",
+                   trigger_fired, samples, half_width_us, stop->target_us);
+        }
+        *count = 0;
         auto_trigger_clear_timer();
     }
 }
@@ -146,13 +244,15 @@ static void btn_trigger_event_cb(lv_event_t * e)
             count = 0;
             auto_trigger_clear_timer();
         } else {
-            // Trigger a new series of measurements
+            // Trigger a new series of measurements, up to the maximum unless it converges earlier
             printf("AutoTrigger activated\n");
-            count = 1000;
+            count = xlat_get_early_stop()->max_samples;
+            trigger_fired = 0;
+            xlat_series_start();
             // seed the random number generator
             srand(xlat_counter_1mhz_get());
             // start the timer
-            trigger_timer = lv_timer_create(auto_trigger_callback, AUTO_TRIGGER_PERIOD_MS,  &count);
+            trigger_timer = lv_timer_create(auto_trigger_callback, xlat_auto_trigger_period_ms(),  &count);
             //lv_timer_set_repeat_count(timer, count);
         }
     }
@@ -194,6 +294,103 @@ static void chart_update(uint32_t value)
     lv_chart_refresh(chart);
 }
 
+static void dist_chart_update(void)
+{
+    uint32_t bins[DIST_BINS];
+    uint32_t lo_us, hi_us;
+    latency_modes_t modes;
+    lv_chart_series_t * ser = lv_chart_get_series_next(dist_chart, NULL);
+    uint32_t peak = 1;
+    char text[160];
+    size_t len;
+
+    dist_last_update = lv_tick_get();
+
+    if (!xlat_get_latency_distribution(0, LATENCY_GPIO_TO_USB, bins, DIST_BINS, &lo_us, &hi_us)) {
+        lv_chart_set_all_value(dist_chart, ser, 0);
+        for (size_t j = 0; j < LATENCY_MODES_MAX; j++) {
+            lv_chart_set_cursor_point(dist_chart, dist_cursors[j], ser, LV_CHART_POINT_NONE);
+        }
+        lv_label_set_text(dist_label, "No samples yet");
+        lv_chart_refresh(dist_chart);
+        return;
+    }
+
+    for (size_t i = 0; i < DIST_BINS; i++) {
+        peak = (bins[i] > peak) ? bins[i] : peak;
+    }
+    for (size_t i = 0; i < DIST_BINS; i++) {
+        ser->y_points[i] = (lv_coord_t)((bins[i] * 1000ULL) / peak);
+    }
+
+    // Mark every mode at its bin, with centre, share and spread in the label
+    xlat_get_latency_modes(0, LATENCY_GPIO_TO_USB, &modes);
+    len = snprintf(text, sizeof(text), "%lu - %lu us", lo_us, hi_us);
+    for (size_t j = 0; j < LATENCY_MODES_MAX; j++) {
+        uint16_t point = LV_CHART_POINT_NONE;
+        if (j < modes.count) {
+            const latency_mode_t *mode = &modes.mode[j];
+            float pos = (mode->centre_us - lo_us) * DIST_BINS / (float)(hi_us - lo_us);
+            point = (pos < 0.0f) ? 0 : (pos >= DIST_BINS) ? (DIST_BINS - 1) : (uint16_t)pos;
+            len += snprintf(text + len, sizeof(text) - len, "\nM%u %luus %lu%% +-%luus", j + 1,
+                            (uint32_t)(mode->centre_us + 0.5f), (uint32_t)(mode->weight * 100.0f + 0.5f),
+                            (uint32_t)(mode->spread_us + 0.5f));
+        }
+        lv_chart_set_cursor_point(dist_chart, dist_cursors[j], ser, point);
+    }
+
+    lv_label_set_text(dist_label, text);
+    lv_chart_refresh(dist_chart);
+}
+
+static void chart_toggle_event_cb(lv_event_t * e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (lv_obj_has_flag(dist_chart, LV_OBJ_FLAG_HIDDEN)) {
+        dist_chart_update();
+        lv_obj_add_flag(chart, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_clear_flag(dist_chart, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        lv_obj_add_flag(dist_chart, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_clear_flag(chart, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+// Histogram of the channel 0 presses with the fitted modes, in place of the time series chart
+static void dist_chart_new(void)
+{
+    static const lv_color_t mode_colors[LATENCY_MODES_MAX] = {
+        LV_COLOR_MAKE(0xff, 0x60, 0x60), LV_COLOR_MAKE(0x60, 0xff, 0x60), LV_COLOR_MAKE(0xff, 0xc0, 0x40),
+    };
+
+    dist_chart = lv_chart_create(lv_scr_act());
+    lv_obj_set_size(dist_chart, Y_CHART_SIZE_X, Y_CHART_SIZE_Y);
+    lv_obj_align(dist_chart, LV_ALIGN_CENTER, 20, 20);
+    lv_chart_set_type(dist_chart, LV_CHART_TYPE_BAR);
+    lv_chart_set_point_count(dist_chart, DIST_BINS);
+    lv_chart_set_range(dist_chart, LV_CHART_AXIS_PRIMARY_Y, 0, 1000);
+    lv_chart_set_div_line_count(dist_chart, 0, 0);
+    lv_obj_set_style_pad_column(dist_chart, 1, LV_PART_MAIN);
+    lv_obj_set_style_size(dist_chart, 0, LV_PART_CURSOR);
+    lv_chart_series_t * ser = lv_chart_add_series(dist_chart, lv_color_lightblue, LV_CHART_AXIS_PRIMARY_Y);
+    lv_chart_set_all_value(dist_chart, ser, 0);
+
+    for (size_t j = 0; j < LATENCY_MODES_MAX; j++) {
+        dist_cursors[j] = lv_chart_add_cursor(dist_chart, mode_colors[j], LV_DIR_VER);
+    }
+
+    dist_label = lv_label_create(dist_chart);
+    lv_obj_set_style_text_font(dist_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(dist_label, LV_ALIGN_TOP_RIGHT, 0, 0);
+
+    lv_obj_add_flag(dist_chart, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_add_event_cb(dist_chart, chart_toggle_event_cb, LV_EVENT_ALL, NULL);
+    lv_obj_add_event_cb(chart, chart_toggle_event_cb, LV_EVENT_ALL, NULL);
+}
+
 /**
  * Display 1000 data points with zooming and scrolling.
  * See how the chart changes drawing mode (draw only vertical lines) when
@@ -204,7 +401,7 @@ void lv_chart_new(lv_coord_t xrange, lv_coord_t yrange)
     // Create a chart
     chart = lv_chart_create(lv_scr_act());
     lv_obj_set_size(chart, Y_CHART_SIZE_X, Y_CHART_SIZE_Y);
-    lv_obj_align(chart, LV_ALIGN_CENTER, 20, 10);
+    lv_obj_align(chart, LV_ALIGN_CENTER, 20, 20);
     lv_chart_set_range(chart, LV_CHART_AXIS_PRIMARY_Y, 0, yrange);
     lv_chart_set_range(chart, LV_CHART_AXIS_PRIMARY_X, 0, xrange);
 
@@ -286,14 +483,23 @@ void gfx_set_byte_offsets_text(void)
     hid_data_location_t * x = xlat_get_x_location();
     hid_data_location_t * y = xlat_get_y_location();
 
-    if (button->found && x->found && y->found) {
+    int index = xlat_get_trigger_item();
+    const hid_input_item_t * item = (index >= 0) ? xlat_get_hid_item(index) : NULL;
+
+    if (item && x->found && y->found) {
+        // trigger source picked by the user
+        char name[24];
+        sprintf(text, "Data: %s@%d motion@%d,%d",
+                xlat_get_hid_usage_name(item->usage_page, item->usage, name, sizeof(name)),
+                item->bit_index / 8 + xlat_get_using_reportid(), x->byte_offset, y->byte_offset);
+    } else if (button->found && x->found && y->found) {
         sprintf(text, "Data: click@%d motion@%d,%d", button->byte_offset, x->byte_offset, y->byte_offset);
     } else {
         // offsets not found
         sprintf(text, "Data: offsets not found");
     }
 
-    lv_checkbox_set_text(hid_offsets_label, text);
+    lv_label_set_text(hid_offsets_label, text);
     lv_obj_align_to(hid_offsets_label, productname_label, LV_ALIGN_OUT_BOTTOM_RIGHT, 0, 5);
 }
 
@@ -390,6 +596,7 @@ static void gfx_xlat_gui(void)
     ///////////
     lv_chart_new(X_CHART_RANGE, Y_CHART_RANGE);
     lv_chart_add_cursor(chart, lv_color_white(), LV_DIR_TOP);
+    dist_chart_new();
 }
 
 
@@ -423,19 +630,46 @@ void gfx_task(void)
         switch (g_evt->type) {
             case GFX_EVENT_MEASUREMENT:
                 // New measurement received
+                // The chart and label show channel 0, the other channels have their own page
+
+                if (g_evt->channel == 0) {
+                    // guard with LVGL mutex
+                    xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
+                    {
+                        // update chart data
+                        chart_update(g_evt->value);
+
+                        // The mode fit takes a few ms, do not redo it for every sample
+                        if (!lv_obj_has_flag(dist_chart, LV_OBJ_FLAG_HIDDEN) &&
+                            (lv_tick_elaps(dist_last_update) >= DIST_UPDATE_MS)) {
+                            dist_chart_update();
+                        }
+
+                        // update to latest xlat measurements
+                        latency_label_update();
+                    }
+                    xSemaphoreGive(lvgl_mutex);
+                }
 
-                // guard with LVGL mutex
-                xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
-                {
-                    // update chart data
-                    chart_update(g_evt->value);
+                // A running soak test, phase sweep or reference mouse follows D12, every report, outliers included
+                if (g_evt->channel == 0) {
+                    soak_add(lv_tick_get(), (uint32_t)g_evt->value);
+                    phase_sweep_add((uint32_t)g_evt->value);
+                    usb_reference_add(g_evt->value);
+                }
+
+                xlat_print_measurement(g_evt->channel, LATENCY_GPIO_TO_USB);
+                break;
 
-                    // update to latest xlat measurements
+            case GFX_EVENT_RELEASE_MEASUREMENT:
+                // New release measurement received, the chart only shows presses
+                if (g_evt->channel == 0) {
+                    xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
                     latency_label_update();
+                    xSemaphoreGive(lvgl_mutex);
                 }
-                xSemaphoreGive(lvgl_mutex);
 
-                xlat_print_measurement();
+                xlat_print_measurement(g_evt->channel, LATENCY_GPIO_TO_USB_RELEASE);
                 break;
 
             case GFX_EVENT_HID_DEVICE_CONNECTED:
@@ -443,11 +677,13 @@ void gfx_task(void)
                                      usb_host_get_product_string(),
                                      usb_host_get_vidpid_string());
                 gfx_set_byte_offsets_text();
+                soak_connection(lv_tick_get(), true);
                 break;
 
             case GFX_EVENT_HID_DEVICE_DISCONNECTED:
                 gfx_set_device_label("", "No USB device connected", "");
                 gfx_set_byte_offsets_text();
+                soak_connection(lv_tick_get(), false);
                 break;
         }
 
@@ -27,12 +27,14 @@
 
 typedef enum gfx_event_type {
     GFX_EVENT_MEASUREMENT,
+    GFX_EVENT_RELEASE_MEASUREMENT,
     GFX_EVENT_HID_DEVICE_CONNECTED,
     GFX_EVENT_HID_DEVICE_DISCONNECTED,
 } gfx_event_t;
 
 struct gfx_event {
     gfx_event_t type;
+    uint8_t channel;    // input channel of a measurement
     int32_t value;
 };
 
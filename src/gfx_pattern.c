@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "gfx_pattern.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+#include "hardware_config.h"
+#include "pattern_gen.h"
+#include "gfx_logic.h"
+#include "gfx_bounce.h"
+#include "gfx_analog.h"
+
+#define PATTERN_TICK_PERIOD     (2)   // ms
+#define PATTERN_PAGE_PERIOD     (500) // ms
+
+static lv_obj_t *pattern_screen = NULL;
+static lv_obj_t *pattern_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *kind_dropdown;
+static lv_obj_t *keys_dropdown;
+static lv_obj_t *spacing_dropdown;
+static lv_obj_t *runs_dropdown;
+static lv_obj_t *start_label;
+static lv_timer_t *page_timer = NULL;
+
+// The tick timer outlives the page, so the runs go on while other pages are shown
+static lv_timer_t *pattern_tick_timer = NULL;
+
+#define KIND_OPTIONS "Chord\nStaggered\nRollover\nRapid tap"
+#define KEYS_OPTIONS "1 key\n2 keys\n3 keys"
+static const uint32_t spacing_options[] = { 250, 1000, 10000, 100000, 1000000, 5000000 };
+#define SPACING_OPTIONS "250 ns\n1 us\n10 us\n100 us\n1 ms\n5 ms"
+static const uint32_t run_options[] = { 10, 50, 200, 1000 };
+#define RUNS_OPTIONS "10 runs\n50 runs\n200 runs\n1000 runs"
+
+static void pattern_tick_callback(lv_timer_t *timer)
+{
+    pattern_gen_tick(lv_tick_get());
+
+    // Finished on its own
+    if (!pattern_gen_is_running()) {
+        lv_timer_del(timer);
+        pattern_tick_timer = NULL;
+    }
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    char text[256];
+    int len = 0;
+    (void)timer;
+
+    lv_label_set_text_fmt(status_label, "%s, %u steps, %lu of %lu runs",
+                          pattern_gen_is_running() ? "Running" : "Stopped", pattern_gen_step_count(),
+                          pattern_gen_runs(), pattern_gen_runs_total());
+    lv_label_set_text(start_label, pattern_gen_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    // Every key is measured on the input channel with its number
+    size_t keys = lv_dropdown_get_selected(keys_dropdown) + 1;
+    for (size_t key = 0; (key < keys) && (key < HW_PATTERN_OUTPUT_MAX); key++) {
+        if (!hw_config_input_channel_is_enabled(key)) {
+            len += snprintf(text + len, sizeof(text) - len, "%sKey %u (%s): input %s is off",
+                            key ? "\n" : "", key, hw_pattern_output_name(key), hw_input_channel_name(key));
+            continue;
+        }
+        len += snprintf(text + len, sizeof(text) - len, "%sKey %u (%s -> %s): %luus mean, %lu presses",
+                        key ? "\n" : "", key, hw_pattern_output_name(key), hw_input_channel_name(key),
+                        xlat_get_average_latency(key, LATENCY_GPIO_TO_USB),
+                        xlat_get_latency_count(key, LATENCY_GPIO_TO_USB));
+    }
+    lv_label_set_text(result_label, text);
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (pattern_gen_is_running()) {
+        pattern_gen_stop();
+        if (pattern_tick_timer) {
+            lv_timer_del(pattern_tick_timer);
+            pattern_tick_timer = NULL;
+        }
+    } else {
+        uint16_t kind = lv_dropdown_get_selected(kind_dropdown);
+        uint16_t keys = lv_dropdown_get_selected(keys_dropdown) + 1;
+        uint16_t spacing = lv_dropdown_get_selected(spacing_dropdown);
+        uint16_t runs = lv_dropdown_get_selected(runs_dropdown);
+        srand(xlat_counter_1mhz_get());
+        if (pattern_gen_build((pattern_kind_t)kind, keys,
+                              (spacing < sizeof(spacing_options) / sizeof(spacing_options[0])) ? spacing_options[spacing] : 1000) &&
+            pattern_gen_start((runs < sizeof(run_options) / sizeof(run_options[0])) ? run_options[runs] : 10) &&
+            (pattern_tick_timer == NULL)) {
+            pattern_tick_timer = lv_timer_create(pattern_tick_callback, PATTERN_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void logic_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_logic_create_page(pattern_screen);
+    }
+}
+
+static void bounce_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_bounce_create_page(pattern_screen);
+    }
+}
+
+static void analog_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_analog_create_page(pattern_screen);
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (pattern_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(pattern_prev_screen);
+            lv_obj_del(pattern_screen);
+            pattern_screen = NULL;
+        }
+    }
+}
+
+void gfx_pattern_create_page(lv_obj_t *previous_screen)
+{
+    pattern_prev_screen = previous_screen;
+    pattern_screen = lv_obj_create(NULL);
+    lv_scr_load(pattern_screen);
+
+    lv_obj_t *title_label = lv_label_create(pattern_screen);
+    lv_label_set_text(title_label, "Pattern generator, key N drives the button of input N");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(pattern_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    kind_dropdown = lv_dropdown_create(pattern_screen);
+    lv_dropdown_set_options(kind_dropdown, KIND_OPTIONS);
+    lv_obj_set_width(kind_dropdown, 120);
+    lv_obj_align(kind_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+
+    keys_dropdown = lv_dropdown_create(pattern_screen);
+    lv_dropdown_set_options(keys_dropdown, KEYS_OPTIONS);
+    lv_obj_set_width(keys_dropdown, 90);
+    lv_obj_align_to(keys_dropdown, kind_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(keys_dropdown, HW_PATTERN_OUTPUT_MAX - 1);
+
+    // Between the keys of a staggered chord, rollover or tap
+    spacing_dropdown = lv_dropdown_create(pattern_screen);
+    lv_dropdown_set_options(spacing_dropdown, SPACING_OPTIONS);
+    lv_obj_set_width(spacing_dropdown, 100);
+    lv_obj_align_to(spacing_dropdown, keys_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(spacing_dropdown, 1);
+
+    runs_dropdown = lv_dropdown_create(pattern_screen);
+    lv_dropdown_set_options(runs_dropdown, RUNS_OPTIONS);
+    lv_obj_set_width(runs_dropdown, 100);
+    lv_obj_align_to(runs_dropdown, spacing_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(runs_dropdown, 1);
+
+    result_label = lv_label_create(pattern_screen);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 100);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(pattern_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the step schedule and run start times go to the console
+    lv_obj_t *btn_start = lv_btn_create(pattern_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    // Logic capture button, records the outputs and inputs together
+    lv_obj_t *btn_logic = lv_btn_create(pattern_screen);
+    lv_obj_set_size(btn_logic, 80, 30);
+    lv_obj_align_to(btn_logic, btn_start, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_logic, logic_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *logic_label = lv_label_create(btn_logic);
+    lv_label_set_text(logic_label, "LOGIC");
+    lv_obj_center(logic_label);
+
+    // Bounce capture button, sets the hold-off of channel 0
+    lv_obj_t *btn_bounce = lv_btn_create(pattern_screen);
+    lv_obj_set_size(btn_bounce, 90, 30);
+    lv_obj_align_to(btn_bounce, btn_logic, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_bounce, bounce_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *bounce_label = lv_label_create(btn_bounce);
+    lv_label_set_text(bounce_label, "BOUNCE");
+    lv_obj_center(bounce_label);
+
+    // Analog trigger button, a sensor voltage instead of the GPIO input of channel 0
+    lv_obj_t *btn_analog = lv_btn_create(pattern_screen);
+    lv_obj_set_size(btn_analog, 80, 30);
+    lv_obj_align_to(btn_analog, btn_bounce, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_analog, analog_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *analog_label = lv_label_create(btn_analog);
+    lv_label_set_text(analog_label, "ANALOG");
+    lv_obj_center(analog_label);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, PATTERN_PAGE_PERIOD, NULL);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_proxy.h"
+#include "lvgl/lvgl.h"
+#include "usb_proxy.h"
+#include "usb_host.h"
+
+#define PROXY_PAGE_PERIOD (250) // ms
+
+static lv_obj_t *proxy_screen = NULL;
+static lv_obj_t *proxy_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *stats_label;
+static lv_obj_t *start_label;
+static lv_timer_t *page_timer = NULL;
+
+static void page_update(lv_timer_t *timer)
+{
+    usb_proxy_state_t state = usb_proxy_get_state();
+    usb_proxy_stats_t stats;
+    (void)timer;
+
+    if (state == USB_PROXY_OFF) {
+        lv_label_set_text(status_label, usb_proxy_state_name(state));
+    } else {
+        lv_label_set_text_fmt(status_label, "%s: %s %s", usb_proxy_state_name(state), usb_host_get_vidpid_string(),
+                              usb_host_get_product_string());
+    }
+    lv_label_set_text(start_label, (state == USB_PROXY_OFF) ? "START" : "STOP");
+    lv_obj_center(start_label);
+
+    usb_proxy_get_stats(&stats);
+    if (stats.forwarded == 0) {
+        lv_label_set_text_fmt(stats_label, "No reports forwarded\n%lu dropped, %lu before the PC configured it",
+                              stats.dropped, stats.not_configured);
+        return;
+    }
+    lv_label_set_text_fmt(stats_label,
+                          "%lu reports forwarded, %lu dropped, %lu before the PC configured it, queue up to %lu\n"
+                          "Forwarding delay: mean %lu us, stdev %lu us, %lu .. %lu us\n"
+                          "On the board: mean %lu us, max %lu us (host thread, copy, queue)\n"
+                          "PC poll: mean %lu us, max %lu us (armed to sent)",
+                          stats.forwarded, stats.dropped, stats.not_configured, stats.queue_max,
+                          stats.total.mean_us, stats.total.stdev_us, stats.total.min_us, stats.total.max_us,
+                          stats.board.mean_us, stats.board.max_us, stats.poll.mean_us, stats.poll.max_us);
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (usb_proxy_get_state() == USB_PROXY_OFF) {
+        usb_proxy_start();
+    } else {
+        usb_proxy_stop();
+    }
+    page_update(NULL);
+}
+
+static void reset_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        usb_proxy_reset_stats();
+        page_update(NULL);
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (proxy_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(proxy_prev_screen);
+            lv_obj_del(proxy_screen);
+            proxy_screen = NULL;
+        }
+    }
+}
+
+void gfx_proxy_create_page(lv_obj_t *previous_screen)
+{
+    proxy_prev_screen = previous_screen;
+    proxy_screen = lv_obj_create(NULL);
+    lv_scr_load(proxy_screen);
+
+    lv_obj_t *title_label = lv_label_create(proxy_screen);
+    lv_label_set_text(title_label, "HID proxy, the mouse cloned on the USB FS port");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(proxy_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    stats_label = lv_label_create(proxy_screen);
+    lv_obj_set_style_text_font(stats_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(stats_label, LV_ALIGN_TOP_LEFT, 10, 64);
+
+    // Reset button, clears the forwarding statistics
+    lv_obj_t *btn_reset = lv_btn_create(proxy_screen);
+    lv_obj_set_size(btn_reset, 80, 30);
+    lv_obj_align(btn_reset, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_reset, reset_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *reset_label = lv_label_create(btn_reset);
+    lv_label_set_text(reset_label, "RESET");
+    lv_obj_center(reset_label);
+
+    // Back button, the proxy keeps running
+    lv_obj_t *btn_back = lv_btn_create(proxy_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the PC sees the clone attached or unplugged
+    lv_obj_t *btn_start = lv_btn_create(proxy_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, PROXY_PAGE_PERIOD, NULL);
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "gfx_reference.h"
+#include "lvgl/lvgl.h"
+#include "usb_reference.h"
+#include "xlat.h"
+
+#define REFERENCE_TICK_PERIOD (10)  // ms
+#define REFERENCE_PAGE_PERIOD (250) // ms
+
+static lv_obj_t *reference_screen = NULL;
+static lv_obj_t *reference_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *verdict_label;
+static lv_obj_t *delay_dropdown;
+static lv_obj_t *interval_dropdown;
+static lv_obj_t *cycles_dropdown;
+static lv_obj_t *start_label;
+static lv_timer_t *page_timer = NULL;
+static lv_timer_t *reference_tick_timer = NULL;
+
+static const usb_reference_config_t delay_options[] = {
+    { USB_REFERENCE_FIXED,   1000, 1000,  100, 1, 0 },
+    { USB_REFERENCE_FIXED,   5000, 5000,  100, 1, 0 },
+    { USB_REFERENCE_UNIFORM, 500,  4000,  0,   1, 0 },
+    { USB_REFERENCE_BIMODAL, 1000, 4000,  50,  1, 0 },
+    { USB_REFERENCE_BIMODAL, 1000, 8000,  90,  1, 0 },
+};
+#define DELAY_OPTIONS "Fixed 1 ms\nFixed 5 ms\nUniform 0.5 - 4 ms\nBimodal 1 / 4 ms\nBimodal 1 / 8 ms, 10%"
+static const uint8_t interval_options[] = { 1, 2, 4, 8 };
+#define INTERVAL_OPTIONS "bInterval 1 ms\nbInterval 2 ms\nbInterval 4 ms\nbInterval 8 ms"
+static const uint32_t cycles_options[] = { 200, 1000, 5000 };
+#define CYCLES_OPTIONS "200 presses\n1000 presses\n5000 presses"
+
+static void result_update(void)
+{
+    const usb_reference_result_t *result = usb_reference_result();
+    const offset_stats_t *error = &result->error;
+
+    if (result->cycles == 0) {
+        lv_label_set_text(result_label, "");
+        lv_label_set_text(verdict_label, "");
+        return;
+    }
+    lv_label_set_text_fmt(result_label,
+                          "Programmed delay: mean %lu us, %lu .. %lu us, compare up to %lu us late\n"
+                          "True latency: mean %lu us, stdev %lu us, %lu .. %lu us\n"
+                          "Measured: mean %lu us, stdev %lu us, %lu .. %lu us (%lu)\n"
+                          "Error: bias %ld ns, stdev %lu ns, %ld .. %ld us",
+                          result->delay.mean_us, result->delay.min_us, result->delay.max_us, result->late_max_us,
+                          result->truth.mean_us, result->truth.stdev_us, result->truth.min_us, result->truth.max_us,
+                          result->measured.mean_us, result->measured.stdev_us, result->measured.min_us,
+                          result->measured.max_us, result->measured.count, usb_reference_bias_ns(error),
+                          usb_reference_stdev_ns(error), error->min, error->max);
+
+    if (error->count < USB_REFERENCE_SAMPLES_MIN) {
+        lv_label_set_text_fmt(verdict_label, "%lu of %d presses needed for a verdict", error->count,
+                              USB_REFERENCE_SAMPLES_MIN);
+        return;
+    }
+    lv_label_set_text_fmt(verdict_label, "%s: bias within +-%d ns, 2 sigma within %d ns%s",
+                          usb_reference_passed(result) ? "PASS" : "FAIL", USB_REFERENCE_BIAS_LIMIT_NS,
+                          USB_REFERENCE_SPREAD_LIMIT_NS,
+                          (xlat_get_calibration() != NULL) ? "" : " (not calibrated)");
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    const usb_reference_result_t *result = usb_reference_result();
+    (void)timer;
+
+    if (usb_reference_is_waiting()) {
+        lv_label_set_text(status_label, "Waiting for USB HS to enumerate the reference mouse");
+    } else {
+        lv_label_set_text_fmt(status_label, "%s, %lu / %lu presses, %lu missed",
+                              usb_reference_is_running() ? "Running" : "Idle", result->cycles,
+                              usb_reference_config()->cycles, result->missed);
+    }
+    lv_label_set_text(start_label, usb_reference_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+    result_update();
+}
+
+static void reference_tick_callback(lv_timer_t *timer)
+{
+    usb_reference_tick(lv_tick_get());
+
+    if (!usb_reference_is_running()) {
+        lv_timer_del(timer);
+        reference_tick_timer = NULL;
+    }
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (usb_reference_is_running()) {
+        usb_reference_stop();
+        if (reference_tick_timer) {
+            lv_timer_del(reference_tick_timer);
+            reference_tick_timer = NULL;
+        }
+    } else {
+        uint16_t delay = lv_dropdown_get_selected(delay_dropdown);
+        uint16_t interval = lv_dropdown_get_selected(interval_dropdown);
+        uint16_t cycles = lv_dropdown_get_selected(cycles_dropdown);
+        usb_reference_config_t config =
+            delay_options[(delay < sizeof(delay_options) / sizeof(delay_options[0])) ? delay : 0];
+        config.interval_ms = (interval < sizeof(interval_options)) ? interval_options[interval] : 1;
+        config.cycles = (cycles < sizeof(cycles_options) / sizeof(cycles_options[0])) ? cycles_options[cycles] : 1000;
+
+        srand(xlat_counter_1mhz_get());
+        if (usb_reference_start(&config) && (reference_tick_timer == NULL)) {
+            reference_tick_timer = lv_timer_create(reference_tick_callback, REFERENCE_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (reference_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(reference_prev_screen);
+            lv_obj_del(reference_screen);
+            reference_screen = NULL;
+        }
+    }
+}
+
+void gfx_reference_create_page(lv_obj_t *previous_screen)
+{
+    reference_prev_screen = previous_screen;
+    reference_screen = lv_obj_create(NULL);
+    lv_scr_load(reference_screen);
+
+    lv_obj_t *title_label = lv_label_create(reference_screen);
+    lv_label_set_text(title_label, "Reference mouse, USB FS to USB HS, D11 to D12");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(reference_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    delay_dropdown = lv_dropdown_create(reference_screen);
+    lv_dropdown_set_options(delay_dropdown, DELAY_OPTIONS);
+    lv_obj_set_width(delay_dropdown, 200);
+    lv_obj_align(delay_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+
+    interval_dropdown = lv_dropdown_create(reference_screen);
+    lv_dropdown_set_options(interval_dropdown, INTERVAL_OPTIONS);
+    lv_obj_set_width(interval_dropdown, 130);
+    lv_obj_align_to(interval_dropdown, delay_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+
+    cycles_dropdown = lv_dropdown_create(reference_screen);
+    lv_dropdown_set_options(cycles_dropdown, CYCLES_OPTIONS);
+    lv_obj_set_width(cycles_dropdown, 120);
+    lv_obj_align_to(cycles_dropdown, interval_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(cycles_dropdown, 1);
+
+    result_label = lv_label_create(reference_screen);
+    lv_obj_set_style_text_font(result_label, &lv_font_montserrat_12, 0);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 100);
+    lv_label_set_text(result_label, "");
+
+    verdict_label = lv_label_create(reference_screen);
+    lv_obj_align(verdict_label, LV_ALIGN_TOP_LEFT, 10, 180);
+    lv_label_set_text(verdict_label, "");
+
+    // Back button, a running self-test goes on
+    lv_obj_t *btn_back = lv_btn_create(reference_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_RIGHT, -110, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the reference mouse is attached while it runs
+    lv_obj_t *btn_start = lv_btn_create(reference_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, REFERENCE_PAGE_PERIOD, NULL);
+}
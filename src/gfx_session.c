@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_session.h"
+#include "gfx_soak.h"
+#include "gfx_sweep.h"
+#include "gfx_pattern.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+#include "hardware_config.h"
+#include "stdio_glue.h"
+
+#define SESSION_USAGE_PERIOD    (500) // ms
+#define SESSION_ROWS_MAX        (XLAT_CHANNEL_MAX * 2)
+// CSV dump of the sample store on the serial port, a few records per tick so the UI keeps running.
+// At 1 Mbaud that is about 3000 samples/s, a full store takes a few minutes.
+#define SESSION_DUMP_PERIOD     (10) // ms
+#define SESSION_DUMP_RECORDS    (16) // per tick
+
+static lv_obj_t *session_screen;
+static lv_obj_t *session_prev_screen = NULL;
+static lv_obj_t *usage_label;
+static lv_obj_t *window_label;
+static lv_obj_t *window_samples_dropdown;
+static lv_obj_t *window_seconds_dropdown;
+static lv_obj_t *stop_target_dropdown;
+static lv_obj_t *stop_statistic_dropdown;
+static lv_obj_t *session_table;
+static lv_timer_t *session_timer = NULL;
+static lv_timer_t *dump_timer = NULL;
+static sample_store_iter_t dump_iter;
+static uint32_t dump_index = 0;
+
+// Sliding window choices
+static const uint32_t window_samples[] = { 20, 50, 100, 200, 500, 1000, 2000 };
+#define WINDOW_SAMPLES_OPTIONS "Last 20\nLast 50\nLast 100\nLast 200\nLast 500\nLast 1000\nLast 2000"
+static const uint32_t window_seconds[] = { 10, 30, 60, 120, 300, 600 };
+#define WINDOW_SECONDS_OPTIONS "Last 10s\nLast 30s\nLast 60s\nLast 2min\nLast 5min\nLast 10min"
+
+// Auto-trigger early stop choices: confidence interval half-width, and statistic with confidence
+static const uint32_t stop_targets[] = { 0, 5, 10, 20, 50, 100 };
+#define STOP_TARGET_OPTIONS "Run all\n+-5us\n+-10us\n+-20us\n+-50us\n+-100us"
+static const struct {
+    enum ci_statistic statistic;
+    uint32_t confidence_pct;
+} stop_statistics[] = {
+    { CI_STATISTIC_MEAN, 90 },
+    { CI_STATISTIC_MEAN, 95 },
+    { CI_STATISTIC_MEAN, 99 },
+    { CI_STATISTIC_MEDIAN, 95 },
+    { CI_STATISTIC_MEDIAN, 99 },
+};
+#define STOP_STATISTIC_OPTIONS "Mean 90%\nMean 95%\nMean 99%\nMedian 95%\nMedian 99%"
+
+static void window_label_update(void)
+{
+    latency_window_result_t by_samples;
+    latency_window_result_t by_time;
+    xlat_get_window_stats(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_SAMPLES, &by_samples);
+    xlat_get_window_stats(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_TIME, &by_time);
+
+    lv_label_set_text_fmt(window_label, "N=%lu: avg %luus, stdev %luus, P50 %luus, P99 %luus, %s\n"
+                                        "T=%lu: avg %luus, stdev %luus, P50 %luus, P99 %luus, %s",
+                          by_samples.count, by_samples.mean_us, by_samples.stdev_us, by_samples.p50_us, by_samples.p99_us,
+                          xlat_get_trend_name(xlat_get_window_trend(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_SAMPLES)),
+                          by_time.count, by_time.mean_us, by_time.stdev_us, by_time.p50_us, by_time.p99_us,
+                          xlat_get_trend_name(xlat_get_window_trend(0, LATENCY_GPIO_TO_USB, LATENCY_WINDOW_TIME)));
+}
+
+static void usage_label_update(lv_timer_t *timer)
+{
+    (void)timer;
+
+    window_label_update();
+
+    uint32_t count = sample_store_count();
+    size_t used = sample_store_bytes_used();
+    uint32_t bytes_x10 = count ? (uint32_t)((used * 10) / count) : 0;
+
+    lv_label_set_text_fmt(usage_label, "%lu samples, %lu of %lu KB (%lu.%lu B/sample)%s",
+                          count, (uint32_t)(used / 1024), (uint32_t)(sample_store_capacity() / 1024),
+                          bytes_x10 / 10, bytes_x10 % 10,
+                          sample_store_is_full() ? ", FULL" : "");
+}
+
+// Exact order statistics of every stream with samples. Each quantile is a selection over the
+// raw samples, so this takes a moment with a large session and is only done on request.
+static void session_table_update(void)
+{
+    static const float quantiles[] = { 0.5f, 0.99f, 0.999f };
+    uint16_t row = 1;
+
+    lv_table_set_row_cnt(session_table, SESSION_ROWS_MAX + 1);
+
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        for (size_t edge = 0; edge < 2; edge++) {
+            enum latency_type type = edge ? LATENCY_GPIO_TO_USB_RELEASE : LATENCY_GPIO_TO_USB;
+            uint32_t n = sample_store_stream_count(ch, type);
+            if (n == 0) {
+                continue;
+            }
+
+            uint32_t min_us = 0;
+            uint32_t max_us = 0;
+            sample_store_select(ch, type, 0, &min_us);
+            sample_store_select(ch, type, n - 1, &max_us);
+
+            lv_table_set_cell_value_fmt(session_table, row, 0, "%s %s", hw_input_channel_name(ch),
+                                        edge ? "release" : "press");
+            lv_table_set_cell_value_fmt(session_table, row, 1, "%lu", n);
+            lv_table_set_cell_value_fmt(session_table, row, 2, "%lu", min_us);
+            for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+                uint32_t value_us = 0;
+                xlat_get_exact_latency_quantile(ch, type, quantiles[i], &value_us);
+                lv_table_set_cell_value_fmt(session_table, row, 3 + i, "%lu", value_us);
+            }
+            lv_table_set_cell_value_fmt(session_table, row, 6, "%lu", max_us);
+            row++;
+
+            // Modes of the distribution go to the console, the table has no room for them
+            latency_modes_t modes;
+            xlat_get_latency_modes(ch, type, &modes);
+            printf("[modes] %s %s:", hw_input_channel_name(ch), edge ? "release" : "press");
+            for (size_t j = 0; j < modes.count; j++) {
+                printf(" %luus %lu%% +-%luus%s", (uint32_t)(modes.mode[j].centre_us + 0.5f),
+                       (uint32_t)(modes.mode[j].weight * 100.0f + 0.5f),
+                       (uint32_t)(modes.mode[j].spread_us + 0.5f), (j + 1 < modes.count) ? "," : "");
+            }
+            printf("%s\n", modes.count ? "" : " not enough samples");
+
+            // Internal scan period, only meaningful with a confidence close to 100%
+            scan_period_result_t scan;
+            xlat_get_scan_period(ch, type, &scan);
+            if (scan.candidates == 0) {
+                printf("[scan] %s %s: not enough samples\n",
+                       hw_input_channel_name(ch), edge ? "release" : "press");
+            } else {
+                printf("[scan] %s %s: period %lu.%luus, consistency %lu%%, confidence %lu%% (%lu pairs)\n",
+                       hw_input_channel_name(ch), edge ? "release" : "press",
+                       (uint32_t)(scan.period_us * 10.0f + 0.5f) / 10, (uint32_t)(scan.period_us * 10.0f + 0.5f) % 10,
+                       (uint32_t)(scan.consistency * 100.0f + 0.5f), (uint32_t)(scan.confidence * 100.0f),
+                       scan.pairs);
+            }
+        }
+    }
+
+    if (row == 1) {
+        lv_table_set_cell_value(session_table, row++, 0, "No samples");
+    }
+    lv_table_set_row_cnt(session_table, row);
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (session_prev_screen) {
+            lv_timer_del(session_timer);
+            session_timer = NULL;
+            lv_scr_load(session_prev_screen);
+            lv_obj_del(session_screen);
+        }
+    }
+}
+
+static void window_event_handler(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    uint16_t sel = lv_dropdown_get_selected(obj);
+
+    if (obj == window_samples_dropdown) {
+        if (sel < sizeof(window_samples) / sizeof(window_samples[0])) {
+            xlat_set_window_samples(window_samples[sel]);
+        }
+    } else if (obj == window_seconds_dropdown) {
+        if (sel < sizeof(window_seconds) / sizeof(window_seconds[0])) {
+            xlat_set_window_seconds(window_seconds[sel]);
+        }
+    }
+    window_label_update();
+}
+
+static void stop_event_handler(lv_event_t *e)
+{
+    xlat_early_stop_t stop = *xlat_get_early_stop();
+    uint16_t target = lv_dropdown_get_selected(stop_target_dropdown);
+    uint16_t statistic = lv_dropdown_get_selected(stop_statistic_dropdown);
+    (void)e;
+
+    if (target < sizeof(stop_targets) / sizeof(stop_targets[0])) {
+        stop.target_us = stop_targets[target];
+    }
+    if (statistic < sizeof(stop_statistics) / sizeof(stop_statistics[0])) {
+        stop.statistic = stop_statistics[statistic].statistic;
+        stop.confidence_pct = stop_statistics[statistic].confidence_pct;
+    }
+    xlat_set_early_stop(&stop);
+}
+
+static void soak_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_soak_create_page(session_screen);
+    }
+}
+
+static void sweep_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_sweep_create_page(session_screen);
+    }
+}
+
+static void pattern_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_pattern_create_page(session_screen);
+    }
+}
+
+static void dump_stop(const char *reason)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "# %lu samples, %s\r\n", dump_index, reason);
+    vcp_writestr(line);
+    lv_timer_del(dump_timer);
+    dump_timer = NULL;
+}
+
+static void dump_timer_callback(lv_timer_t *timer)
+{
+    sample_record_t record;
+    char line[80];
+
+    // A CLEAR in between: the records are gone
+    if (sample_store_bytes_used() < dump_iter.end) {
+        dump_stop("aborted by CLEAR");
+        return;
+    }
+
+    for (int i = 0; i < SESSION_DUMP_RECORDS; i++) {
+        if (!sample_store_iter_next(&dump_iter, &record)) {
+            dump_stop("done");
+            return;
+        }
+        snprintf(line, sizeof(line), "%lu;%lu.%06lu;%lu;%u;%u;%u;%u\r\n", dump_index,
+                 (uint32_t)(record.timestamp_us / 1000000), (uint32_t)(record.timestamp_us % 1000000),
+                 record.latency_us, record.channel, record.type, (record.flags & SAMPLE_FLAG_OUTLIER) ? 1 : 0,
+                 (record.flags & SAMPLE_FLAG_MOTION) ? 1 : 0);
+        vcp_writestr(line);
+        dump_index++;
+    }
+}
+
+// The samples recorded up to now, in order, with the types numbered as enum latency_type
+static void dump_start(void)
+{
+    sample_store_iter_init(&dump_iter);
+    dump_index = 0;
+    vcp_writestr("# session samples, type: 0 press, 1 audio, 2 release, 3 device, 4 photon\r\n");
+    vcp_writestr("index;time_s;latency_us;channel;type;outlier;motion\r\n");
+    dump_timer = lv_timer_create(dump_timer_callback, SESSION_DUMP_PERIOD, NULL);
+}
+
+static void analyze_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        session_table_update();
+    } else if (code == LV_EVENT_LONG_PRESSED) {
+        // Long press: dump every sample as CSV, or stop a running dump
+        if (dump_timer) {
+            dump_stop("stopped");
+        } else {
+            dump_start();
+        }
+    }
+}
+
+void gfx_session_create_page(lv_obj_t *previous_screen)
+{
+    session_prev_screen = previous_screen;
+    session_screen = lv_obj_create(NULL);
+    lv_scr_load(session_screen);
+
+    lv_obj_t *title_label = lv_label_create(session_screen);
+    lv_label_set_text(title_label, "Session samples (exact, in us)");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    usage_label = lv_label_create(session_screen);
+    lv_obj_align(usage_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    // Sliding windows of D12 press latency, compared with the whole session
+    lv_obj_t *windows_label = lv_label_create(session_screen);
+    lv_label_set_text(windows_label, "Windows (D12):");
+    lv_obj_align(windows_label, LV_ALIGN_TOP_LEFT, 10, 64);
+
+    window_samples_dropdown = lv_dropdown_create(session_screen);
+    lv_dropdown_set_options(window_samples_dropdown, WINDOW_SAMPLES_OPTIONS);
+    lv_obj_set_width(window_samples_dropdown, 120);
+    lv_obj_align(window_samples_dropdown, LV_ALIGN_TOP_LEFT, 140, 54);
+    lv_obj_add_event_cb(window_samples_dropdown, window_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    window_seconds_dropdown = lv_dropdown_create(session_screen);
+    lv_dropdown_set_options(window_seconds_dropdown, WINDOW_SECONDS_OPTIONS);
+    lv_obj_set_width(window_seconds_dropdown, 130);
+    lv_obj_align_to(window_seconds_dropdown, window_samples_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb(window_seconds_dropdown, window_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    for (size_t i = 0; i < sizeof(window_samples) / sizeof(window_samples[0]); i++) {
+        if (window_samples[i] == xlat_get_window_samples()) {
+            lv_dropdown_set_selected(window_samples_dropdown, i);
+        }
+    }
+    for (size_t i = 0; i < sizeof(window_seconds) / sizeof(window_seconds[0]); i++) {
+        if (window_seconds[i] == xlat_get_window_seconds()) {
+            lv_dropdown_set_selected(window_seconds_dropdown, i);
+        }
+    }
+
+    window_label = lv_label_create(session_screen);
+    lv_obj_align(window_label, LV_ALIGN_TOP_LEFT, 10, 92);
+
+    // Auto-trigger early stop, on the confidence interval of D12 press latency
+    lv_obj_t *stop_label = lv_label_create(session_screen);
+    lv_label_set_text(stop_label, "Trigger stop:");
+    lv_obj_align(stop_label, LV_ALIGN_TOP_LEFT, 10, 140);
+
+    stop_target_dropdown = lv_dropdown_create(session_screen);
+    lv_dropdown_set_options(stop_target_dropdown, STOP_TARGET_OPTIONS);
+    lv_obj_set_width(stop_target_dropdown, 120);
+    lv_obj_align(stop_target_dropdown, LV_ALIGN_TOP_LEFT, 140, 130);
+    lv_obj_add_event_cb(stop_target_dropdown, stop_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    stop_statistic_dropdown = lv_dropdown_create(session_screen);
+    lv_dropdown_set_options(stop_statistic_dropdown, STOP_STATISTIC_OPTIONS);
+    lv_obj_set_width(stop_statistic_dropdown, 130);
+    lv_obj_align_to(stop_statistic_dropdown, stop_target_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb(stop_statistic_dropdown, stop_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    const xlat_early_stop_t *stop = xlat_get_early_stop();
+    for (size_t i = 0; i < sizeof(stop_targets) / sizeof(stop_targets[0]); i++) {
+        if (stop_targets[i] == stop->target_us) {
+            lv_dropdown_set_selected(stop_target_dropdown, i);
+        }
+    }
+    for (size_t i = 0; i < sizeof(stop_statistics) / sizeof(stop_statistics[0]); i++) {
+        if ((stop_statistics[i].statistic == stop->statistic) && (stop_statistics[i].confidence_pct == stop->confidence_pct)) {
+            lv_dropdown_set_selected(stop_statistic_dropdown, i);
+        }
+    }
+
+    usage_label_update(NULL);
+    session_timer = lv_timer_create(usage_label_update, SESSION_USAGE_PERIOD, NULL);
+
+    // One row per channel and edge: count, min, median, P99, P99.9 and max
+    session_table = lv_table_create(session_screen);
+    lv_table_set_col_cnt(session_table, 7);
+    lv_table_set_col_width(session_table, 0, 100);
+    for (uint16_t col = 1; col < 7; col++) {
+        lv_table_set_col_width(session_table, col, 60);
+    }
+    lv_obj_set_style_pad_ver(session_table, 4, LV_PART_ITEMS);
+    lv_obj_set_style_pad_hor(session_table, 4, LV_PART_ITEMS);
+    lv_table_set_cell_value(session_table, 0, 0, "Input");
+    lv_table_set_cell_value(session_table, 0, 1, "#");
+    lv_table_set_cell_value(session_table, 0, 2, "Min");
+    lv_table_set_cell_value(session_table, 0, 3, "P50");
+    lv_table_set_cell_value(session_table, 0, 4, "P99");
+    lv_table_set_cell_value(session_table, 0, 5, "P99.9");
+    lv_table_set_cell_value(session_table, 0, 6, "Max");
+    lv_table_set_row_cnt(session_table, 1);
+    lv_obj_set_size(session_table, 460, 60);
+    lv_obj_align(session_table, LV_ALIGN_TOP_LEFT, 10, 170);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(session_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Analyze button, runs the selections over the whole session
+    lv_obj_t *btn_analyze = lv_btn_create(session_screen);
+    lv_obj_set_size(btn_analyze, 90, 30);
+    lv_obj_align_to(btn_analyze, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_analyze, analyze_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_add_event_cb(btn_analyze, analyze_btn_event_handler, LV_EVENT_LONG_PRESSED, NULL);
+    lv_obj_t *analyze_label = lv_label_create(btn_analyze);
+    lv_label_set_text(analyze_label, "ANALYZE");
+    lv_obj_center(analyze_label);
+
+    // Soak test button, long runs with decimated series and alarms
+    lv_obj_t *btn_soak = lv_btn_create(session_screen);
+    lv_obj_set_size(btn_soak, 80, 30);
+    lv_obj_align_to(btn_soak, btn_analyze, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_soak, soak_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *soak_label = lv_label_create(btn_soak);
+    lv_label_set_text(soak_label, "SOAK");
+    lv_obj_center(soak_label);
+
+    // Phase sweep button, clicks timed from the USB SOF
+    lv_obj_t *btn_sweep = lv_btn_create(session_screen);
+    lv_obj_set_size(btn_sweep, 80, 30);
+    lv_obj_align_to(btn_sweep, btn_soak, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_sweep, sweep_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *sweep_label = lv_label_create(btn_sweep);
+    lv_label_set_text(sweep_label, "SWEEP");
+    lv_obj_center(sweep_label);
+
+    // Pattern generator button, timed multi-key stimulus
+    lv_obj_t *btn_pattern = lv_btn_create(session_screen);
+    lv_obj_set_size(btn_pattern, 90, 30);
+    lv_obj_align_to(btn_pattern, btn_sweep, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_pattern, pattern_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *pattern_label = lv_label_create(btn_pattern);
+    lv_label_set_text(pattern_label, "PATTERN");
+    lv_obj_center(pattern_label);
+}
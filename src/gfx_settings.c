@@ -17,6 +17,10 @@
 
 #include <stdio.h>
 #include "gfx_settings.h"
+#include "gfx_usage_picker.h"
+#include "gfx_channels.h"
+#include "gfx_idle.h"
+#include "gfx_session.h"
 #include "lvgl/lvgl.h"
 #include "xlat.h"
 #include "hardware_config.h"
@@ -27,10 +31,21 @@ lv_dropdown_t *edge_dropdown;
 lv_slider_t *debounce_dropdown;
 lv_dropdown_t *trigger_dropdown;
 lv_dropdown_t *detection_dropdown;
+lv_dropdown_t *release_dropdown;
+lv_dropdown_t *outlier_dropdown;
+lv_dropdown_t *polling_dropdown;
+lv_dropdown_t *motion_threshold_dropdown;
+lv_dropdown_t *motion_direction_dropdown;
 lv_obj_t *prev_screen = NULL; // Pointer to store previous screen
 
 LV_IMG_DECLARE(xlat_logo);
 
+// Motion onset threshold choices, in counts
+static const uint32_t motion_thresholds[] = { 1, 2, 3, 5, 10, 20, 50 };
+
+// Outlier sensitivity choices, in scaled MADs (0 = keep all samples)
+static const uint32_t outlier_sensitivities[] = { 0, 3, 5, 8, 12 };
+
 // Event handler for the back button
 static void back_btn_event_handler(lv_event_t* e)
 {
@@ -43,6 +58,42 @@ static void back_btn_event_handler(lv_event_t* e)
     }
 }
 
+// Event handler for the usage picker button
+static void usages_btn_event_handler(lv_event_t* e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_usage_picker_create_page(settings_screen);
+    }
+}
+
+// Event handler for the input channels button
+static void channels_btn_event_handler(lv_event_t* e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_channels_create_page(settings_screen);
+    }
+}
+
+// Event handler for the wake-from-idle button
+static void idle_btn_event_handler(lv_event_t* e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_idle_create_page(settings_screen);
+    }
+}
+
+// Event handler for the session samples button
+static void session_btn_event_handler(lv_event_t* e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        gfx_session_create_page(settings_screen);
+    }
+}
+
 static void event_handler(lv_event_t* e)
 {
     lv_event_code_t code = lv_event_get_code(e);
@@ -52,7 +103,7 @@ static void event_handler(lv_event_t* e)
         if (obj == (lv_obj_t *)edge_dropdown) {
             // Detection edge changed
             uint16_t sel = lv_dropdown_get_selected(obj);
-            hw_config_input_trigger(sel);
+            hw_config_input_trigger(0, sel);
         } else if (obj == (lv_obj_t *)debounce_dropdown) {
             // Hold-off time changed
             uint16_t sel = lv_dropdown_get_selected(obj);
@@ -79,10 +130,11 @@ static void event_handler(lv_event_t* e)
                     val = 1000;
                     break;
                 default:
-                    break;
+                    // Measured by the bounce capture, keep it
+                    return;
             }
             // Set hold-off time to "value"
-            xlat_set_gpio_irq_holdoff_us(val * 1000);
+            xlat_set_gpio_irq_holdoff_us(0, val * 1000);
         }
         else if (obj == (lv_obj_t *)trigger_dropdown) {
             // Auto-trigger level changed
@@ -100,6 +152,35 @@ static void event_handler(lv_event_t* e)
                 xlat_set_mode(XLAT_MODE_MOTION);
             }
         }
+        else if (obj == (lv_obj_t *)motion_threshold_dropdown) {
+            // Motion onset threshold changed
+            uint16_t sel = lv_dropdown_get_selected(obj);
+            if (sel < sizeof(motion_thresholds) / sizeof(motion_thresholds[0])) {
+                xlat_set_motion_threshold(motion_thresholds[sel]);
+            }
+        }
+        else if (obj == (lv_obj_t *)motion_direction_dropdown) {
+            // Motion direction filter changed, the options follow enum motion_direction
+            uint16_t sel = lv_dropdown_get_selected(obj);
+            xlat_set_motion_direction(sel);
+        }
+        else if (obj == (lv_obj_t *)release_dropdown) {
+            // Release edge capture changed
+            uint16_t sel = lv_dropdown_get_selected(obj);
+            hw_config_input_both_edges(sel);
+        }
+        else if (obj == (lv_obj_t *)polling_dropdown) {
+            // USB polling changed, the options follow enum xlat_usb_polling
+            uint16_t sel = lv_dropdown_get_selected(obj);
+            xlat_set_usb_polling(sel);
+        }
+        else if (obj == (lv_obj_t *)outlier_dropdown) {
+            // Outlier sensitivity changed
+            uint16_t sel = lv_dropdown_get_selected(obj);
+            if (sel < sizeof(outlier_sensitivities) / sizeof(outlier_sensitivities[0])) {
+                xlat_set_outlier_sensitivity(outlier_sensitivities[sel]);
+            }
+        }
         else {
             printf("Unknown event\n");
         }
@@ -156,6 +237,15 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
     lv_dropdown_set_options((lv_obj_t *) detection_dropdown, "Click\nMotion");
     lv_obj_add_event_cb((struct _lv_obj_t *) detection_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
 
+    // Release edge label & dropdown
+    lv_obj_t *release_label = lv_label_create(settings_screen);
+    lv_label_set_text(release_label, "Release Edge:");
+    lv_obj_align_to(release_label, detection_mode, LV_ALIGN_OUT_BOTTOM_LEFT, 0, 30);
+
+    release_dropdown = (lv_dropdown_t *) lv_dropdown_create(settings_screen);
+    lv_dropdown_set_options((lv_obj_t *) release_dropdown, "Ignore\nMeasure");
+    lv_obj_add_event_cb((struct _lv_obj_t *) release_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
     // If we don't add this label, the y-value of the last item will be 0
     lv_obj_t *debounce_label2 = lv_label_create(settings_screen);
     lv_label_set_text(debounce_label2, "");
@@ -174,6 +264,34 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
     lv_obj_align((struct _lv_obj_t *) trigger_dropdown, LV_ALIGN_DEFAULT, max_width + widget_gap, lv_obj_get_y(trigger_label) - 10);
     lv_obj_align((struct _lv_obj_t *) detection_dropdown, LV_ALIGN_DEFAULT, max_width + widget_gap, lv_obj_get_y(detection_mode) - 10);
 
+    // USB polling, next to the detection edge
+    polling_dropdown = (lv_dropdown_t *) lv_dropdown_create(settings_screen);
+    lv_dropdown_set_options((lv_obj_t *) polling_dropdown, "Poll: back-to-back\nPoll: bInterval");
+    lv_obj_set_width((lv_obj_t *) polling_dropdown, 165);
+    lv_obj_align_to((lv_obj_t *) polling_dropdown, (lv_obj_t *) edge_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb((struct _lv_obj_t *) polling_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    // Motion onset threshold and direction, next to the detection mode
+    motion_threshold_dropdown = (lv_dropdown_t *) lv_dropdown_create(settings_screen);
+    lv_dropdown_set_options((lv_obj_t *) motion_threshold_dropdown, "1 cnt\n2 cnt\n3 cnt\n5 cnt\n10 cnt\n20 cnt\n50 cnt");
+    lv_obj_set_width((lv_obj_t *) motion_threshold_dropdown, 85);
+    lv_obj_align_to((lv_obj_t *) motion_threshold_dropdown, (lv_obj_t *) detection_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb((struct _lv_obj_t *) motion_threshold_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    motion_direction_dropdown = (lv_dropdown_t *) lv_dropdown_create(settings_screen);
+    lv_dropdown_set_options((lv_obj_t *) motion_direction_dropdown, "Any\n+X\n-X\n+Y\n-Y");
+    lv_obj_set_width((lv_obj_t *) motion_direction_dropdown, 70);
+    lv_obj_align_to((lv_obj_t *) motion_direction_dropdown, (lv_obj_t *) motion_threshold_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb((struct _lv_obj_t *) motion_direction_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+    lv_obj_align((struct _lv_obj_t *) release_dropdown, LV_ALIGN_DEFAULT, max_width + widget_gap, lv_obj_get_y(release_label) - 10);
+
+    // Outlier sensitivity, next to the release edge
+    outlier_dropdown = (lv_dropdown_t *) lv_dropdown_create(settings_screen);
+    lv_dropdown_set_options((lv_obj_t *) outlier_dropdown, "Outliers: keep\nOutliers: 3 MAD\nOutliers: 5 MAD\nOutliers: 8 MAD\nOutliers: 12 MAD");
+    lv_obj_set_width((lv_obj_t *) outlier_dropdown, 165);
+    lv_obj_align_to((lv_obj_t *) outlier_dropdown, (lv_obj_t *) release_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb((struct _lv_obj_t *) outlier_dropdown, event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
     // Print all y-values for debugging
     //printf("edge_label y: %d\n", lv_obj_get_y(edge_label));
     //printf("debounce_label y: %d\n", lv_obj_get_y(debounce_label));
@@ -188,6 +306,42 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
     lv_label_set_text(back_label, "BACK");
     lv_obj_center(back_label);
 
+    // Usage picker button, to select the trigger source from the HID report descriptor
+    lv_obj_t *btn_usages = lv_btn_create(settings_screen);
+    lv_obj_set_size(btn_usages, 80, 30);
+    lv_obj_align_to(btn_usages, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_usages, usages_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *usages_label = lv_label_create(btn_usages);
+    lv_label_set_text(usages_label, "USAGES");
+    lv_obj_center(usages_label);
+
+    // Input channels button, to configure and compare the extra GPIO inputs
+    lv_obj_t *btn_channels = lv_btn_create(settings_screen);
+    lv_obj_set_size(btn_channels, 90, 30);
+    lv_obj_align_to(btn_channels, btn_usages, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_channels, channels_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *channels_label = lv_label_create(btn_channels);
+    lv_label_set_text(channels_label, "CHANNELS");
+    lv_obj_center(channels_label);
+
+    // Wake-from-idle button, latency split by idle time
+    lv_obj_t *btn_idle = lv_btn_create(settings_screen);
+    lv_obj_set_size(btn_idle, 80, 30);
+    lv_obj_align_to(btn_idle, btn_channels, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_idle, idle_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *idle_label = lv_label_create(btn_idle);
+    lv_label_set_text(idle_label, "IDLE");
+    lv_obj_center(idle_label);
+
+    // Session button, exact statistics over all raw samples
+    lv_obj_t *btn_session = lv_btn_create(settings_screen);
+    lv_obj_set_size(btn_session, 90, 30);
+    lv_obj_align_to(btn_session, btn_idle, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_session, session_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *session_label = lv_label_create(btn_session);
+    lv_label_set_text(session_label, "SESSION");
+    lv_obj_center(session_label);
+
     // Version number label in the top right
     lv_obj_t *version_label = lv_label_create(settings_screen);
     // Get the version number from APP_VERSION_* defines
@@ -198,7 +352,8 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
 
 
     // Display current settings
-    uint32_t debounce_time = xlat_get_gpio_irq_holdoff_us() / 1000;
+    uint32_t debounce_us = xlat_get_gpio_irq_holdoff_us(0);
+    uint32_t debounce_time = (debounce_us % 1000) ? 0 : debounce_us / 1000;
     uint16_t debounce_index = 0;
     switch (debounce_time) {
         case 20:
@@ -216,8 +371,14 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
         case 1000:
             debounce_index = 4;
             break;
-        default:
+        default: {
+            // Not one of the presets, set by the bounce capture
+            char measured[32];
+            snprintf(measured, sizeof(measured), "%lu.%lums (measured)", debounce_us / 1000, (debounce_us % 1000) / 100);
+            lv_dropdown_add_option((lv_obj_t *) debounce_dropdown, measured, LV_DROPDOWN_POS_LAST);
+            debounce_index = 5;
             break;
+        }
     }
     lv_dropdown_set_selected((lv_obj_t *) debounce_dropdown, debounce_index);
 
@@ -226,10 +387,31 @@ void gfx_settings_create_page(lv_obj_t *previous_screen)
 
 
     // Display current detection edge
-    lv_dropdown_set_selected((lv_obj_t *) edge_dropdown, hw_config_input_trigger_is_rising_edge());
+    lv_dropdown_set_selected((lv_obj_t *) edge_dropdown, hw_config_input_trigger_is_rising_edge(0));
 
     // Display current auto-trigger level
     lv_dropdown_set_selected((lv_obj_t *) trigger_dropdown, xlat_auto_trigger_level_is_high());
 
+    // Display current motion onset settings
+    for (size_t i = 0; i < sizeof(motion_thresholds) / sizeof(motion_thresholds[0]); i++) {
+        if (motion_thresholds[i] == xlat_get_motion_threshold()) {
+            lv_dropdown_set_selected((lv_obj_t *) motion_threshold_dropdown, i);
+        }
+    }
+    lv_dropdown_set_selected((lv_obj_t *) motion_direction_dropdown, xlat_get_motion_direction());
+
+    // Display current release edge setting
+    lv_dropdown_set_selected((lv_obj_t *) release_dropdown, hw_config_input_both_edges_is_enabled());
+
+    // Display current USB polling
+    lv_dropdown_set_selected((lv_obj_t *) polling_dropdown, xlat_get_usb_polling());
+
+    // Display current outlier sensitivity
+    for (size_t i = 0; i < sizeof(outlier_sensitivities) / sizeof(outlier_sensitivities[0]); i++) {
+        if (outlier_sensitivities[i] == xlat_get_outlier_sensitivity()) {
+            lv_dropdown_set_selected((lv_obj_t *) outlier_dropdown, i);
+        }
+    }
+
 }
 
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "gfx_soak.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+#include "soak.h"
+
+#define SOAK_PAGE_PERIOD        (1000) // ms
+#define SOAK_CHART_POINTS       (60)
+#define SOAK_EVENT_LINES        (3)
+
+static lv_obj_t *soak_screen = NULL;
+static lv_obj_t *soak_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *events_label;
+static lv_obj_t *rate_dropdown;
+static lv_obj_t *drift_dropdown;
+static lv_obj_t *level_dropdown;
+static lv_obj_t *soak_chart;
+static lv_obj_t *start_label;
+static lv_chart_series_t *mean_series;
+static lv_chart_series_t *p99_series;
+static lv_chart_series_t *max_series;
+static lv_timer_t *page_timer = NULL;
+
+// The trigger timer outlives the page, the run goes on while other pages are shown
+static lv_timer_t *soak_trigger_timer = NULL;
+static uint32_t soak_period_ms = 1000;
+
+// Trigger rate and drift alarm choices
+static const uint32_t rate_periods_ms[] = { 2000, 1000, 500, 200 };
+#define RATE_OPTIONS "0.5 clicks/s\n1 click/s\n2 clicks/s\n5 clicks/s"
+static const uint32_t drift_pcts[] = { 5, 10, 20, 50 };
+#define DRIFT_OPTIONS "Drift 5%\nDrift 10%\nDrift 20%\nDrift 50%"
+#define LEVEL_OPTIONS "Minutes\nHours\nDays"
+
+static void soak_trigger_callback(lv_timer_t *timer)
+{
+    uint32_t now_ms = lv_tick_get();
+
+    xlat_auto_trigger_action();
+    soak_trigger(now_ms);
+    soak_tick(now_ms);
+
+    // A little randomness, so the clicks do not lock to the device's own scan or poll grid
+    lv_timer_set_period(timer, soak_period_ms + (rand() % 10));
+}
+
+static void format_offset(char *buf, size_t size, uint32_t offset_ms)
+{
+    uint32_t s = offset_ms / 1000;
+    snprintf(buf, size, "%02lu:%02lu:%02lu", s / 3600, (s / 60) % 60, s % 60);
+}
+
+static void chart_update(void)
+{
+    soak_level_t level = (soak_level_t)lv_dropdown_get_selected(level_dropdown);
+    size_t count = soak_series_count(level);
+    size_t first = (count > SOAK_CHART_POINTS) ? (count - SOAK_CHART_POINTS) : 0;
+    uint32_t top_us = 1000;
+
+    lv_chart_set_all_value(soak_chart, mean_series, LV_CHART_POINT_NONE);
+    lv_chart_set_all_value(soak_chart, p99_series, LV_CHART_POINT_NONE);
+    lv_chart_set_all_value(soak_chart, max_series, LV_CHART_POINT_NONE);
+
+    // The newest points, left aligned, periods without reports stay empty
+    for (size_t i = first; i < count; i++) {
+        soak_point_t point;
+        if (!soak_series_get(level, i, &point) || (point.count == 0)) {
+            continue;
+        }
+        uint32_t max_us = (point.max_us > INT16_MAX) ? INT16_MAX : point.max_us;
+        mean_series->y_points[i - first] = (lv_coord_t)((point.mean_us > INT16_MAX) ? INT16_MAX : point.mean_us);
+        p99_series->y_points[i - first] = (lv_coord_t)((point.p99_us > INT16_MAX) ? INT16_MAX : point.p99_us);
+        max_series->y_points[i - first] = (lv_coord_t)max_us;
+        top_us = (max_us > top_us) ? max_us : top_us;
+    }
+
+    lv_chart_set_range(soak_chart, LV_CHART_AXIS_PRIMARY_Y, 0, (lv_coord_t)((top_us + 999) / 1000 * 1000));
+    lv_chart_refresh(soak_chart);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    char elapsed[16];
+    char text[160];
+    size_t len = 0;
+    (void)timer;
+
+    format_offset(elapsed, sizeof(elapsed), soak_elapsed_ms(lv_tick_get()));
+    lv_label_set_text_fmt(status_label, "%s %s, %lu reports, %lu events",
+                          soak_is_running() ? "Running" : "Stopped", elapsed,
+                          soak_sample_count(), (uint32_t)soak_event_count());
+    lv_label_set_text(start_label, soak_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    // Latest events, newest first
+    size_t events = soak_event_count();
+    for (size_t i = 0; (i < SOAK_EVENT_LINES) && (i < events); i++) {
+        soak_event_t event;
+        char offset[16];
+        soak_event_get(events - 1 - i, &event);
+        format_offset(offset, sizeof(offset), event.offset_ms);
+        len += snprintf(text + len, sizeof(text) - len, "%s%s %s %lu", i ? "\n" : "", offset,
+                        soak_event_name(event.type), event.value);
+    }
+    lv_label_set_text(events_label, len ? text : "No events");
+
+    chart_update();
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (soak_is_running()) {
+        lv_timer_del(soak_trigger_timer);
+        soak_trigger_timer = NULL;
+        soak_stop(lv_tick_get());
+    } else {
+        uint16_t rate = lv_dropdown_get_selected(rate_dropdown);
+        uint16_t drift = lv_dropdown_get_selected(drift_dropdown);
+        if (rate < sizeof(rate_periods_ms) / sizeof(rate_periods_ms[0])) {
+            soak_period_ms = rate_periods_ms[rate];
+        }
+        soak_start(lv_tick_get(), (drift < sizeof(drift_pcts) / sizeof(drift_pcts[0])) ? drift_pcts[drift] : 0);
+        srand(xlat_counter_1mhz_get());
+        soak_trigger_timer = lv_timer_create(soak_trigger_callback, soak_period_ms, NULL);
+    }
+    page_update(NULL);
+}
+
+static void level_event_handler(lv_event_t *e)
+{
+    (void)e;
+    chart_update();
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (soak_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(soak_prev_screen);
+            lv_obj_del(soak_screen);
+            soak_screen = NULL;
+        }
+    }
+}
+
+void gfx_soak_create_page(lv_obj_t *previous_screen)
+{
+    soak_prev_screen = previous_screen;
+    soak_screen = lv_obj_create(NULL);
+    lv_scr_load(soak_screen);
+
+    lv_obj_t *title_label = lv_label_create(soak_screen);
+    lv_label_set_text(title_label, "Soak test (D12)");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(soak_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    rate_dropdown = lv_dropdown_create(soak_screen);
+    lv_dropdown_set_options(rate_dropdown, RATE_OPTIONS);
+    lv_obj_set_width(rate_dropdown, 140);
+    lv_obj_align(rate_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+    for (size_t i = 0; i < sizeof(rate_periods_ms) / sizeof(rate_periods_ms[0]); i++) {
+        if (rate_periods_ms[i] == soak_period_ms) {
+            lv_dropdown_set_selected(rate_dropdown, i);
+        }
+    }
+
+    drift_dropdown = lv_dropdown_create(soak_screen);
+    lv_dropdown_set_options(drift_dropdown, DRIFT_OPTIONS);
+    lv_obj_set_width(drift_dropdown, 130);
+    lv_obj_align_to(drift_dropdown, rate_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(drift_dropdown, 1);
+
+    level_dropdown = lv_dropdown_create(soak_screen);
+    lv_dropdown_set_options(level_dropdown, LEVEL_OPTIONS);
+    lv_obj_set_width(level_dropdown, 120);
+    lv_obj_align_to(level_dropdown, drift_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_obj_add_event_cb(level_dropdown, level_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    // Mean, P99 and max of the last points of the selected level
+    soak_chart = lv_chart_create(soak_screen);
+    lv_obj_set_size(soak_chart, 400, 80);
+    lv_obj_align(soak_chart, LV_ALIGN_TOP_LEFT, 70, 100);
+    lv_chart_set_point_count(soak_chart, SOAK_CHART_POINTS);
+    lv_obj_set_style_size(soak_chart, 0, LV_PART_INDICATOR);
+    lv_chart_set_axis_tick(soak_chart, LV_CHART_AXIS_PRIMARY_Y, 10, 5, 3, 2, true, 60);
+    mean_series = lv_chart_add_series(soak_chart, lv_palette_main(LV_PALETTE_LIGHT_BLUE), LV_CHART_AXIS_PRIMARY_Y);
+    p99_series = lv_chart_add_series(soak_chart, lv_palette_main(LV_PALETTE_ORANGE), LV_CHART_AXIS_PRIMARY_Y);
+    max_series = lv_chart_add_series(soak_chart, lv_palette_main(LV_PALETTE_RED), LV_CHART_AXIS_PRIMARY_Y);
+
+    events_label = lv_label_create(soak_screen);
+    lv_obj_align(events_label, LV_ALIGN_TOP_LEFT, 10, 186);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(soak_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the run keeps going after BACK
+    lv_obj_t *btn_start = lv_btn_create(soak_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, SOAK_PAGE_PERIOD, NULL);
+}
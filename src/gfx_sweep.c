@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "gfx_sweep.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+#include "phase_sweep.h"
+
+#define SWEEP_TICK_PERIOD       (2)   // ms
+#define SWEEP_PAGE_PERIOD       (500) // ms
+
+static lv_obj_t *sweep_screen = NULL;
+static lv_obj_t *sweep_prev_screen = NULL;
+static lv_obj_t *status_label;
+static lv_obj_t *result_label;
+static lv_obj_t *steps_dropdown;
+static lv_obj_t *passes_dropdown;
+static lv_obj_t *sweep_chart;
+static lv_obj_t *start_label;
+static lv_chart_series_t *min_series;
+static lv_chart_series_t *mean_series;
+static lv_chart_series_t *max_series;
+static lv_timer_t *page_timer = NULL;
+
+// The tick timer outlives the page, so the sweep goes on while other pages are shown
+static lv_timer_t *sweep_tick_timer = NULL;
+
+static const uint32_t step_options[] = { 16, 32, 64 };
+#define STEPS_OPTIONS "16 steps\n32 steps\n64 steps"
+static const uint32_t pass_options[] = { 1, 2, 4, 8 };
+#define PASSES_OPTIONS "1 pass\n2 passes\n4 passes\n8 passes"
+
+static void sweep_tick_callback(lv_timer_t *timer)
+{
+    phase_sweep_tick(lv_tick_get());
+
+    // Finished on its own
+    if (!phase_sweep_is_running()) {
+        lv_timer_del(timer);
+        sweep_tick_timer = NULL;
+    }
+}
+
+static void chart_update(void)
+{
+    uint32_t count = phase_sweep_step_count();
+    uint32_t top_us = 1000;
+    const phase_sweep_step_t *best = NULL;
+    const phase_sweep_step_t *worst = NULL;
+
+    lv_chart_set_point_count(sweep_chart, count ? count : 1);
+    lv_chart_set_all_value(sweep_chart, min_series, LV_CHART_POINT_NONE);
+    lv_chart_set_all_value(sweep_chart, mean_series, LV_CHART_POINT_NONE);
+    lv_chart_set_all_value(sweep_chart, max_series, LV_CHART_POINT_NONE);
+
+    for (size_t i = 0; i < count; i++) {
+        const phase_sweep_step_t *step = phase_sweep_get_step(i);
+        if (step->count == 0) {
+            continue;
+        }
+        uint32_t mean_us = (uint32_t)(step->sum_us / step->count);
+        uint32_t max_us = (step->max_us > INT16_MAX) ? INT16_MAX : step->max_us;
+        min_series->y_points[i] = (lv_coord_t)((step->min_us > INT16_MAX) ? INT16_MAX : step->min_us);
+        mean_series->y_points[i] = (lv_coord_t)((mean_us > INT16_MAX) ? INT16_MAX : mean_us);
+        max_series->y_points[i] = (lv_coord_t)max_us;
+        top_us = (max_us > top_us) ? max_us : top_us;
+
+        // Best and worst phase by their mean latency
+        if ((best == NULL) || (step->sum_us * best->count < best->sum_us * step->count)) {
+            best = step;
+        }
+        if ((worst == NULL) || (step->sum_us * worst->count > worst->sum_us * step->count)) {
+            worst = step;
+        }
+    }
+
+    lv_chart_set_range(sweep_chart, LV_CHART_AXIS_PRIMARY_Y, 0, (lv_coord_t)((top_us + 999) / 1000 * 1000));
+    lv_chart_refresh(sweep_chart);
+
+    if (best == NULL) {
+        lv_label_set_text(result_label, "No results yet");
+        return;
+    }
+    uint32_t best_us = (uint32_t)(best->sum_us / best->count);
+    uint32_t worst_us = (uint32_t)(worst->sum_us / worst->count);
+    lv_label_set_text_fmt(result_label, "Best %luus at +%luus, worst %luus at +%luus, span %luus",
+                          best_us, best->offset_us, worst_us, worst->offset_us, worst_us - best_us);
+}
+
+static void page_update(lv_timer_t *timer)
+{
+    (void)timer;
+
+    lv_label_set_text_fmt(status_label, "%s, poll period %luus (%s), %lu of %lu clicks",
+                          phase_sweep_is_running() ? "Running" : "Stopped", xlat_get_usb_poll_period_us(),
+                          (xlat_get_usb_polling() == XLAT_POLLING_INTERVAL) ? "bInterval" : "back-to-back",
+                          phase_sweep_clicks(), phase_sweep_clicks_total());
+    lv_label_set_text(start_label, phase_sweep_is_running() ? "STOP" : "START");
+    lv_obj_center(start_label);
+
+    chart_update();
+}
+
+static void start_btn_event_handler(lv_event_t *e)
+{
+    if (lv_event_get_code(e) != LV_EVENT_CLICKED) {
+        return;
+    }
+
+    if (phase_sweep_is_running()) {
+        phase_sweep_stop();
+        if (sweep_tick_timer) {
+            lv_timer_del(sweep_tick_timer);
+            sweep_tick_timer = NULL;
+        }
+    } else {
+        uint16_t steps = lv_dropdown_get_selected(steps_dropdown);
+        uint16_t passes = lv_dropdown_get_selected(passes_dropdown);
+        srand(xlat_counter_1mhz_get());
+        phase_sweep_start(xlat_get_usb_poll_period_us(),
+                          (steps < sizeof(step_options) / sizeof(step_options[0])) ? step_options[steps] : PHASE_SWEEP_STEPS_MAX,
+                          (passes < sizeof(pass_options) / sizeof(pass_options[0])) ? pass_options[passes] : 1);
+        if (sweep_tick_timer == NULL) {
+            sweep_tick_timer = lv_timer_create(sweep_tick_callback, SWEEP_TICK_PERIOD, NULL);
+        }
+    }
+    page_update(NULL);
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (sweep_prev_screen) {
+            lv_timer_del(page_timer);
+            page_timer = NULL;
+            lv_scr_load(sweep_prev_screen);
+            lv_obj_del(sweep_screen);
+            sweep_screen = NULL;
+        }
+    }
+}
+
+void gfx_sweep_create_page(lv_obj_t *previous_screen)
+{
+    sweep_prev_screen = previous_screen;
+    sweep_screen = lv_obj_create(NULL);
+    lv_scr_load(sweep_screen);
+
+    lv_obj_t *title_label = lv_label_create(sweep_screen);
+    lv_label_set_text(title_label, "Phase sweep (D12), latency vs. click offset after SOF");
+    lv_obj_align(title_label, LV_ALIGN_TOP_LEFT, 10, 10);
+
+    status_label = lv_label_create(sweep_screen);
+    lv_obj_align(status_label, LV_ALIGN_TOP_LEFT, 10, 32);
+
+    steps_dropdown = lv_dropdown_create(sweep_screen);
+    lv_dropdown_set_options(steps_dropdown, STEPS_OPTIONS);
+    lv_obj_set_width(steps_dropdown, 120);
+    lv_obj_align(steps_dropdown, LV_ALIGN_TOP_LEFT, 10, 54);
+    lv_dropdown_set_selected(steps_dropdown, 2);
+
+    passes_dropdown = lv_dropdown_create(sweep_screen);
+    lv_dropdown_set_options(passes_dropdown, PASSES_OPTIONS);
+    lv_obj_set_width(passes_dropdown, 120);
+    lv_obj_align_to(passes_dropdown, steps_dropdown, LV_ALIGN_OUT_RIGHT_MID, 10, 0);
+    lv_dropdown_set_selected(passes_dropdown, 2);
+
+    // Min, mean and max latency of every step, from offset 0 on the left to the end of the period
+    sweep_chart = lv_chart_create(sweep_screen);
+    lv_obj_set_size(sweep_chart, 400, 90);
+    lv_obj_align(sweep_chart, LV_ALIGN_TOP_LEFT, 70, 100);
+    lv_obj_set_style_size(sweep_chart, 0, LV_PART_INDICATOR);
+    lv_chart_set_axis_tick(sweep_chart, LV_CHART_AXIS_PRIMARY_Y, 10, 5, 3, 2, true, 60);
+    min_series = lv_chart_add_series(sweep_chart, lv_palette_main(LV_PALETTE_GREEN), LV_CHART_AXIS_PRIMARY_Y);
+    mean_series = lv_chart_add_series(sweep_chart, lv_palette_main(LV_PALETTE_LIGHT_BLUE), LV_CHART_AXIS_PRIMARY_Y);
+    max_series = lv_chart_add_series(sweep_chart, lv_palette_main(LV_PALETTE_RED), LV_CHART_AXIS_PRIMARY_Y);
+
+    result_label = lv_label_create(sweep_screen);
+    lv_obj_align(result_label, LV_ALIGN_TOP_LEFT, 10, 198);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(sweep_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+
+    // Start/stop button, the curve is also printed to the console at the end
+    lv_obj_t *btn_start = lv_btn_create(sweep_screen);
+    lv_obj_set_size(btn_start, 90, 30);
+    lv_obj_align_to(btn_start, btn_back, LV_ALIGN_OUT_RIGHT_TOP, 10, 0);
+    lv_obj_add_event_cb(btn_start, start_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    start_label = lv_label_create(btn_start);
+
+    page_update(NULL);
+    page_timer = lv_timer_create(page_update, SWEEP_PAGE_PERIOD, NULL);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "gfx_usage_picker.h"
+#include "gfx_main.h"
+#include "lvgl/lvgl.h"
+#include "xlat.h"
+
+// Table row 0 is the header, row 1 is the "all buttons" default, items start at row 2
+#define PICKER_FIRST_ITEM_ROW (2)
+
+static lv_obj_t *picker_screen;
+static lv_obj_t *picker_prev_screen = NULL;
+static lv_obj_t *picker_table;
+static lv_obj_t *selected_label;
+
+static void selected_label_update(void)
+{
+    char name[24];
+    int index = xlat_get_trigger_item();
+    const hid_input_item_t *item = (index >= 0) ? xlat_get_hid_item(index) : NULL;
+
+    if (item) {
+        lv_label_set_text_fmt(selected_label, "Trigger source: %s",
+                              xlat_get_hid_usage_name(item->usage_page, item->usage, name, sizeof(name)));
+    } else {
+        lv_label_set_text(selected_label, "Trigger source: All buttons");
+    }
+}
+
+static void back_btn_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_CLICKED) {
+        if (picker_prev_screen) {
+            lv_scr_load(picker_prev_screen);
+            lv_obj_del(picker_screen);
+        }
+    }
+}
+
+static void table_event_handler(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_VALUE_CHANGED) {
+        uint16_t row, col;
+        lv_table_get_selected_cell(picker_table, &row, &col);
+        if ((row == LV_TABLE_CELL_NONE) || (row == 0)) {
+            return;
+        }
+
+        // Row 1 maps to -1 (all buttons), the items follow
+        xlat_set_trigger_item((int)row - PICKER_FIRST_ITEM_ROW);
+        selected_label_update();
+        gfx_set_byte_offsets_text();
+    }
+}
+
+void gfx_usage_picker_create_page(lv_obj_t *previous_screen)
+{
+    picker_prev_screen = previous_screen;
+    picker_screen = lv_obj_create(NULL);
+    lv_scr_load(picker_screen);
+
+    selected_label = lv_label_create(picker_screen);
+    lv_obj_align(selected_label, LV_ALIGN_TOP_LEFT, 10, 10);
+    selected_label_update();
+
+    // One row per Input item: usage, reportId, bit position and size
+    size_t count = xlat_get_hid_item_count();
+    picker_table = lv_table_create(picker_screen);
+    lv_table_set_col_cnt(picker_table, 4);
+    lv_table_set_row_cnt(picker_table, count + PICKER_FIRST_ITEM_ROW);
+    lv_table_set_col_width(picker_table, 0, 190);
+    lv_table_set_col_width(picker_table, 1, 70);
+    lv_table_set_col_width(picker_table, 2, 70);
+    lv_table_set_col_width(picker_table, 3, 70);
+    lv_obj_set_style_pad_ver(picker_table, 4, LV_PART_ITEMS);
+
+    lv_table_set_cell_value(picker_table, 0, 0, "Usage");
+    lv_table_set_cell_value(picker_table, 0, 1, "ID");
+    lv_table_set_cell_value(picker_table, 0, 2, "Bit");
+    lv_table_set_cell_value(picker_table, 0, 3, "Size");
+    lv_table_set_cell_value(picker_table, 1, 0, "All buttons");
+
+    for (size_t i = 0; i < count; i++) {
+        char name[24];
+        const hid_input_item_t *item = xlat_get_hid_item(i);
+        uint16_t row = i + PICKER_FIRST_ITEM_ROW;
+
+        lv_table_set_cell_value(picker_table, row, 0,
+                                xlat_get_hid_usage_name(item->usage_page, item->usage, name, sizeof(name)));
+        lv_table_set_cell_value_fmt(picker_table, row, 1, "%u", item->report_id);
+        lv_table_set_cell_value_fmt(picker_table, row, 2, "%u", item->bit_index);
+        lv_table_set_cell_value_fmt(picker_table, row, 3, "%u", item->bit_size);
+    }
+
+    lv_obj_set_size(picker_table, 460, 180);
+    lv_obj_align_to(picker_table, selected_label, LV_ALIGN_OUT_BOTTOM_LEFT, 0, 10);
+    lv_obj_add_event_cb(picker_table, table_event_handler, LV_EVENT_VALUE_CHANGED, NULL);
+
+    // Back button
+    lv_obj_t *btn_back = lv_btn_create(picker_screen);
+    lv_obj_set_size(btn_back, 80, 30);
+    lv_obj_align(btn_back, LV_ALIGN_BOTTOM_LEFT, 10, -10);
+    lv_obj_add_event_cb(btn_back, back_btn_event_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *back_label = lv_label_create(btn_back);
+    lv_label_set_text(back_label, "BACK");
+    lv_obj_center(back_label);
+}
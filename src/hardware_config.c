@@ -22,13 +22,20 @@
 #include "xlat.h"
 #include "hardware_config.h"
 
+ADC_HandleTypeDef hadc2;
+DMA_HandleTypeDef hdma_adc2;
 CRC_HandleTypeDef hcrc;
 DMA2D_HandleTypeDef hdma2d;
 LTDC_HandleTypeDef hltdc;
 RTC_HandleTypeDef hrtc;
 
 TIM_HandleTypeDef htim1;
+DMA_HandleTypeDef hdma_tim1_up;
+DMA_HandleTypeDef hdma_tim2_ch1;
 TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim8;
+DMA_HandleTypeDef hdma_tim8_up;
+DMA_HandleTypeDef hdma_tim8_ch1;
 
 UART_HandleTypeDef huart1;
 UART_HandleTypeDef huart6;
@@ -37,15 +44,56 @@ UART_HandleTypeDef huart6;
 void SystemClock_Config(void);
 void PeriphCommonClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_ADC2_Init(void);
 static void MX_CRC_Init(void);
 static void MX_DMA2D_Init(void);
 static void MX_LTDC_Init(void);
 static void MX_TIM1_Init(void);
 static void MX_TIM2_Init(void);
+static void MX_TIM8_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_USART6_UART_Init(void);
 
-static bool rising_edge = false;
+// GPIO input channels. Channel 0 is the original button input on D12.
+typedef struct hw_input_channel {
+    GPIO_TypeDef *port;
+    uint16_t      pin;
+    IRQn_Type     irqn;
+    const char   *name;
+} hw_input_channel_t;
+
+static const hw_input_channel_t input_channels[HW_INPUT_CHANNEL_MAX] = {
+    { ARDUINO_D12_GPIO_Port,     ARDUINO_D12_Pin,     EXTI15_10_IRQn, "D12" },
+    { ARDUINO_SCK_D13_GPIO_Port, ARDUINO_SCK_D13_Pin, EXTI1_IRQn,     "D13" },
+    { ARDUINO_D2_GPIO_Port,      ARDUINO_D2_Pin,      EXTI9_5_IRQn,   "D2"  },
+    { ARDUINO_D8_GPIO_Port,      ARDUINO_D8_Pin,      EXTI2_IRQn,     "D8"  },
+};
+
+// Pattern generator outputs on HW_PATTERN_GPIO_Port. Output 0 is the auto-trigger pin.
+static const struct {
+    uint16_t    pin;
+    const char *name;
+} pattern_outputs[HW_PATTERN_OUTPUT_MAX] = {
+    { ARDUINO_D11_Pin,     "D11" },
+    { ARDUINO_SCL_D15_Pin, "D15" },
+    { ARDUINO_SDA_D14_Pin, "D14" },
+};
+
+// Logic capture ports, with the Arduino header pins on them
+static const struct {
+    GPIO_TypeDef *port;
+    const char   *name;
+    const char   *pins[16];
+} capture_ports[HW_CAPTURE_PORT_MAX] = {
+    { GPIOB, "Port B", { [4] = "D3", [8] = "D15", [9] = "D14", [14] = "D12", [15] = "D11" } },
+    { GPIOI, "Port I", { [0] = "D5", [1] = "D13", [2] = "D8", [3] = "D7" } },
+    { GPIOG, "Port G", { [6] = "D2", [7] = "D4" } },
+};
+
+static bool channel_enabled[HW_INPUT_CHANNEL_MAX] = { true, false, false, false };
+static bool rising_edge[HW_INPUT_CHANNEL_MAX] = { false, false, false, false };
+static bool both_edges = false; // also interrupt on the release edge
+static bool exti_enabled = false;
 
 /**
   * @brief  The application entry point.
@@ -77,6 +125,8 @@ int hw_init(void)
     MX_LTDC_Init();
     MX_TIM1_Init();
     MX_TIM2_Init();
+    MX_TIM8_Init();
+    MX_ADC2_Init();
     MX_USART1_UART_Init();
     MX_USART6_UART_Init();
     return 0;
@@ -97,14 +147,44 @@ void hw_debug_init(void)
 void hw_exti_interrupts_enable(void)
 {
     /* EXTI interrupt init */
-    HAL_NVIC_SetPriority(EXTI15_10_IRQn, 5, 0);
-    HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+    exti_enabled = true;
+    for (size_t ch = 0; ch < HW_INPUT_CHANNEL_MAX; ch++) {
+        if (channel_enabled[ch]) {
+            HAL_NVIC_SetPriority(input_channels[ch].irqn, 5, 0);
+            HAL_NVIC_EnableIRQ(input_channels[ch].irqn);
+        }
+    }
 }
 
 void hw_exti_interrupts_disable(void)
 {
     /* EXTI interrupt deinit */
-    HAL_NVIC_DisableIRQ(EXTI15_10_IRQn);
+    exti_enabled = false;
+    for (size_t ch = 0; ch < HW_INPUT_CHANNEL_MAX; ch++) {
+        HAL_NVIC_DisableIRQ(input_channels[ch].irqn);
+    }
+}
+
+// Mask a single EXTI line, for the per-channel hold-off.
+// Edges seen while masked are dropped when unmasking.
+// Called from the EXTI interrupt and from the timer task: the read-modify-write of IMR runs with
+// the interrupts off, or an interrupt in between would have its change to another line undone.
+void hw_exti_channel_mask(size_t channel, bool masked)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return;
+    }
+
+    uint16_t pin = input_channels[channel].pin;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (masked) {
+        EXTI->IMR &= ~pin;
+    } else if (channel_enabled[channel]) {
+        __HAL_GPIO_EXTI_CLEAR_IT(pin);
+        EXTI->IMR |= pin;
+    }
+    __set_PRIMASK(primask);
 }
 
 
@@ -176,7 +256,7 @@ void PeriphCommonClock_Config(void)
 
     /** Initializes the peripherals clock
     */
-    PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_LTDC|RCC_PERIPHCLK_SAI2;
+    PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_LTDC|RCC_PERIPHCLK_SAI2|RCC_PERIPHCLK_CLK48;
     PeriphClkInitStruct.PLLSAI.PLLSAIN = 384;
     PeriphClkInitStruct.PLLSAI.PLLSAIR = 5;
     PeriphClkInitStruct.PLLSAI.PLLSAIQ = 2;
@@ -184,6 +264,8 @@ void PeriphCommonClock_Config(void)
     PeriphClkInitStruct.PLLSAIDivQ = 1;
     PeriphClkInitStruct.PLLSAIDivR = RCC_PLLSAIDIVR_8;
     PeriphClkInitStruct.Sai2ClockSelection = RCC_SAI2CLKSOURCE_PLLSAI;
+    // OTG_FS (HID proxy device) needs 48 MHz, PLLQ is 50 MHz: PLLSAIP = 384 MHz / 8
+    PeriphClkInitStruct.Clk48ClockSelection = RCC_CLK48SOURCE_PLLSAIP;
     if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInitStruct) != HAL_OK)
     {
         Error_Handler();
@@ -341,6 +423,27 @@ static void MX_TIM1_Init(void)
     }
 
     HAL_TIM_MspPostInit(&htim1);
+
+    // TIM1_UP: DMA2 stream 5 channel 6, samples a GPIO input register for the logic capture.
+    // Double buffer mode, the interrupt moves the finished half further into the capture buffer.
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_tim1_up.Instance = DMA2_Stream5;
+    hdma_tim1_up.Init.Channel = DMA_CHANNEL_6;
+    hdma_tim1_up.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_tim1_up.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_tim1_up.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_tim1_up.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma_tim1_up.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_tim1_up.Init.Mode = DMA_NORMAL;
+    hdma_tim1_up.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_tim1_up.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_tim1_up) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    __HAL_LINKDMA(&htim1, hdma[TIM_DMA_ID_UPDATE], hdma_tim1_up);
+    HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
 }
 
 /**
@@ -354,7 +457,7 @@ static void MX_TIM2_Init(void)
     TIM_MasterConfigTypeDef sMasterConfig = {0};
 
     htim2.Instance = TIM2;
-    htim2.Init.Prescaler = 100; // So we end up with 100 Mhz / 100 = 1 Mhz
+    htim2.Init.Prescaler = 99; // So we end up with 100 Mhz / (99 + 1) = 1 Mhz
     htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
     htim2.Init.Period = 4294967295;
     htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
@@ -375,10 +478,183 @@ static void MX_TIM2_Init(void)
         Error_Handler();
     }
 
+    // Channel 4 compare (no pin) times the clicks of the phase sweep
+    TIM_OC_InitTypeDef sConfigOC = {0};
+    sConfigOC.OCMode = TIM_OCMODE_TIMING;
+    sConfigOC.Pulse = 0;
+    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+    if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_4) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    // Above the USB interrupt that arms it, the handler does not use FreeRTOS
+    HAL_NVIC_SetPriority(TIM2_IRQn, 4, 0);
+    HAL_NVIC_EnableIRQ(TIM2_IRQn);
+
+    // Channel 1 captures both edges on D9 for the bounce capture, straight on the time base
+    TIM_IC_InitTypeDef sConfigIC = {0};
+    sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
+    sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+    sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+    sConfigIC.ICFilter = 0;
+    if (HAL_TIM_IC_ConfigChannel(&htim2, &sConfigIC, TIM_CHANNEL_1) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    HAL_TIM_MspPostInit(&htim2);
+
+    // TIM2_CH1: DMA1 stream 5 channel 3, the captured edge times into the capture buffer
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    hdma_tim2_ch1.Instance = DMA1_Stream5;
+    hdma_tim2_ch1.Init.Channel = DMA_CHANNEL_3;
+    hdma_tim2_ch1.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_tim2_ch1.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_tim2_ch1.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_tim2_ch1.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_tim2_ch1.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_tim2_ch1.Init.Mode = DMA_NORMAL;
+    hdma_tim2_ch1.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_tim2_ch1.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_tim2_ch1) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    __HAL_LINKDMA(&htim2, hdma[TIM_DMA_ID_CC1], hdma_tim2_ch1);
+
     // Start as free-running timer right away
     HAL_TIM_Base_Start(&htim2);
 }
 
+/**
+  * @brief TIM8 Initialization Function; clocks the pattern generator
+  * @param None
+  * @retval None
+  */
+static void MX_TIM8_Init(void)
+{
+    TIM_MasterConfigTypeDef sMasterConfig = {0};
+    TIM_OC_InitTypeDef sConfigOC = {0};
+
+    htim8.Instance = TIM8;
+    htim8.Init.Prescaler = 1; // 200 MHz / 2 = 100 MHz, 10 ns steps
+    htim8.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim8.Init.Period = 65535;
+    htim8.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim8.Init.RepetitionCounter = 0;
+    htim8.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE; // each step's length is loaded a step ahead
+    if (HAL_TIM_Base_Init(&htim8) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+    sMasterConfig.MasterOutputTrigger2 = TIM_TRGO2_RESET;
+    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    if (HAL_TIMEx_MasterConfigSynchronization(&htim8, &sMasterConfig) != HAL_OK)
+    {
+        Error_Handler();
+    }
+
+    // Channel 1 compare (no pin) matches one count after every update, its DMA request writes the next ARR
+    sConfigOC.OCMode = TIM_OCMODE_TIMING;
+    sConfigOC.Pulse = 1;
+    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+    if (HAL_TIM_OC_ConfigChannel(&htim8, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+    {
+        Error_Handler();
+    }
+
+    // TIM8_UP: DMA2 stream 1 channel 7, the pattern words into the GPIO BSRR
+    // TIM8_CH1: DMA2 stream 2 channel 7, the step lengths into TIM8 ARR
+    // No interrupts, the pattern generator polls for the end of a run
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_tim8_up.Instance = DMA2_Stream1;
+    hdma_tim8_up.Init.Channel = DMA_CHANNEL_7;
+    hdma_tim8_up.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_tim8_up.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_tim8_up.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_tim8_up.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_tim8_up.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_tim8_up.Init.Mode = DMA_NORMAL;
+    hdma_tim8_up.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+    hdma_tim8_up.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_tim8_up) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    __HAL_LINKDMA(&htim8, hdma[TIM_DMA_ID_UPDATE], hdma_tim8_up);
+
+    hdma_tim8_ch1.Instance = DMA2_Stream2;
+    hdma_tim8_ch1.Init = hdma_tim8_up.Init;
+    hdma_tim8_ch1.Init.Priority = DMA_PRIORITY_HIGH;
+    if (HAL_DMA_Init(&hdma_tim8_ch1) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    __HAL_LINKDMA(&htim8, hdma[TIM_DMA_ID_CC1], hdma_tim8_ch1);
+}
+
+/**
+  * @brief ADC2 Initialization Function; samples A0 for the analog trigger
+  * @param None
+  * @retval None
+  */
+static void MX_ADC2_Init(void)
+{
+    ADC_ChannelConfTypeDef sConfig = {0};
+
+    // PCLK2 / 4 = 25 MHz, continuous conversions straight into a circular DMA buffer
+    hadc2.Instance = ADC2;
+    hadc2.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
+    hadc2.Init.Resolution = ADC_RESOLUTION_12B;
+    hadc2.Init.ScanConvMode = DISABLE;
+    hadc2.Init.ContinuousConvMode = ENABLE;
+    hadc2.Init.DiscontinuousConvMode = DISABLE;
+    hadc2.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+    hadc2.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    hadc2.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    hadc2.Init.NbrOfConversion = 1;
+    hadc2.Init.DMAContinuousRequests = ENABLE;
+    hadc2.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+    if (HAL_ADC_Init(&hadc2) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    sConfig.Channel = ADC_CHANNEL_0;
+    sConfig.Rank = ADC_REGULAR_RANK_1;
+    sConfig.SamplingTime = ADC_SAMPLETIME_3CYCLES;
+    if (HAL_ADC_ConfigChannel(&hadc2, &sConfig) != HAL_OK)
+    {
+        Error_Handler();
+    }
+
+    // ADC2: DMA2 stream 3 channel 1, the samples into the analog trigger ring.
+    // The half and full transfer interrupts track the write position.
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_adc2.Instance = DMA2_Stream3;
+    hdma_adc2.Init.Channel = DMA_CHANNEL_1;
+    hdma_adc2.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_adc2.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_adc2.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_adc2.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma_adc2.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_adc2.Init.Mode = DMA_CIRCULAR;
+    hdma_adc2.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_adc2.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_adc2) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    __HAL_LINKDMA(&hadc2, DMA_Handle, hdma_adc2);
+
+    // The analog watchdog interrupt timestamps the threshold crossings
+    HAL_NVIC_SetPriority(ADC_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(ADC_IRQn);
+    HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+}
+
 /**
   * @brief USART1 Initialization Function -- this is the VCOM on the devkit
   * @param None
@@ -451,7 +727,7 @@ static void MX_GPIO_Init(void)
     HAL_GPIO_WritePin(OTG_FS_PowerSwitchOn_GPIO_Port, OTG_FS_PowerSwitchOn_Pin, GPIO_PIN_SET);
 
     /*Configure GPIO pin Output Level */
-    HAL_GPIO_WritePin(GPIOI, ARDUINO_D7_Pin|ARDUINO_D8_Pin, GPIO_PIN_RESET);
+    HAL_GPIO_WritePin(GPIOI, ARDUINO_D7_Pin, GPIO_PIN_RESET);
 
     /*Configure GPIO pin Output Level */
     HAL_GPIO_WritePin(LCD_BL_CTRL_GPIO_Port, LCD_BL_CTRL_Pin, GPIO_PIN_SET);
@@ -472,12 +748,13 @@ static void MX_GPIO_Init(void)
     HAL_GPIO_Init(OTG_HS_OverCurrent_GPIO_Port, &GPIO_InitStruct);
 
     /*Configure GPIO pins : ARDUINO_SCL_D15_Pin ARDUINO_SDA_D14_Pin */
+    // Pattern generator outputs 1 and 2, open drain like D11 (I2C1 is not used)
     GPIO_InitStruct.Pin = ARDUINO_SCL_D15_Pin|ARDUINO_SDA_D14_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_OD;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    GPIO_InitStruct.Alternate = GPIO_AF4_I2C1;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+    HAL_GPIO_WritePin(GPIOB, ARDUINO_SCL_D15_Pin|ARDUINO_SDA_D14_Pin, GPIO_PIN_SET);
 
     /*Configure GPIO pins : DCMI_D6_Pin DCMI_D7_Pin */
     GPIO_InitStruct.Pin = DCMI_D6_Pin|DCMI_D7_Pin;
@@ -526,8 +803,9 @@ static void MX_GPIO_Init(void)
     GPIO_InitStruct.Alternate = GPIO_AF13_DCMI;
     HAL_GPIO_Init(DCMI_D5_GPIO_Port, &GPIO_InitStruct);
 
-    /*Configure GPIO pins : ARDUINO_D7_Pin ARDUINO_D8_Pin LCD_DISP_Pin */
-    GPIO_InitStruct.Pin = ARDUINO_D7_Pin|ARDUINO_D8_Pin|LCD_DISP_Pin;
+    /*Configure GPIO pins : ARDUINO_D7_Pin LCD_DISP_Pin */
+    /* ARDUINO_D8_Pin is input channel 3, see hw_config_input_trigger() */
+    GPIO_InitStruct.Pin = ARDUINO_D7_Pin|LCD_DISP_Pin;
     GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
@@ -621,7 +899,9 @@ static void MX_GPIO_Init(void)
     HAL_GPIO_WritePin(ARDUINO_D11_GPIO_Port, ARDUINO_D11_Pin, GPIO_PIN_SET); // Set high, not draining or pulling low
 
     /* Detect MOUSE BUTTON -> Interrupt */
-    hw_config_input_trigger(rising_edge);
+    for (size_t ch = 0; ch < HW_INPUT_CHANNEL_MAX; ch++) {
+        hw_config_input_trigger(ch, rising_edge[ch]);
+    }
 
     /*Configure GPIO pin : PB2 */
     GPIO_InitStruct.Pin = GPIO_PIN_2;
@@ -666,20 +946,150 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 }
 
 
-void hw_config_input_trigger(bool rising)
+static void hw_config_input_pin(size_t channel)
 {
-    rising_edge = rising;
-    uint32_t mode = rising_edge ? GPIO_MODE_IT_RISING : GPIO_MODE_IT_FALLING;
+    const hw_input_channel_t *input = &input_channels[channel];
+
+    if (!channel_enabled[channel]) {
+        // Back to analog, this also clears the EXTI configuration of the line
+        HAL_GPIO_DeInit(input->port, input->pin);
+        return;
+    }
+
+    uint32_t mode = rising_edge[channel] ? GPIO_MODE_IT_RISING : GPIO_MODE_IT_FALLING;
+    if (both_edges) {
+        // The press edge is still given by rising_edge, the other edge is the release
+        mode = GPIO_MODE_IT_RISING_FALLING;
+    }
 
     GPIO_InitTypeDef GPIO_InitStruct = {0};
-    GPIO_InitStruct.Pin = ARDUINO_D12_Pin;
+    GPIO_InitStruct.Pin = input->pin;
     GPIO_InitStruct.Mode = mode; // GPIO threshold direction
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
-    HAL_GPIO_Init(ARDUINO_D12_GPIO_Port, &GPIO_InitStruct);
+    HAL_GPIO_Init(input->port, &GPIO_InitStruct);
+}
+
+void hw_config_input_trigger(size_t channel, bool rising)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return;
+    }
+    rising_edge[channel] = rising;
+    hw_config_input_pin(channel);
+}
+
+bool hw_config_input_trigger_is_rising_edge(size_t channel)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return false;
+    }
+    return rising_edge[channel];
+}
+
+void hw_config_input_channel_enable(size_t channel, bool enable)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return;
+    }
+
+    channel_enabled[channel] = enable;
+    hw_config_input_pin(channel);
+
+    // Only touch the NVIC once the EXTI interrupts are in use (see hw_exti_interrupts_enable())
+    if (exti_enabled) {
+        if (enable) {
+            HAL_NVIC_SetPriority(input_channels[channel].irqn, 5, 0);
+            HAL_NVIC_EnableIRQ(input_channels[channel].irqn);
+        } else {
+            HAL_NVIC_DisableIRQ(input_channels[channel].irqn);
+        }
+    }
+}
+
+bool hw_config_input_channel_is_enabled(size_t channel)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return false;
+    }
+    return channel_enabled[channel];
+}
+
+void hw_config_input_both_edges(bool both)
+{
+    both_edges = both;
+    for (size_t ch = 0; ch < HW_INPUT_CHANNEL_MAX; ch++) {
+        hw_config_input_pin(ch);
+    }
+}
+
+bool hw_config_input_both_edges_is_enabled(void)
+{
+    return both_edges;
+}
+
+bool hw_input_trigger_is_pressed(size_t channel)
+{
+    const hw_input_channel_t *input = &input_channels[channel];
+    GPIO_PinState state = HAL_GPIO_ReadPin(input->port, input->pin);
+    return rising_edge[channel] ? (state == GPIO_PIN_SET) : (state == GPIO_PIN_RESET);
 }
 
-bool hw_config_input_trigger_is_rising_edge(void)
+int hw_input_channel_from_pin(uint16_t pin)
 {
-    return rising_edge;
-}
\ No newline at end of file
+    for (size_t ch = 0; ch < HW_INPUT_CHANNEL_MAX; ch++) {
+        if (input_channels[ch].pin == pin) {
+            return (int)ch;
+        }
+    }
+    return -1;
+}
+
+uint16_t hw_pattern_output_pin(size_t output)
+{
+    if (output >= HW_PATTERN_OUTPUT_MAX) {
+        return 0;
+    }
+    return pattern_outputs[output].pin;
+}
+
+const char * hw_pattern_output_name(size_t output)
+{
+    if (output >= HW_PATTERN_OUTPUT_MAX) {
+        return "";
+    }
+    return pattern_outputs[output].name;
+}
+
+uint32_t hw_capture_port_idr_address(size_t port)
+{
+    if (port >= HW_CAPTURE_PORT_MAX) {
+        return 0;
+    }
+    return (uint32_t)&capture_ports[port].port->IDR;
+}
+
+const char * hw_capture_port_name(size_t port)
+{
+    if (port >= HW_CAPTURE_PORT_MAX) {
+        return "";
+    }
+    return capture_ports[port].name;
+}
+
+// Name of a pin on the header, NULL for the ones that are not on it
+const char * hw_capture_pin_name(size_t port, size_t pin)
+{
+    if ((port >= HW_CAPTURE_PORT_MAX) || (pin >= 16)) {
+        return NULL;
+    }
+    return capture_ports[port].pins[pin];
+}
+
+const char * hw_input_channel_name(size_t channel)
+{
+    if (channel >= HW_INPUT_CHANNEL_MAX) {
+        return "";
+    }
+    return input_channels[channel].name;
+}
@@ -21,12 +21,61 @@
 #define XLAT_TIMx                           TIM2
 #define XLAT_TIMx_CLK_ENABLE()              __HAL_RCC_TIM2_CLK_ENABLE()
 #define XLAT_TIMx_handle                   htim2
+#define XLAT_TIMx_TICK_NS                   (1000)  // 100 MHz / (99 + 1): the 1 us time base
+
+// External SDRAM (8 MB). The LCD framebuffer (480x272, 16 bit) takes the start of it,
+// the latency histograms, the session sample store, the capture buffer, the soak test series,
+// the sliding windows and the scratch buffer follow in their own fixed regions.
+#define HW_SDRAM_BASE                       (0x60000000UL)
+#define HW_SDRAM_SIZE                       (8UL * 1024 * 1024)
+#define HW_SDRAM_HISTOGRAM_ADDR             (HW_SDRAM_BASE + 0x40000UL)
+#define HW_SDRAM_HISTOGRAM_SIZE             (0x80000UL)
+#define HW_SDRAM_SAMPLES_ADDR               (HW_SDRAM_BASE + 0xC0000UL)
+#define HW_SDRAM_SAMPLES_SIZE               (0x460000UL)
+// Shared by the logic and bounce captures, one at a time
+#define HW_SDRAM_CAPTURE_ADDR               (HW_SDRAM_BASE + 0x520000UL)
+#define HW_SDRAM_CAPTURE_SIZE               (0x100000UL)
+#define HW_SDRAM_SOAK_ADDR                  (HW_SDRAM_BASE + 0x620000UL)
+#define HW_SDRAM_SOAK_SIZE                  (0x40000UL)
+#define HW_SDRAM_WINDOW_ADDR                (HW_SDRAM_BASE + 0x660000UL)
+#define HW_SDRAM_WINDOW_SIZE                (0xA0000UL)
+#define HW_SDRAM_SCRATCH_ADDR               (HW_SDRAM_BASE + 0x700000UL)
+#define HW_SDRAM_SCRATCH_SIZE               (0x100000UL)
+
+// Number of GPIO input channels, each on its own EXTI line (D12, D13, D2, D8)
+#define HW_INPUT_CHANNEL_MAX    (4)
+
+// Pattern generator outputs, all on one port so a single BSRR write sets them at once.
+// Output N is wired like D11 (open drain) and is measured by input channel N.
+#define HW_PATTERN_GPIO_Port    GPIOB
+#define HW_PATTERN_OUTPUT_MAX   (3)
+// TIM8 counts at 100 MHz, 10 ns steps
+#define HW_PATTERN_TICK_NS      (10)
+#define HW_PATTERN_TICKS_PER_US (1000 / HW_PATTERN_TICK_NS)
+
+// Logic capture: TIM1 update events sample the input register of one GPIO port by DMA.
+// TIM1 counts at 200 MHz.
+#define HW_CAPTURE_PORT_MAX     (3)
+#define HW_CAPTURE_CLOCK_MHZ    (200)
 
 int hw_init(void);
 void hw_debug_init(void);
 void hw_exti_interrupts_enable(void);
 void hw_exti_interrupts_disable(void);
-void hw_config_input_trigger(bool rising);
-bool hw_config_input_trigger_is_rising_edge(void);
+void hw_exti_channel_mask(size_t channel, bool masked);
+void hw_config_input_trigger(size_t channel, bool rising);
+bool hw_config_input_trigger_is_rising_edge(size_t channel);
+void hw_config_input_channel_enable(size_t channel, bool enable);
+bool hw_config_input_channel_is_enabled(size_t channel);
+void hw_config_input_both_edges(bool both);
+bool hw_config_input_both_edges_is_enabled(void);
+bool hw_input_trigger_is_pressed(size_t channel);
+int hw_input_channel_from_pin(uint16_t pin);
+const char * hw_input_channel_name(size_t channel);
+uint16_t hw_pattern_output_pin(size_t output);
+const char * hw_pattern_output_name(size_t output);
+uint32_t hw_capture_port_idr_address(size_t port);
+const char * hw_capture_port_name(size_t port);
+const char * hw_capture_pin_name(size_t port, size_t pin);
 
 #endif //HARDWARE_CONFIG_H
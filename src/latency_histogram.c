@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "latency_histogram.h"
+
+#define HIST_SUB_BITS   (LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define HIST_VALUE_MAX  ((1ULL << LATENCY_HISTOGRAM_VALUE_BITS) - 1)
+
+// Values below 2^SUB_BITS map 1:1. Above, the value is shifted right until it fits in SUB_BITS bits,
+// the shift selects the group and the remaining top bits (always >= SUB_BUCKETS) the bucket in it.
+static inline uint32_t hist_index(uint64_t value)
+{
+    if (value > HIST_VALUE_MAX) {
+        value = HIST_VALUE_MAX;
+    }
+    if (value < (1ULL << HIST_SUB_BITS)) {
+        return (uint32_t)value;
+    }
+    uint32_t msb = 63 - __builtin_clzll(value);
+    uint32_t shift = msb - HIST_SUB_BITS + 1;
+    return (shift << (HIST_SUB_BITS - 1)) + (uint32_t)(value >> shift);
+}
+
+// Lowest value counted in a bucket
+static inline uint64_t hist_bucket_low(uint32_t index)
+{
+    if (index < (1UL << HIST_SUB_BITS)) {
+        return index;
+    }
+    uint32_t shift = (index >> (HIST_SUB_BITS - 1)) - 1;
+    uint64_t sub = index - (shift << (HIST_SUB_BITS - 1));
+    return sub << shift;
+}
+
+// Highest value counted in a bucket
+static inline uint64_t hist_bucket_value(uint32_t index)
+{
+    if (index < (1UL << HIST_SUB_BITS)) {
+        return index;
+    }
+    uint32_t shift = (index >> (HIST_SUB_BITS - 1)) - 1;
+    uint64_t sub = index - (shift << (HIST_SUB_BITS - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+void latency_histogram_reset(latency_histogram_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void latency_histogram_add(latency_histogram_t *hist, uint64_t value_ns)
+{
+    if ((hist->total == 0) || (value_ns < hist->min_ns)) {
+        hist->min_ns = value_ns;
+    }
+    if (value_ns > hist->max_ns) {
+        hist->max_ns = value_ns;
+    }
+    hist->counts[hist_index(value_ns)]++;
+    hist->total++;
+}
+
+void latency_histogram_remove(latency_histogram_t *hist, uint64_t value_ns)
+{
+    uint32_t index = hist_index(value_ns);
+    if (hist->counts[index] > 0) {
+        hist->counts[index]--;
+        hist->total--;
+    }
+}
+
+void latency_histogram_merge(latency_histogram_t *dst, const latency_histogram_t *src)
+{
+    if (src->total == 0) {
+        return;
+    }
+    if ((dst->total == 0) || (src->min_ns < dst->min_ns)) {
+        dst->min_ns = src->min_ns;
+    }
+    if (src->max_ns > dst->max_ns) {
+        dst->max_ns = src->max_ns;
+    }
+    // Same bucket layout on both sides, so merging is a plain element-wise sum
+    for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+}
+
+void latency_histogram_percentiles(const latency_histogram_t *hist, const float *percentiles,
+                                   uint64_t *values_ns, size_t n)
+{
+    size_t p = 0;
+    uint32_t cumulative = 0;
+
+    if (hist->total == 0) {
+        memset(values_ns, 0, n * sizeof(*values_ns));
+        return;
+    }
+
+    for (uint32_t i = 0; (i < LATENCY_HISTOGRAM_BUCKETS) && (p < n); i++) {
+        cumulative += hist->counts[i];
+
+        // Rank of the sample at this percentile (nearest-rank method), at least the first one
+        while (p < n) {
+            uint32_t rank = (uint32_t)ceilf(percentiles[p] / 100.0f * hist->total);
+            if (rank == 0) {
+                rank = 1;
+            }
+            if (cumulative < rank) {
+                break;
+            }
+
+            // Report the bucket's upper edge, but never beyond the samples actually seen
+            uint64_t value = hist_bucket_value(i);
+            if (value > hist->max_ns) {
+                value = hist->max_ns;
+            }
+            if (value < hist->min_ns) {
+                value = hist->min_ns;
+            }
+            values_ns[p++] = value;
+        }
+    }
+
+    // Anything left over (percentile above 100) is the maximum
+    while (p < n) {
+        values_ns[p++] = hist->max_ns;
+    }
+}
+
+uint64_t latency_histogram_percentile(const latency_histogram_t *hist, float percentile)
+{
+    uint64_t value_ns;
+    latency_histogram_percentiles(hist, &percentile, &value_ns, 1);
+    return value_ns;
+}
+
+void latency_histogram_rebin(const latency_histogram_t *hist, uint64_t lo_ns, uint64_t hi_ns,
+                             uint32_t *bins, size_t n)
+{
+    memset(bins, 0, n * sizeof(*bins));
+    if ((hist->total == 0) || (hi_ns <= lo_ns) || (n == 0)) {
+        return;
+    }
+
+    uint64_t span = hi_ns - lo_ns;
+    for (uint32_t i = hist_index(lo_ns); i <= hist_index(hi_ns); i++) {
+        if (hist->counts[i] == 0) {
+            continue;
+        }
+        uint64_t mid = (hist_bucket_low(i) + hist_bucket_value(i)) / 2;
+        if ((mid < lo_ns) || (mid > hi_ns)) {
+            continue;
+        }
+        size_t bin = (size_t)(((mid - lo_ns) * n) / (span + 1));
+        bins[bin] += hist->counts[i];
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-memory log-linear (HDR style) latency histogram, values in nanoseconds.
+// Every power of two is split into 2^(SUB_BUCKET_BITS - 1) linear buckets, so the relative error
+// of a reported value is below 2^-(SUB_BUCKET_BITS - 1), at any magnitude. Values below
+// 2^SUB_BUCKET_BITS ns are counted exactly.
+#ifndef LATENCY_HISTOGRAM_SUB_BUCKET_BITS
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS   (7)     // 1.6% worst case error
+#endif
+
+// Largest value is 2^VALUE_BITS - 1 ns (~68 s), larger values are counted in the last bucket
+#define LATENCY_HISTOGRAM_VALUE_BITS        (36)
+
+#define LATENCY_HISTOGRAM_SUB_BUCKETS       (1UL << (LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1))
+#define LATENCY_HISTOGRAM_BUCKETS           ((LATENCY_HISTOGRAM_VALUE_BITS - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 2) * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct latency_histogram {
+    uint32_t total;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t counts[LATENCY_HISTOGRAM_BUCKETS];
+} latency_histogram_t;
+
+void latency_histogram_reset(latency_histogram_t *hist);
+void latency_histogram_add(latency_histogram_t *hist, uint64_t value_ns);
+// Take back a value that was added before (sliding windows). min_ns and max_ns are not narrowed,
+// they remain bounds of the values ever seen.
+void latency_histogram_remove(latency_histogram_t *hist, uint64_t value_ns);
+void latency_histogram_merge(latency_histogram_t *dst, const latency_histogram_t *src);
+
+// Percentile in percent (e.g. 99.9), 0 if the histogram is empty
+uint64_t latency_histogram_percentile(const latency_histogram_t *hist, float percentile);
+
+// Several percentiles in one pass over the buckets, the percentiles must be in ascending order
+void latency_histogram_percentiles(const latency_histogram_t *hist, const float *percentiles,
+                                   uint64_t *values_ns, size_t n);
+
+// Spread the counts over n uniform bins between lo_ns and hi_ns, by the middle of each bucket.
+// Counts outside the range are left out.
+void latency_histogram_rebin(const latency_histogram_t *hist, uint64_t lo_ns, uint64_t hi_ns,
+                             uint32_t *bins, size_t n);
+
+#endif //LATENCY_HISTOGRAM_H
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "latency_modes.h"
+
+#define EM_ITERATIONS_MAX   (100)
+#define EM_TOLERANCE        (1e-5f)
+#define MODE_MIN_WEIGHT     (0.05f)     // a mode must hold 5% of the samples
+#define MODE_MAX_DIP        (0.6f)      // valley between two modes, relative to the lower peak
+#define SMOOTH_BINS_MAX     (128)
+
+#define INV_SQRT_2PI        (0.39894228f)
+
+typedef struct em_fit {
+    size_t k;
+    float mean[LATENCY_MODES_MAX];
+    float var[LATENCY_MODES_MAX];
+    float weight[LATENCY_MODES_MAX];
+    float log_likelihood;
+} em_fit_t;
+
+// Value below which the given share of the samples lies, for the initial centres
+static float bins_quantile(const uint32_t *bins, size_t n, uint32_t total, float q, float lo_us, float width_us)
+{
+    uint32_t rank = (uint32_t)(q * total);
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < n; i++) {
+        cumulative += bins[i];
+        if (cumulative > rank) {
+            return lo_us + (i + 0.5f) * width_us;
+        }
+    }
+    return lo_us + n * width_us;
+}
+
+// 3-bin moving sum, so single-bin noise does not look like a peak or a valley
+static void bins_smooth(const uint32_t *bins, size_t n, uint32_t *smooth)
+{
+    for (size_t i = 0; i < n; i++) {
+        smooth[i] = bins[i] + ((i > 0) ? bins[i - 1] : 0) + ((i + 1 < n) ? bins[i + 1] : 0);
+    }
+}
+
+// Centres of the k highest local maxima, false if there are fewer
+static bool bins_peaks(const uint32_t *smooth, size_t n, size_t k, float lo_us, float width_us, float *centres)
+{
+    uint32_t height[LATENCY_MODES_MAX] = { 0 };
+    size_t found = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        bool rising = (i == 0) || (smooth[i] > smooth[i - 1]);
+        bool falling = (i + 1 == n) || (smooth[i] >= smooth[i + 1]);
+        if (!rising || !falling || (smooth[i] == 0)) {
+            continue;
+        }
+        // Insert into the top k
+        size_t pos = (found < k) ? found++ : k;
+        while ((pos > 0) && (height[pos - 1] < smooth[i])) {
+            if (pos < k) {
+                height[pos] = height[pos - 1];
+                centres[pos] = centres[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < k) {
+            height[pos] = smooth[i];
+            centres[pos] = lo_us + (i + 0.5f) * width_us;
+        }
+    }
+    return found == k;
+}
+
+static void em_run(const uint32_t *bins, size_t n, uint32_t total, float lo_us, float width_us,
+                   const float *centres, em_fit_t *fit)
+{
+    // Bins limit the resolution, a mode cannot be narrower than that
+    float var_floor = width_us * width_us / 4.0f;
+    float span = n * width_us;
+    float prev_ll = -INFINITY;
+
+    for (size_t j = 0; j < fit->k; j++) {
+        fit->mean[j] = centres[j];
+        fit->var[j] = (span / (2.0f * fit->k)) * (span / (2.0f * fit->k));
+        fit->weight[j] = 1.0f / fit->k;
+    }
+
+    for (int iter = 0; iter < EM_ITERATIONS_MAX; iter++) {
+        float sum_r[LATENCY_MODES_MAX] = { 0 };
+        float sum_rx[LATENCY_MODES_MAX] = { 0 };
+        float sum_rxx[LATENCY_MODES_MAX] = { 0 };
+        float norm[LATENCY_MODES_MAX];
+        float inv_var[LATENCY_MODES_MAX];
+        float ll = 0.0f;
+
+        for (size_t j = 0; j < fit->k; j++) {
+            inv_var[j] = 1.0f / fit->var[j];
+            norm[j] = fit->weight[j] * INV_SQRT_2PI * sqrtf(inv_var[j]);
+        }
+
+        // E and M step in one pass, every bin weighted by its count
+        for (size_t i = 0; i < n; i++) {
+            if (bins[i] == 0) {
+                continue;
+            }
+            float x = lo_us + (i + 0.5f) * width_us;
+            float p[LATENCY_MODES_MAX];
+            float p_sum = 0.0f;
+            for (size_t j = 0; j < fit->k; j++) {
+                float d = x - fit->mean[j];
+                p[j] = norm[j] * expf(-0.5f * d * d * inv_var[j]);
+                p_sum += p[j];
+            }
+            if (p_sum < 1e-30f) {
+                p_sum = 1e-30f;
+            }
+            ll += bins[i] * logf(p_sum);
+            for (size_t j = 0; j < fit->k; j++) {
+                float r = bins[i] * p[j] / p_sum;
+                sum_r[j] += r;
+                sum_rx[j] += r * x;
+                sum_rxx[j] += r * x * x;
+            }
+        }
+
+        for (size_t j = 0; j < fit->k; j++) {
+            if (sum_r[j] < 1e-3f) {
+                continue;   // empty component, keep it where it is
+            }
+            fit->weight[j] = sum_r[j] / total;
+            fit->mean[j] = sum_rx[j] / sum_r[j];
+            float var = sum_rxx[j] / sum_r[j] - fit->mean[j] * fit->mean[j];
+            fit->var[j] = (var > var_floor) ? var : var_floor;
+        }
+        fit->log_likelihood = ll;
+
+        if (fabsf(ll - prev_ll) < EM_TOLERANCE * fabsf(ll)) {
+            break;
+        }
+        prev_ll = ll;
+    }
+}
+
+static inline size_t bin_of(float us, size_t n, float lo_us, float width_us)
+{
+    float pos = (us - lo_us) / width_us;
+    if (pos < 0.0f) {
+        return 0;
+    }
+    return (pos >= n) ? (n - 1) : (size_t)pos;
+}
+
+// Every mode needs a real share of the samples and a clear valley in the data towards its
+// neighbour; a mixture can also fit a flat or skewed single mode, which has none.
+static bool em_modes_are_distinct(const em_fit_t *fit, const uint32_t *smooth, size_t n,
+                                  float lo_us, float width_us)
+{
+    size_t order[LATENCY_MODES_MAX];
+
+    for (size_t j = 0; j < fit->k; j++) {
+        if (fit->weight[j] < MODE_MIN_WEIGHT) {
+            return false;
+        }
+        order[j] = j;
+    }
+    for (size_t a = 1; a < fit->k; a++) {
+        for (size_t b = a; (b > 0) && (fit->mean[order[b]] < fit->mean[order[b - 1]]); b--) {
+            size_t tmp = order[b];
+            order[b] = order[b - 1];
+            order[b - 1] = tmp;
+        }
+    }
+
+    for (size_t j = 1; j < fit->k; j++) {
+        size_t left = bin_of(fit->mean[order[j - 1]], n, lo_us, width_us);
+        size_t right = bin_of(fit->mean[order[j]], n, lo_us, width_us);
+        if (right <= left + 1) {
+            return false;
+        }
+        uint32_t valley = UINT32_MAX;
+        for (size_t i = left; i <= right; i++) {
+            valley = (smooth[i] < valley) ? smooth[i] : valley;
+        }
+        uint32_t lower_peak = (smooth[left] < smooth[right]) ? smooth[left] : smooth[right];
+        // Deeper than the counting noise as well, sparse bins have valleys everywhere
+        if ((valley > MODE_MAX_DIP * lower_peak) || ((lower_peak - valley) < 3.0f * sqrtf(lower_peak))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void latency_modes_fit(const uint32_t *bins, size_t n, float lo_us, float width_us, latency_modes_t *modes)
+{
+    uint32_t total = 0;
+    uint32_t smooth[SMOOTH_BINS_MAX];
+    em_fit_t best = { 0 };
+    float best_bic = INFINITY;
+
+    memset(modes, 0, sizeof(*modes));
+    for (size_t i = 0; i < n; i++) {
+        total += bins[i];
+    }
+    if ((total < LATENCY_MODES_MIN_SAMPLES) || (width_us <= 0.0f) || (n > SMOOTH_BINS_MAX)) {
+        return;
+    }
+    bins_smooth(bins, n, smooth);
+
+    for (size_t k = 1; k <= LATENCY_MODES_MAX; k++) {
+        // Start from the highest peaks, or from evenly spaced quantiles when there are not enough
+        float centres[LATENCY_MODES_MAX];
+        if (!bins_peaks(smooth, n, k, lo_us, width_us, centres)) {
+            for (size_t j = 0; j < k; j++) {
+                centres[j] = bins_quantile(bins, n, total, (2.0f * j + 1.0f) / (2.0f * k), lo_us, width_us);
+            }
+        }
+
+        em_fit_t fit = { .k = k };
+        em_run(bins, n, total, lo_us, width_us, centres, &fit);
+        if ((k > 1) && !em_modes_are_distinct(&fit, smooth, n, lo_us, width_us)) {
+            continue;
+        }
+
+        // Bayesian information criterion, 3k - 1 free parameters
+        float bic = -2.0f * fit.log_likelihood + (3.0f * k - 1.0f) * logf((float)total);
+        if (bic < best_bic) {
+            best_bic = bic;
+            best = fit;
+        }
+    }
+
+    // Report them ascending by centre
+    modes->count = best.k;
+    for (size_t j = 0; j < best.k; j++) {
+        size_t pos = 0;
+        for (size_t other = 0; other < best.k; other++) {
+            if (best.mean[other] < best.mean[j]) {
+                pos++;
+            }
+        }
+        modes->mode[pos].centre_us = best.mean[j];
+        modes->mode[pos].weight = best.weight[j];
+        modes->mode[pos].spread_us = sqrtf(best.var[j]);
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_MODES_H
+#define LATENCY_MODES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Multimodal latency distributions (RF retransmits, sensor/MCU scan slots).
+// A 1-D Gaussian mixture with 1..LATENCY_MODES_MAX components is fitted with EM to a binned
+// distribution of at most 128 bins. The number of modes is the one with the lowest BIC whose
+// components all carry a real share of the samples and have a clear valley in between, so a flat
+// or skewed single mode, e.g. the uniform wait for the next poll, is not split up.
+#define LATENCY_MODES_MAX           (3)
+#define LATENCY_MODES_MIN_SAMPLES   (50)
+
+typedef struct latency_mode {
+    float centre_us;
+    float weight;           // share of the samples, 0..1
+    float spread_us;        // standard deviation
+} latency_mode_t;
+
+typedef struct latency_modes {
+    uint32_t count;         // 0 when there are not enough samples
+    latency_mode_t mode[LATENCY_MODES_MAX];     // ascending by centre
+} latency_modes_t;
+
+// bins[i] samples at lo_us + (i + 0.5) * width_us
+void latency_modes_fit(const uint32_t *bins, size_t n, float lo_us, float width_us, latency_modes_t *modes);
+
+#endif //LATENCY_MODES_H
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "latency_stats.h"
+
+#define STATS_MEAN_SHIFT (16)
+
+// Product of two Q16 differences, in us^2. Large differences (above ~8 s) drop more
+// fractional bits first, so the product cannot overflow.
+static inline int64_t stats_mul_q16(int64_t a, int64_t b)
+{
+    if ((llabs(a) < (1LL << 39)) && (llabs(b) < (1LL << 39))) {
+        return ((a >> 8) * (b >> 8)) >> 16;
+    }
+    return (a >> STATS_MEAN_SHIFT) * (b >> STATS_MEAN_SHIFT);
+}
+
+static void stats_update_cache(latency_stats_t *stats)
+{
+    stats->mean_us = (uint32_t)((stats->sum_us + stats->count / 2) / stats->count);
+    stats->variance = (stats->count > 1) ? stats->m2 / (stats->count - 1) : 0;
+
+    // Single precision square root, done by the FPU (the double one is emulated in software)
+    stats->stdev_us = (uint32_t)(sqrtf((float)stats->variance) + 0.5f);
+}
+
+void latency_stats_reset(latency_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void latency_stats_add(latency_stats_t *stats, uint32_t value_us)
+{
+    int64_t x_q16 = (int64_t)value_us << STATS_MEAN_SHIFT;
+
+    stats->count++;
+    stats->last_us = value_us;
+
+    if (stats->count == 1) {
+        stats->min_us = value_us;
+        stats->max_us = value_us;
+    } else {
+        if (value_us < stats->min_us) {
+            stats->min_us = value_us;
+        }
+        if (value_us > stats->max_us) {
+            stats->max_us = value_us;
+        }
+    }
+
+    // Welford: the difference to the old and to the new mean.
+    // The mean comes from the exact sum, so rounding does not accumulate.
+    int64_t delta = x_q16 - stats->mean_q16;
+    stats->sum_us += value_us;
+    stats->mean_q16 = (int64_t)((stats->sum_us << STATS_MEAN_SHIFT) / stats->count);
+    int64_t delta2 = x_q16 - stats->mean_q16;
+    int64_t m2_inc = stats_mul_q16(delta, delta2);
+    if (m2_inc > 0) {
+        stats->m2 += (uint64_t)m2_inc;
+    }
+
+    stats_update_cache(stats);
+}
+
+// Combine two streams (Chan et al.), e.g. several channels into one total
+void latency_stats_merge(latency_stats_t *dst, const latency_stats_t *src)
+{
+    if (src->count == 0) {
+        return;
+    }
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+
+    uint64_t count = (uint64_t)dst->count + src->count;
+
+    // Merging is rare (not per sample), so double precision is fine here:
+    // m2 = m2_a + m2_b + delta^2 * n_a * n_b / n
+    double delta_us = (double)(src->mean_q16 - dst->mean_q16) / (1 << STATS_MEAN_SHIFT);
+    double weight = (double)dst->count * (double)src->count / (double)count;
+    dst->m2 += src->m2 + (uint64_t)(delta_us * delta_us * weight);
+
+    dst->count = (uint32_t)count;
+    dst->sum_us += src->sum_us;
+    dst->mean_q16 = (int64_t)((dst->sum_us << STATS_MEAN_SHIFT) / dst->count);
+    dst->last_us = src->last_us;
+    if (src->min_us < dst->min_us) {
+        dst->min_us = src->min_us;
+    }
+    if (src->max_us > dst->max_us) {
+        dst->max_us = src->max_us;
+    }
+
+    stats_update_cache(dst);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdint.h>
+
+// Streaming latency statistics, O(1) per sample.
+// Mean and variance use Welford's method in fixed point: the mean is derived from the exact
+// 64-bit sum in 1/65536 us, the sum of squared differences (M2) is kept in us^2.
+// The derived values are cached on every sample, so reading them is free.
+typedef struct latency_stats {
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;        // exact sum of all samples
+    int64_t  mean_q16;      // sum_us / count, in 1/65536 us
+    uint64_t m2;            // sum of squared differences from the mean, us^2
+
+    // cached results
+    uint32_t mean_us;
+    uint64_t variance;      // sample variance, us^2
+    uint32_t stdev_us;
+} latency_stats_t;
+
+void latency_stats_reset(latency_stats_t *stats);
+void latency_stats_add(latency_stats_t *stats, uint32_t value_us);
+void latency_stats_merge(latency_stats_t *dst, const latency_stats_t *src);
+
+#endif //LATENCY_STATS_H
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "latency_window.h"
+
+#define SLOT(i) ((i) % LATENCY_WINDOW_CAPACITY)
+
+static void part_add(latency_window_part_t *part, uint32_t value_us)
+{
+    part->count++;
+    part->sum_us += value_us;
+    part->sum_sq_us += (uint64_t)value_us * value_us;
+    latency_histogram_add(&part->hist, (uint64_t)value_us * 1000);
+}
+
+static void part_remove_oldest(latency_window_t *window, latency_window_part_t *part)
+{
+    uint32_t value_us = window->value_us[SLOT(part->tail)];
+    part->tail++;
+    part->count--;
+    part->sum_us -= value_us;
+    part->sum_sq_us -= (uint64_t)value_us * value_us;
+    latency_histogram_remove(&part->hist, (uint64_t)value_us * 1000);
+}
+
+// Drop the samples that no longer belong to the windows, based on the newest timestamp
+static void window_evict(latency_window_t *window, uint32_t now_ms)
+{
+    latency_window_part_t *by_samples = &window->part[LATENCY_WINDOW_SAMPLES];
+    latency_window_part_t *by_time = &window->part[LATENCY_WINDOW_TIME];
+
+    while (by_samples->count > window->max_samples) {
+        part_remove_oldest(window, by_samples);
+    }
+    while ((by_time->count > 0) && (now_ms - window->timestamp_ms[SLOT(by_time->tail)] > window->max_age_ms)) {
+        part_remove_oldest(window, by_time);
+    }
+}
+
+static void window_clear_parts(latency_window_t *window, uint32_t tail)
+{
+    for (int kind = 0; kind < LATENCY_WINDOW_KIND_MAX; kind++) {
+        latency_window_part_t *part = &window->part[kind];
+        part->tail = tail;
+        part->count = 0;
+        part->sum_us = 0;
+        part->sum_sq_us = 0;
+        latency_histogram_reset(&part->hist);
+    }
+}
+
+void latency_window_reset(latency_window_t *window)
+{
+    window->head = 0;
+    window_clear_parts(window, 0);
+}
+
+void latency_window_configure(latency_window_t *window, uint32_t max_samples, uint32_t max_age_ms)
+{
+    if (max_samples > LATENCY_WINDOW_CAPACITY) {
+        max_samples = LATENCY_WINDOW_CAPACITY;
+    }
+    if (max_samples == 0) {
+        max_samples = 1;
+    }
+    window->max_samples = max_samples;
+    window->max_age_ms = max_age_ms;
+
+    // Refill both windows from the ring, so a new size applies to the samples already seen
+    uint32_t available = (window->head < LATENCY_WINDOW_CAPACITY) ? window->head : LATENCY_WINDOW_CAPACITY;
+    uint32_t first = window->head - available;
+    window_clear_parts(window, first);
+    for (uint32_t i = first; i != window->head; i++) {
+        uint32_t value_us = window->value_us[SLOT(i)];
+        part_add(&window->part[LATENCY_WINDOW_SAMPLES], value_us);
+        part_add(&window->part[LATENCY_WINDOW_TIME], value_us);
+    }
+    if (available) {
+        window_evict(window, window->timestamp_ms[SLOT(window->head - 1)]);
+    }
+}
+
+void latency_window_add(latency_window_t *window, uint32_t timestamp_ms, uint32_t value_us)
+{
+    // The slot about to be overwritten must have left both windows
+    if (window->head >= LATENCY_WINDOW_CAPACITY) {
+        uint32_t oldest = window->head - LATENCY_WINDOW_CAPACITY;
+        for (int kind = 0; kind < LATENCY_WINDOW_KIND_MAX; kind++) {
+            if ((window->part[kind].count > 0) && (window->part[kind].tail == oldest)) {
+                part_remove_oldest(window, &window->part[kind]);
+            }
+        }
+    }
+
+    window->timestamp_ms[SLOT(window->head)] = timestamp_ms;
+    window->value_us[SLOT(window->head)] = value_us;
+    window->head++;
+
+    for (int kind = 0; kind < LATENCY_WINDOW_KIND_MAX; kind++) {
+        // An empty window starts at the new sample
+        if (window->part[kind].count == 0) {
+            window->part[kind].tail = window->head - 1;
+        }
+        part_add(&window->part[kind], value_us);
+    }
+    window_evict(window, timestamp_ms);
+}
+
+void latency_window_get(const latency_window_t *window, enum latency_window_kind kind, latency_window_result_t *result)
+{
+    static const float percentiles[] = { 50.0f, 90.0f, 99.0f };
+    uint64_t values_ns[3];
+
+    memset(result, 0, sizeof(*result));
+    if (kind >= LATENCY_WINDOW_KIND_MAX) {
+        return;
+    }
+
+    const latency_window_part_t *part = &window->part[kind];
+    if (part->count == 0) {
+        return;
+    }
+
+    // The sums are exact integers, so the textbook variance formula loses nothing here
+    result->count = part->count;
+    result->mean_us = (uint32_t)((part->sum_us + part->count / 2) / part->count);
+    if (part->count > 1) {
+        uint64_t sq_of_sum = (part->sum_us * part->sum_us) / part->count;
+        result->variance = (part->sum_sq_us - sq_of_sum) / (part->count - 1);
+    }
+    result->stdev_us = (uint32_t)(sqrtf((float)result->variance) + 0.5f);
+
+    latency_histogram_percentiles(&part->hist, percentiles, values_ns, 3);
+    result->p50_us = (uint32_t)((values_ns[0] + 500) / 1000);
+    result->p90_us = (uint32_t)((values_ns[1] + 500) / 1000);
+    result->p99_us = (uint32_t)((values_ns[2] + 500) / 1000);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_WINDOW_H
+#define LATENCY_WINDOW_H
+
+#include <stdint.h>
+#include "latency_histogram.h"
+
+// Sliding-window latency statistics, next to the cumulative ones.
+// The last LATENCY_WINDOW_CAPACITY samples are kept in a ring. Two windows are suffixes of it:
+// the last N samples and the samples of the last T milliseconds. Each keeps its own sums and a
+// histogram, updated in O(1) when a sample enters or leaves, so mean, stdev and percentiles are
+// always available. The time window ages out on new samples only, and is capped by the ring size.
+#define LATENCY_WINDOW_CAPACITY     (2048)
+
+typedef enum latency_window_kind {
+    LATENCY_WINDOW_SAMPLES = 0,     // last N samples
+    LATENCY_WINDOW_TIME,            // last T milliseconds
+    LATENCY_WINDOW_KIND_MAX,
+} latency_window_kind_t;
+
+typedef struct latency_window_part {
+    uint32_t tail;          // absolute index of the oldest sample in the window
+    uint32_t count;
+    uint64_t sum_us;
+    uint64_t sum_sq_us;
+    latency_histogram_t hist;
+} latency_window_part_t;
+
+typedef struct latency_window {
+    uint32_t head;          // absolute index of the next sample, the ring slot is head % capacity
+    uint32_t max_samples;
+    uint32_t max_age_ms;
+    uint32_t timestamp_ms[LATENCY_WINDOW_CAPACITY];
+    uint32_t value_us[LATENCY_WINDOW_CAPACITY];
+    latency_window_part_t part[LATENCY_WINDOW_KIND_MAX];
+} latency_window_t;
+
+typedef struct latency_window_result {
+    uint32_t count;
+    uint32_t mean_us;
+    uint64_t variance;      // sample variance, us^2
+    uint32_t stdev_us;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+} latency_window_result_t;
+
+void latency_window_reset(latency_window_t *window);
+void latency_window_configure(latency_window_t *window, uint32_t max_samples, uint32_t max_age_ms);
+void latency_window_add(latency_window_t *window, uint32_t timestamp_ms, uint32_t value_us);
+void latency_window_get(const latency_window_t *window, enum latency_window_kind kind, latency_window_result_t *result);
+
+#endif //LATENCY_WINDOW_H
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "logic_capture.h"
+#include "bounce_capture.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define CHUNK_SAMPLES           (32768)     // per DMA transfer, the counter is 16 bit
+
+static uint16_t *buffer = NULL;
+static size_t chunk_total = 0;              // usable chunks, one more catches the samples until the stop
+
+static volatile logic_capture_state_t state = LOGIC_CAPTURE_IDLE;
+static volatile size_t chunks_done = 0;
+static volatile bool hw_done = false;
+
+static size_t port = 0;
+static uint32_t rate_mhz = 1;
+static uint32_t start_us = 0;
+static uint16_t pin_mask = 0;
+static uint16_t initial_level = 0;          // the buffer is shared with the bounce capture
+static bool click = false;
+static bool click_pressed = false;
+static uint32_t start_ms = 0;
+
+static logic_edge_t edges[LOGIC_CAPTURE_EDGES_MAX];
+static size_t edge_count = 0;
+static uint32_t edges_dropped = 0;
+
+static void hw_stop(void)
+{
+    __HAL_TIM_DISABLE_DMA(&htim1, TIM_DMA_UPDATE);
+    __HAL_TIM_DISABLE(&htim1);
+}
+
+// DMA interrupt: a chunk is full, the DMA goes on in the other half
+static void chunk_complete(DMA_HandleTypeDef *hdma, HAL_DMA_MemoryTypeDef memory)
+{
+    size_t done = chunks_done + 1;
+    chunks_done = done;
+
+    if (done >= chunk_total) {
+        hw_stop();
+        hw_done = true;
+        return;
+    }
+    HAL_DMAEx_ChangeMemory(hdma, (uint32_t)&buffer[(done + 1) * CHUNK_SAMPLES], memory);
+}
+
+static void m0_complete(DMA_HandleTypeDef *hdma)
+{
+    chunk_complete(hdma, MEMORY0);
+}
+
+static void m1_complete(DMA_HandleTypeDef *hdma)
+{
+    chunk_complete(hdma, MEMORY1);
+}
+
+static void transfer_error(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    hw_stop();
+    hw_done = true;
+}
+
+bool logic_capture_init(void *buf, size_t size)
+{
+    size_t chunks = size / (CHUNK_SAMPLES * sizeof(uint16_t));
+    if (chunks < 3) {
+        return false;
+    }
+    buffer = (uint16_t *)buf;
+    chunk_total = chunks - 1;
+    return true;
+}
+
+size_t logic_capture_extract(const uint16_t *samples, size_t n, uint16_t mask,
+                             logic_edge_t *out, size_t out_max, uint32_t *dropped)
+{
+    size_t count = 0;
+    uint64_t mask4 = mask * 0x0001000100010001ULL;
+    uint64_t prev = samples[0];
+    size_t words = n / 4;
+
+    *dropped = 0;
+
+    // Four samples at a time, against the same word shifted by one sample: most of a capture
+    // has no edges and goes by at memory speed
+    const uint64_t *word = (const uint64_t *)samples;
+    for (size_t w = 0; w <= words; w++) {
+        uint64_t x;
+        size_t valid = 4;
+        if (w < words) {
+            x = word[w];
+        } else {
+            // The last few samples
+            valid = n % 4;
+            if (valid == 0) {
+                break;
+            }
+            x = 0;
+            for (size_t k = 0; k < valid; k++) {
+                x |= (uint64_t)samples[w * 4 + k] << (16 * k);
+            }
+        }
+
+        uint64_t diff = (x ^ ((x << 16) | prev)) & mask4;
+        prev = x >> 48;
+        if (diff == 0) {
+            continue;
+        }
+        for (size_t k = 0; k < valid; k++) {
+            uint16_t changed = (uint16_t)(diff >> (16 * k));
+            if (changed == 0) {
+                continue;
+            }
+            if (count >= out_max) {
+                (*dropped)++;
+                continue;
+            }
+            uint16_t level = (uint16_t)(x >> (16 * k));
+            out[count].sample = w * 4 + k;
+            out[count].rising = changed & level;
+            out[count].falling = changed & ~level;
+            count++;
+        }
+    }
+    return count;
+}
+
+static void print_edges(void)
+{
+    printf("[logic] %s @ %lu MHz, %lu samples from %lu, %u edges", hw_capture_port_name(port), rate_mhz,
+           logic_capture_sample_count(), start_us, edge_count);
+    if (edges_dropped) {
+        printf(" (%lu more not kept)", edges_dropped);
+    }
+    printf("\n[logic] time_us;offset_ns;pin;edge\n");
+
+    for (size_t i = 0; i < edge_count; i++) {
+        const logic_edge_t *edge = &edges[i];
+        for (size_t pin = 0; pin < 16; pin++) {
+            uint16_t bit = 1 << pin;
+            if ((edge->rising | edge->falling) & bit) {
+                printf("[logic] %lu;%lu;%s;%s\n", logic_capture_sample_time_us(edge->sample),
+                       logic_capture_sample_offset_ns(edge->sample), hw_capture_pin_name(port, pin),
+                       (edge->rising & bit) ? "rise" : "fall");
+            }
+        }
+    }
+}
+
+static void finish(void)
+{
+    HAL_DMA_Abort(&hdma_tim1_up);
+
+    uint32_t samples = logic_capture_sample_count();
+    SCB_InvalidateDCache_by_Addr((uint32_t *)buffer, samples * sizeof(uint16_t));
+    initial_level = buffer[0] & pin_mask;
+    edge_count = logic_capture_extract(buffer, samples, pin_mask, edges, LOGIC_CAPTURE_EDGES_MAX, &edges_dropped);
+    state = LOGIC_CAPTURE_DONE;
+    print_edges();
+}
+
+bool logic_capture_start(size_t capture_port, uint32_t rate, bool with_click)
+{
+    if ((buffer == NULL) || (state == LOGIC_CAPTURE_RUNNING) || bounce_capture_is_running() ||
+        (capture_port >= HW_CAPTURE_PORT_MAX) || (rate == 0) || (HW_CAPTURE_CLOCK_MHZ % rate)) {
+        return false;
+    }
+    port = capture_port;
+    rate_mhz = rate;
+    click = with_click;
+    click_pressed = false;
+    start_ms = 0;
+    edge_count = 0;
+    edges_dropped = 0;
+
+    // Only the header pins, the others on the port toggle with other peripherals
+    pin_mask = 0;
+    for (size_t pin = 0; pin < 16; pin++) {
+        if (hw_capture_pin_name(port, pin)) {
+            pin_mask |= 1 << pin;
+        }
+    }
+
+    hw_stop();
+    HAL_DMA_Abort(&hdma_tim1_up);
+    SCB_InvalidateDCache_by_Addr((uint32_t *)buffer, (chunk_total + 1) * CHUNK_SAMPLES * sizeof(uint16_t));
+
+    __HAL_TIM_SET_PRESCALER(&htim1, 0);
+    __HAL_TIM_SET_AUTORELOAD(&htim1, HW_CAPTURE_CLOCK_MHZ / rate_mhz - 1);
+    __HAL_TIM_SET_COUNTER(&htim1, 0);
+    HAL_TIM_GenerateEvent(&htim1, TIM_EVENTSOURCE_UPDATE);
+    __HAL_TIM_CLEAR_FLAG(&htim1, TIM_FLAG_UPDATE);
+
+    chunks_done = 0;
+    hw_done = false;
+    hdma_tim1_up.XferCpltCallback = m0_complete;
+    hdma_tim1_up.XferM1CpltCallback = m1_complete;
+    hdma_tim1_up.XferErrorCallback = transfer_error;
+    if (HAL_DMAEx_MultiBufferStart_IT(&hdma_tim1_up, hw_capture_port_idr_address(port), (uint32_t)&buffer[0],
+                                      (uint32_t)&buffer[CHUNK_SAMPLES], CHUNK_SAMPLES) != HAL_OK) {
+        return false;
+    }
+    __HAL_TIM_ENABLE_DMA(&htim1, TIM_DMA_UPDATE);
+    state = LOGIC_CAPTURE_RUNNING;
+
+    // Start right after a tick of the time base, so the sample times line up with it
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now_us = xlat_counter_1mhz_get();
+    while (xlat_counter_1mhz_get() == now_us) {
+    }
+    __HAL_TIM_ENABLE(&htim1);
+    __set_PRIMASK(primask);
+    start_us = now_us + 1;
+
+    printf("Logic capture: %s @ %lu MHz, %lu samples\n", hw_capture_port_name(port), rate_mhz,
+           logic_capture_sample_count());
+    return true;
+}
+
+void logic_capture_stop(void)
+{
+    if (state != LOGIC_CAPTURE_RUNNING) {
+        return;
+    }
+    hw_stop();
+    HAL_DMA_Abort(&hdma_tim1_up);
+    if (click_pressed) {
+        xlat_auto_trigger_set(false);
+    }
+    state = LOGIC_CAPTURE_IDLE;
+}
+
+logic_capture_state_t logic_capture_get_state(void)
+{
+    return state;
+}
+
+void logic_capture_tick(uint32_t now_ms)
+{
+    if (state != LOGIC_CAPTURE_RUNNING) {
+        return;
+    }
+    if (start_ms == 0) {
+        start_ms = now_ms ? now_ms : 1;
+    }
+
+    if (click && !click_pressed && (now_ms - start_ms >= LOGIC_CAPTURE_CLICK_MS)) {
+        xlat_auto_trigger_set(true);
+        click_pressed = true;
+    } else if (click_pressed && (now_ms - start_ms >= LOGIC_CAPTURE_CLICK_MS + AUTO_TRIGGER_PRESS_MS)) {
+        xlat_auto_trigger_set(false);
+        click = false;
+        click_pressed = false;
+    }
+
+    if (hw_done) {
+        if (click_pressed) {
+            xlat_auto_trigger_set(false);
+            click_pressed = false;
+        }
+        finish();
+    }
+}
+
+size_t logic_capture_port(void)
+{
+    return port;
+}
+
+uint32_t logic_capture_rate_mhz(void)
+{
+    return rate_mhz;
+}
+
+uint32_t logic_capture_sample_count(void)
+{
+    return chunk_total * CHUNK_SAMPLES;
+}
+
+uint32_t logic_capture_start_us(void)
+{
+    return start_us;
+}
+
+uint16_t logic_capture_pin_mask(void)
+{
+    return pin_mask;
+}
+
+uint16_t logic_capture_initial_level(void)
+{
+    return (state == LOGIC_CAPTURE_DONE) ? initial_level : 0;
+}
+
+size_t logic_capture_edge_count(void)
+{
+    return edge_count;
+}
+
+uint32_t logic_capture_edges_dropped(void)
+{
+    return edges_dropped;
+}
+
+const logic_edge_t * logic_capture_get_edge(size_t edge)
+{
+    return (edge < edge_count) ? &edges[edge] : NULL;
+}
+
+// Sample N is taken at the (N+1)th update event after the start
+uint32_t logic_capture_sample_offset_ns(uint32_t sample)
+{
+    uint64_t ticks = (uint64_t)(sample + 1) * (HW_CAPTURE_CLOCK_MHZ / rate_mhz);
+    return (uint32_t)(ticks * 1000 / HW_CAPTURE_CLOCK_MHZ);
+}
+
+uint32_t logic_capture_sample_time_us(uint32_t sample)
+{
+    uint64_t ticks = (uint64_t)(sample + 1) * (HW_CAPTURE_CLOCK_MHZ / rate_mhz);
+    return start_us + (uint32_t)((ticks + HW_CAPTURE_CLOCK_MHZ / 2) / HW_CAPTURE_CLOCK_MHZ);
+}
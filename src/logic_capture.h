@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGIC_CAPTURE_H
+#define LOGIC_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Logic analyzer capture of a GPIO port.
+// TIM1 update events sample the whole input register by DMA into SDRAM at 1-10 MHz, so the
+// switch lines, the trigger outputs and any other header pin on the port are recorded together,
+// with no interrupt per edge and no hold-off. The DMA runs in double buffer mode over 64 KB
+// chunks, its interrupt only moves the finished chunk further into the buffer. Afterwards the
+// edges are extracted by comparing four samples at a time against the samples before them, and
+// every edge is timestamped on the 1 MHz time base of the USB reports.
+#define LOGIC_CAPTURE_EDGES_MAX     (1024)
+#define LOGIC_CAPTURE_CLICK_MS      (5)     // optional click after the start
+
+typedef enum logic_capture_state {
+    LOGIC_CAPTURE_IDLE = 0,
+    LOGIC_CAPTURE_RUNNING,
+    LOGIC_CAPTURE_DONE,
+} logic_capture_state_t;
+
+typedef struct logic_edge {
+    uint32_t sample;
+    uint16_t rising;        // pin masks
+    uint16_t falling;
+} logic_edge_t;
+
+bool logic_capture_init(void *buffer, size_t size);
+bool logic_capture_start(size_t port, uint32_t rate_mhz, bool click);
+void logic_capture_stop(void);
+logic_capture_state_t logic_capture_get_state(void);
+
+// Gfx task: presses and releases the optional click and extracts the edges when the capture is done
+void logic_capture_tick(uint32_t now_ms);
+
+size_t logic_capture_port(void);
+uint32_t logic_capture_rate_mhz(void);
+uint32_t logic_capture_sample_count(void);
+uint32_t logic_capture_start_us(void);
+uint16_t logic_capture_pin_mask(void);
+uint16_t logic_capture_initial_level(void);
+size_t logic_capture_edge_count(void);
+uint32_t logic_capture_edges_dropped(void);
+const logic_edge_t * logic_capture_get_edge(size_t edge);
+// Time of a sample, from the start of the capture and on the time base
+uint32_t logic_capture_sample_offset_ns(uint32_t sample);
+uint32_t logic_capture_sample_time_us(uint32_t sample);
+
+// Edge extraction on its own, for a buffer of n samples: returns the number of edges found
+size_t logic_capture_extract(const uint16_t *samples, size_t n, uint16_t mask,
+                             logic_edge_t *edges, size_t edges_max, uint32_t *dropped);
+
+#endif //LOGIC_CAPTURE_H
@@ -31,7 +31,7 @@ osThreadId lvglTaskHandle;
 osPoolDef(hidevt_pool, 16, hid_event_t);               // Define memory pool
 osPoolId  hidevt_pool;
 
-osPoolDef(gfxevt_pool, 16, gfx_event_t);               // Define memory pool
+osPoolDef(gfxevt_pool, 16, struct gfx_event);               // Define memory pool
 osPoolId  gfxevt_pool;
 
 osMessageQDef(msgQUsbClick, 16, hid_event_t *);              // Define message queue
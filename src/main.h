@@ -363,6 +363,14 @@ void Error_Handler(void);
 
 extern UART_HandleTypeDef huart1;
 extern TIM_HandleTypeDef htim2;
+extern TIM_HandleTypeDef htim8;
+extern DMA_HandleTypeDef hdma_tim8_up;
+extern DMA_HandleTypeDef hdma_tim8_ch1;
+extern TIM_HandleTypeDef htim1;
+extern DMA_HandleTypeDef hdma_tim1_up;
+extern DMA_HandleTypeDef hdma_tim2_ch1;
+extern ADC_HandleTypeDef hadc2;
+extern DMA_HandleTypeDef hdma_adc2;
 
 extern const osPoolDef_t os_pool_def_hidevt_pool;
 extern const osMessageQDef_t os_messageQ_def_MsgBox;
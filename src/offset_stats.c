@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include "offset_stats.h"
+
+void offset_stats_add(offset_stats_t *stats, int32_t value)
+{
+    if ((stats->count == 0) || (value < stats->min)) {
+        stats->min = value;
+    }
+    if ((stats->count == 0) || (value > stats->max)) {
+        stats->max = value;
+    }
+    stats->count++;
+    stats->sum += value;
+    stats->sum_sq += (int64_t)value * value;
+}
+
+float offset_stats_variance(const offset_stats_t *stats)
+{
+    if (stats->count < 2) {
+        return 0.0f;
+    }
+    int64_t n = stats->count;
+    int64_t numerator = n * stats->sum_sq - stats->sum * stats->sum;
+    return (float)numerator / (float)(n * (n - 1));
+}
+
+int32_t offset_stats_mean_ns(const offset_stats_t *stats, int32_t unit_ns)
+{
+    if (stats->count == 0) {
+        return 0;
+    }
+    return (int32_t)(stats->sum * unit_ns / (int64_t)stats->count);
+}
+
+uint32_t offset_stats_stdev_ns(const offset_stats_t *stats, int32_t unit_ns)
+{
+    return (uint32_t)(sqrtf(offset_stats_variance(stats)) * unit_ns + 0.5f);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OFFSET_STATS_H
+#define OFFSET_STATS_H
+
+#include <stdint.h>
+
+// Signed values (timestamp offsets, measurement errors) in whole units of unit_ns, with exact
+// 64-bit sums. The variance uses the integer numerator n * sum_sq - sum^2, so nothing cancels,
+// and single precision is enough for the rest. n * sum_sq stays below 2^63 for values up to
+// 10^5 units over 2 * 10^4 samples.
+typedef struct offset_stats {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    int64_t sum_sq;
+} offset_stats_t;
+
+void offset_stats_add(offset_stats_t *stats, int32_t value);
+// Sample variance in units^2, 0 below two values
+float offset_stats_variance(const offset_stats_t *stats);
+int32_t offset_stats_mean_ns(const offset_stats_t *stats, int32_t unit_ns);
+uint32_t offset_stats_stdev_ns(const offset_stats_t *stats, int32_t unit_ns);
+
+#endif //OFFSET_STATS_H
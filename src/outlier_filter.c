@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "outlier_filter.h"
+
+// Lower bound of the MAD, relative to the median. Very stable devices can have a MAD of a few
+// us, which would otherwise flag normal polling jitter.
+#define MAD_MIN_PERMILLE    (10)
+#define MAD_MIN_US          (10)
+
+// First position in the sorted history with a value >= value
+static uint32_t sorted_lower_bound(const outlier_filter_t *filter, uint32_t value)
+{
+    uint32_t lo = 0;
+    uint32_t hi = filter->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (filter->sorted[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void sorted_remove(outlier_filter_t *filter, uint32_t value)
+{
+    uint32_t pos = sorted_lower_bound(filter, value);
+    memmove(&filter->sorted[pos], &filter->sorted[pos + 1], (filter->count - pos - 1) * sizeof(uint32_t));
+    filter->count--;
+}
+
+static void sorted_insert(outlier_filter_t *filter, uint32_t value)
+{
+    uint32_t pos = sorted_lower_bound(filter, value);
+    memmove(&filter->sorted[pos + 1], &filter->sorted[pos], (filter->count - pos) * sizeof(uint32_t));
+    filter->sorted[pos] = value;
+    filter->count++;
+}
+
+// The absolute deviations grow outward from the median on both sides of the sorted history,
+// so their median is found by merging the two sides, no second sort needed
+static uint32_t sorted_mad(const outlier_filter_t *filter)
+{
+    uint32_t n = filter->count;
+    uint32_t m = n / 2;
+    int32_t left = (int32_t)m - 1;
+    uint32_t right = m + 1;
+    uint32_t deviation = 0;
+
+    for (uint32_t rank = 1; rank <= n / 2; rank++) {
+        uint32_t dev_left = (left >= 0) ? filter->median_us - filter->sorted[left] : UINT32_MAX;
+        uint32_t dev_right = (right < n) ? filter->sorted[right] - filter->median_us : UINT32_MAX;
+        if (dev_left <= dev_right) {
+            deviation = dev_left;
+            left--;
+        } else {
+            deviation = dev_right;
+            right++;
+        }
+    }
+    return deviation;
+}
+
+void outlier_filter_reset(outlier_filter_t *filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+bool outlier_filter_add(outlier_filter_t *filter, uint32_t value_us, uint32_t sensitivity)
+{
+    bool outlier = false;
+
+    // Judge the sample against the history before it
+    if ((sensitivity > 0) && (filter->count >= OUTLIER_MIN_SAMPLES)) {
+        uint32_t mad = filter->mad_us;
+        uint32_t mad_min = filter->median_us * MAD_MIN_PERMILLE / 1000;
+        if (mad_min < MAD_MIN_US) {
+            mad_min = MAD_MIN_US;
+        }
+        if (mad < mad_min) {
+            mad = mad_min;
+        }
+
+        // 1.4826 * MAD in 1/1024 steps
+        uint64_t limit = ((uint64_t)sensitivity * mad * 1518) >> 10;
+        uint32_t deviation = (value_us > filter->median_us) ? value_us - filter->median_us
+                                                            : filter->median_us - value_us;
+        outlier = deviation > limit;
+    }
+
+    // Slide the history
+    if (filter->count == OUTLIER_HISTORY) {
+        sorted_remove(filter, filter->history[filter->next]);
+    }
+    filter->history[filter->next] = value_us;
+    filter->next = (filter->next + 1) % OUTLIER_HISTORY;
+    sorted_insert(filter, value_us);
+
+    filter->median_us = filter->sorted[filter->count / 2];
+    filter->mad_us = sorted_mad(filter);
+    return outlier;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTLIER_FILTER_H
+#define OUTLIER_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Online robust outlier detector. The median and the median absolute deviation (MAD) of the
+// last OUTLIER_HISTORY samples are the reference; a new sample is an outlier when it is more
+// than `sensitivity` scaled MADs (1.4826 * MAD, the stdev of normal data) away from the median.
+// Outliers still enter the history, so a real shift of the device is adopted after about half
+// of OUTLIER_HISTORY samples.
+#define OUTLIER_HISTORY         (63)
+#define OUTLIER_MIN_SAMPLES     (16)    // nothing is flagged before that
+
+typedef struct outlier_filter {
+    uint32_t history[OUTLIER_HISTORY];  // ring, in arrival order
+    uint32_t sorted[OUTLIER_HISTORY];   // same values, ascending
+    uint32_t count;
+    uint32_t next;
+    uint32_t median_us;
+    uint32_t mad_us;
+} outlier_filter_t;
+
+void outlier_filter_reset(outlier_filter_t *filter);
+
+// Returns true when the value is an outlier against the samples seen before it.
+// A sensitivity of 0 disables the detection.
+bool outlier_filter_add(outlier_filter_t *filter, uint32_t value_us, uint32_t sensitivity);
+
+#endif //OUTLIER_FILTER_H
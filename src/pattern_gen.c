@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pattern_gen.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+
+#define TIMER_PERIOD_MAX        (65536)     // ticks, 655 us
+#define MIN_DELAY_TICKS         (PATTERN_GEN_MIN_DELAY_NS / HW_PATTERN_TICK_NS)
+#define LEAD_NS                 (1000)      // before the first step of a run
+#define TAP_COUNT               (8)
+#define TAP_HOLD_NS             (10 * 1000 * 1000)
+#define MATCH_WINDOW_US         (1000000)   // older steps do not belong to a report
+
+typedef struct pattern_event {
+    uint32_t time_ns;
+    uint8_t  key;
+    bool     press;
+} pattern_event_t;
+
+static pattern_step_t steps[PATTERN_GEN_STEPS_MAX];
+static size_t step_count = 0;
+static uint32_t step_ticks[PATTERN_GEN_STEPS_MAX];   // from the start of a run
+
+// DMA tables: the BSRR word at the end of every timer period, and the ARR of every period.
+// The ARR of period N+1 is written by the CC1 request in period N, so the table is one ahead.
+static uint32_t hw_bsrr[PATTERN_GEN_HW_STEPS_MAX] __attribute__((aligned(32)));
+static uint32_t hw_arr[PATTERN_GEN_HW_STEPS_MAX + 1] __attribute__((aligned(32)));
+static size_t hw_count = 0;
+
+static bool running = false;
+static bool run_active = false;
+static uint32_t runs = 0;
+static uint32_t runs_total = 0;
+static uint32_t state_ms = 0;
+static uint32_t gap_ms = PATTERN_GEN_GAP_MS;
+
+// Read by the USB host task to match reports against the steps
+static volatile bool run_valid = false;
+static volatile uint32_t run_start_us = 0;
+static size_t key_next[HW_PATTERN_OUTPUT_MAX];
+
+static const char *kind_names[PATTERN_KIND_MAX] = {
+    "Chord",
+    "Staggered",
+    "Rollover",
+    "Rapid tap",
+};
+
+// BSRR word for a step: the upper half resets pins, the lower half sets them
+static uint32_t pattern_word(uint16_t press, uint16_t release)
+{
+    bool high = xlat_auto_trigger_level_is_high();
+    uint32_t set = 0;
+    uint32_t reset = 0;
+
+    for (size_t key = 0; key < HW_PATTERN_OUTPUT_MAX; key++) {
+        uint16_t pin = hw_pattern_output_pin(key);
+        if (press & (1 << key)) {
+            *(high ? &set : &reset) |= pin;
+        }
+        if (release & (1 << key)) {
+            *(high ? &reset : &set) |= pin;
+        }
+    }
+    return set | (reset << 16);
+}
+
+static bool compile(void)
+{
+    uint32_t ticks = 0;
+    hw_count = 0;
+
+    for (size_t i = 0; i < step_count; i++) {
+        uint32_t delay = steps[i].delay_ns / HW_PATTERN_TICK_NS;
+        delay = (delay < MIN_DELAY_TICKS) ? MIN_DELAY_TICKS : delay;
+
+        // Delays longer than a timer period get filler periods that write nothing,
+        // without leaving a too short remainder
+        while (delay > TIMER_PERIOD_MAX) {
+            uint32_t filler = (delay - TIMER_PERIOD_MAX < MIN_DELAY_TICKS) ? TIMER_PERIOD_MAX / 2 : TIMER_PERIOD_MAX;
+            if (hw_count >= PATTERN_GEN_HW_STEPS_MAX) {
+                return false;
+            }
+            hw_arr[hw_count] = filler - 1;
+            hw_bsrr[hw_count] = 0;
+            hw_count++;
+            ticks += filler;
+            delay -= filler;
+        }
+
+        if (hw_count >= PATTERN_GEN_HW_STEPS_MAX) {
+            return false;
+        }
+        hw_arr[hw_count] = delay - 1;
+        hw_bsrr[hw_count] = pattern_word(steps[i].press, steps[i].release);
+        hw_count++;
+        ticks += delay;
+        step_ticks[i] = ticks;
+    }
+    // Written in the last period, never used
+    hw_arr[hw_count] = TIMER_PERIOD_MAX - 1;
+    return (hw_count > 0);
+}
+
+static void hw_stop(void)
+{
+    __HAL_TIM_DISABLE_DMA(&htim8, TIM_DMA_UPDATE | TIM_DMA_CC1);
+    __HAL_TIM_DISABLE(&htim8);
+    HAL_DMA_Abort(&hdma_tim8_up);
+    HAL_DMA_Abort(&hdma_tim8_ch1);
+}
+
+static void run_start(void)
+{
+    run_valid = false;
+    hw_stop();
+
+    SCB_CleanDCache_by_Addr(hw_bsrr, sizeof(hw_bsrr));
+    SCB_CleanDCache_by_Addr(hw_arr, sizeof(hw_arr));
+
+    // Load the first period, the update event writes nothing as its DMA request is still off
+    __HAL_TIM_SET_COUNTER(&htim8, 0);
+    __HAL_TIM_SET_AUTORELOAD(&htim8, hw_arr[0]);
+    HAL_TIM_GenerateEvent(&htim8, TIM_EVENTSOURCE_UPDATE);
+    __HAL_TIM_CLEAR_FLAG(&htim8, TIM_FLAG_UPDATE | TIM_FLAG_CC1);
+
+    HAL_DMA_Start(&hdma_tim8_up, (uint32_t)hw_bsrr, (uint32_t)&HW_PATTERN_GPIO_Port->BSRR, hw_count);
+    HAL_DMA_Start(&hdma_tim8_ch1, (uint32_t)&hw_arr[1], (uint32_t)&htim8.Instance->ARR, hw_count);
+    __HAL_TIM_ENABLE_DMA(&htim8, TIM_DMA_UPDATE | TIM_DMA_CC1);
+    memset(key_next, 0, sizeof(key_next));
+
+    // Start right after a tick of the time base, so the step times line up with it
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now_us = xlat_counter_1mhz_get();
+    while (xlat_counter_1mhz_get() == now_us) {
+    }
+    __HAL_TIM_ENABLE(&htim8);
+    __set_PRIMASK(primask);
+
+    run_start_us = now_us + 1;
+    run_valid = true;
+    run_active = true;
+    printf("[pattern] run %lu @ %lu\n", runs + 1, run_start_us);
+}
+
+static void print_schedule(void)
+{
+    printf("[pattern] %u steps, %u timer periods, %lu runs\n", step_count, hw_count, runs_total);
+    printf("[pattern] step;offset_ns;press;release\n");
+    for (size_t i = 0; i < step_count; i++) {
+        printf("[pattern] %u;%lu;0x%x;0x%x\n", i, pattern_gen_step_offset_ns(i), steps[i].press, steps[i].release);
+    }
+}
+
+void pattern_gen_clear(void)
+{
+    if (running) {
+        pattern_gen_stop();
+    }
+    step_count = 0;
+    run_valid = false;
+}
+
+bool pattern_gen_add_step(uint32_t delay_ns, uint16_t press, uint16_t release)
+{
+    uint16_t keys = (1 << HW_PATTERN_OUTPUT_MAX) - 1;
+
+    if (running || (step_count >= PATTERN_GEN_STEPS_MAX) || (press & release) || ((press | release) & ~keys)) {
+        return false;
+    }
+    steps[step_count].delay_ns = delay_ns;
+    steps[step_count].press = press;
+    steps[step_count].release = release;
+    step_count++;
+    return true;
+}
+
+static size_t add_event(pattern_event_t *events, size_t n, uint32_t time_ns, size_t key, bool press)
+{
+    // Insertion sort by time, events at the same time keep their order
+    size_t i = n;
+    while ((i > 0) && (events[i - 1].time_ns > time_ns)) {
+        events[i] = events[i - 1];
+        i--;
+    }
+    events[i].time_ns = time_ns;
+    events[i].key = key;
+    events[i].press = press;
+    return n + 1;
+}
+
+bool pattern_gen_build(pattern_kind_t kind, size_t keys, uint32_t spacing_ns)
+{
+    pattern_event_t events[PATTERN_GEN_STEPS_MAX];
+    uint32_t hold_ns = AUTO_TRIGGER_PRESS_MS * 1000 * 1000;
+    size_t n = 0;
+
+    if ((keys == 0) || (keys > HW_PATTERN_OUTPUT_MAX) || (kind >= PATTERN_KIND_MAX)) {
+        return false;
+    }
+
+    for (size_t key = 0; key < keys; key++) {
+        switch (kind) {
+            case PATTERN_CHORD:
+                n = add_event(events, n, 0, key, true);
+                n = add_event(events, n, hold_ns, key, false);
+                break;
+
+            case PATTERN_STAGGERED:
+                n = add_event(events, n, key * spacing_ns, key, true);
+                n = add_event(events, n, (keys - 1) * spacing_ns + hold_ns, key, false);
+                break;
+
+            case PATTERN_ROLLOVER: {
+                // The next key goes down while this one is held, this one is up before the one after
+                uint32_t step_ns = (spacing_ns > hold_ns) ? spacing_ns : hold_ns;
+                n = add_event(events, n, key * step_ns, key, true);
+                n = add_event(events, n, (key + 2) * step_ns, key, false);
+                break;
+            }
+
+            case PATTERN_RAPID_TAP:
+                for (uint32_t tap = 0; tap < TAP_COUNT; tap++) {
+                    uint32_t at_ns = tap * 2 * TAP_HOLD_NS + key * spacing_ns;
+                    n = add_event(events, n, at_ns, key, true);
+                    n = add_event(events, n, at_ns + TAP_HOLD_NS, key, false);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // Events at the same time make one step
+    pattern_gen_clear();
+    uint32_t prev_ns = 0;
+    for (size_t i = 0; i < n; ) {
+        uint32_t time_ns = events[i].time_ns;
+        uint16_t press = 0;
+        uint16_t release = 0;
+        for (; (i < n) && (events[i].time_ns == time_ns); i++) {
+            if (events[i].press) {
+                press |= 1 << events[i].key;
+            } else {
+                release |= 1 << events[i].key;
+            }
+        }
+        uint32_t delay_ns = (step_count == 0) ? time_ns + LEAD_NS : time_ns - prev_ns;
+        if (!pattern_gen_add_step(delay_ns, press, release)) {
+            return false;
+        }
+        prev_ns = time_ns;
+    }
+    return true;
+}
+
+const char * pattern_gen_kind_name(pattern_kind_t kind)
+{
+    if (kind >= PATTERN_KIND_MAX) {
+        return "";
+    }
+    return kind_names[kind];
+}
+
+size_t pattern_gen_step_count(void)
+{
+    return step_count;
+}
+
+const pattern_step_t * pattern_gen_get_step(size_t step)
+{
+    return (step < step_count) ? &steps[step] : NULL;
+}
+
+uint32_t pattern_gen_step_offset_ns(size_t step)
+{
+    return (step < step_count) ? step_ticks[step] * HW_PATTERN_TICK_NS : 0;
+}
+
+uint32_t pattern_gen_step_time_us(size_t step)
+{
+    if (step >= step_count) {
+        return 0;
+    }
+    return run_start_us + (step_ticks[step] + HW_PATTERN_TICKS_PER_US / 2) / HW_PATTERN_TICKS_PER_US;
+}
+
+bool pattern_gen_start(uint32_t count)
+{
+    if (running || (step_count == 0)) {
+        return false;
+    }
+    if (!compile()) {
+        printf("Pattern generator: the pattern needs more than %d timer periods\n", PATTERN_GEN_HW_STEPS_MAX);
+        return false;
+    }
+
+    runs = 0;
+    runs_total = count ? count : 1;
+    run_active = false;
+    state_ms = 0;
+    gap_ms = 0;
+    running = true;
+    print_schedule();
+    return true;
+}
+
+void pattern_gen_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    running = false;
+    run_active = false;
+    hw_stop();
+
+    // Let go of everything, also when stopped halfway through a run
+    HW_PATTERN_GPIO_Port->BSRR = pattern_word(0, (1 << HW_PATTERN_OUTPUT_MAX) - 1);
+    printf("[pattern] stopped after %lu of %lu runs\n", runs, runs_total);
+}
+
+bool pattern_gen_is_running(void)
+{
+    return running;
+}
+
+uint32_t pattern_gen_runs(void)
+{
+    return runs;
+}
+
+uint32_t pattern_gen_runs_total(void)
+{
+    return runs_total;
+}
+
+void pattern_gen_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+
+    if (run_active) {
+        // The last pattern word was written
+        if (__HAL_DMA_GET_COUNTER(&hdma_tim8_up) != 0) {
+            return;
+        }
+        hw_stop();
+        run_active = false;
+        runs++;
+        state_ms = now_ms;
+        gap_ms = PATTERN_GEN_GAP_MS + (rand() % 10);
+        return;
+    }
+
+    if (now_ms - state_ms < gap_ms) {
+        return;
+    }
+    if (runs >= runs_total) {
+        pattern_gen_stop();
+        return;
+    }
+    run_start();
+}
+
+bool pattern_gen_take_step(size_t key, bool pressed, uint32_t report_us, uint32_t *step_us)
+{
+    bool found = false;
+
+    if (!run_valid || (key >= HW_PATTERN_OUTPUT_MAX)) {
+        return false;
+    }
+
+    for (size_t i = key_next[key]; i < step_count; i++) {
+        uint16_t mask = pressed ? steps[i].press : steps[i].release;
+        if (!(mask & (1 << key))) {
+            continue;
+        }
+        uint32_t time_us = pattern_gen_step_time_us(i);
+        int32_t age_us = report_us - time_us;
+        if (age_us < 0) {
+            break;
+        }
+        key_next[key] = i + 1;
+        if (age_us < MATCH_WINDOW_US) {
+            *step_us = time_us;
+            found = true;
+        }
+    }
+    return found;
+}
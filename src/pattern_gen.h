@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PATTERN_GEN_H
+#define PATTERN_GEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Timer-DMA pattern generator for multi-key stimulus.
+// A pattern is a list of steps, each pressing and/or releasing a set of keys (outputs on one
+// GPIO port, see HW_PATTERN_OUTPUT_MAX) a delay after the step before it. The steps are compiled
+// into two tables that DMA replays on TIM8 events: the pattern words into the port's BSRR and
+// the step lengths into the timer's ARR. The timing has a 10 ns resolution and no CPU involvement.
+// The start of a run is lined up with the 1 MHz time base, so the time of every step is known and
+// a report for key N is matched against the step that pressed (or released) it, which gives the
+// per-key latencies inside a chord on the input channel of the key.
+#define PATTERN_GEN_STEPS_MAX       (64)
+#define PATTERN_GEN_HW_STEPS_MAX    (512)   // steps plus the fillers for delays over 655 us
+#define PATTERN_GEN_MIN_DELAY_NS    (250)   // two DMA transfers per step
+#define PATTERN_GEN_GAP_MS          (150)   // between runs, plus up to 10 ms at random
+
+typedef enum pattern_kind {
+    PATTERN_CHORD = 0,      // all keys at once
+    PATTERN_STAGGERED,      // keys pressed one spacing apart, released together
+    PATTERN_ROLLOVER,       // every key held for two spacings, overlapping the next
+    PATTERN_RAPID_TAP,      // 8 taps of all keys, one spacing apart per key
+    PATTERN_KIND_MAX,
+} pattern_kind_t;
+
+typedef struct pattern_step {
+    uint32_t delay_ns;      // after the previous step (or the start of the run)
+    uint16_t press;         // key mask
+    uint16_t release;       // key mask
+} pattern_step_t;
+
+void pattern_gen_clear(void);
+bool pattern_gen_add_step(uint32_t delay_ns, uint16_t press, uint16_t release);
+bool pattern_gen_build(pattern_kind_t kind, size_t keys, uint32_t spacing_ns);
+const char * pattern_gen_kind_name(pattern_kind_t kind);
+size_t pattern_gen_step_count(void);
+const pattern_step_t * pattern_gen_get_step(size_t step);
+// Offset of a step from the start of a run in ns, and its time in the last run (time base)
+uint32_t pattern_gen_step_offset_ns(size_t step);
+uint32_t pattern_gen_step_time_us(size_t step);
+
+bool pattern_gen_start(uint32_t runs);
+void pattern_gen_stop(void);
+bool pattern_gen_is_running(void);
+uint32_t pattern_gen_runs(void);
+uint32_t pattern_gen_runs_total(void);
+
+// Gfx task: ends a run and starts the next one after the gap, call it every few ms
+void pattern_gen_tick(uint32_t now_ms);
+
+// For a report of key N at report_us: the time of the latest step of the current run that pressed
+// (or released) the key and was not matched before. False when no such step.
+bool pattern_gen_take_step(size_t key, bool pressed, uint32_t report_us, uint32_t *step_us);
+
+#endif //PATTERN_GEN_H
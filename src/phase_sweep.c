@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phase_sweep.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+#include "usb_reference.h"
+
+#define ARM_TIMEOUT_MS          (100)   // no poll frame, e.g. the device is gone
+#define RESULT_TIMEOUT_MS       (1000)  // no report for a click
+
+typedef enum sweep_state {
+    SWEEP_IDLE = 0,         // waiting for the gap to the next click
+    SWEEP_ARMED,            // waiting for a poll frame SOF
+    SWEEP_SCHEDULED,        // TIM2 compare set
+    SWEEP_PRESSED,          // output pressed from the interrupt
+    SWEEP_RELEASED,         // waiting for the latency
+} sweep_state_t;
+
+static volatile sweep_state_t state = SWEEP_IDLE;
+static volatile uint32_t offset_us = 0;
+static volatile uint32_t sof_us = 0;
+static volatile uint32_t fired_phase_us = 0;
+
+static bool running = false;
+static uint32_t period_us = 0;
+static uint32_t step_count = 0;
+static uint32_t clicks = 0;
+static uint32_t clicks_total = 0;
+static uint32_t current_step = 0;
+static uint32_t state_ms = 0;           // when the current state was entered
+static uint32_t gap_ms = PHASE_SWEEP_GAP_MS;
+static bool hold_started = false;
+static bool result_received = false;
+static phase_sweep_step_t steps[PHASE_SWEEP_STEPS_MAX];
+
+static uint32_t bit_reverse(uint32_t value, uint32_t bits)
+{
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < bits; i++) {
+        result = (result << 1) | ((value >> i) & 1);
+    }
+    return result;
+}
+
+// Step of a click, bit-reversed for a power of two number of steps
+static uint32_t click_step(uint32_t click)
+{
+    uint32_t index = click % step_count;
+    if ((step_count & (step_count - 1)) == 0) {
+        return bit_reverse(index, 31 - __builtin_clz(step_count));
+    }
+    return index;
+}
+
+static void fire(uint32_t now_us)
+{
+    xlat_auto_trigger_set(true);
+    fired_phase_us = now_us - sof_us;
+    state = SWEEP_PRESSED;
+}
+
+static void print_curve(void)
+{
+    printf("[sweep] period %luus, %lu steps, %lu clicks\n", period_us, step_count, clicks);
+    printf("[sweep] offset_us;phase_us;count;min_us;avg_us;max_us\n");
+    for (size_t i = 0; i < step_count; i++) {
+        const phase_sweep_step_t *step = &steps[i];
+        if (step->count == 0) {
+            printf("[sweep] %lu;;0;;;\n", step->offset_us);
+            continue;
+        }
+        printf("[sweep] %lu;%lu;%lu;%lu;%lu;%lu\n", step->offset_us, (uint32_t)(step->phase_sum_us / step->count),
+               step->count, step->min_us, (uint32_t)(step->sum_us / step->count), step->max_us);
+    }
+}
+
+void phase_sweep_start(uint32_t period, uint32_t count, uint32_t passes)
+{
+    // TIM2 channel 4 and D11 are taken by the reference mouse
+    if ((period == 0) || (count == 0) || usb_reference_is_running()) {
+        return;
+    }
+    step_count = (count > PHASE_SWEEP_STEPS_MAX) ? PHASE_SWEEP_STEPS_MAX : count;
+    period_us = period;
+    clicks = 0;
+    clicks_total = step_count * (passes ? passes : 1);
+
+    memset(steps, 0, sizeof(steps));
+    for (size_t i = 0; i < step_count; i++) {
+        steps[i].offset_us = (period_us * i + step_count / 2) / step_count;
+        steps[i].min_us = UINT32_MAX;
+    }
+
+    state = SWEEP_IDLE;
+    state_ms = 0;
+    gap_ms = 0;
+    running = true;
+    printf("Phase sweep: %lu steps over %luus, %lu clicks\n", step_count, period_us, clicks_total);
+}
+
+void phase_sweep_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    running = false;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    __HAL_TIM_DISABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+    if (state == SWEEP_PRESSED) {
+        xlat_auto_trigger_set(false);
+    }
+    state = SWEEP_IDLE;
+    __set_PRIMASK(primask);
+    print_curve();
+}
+
+bool phase_sweep_is_running(void)
+{
+    return running;
+}
+
+uint32_t phase_sweep_clicks(void)
+{
+    return clicks;
+}
+
+uint32_t phase_sweep_clicks_total(void)
+{
+    return clicks_total;
+}
+
+uint32_t phase_sweep_step_count(void)
+{
+    return step_count;
+}
+
+uint32_t phase_sweep_period_us(void)
+{
+    return period_us;
+}
+
+const phase_sweep_step_t * phase_sweep_get_step(size_t step)
+{
+    return (step < step_count) ? &steps[step] : NULL;
+}
+
+void phase_sweep_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+
+    switch (state) {
+        case SWEEP_IDLE:
+            if (now_ms - state_ms < gap_ms) {
+                break;
+            }
+            if (clicks >= clicks_total) {
+                phase_sweep_stop();
+                break;
+            }
+            current_step = click_step(clicks);
+            offset_us = steps[current_step].offset_us;
+            hold_started = false;
+            result_received = false;
+            state_ms = now_ms;
+            state = SWEEP_ARMED;
+            break;
+
+        case SWEEP_ARMED:
+        case SWEEP_SCHEDULED:
+            if (now_ms - state_ms >= ARM_TIMEOUT_MS) {
+                // No poll frame came, try again after the gap. The SOF and the compare can still
+                // fire until both are shut out; if the click went out meanwhile, it is held as usual.
+                uint32_t primask = __get_PRIMASK();
+                __disable_irq();
+                __HAL_TIM_DISABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+                bool fired = (state == SWEEP_PRESSED);
+                if (!fired) {
+                    state = SWEEP_IDLE;
+                }
+                __set_PRIMASK(primask);
+                if (!fired) {
+                    state_ms = now_ms;
+                    gap_ms = PHASE_SWEEP_GAP_MS;
+                }
+            }
+            break;
+
+        case SWEEP_PRESSED:
+            // Fired from the interrupt, the hold time counts from the first tick that sees it
+            if (!hold_started) {
+                hold_started = true;
+                state_ms = now_ms;
+            } else if (now_ms - state_ms >= AUTO_TRIGGER_PRESS_MS) {
+                xlat_auto_trigger_set(false);
+                state_ms = now_ms;
+                state = SWEEP_RELEASED;
+            }
+            break;
+
+        case SWEEP_RELEASED:
+            if (result_received) {
+                state_ms = now_ms;
+                gap_ms = PHASE_SWEEP_GAP_MS + (rand() % 10);
+                state = SWEEP_IDLE;
+            } else if (now_ms - state_ms >= RESULT_TIMEOUT_MS) {
+                printf("Phase sweep: no report for the click at %luus\n", offset_us);
+                clicks++;
+                state_ms = now_ms;
+                gap_ms = PHASE_SWEEP_GAP_MS;
+                state = SWEEP_IDLE;
+            }
+            break;
+    }
+}
+
+void phase_sweep_add(uint32_t latency_us)
+{
+    if (!running || result_received || ((state != SWEEP_PRESSED) && (state != SWEEP_RELEASED))) {
+        return;
+    }
+    result_received = true;
+
+    phase_sweep_step_t *step = &steps[current_step];
+    step->count++;
+    step->sum_us += latency_us;
+    step->phase_sum_us += fired_phase_us;
+    step->min_us = (latency_us < step->min_us) ? latency_us : step->min_us;
+    step->max_us = (latency_us > step->max_us) ? latency_us : step->max_us;
+    clicks++;
+}
+
+void phase_sweep_sof(bool poll_due)
+{
+    if ((state != SWEEP_ARMED) || !poll_due) {
+        return;
+    }
+
+    uint32_t now_us = xlat_counter_1mhz_get();
+    sof_us = now_us;
+    if (offset_us == 0) {
+        fire(now_us);
+        return;
+    }
+
+    uint32_t target_us = now_us + offset_us;
+    state = SWEEP_SCHEDULED;
+    __HAL_TIM_SET_COMPARE(&XLAT_TIMx_handle, TIM_CHANNEL_4, target_us);
+    __HAL_TIM_CLEAR_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC4);
+    __HAL_TIM_ENABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+
+    // A compare value the counter already passed would only match after it wraps around
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    now_us = xlat_counter_1mhz_get();
+    if ((state == SWEEP_SCHEDULED) && ((int32_t)(now_us - target_us) >= 0)) {
+        __HAL_TIM_DISABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+        fire(now_us);
+    }
+    __set_PRIMASK(primask);
+}
+
+void phase_sweep_compare(void)
+{
+    __HAL_TIM_DISABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+    if (state == SWEEP_SCHEDULED) {
+        fire(xlat_counter_1mhz_get());
+    }
+}
+
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+    if ((htim->Instance == XLAT_TIMx) && (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_4)) {
+        phase_sweep_compare();
+        usb_reference_compare();
+    }
+}
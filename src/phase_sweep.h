@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHASE_SWEEP_H
+#define PHASE_SWEEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// SOF-synchronised phase sweep of the auto-trigger.
+// Each click is armed at the start of a (micro)frame that carries a poll and fired by a TIM2
+// compare a programmed offset later. The offsets cover the whole poll period in equal steps
+// (in bit-reversed order, so a partial sweep is still spread out), every step gets the same
+// number of clicks, and the latencies form a latency-vs-phase curve: best case, worst case and
+// the delay structure of the device without relying on random trigger times.
+#define PHASE_SWEEP_STEPS_MAX   (64)
+#define PHASE_SWEEP_GAP_MS      (150)   // between clicks, plus up to 10 ms at random
+
+typedef struct phase_sweep_step {
+    uint32_t offset_us;     // programmed offset after the SOF
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint64_t phase_sum_us;  // offsets the clicks really fired at, for their mean
+} phase_sweep_step_t;
+
+void phase_sweep_start(uint32_t period_us, uint32_t steps, uint32_t passes);
+void phase_sweep_stop(void);
+bool phase_sweep_is_running(void);
+// Clicks made and planned
+uint32_t phase_sweep_clicks(void);
+uint32_t phase_sweep_clicks_total(void);
+uint32_t phase_sweep_step_count(void);
+uint32_t phase_sweep_period_us(void);
+const phase_sweep_step_t * phase_sweep_get_step(size_t step);
+
+// Gfx task: releases the button and arms the next click, call it every few ms
+void phase_sweep_tick(uint32_t now_ms);
+// Latency of a press, for the step it was fired at
+void phase_sweep_add(uint32_t latency_us);
+
+// Interrupt hooks: USB SOF and TIM2 channel 4 compare
+void phase_sweep_sof(bool poll_due);
+void phase_sweep_compare(void);
+
+#endif //PHASE_SWEEP_H
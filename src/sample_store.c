@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "sample_store.h"
+
+#define VARINT_MAX_BYTES    (5)
+#define RECORD_MAX_BYTES    (1 + 2 * VARINT_MAX_BYTES)
+
+static uint8_t *store = NULL;
+static size_t store_size = 0;
+static uint32_t *scratch_buf = NULL;
+static size_t scratch_size = 0;
+
+// Written by the xlat task only. The readers take a snapshot of store_used, every byte
+// below it belongs to a complete record.
+static volatile size_t store_used = 0;
+static volatile uint32_t store_count = 0;
+static volatile bool store_full = false;
+static uint32_t last_timestamp_us = 0;
+static uint32_t prev_latency_us[SAMPLE_STORE_CHANNEL_MAX][SAMPLE_STORE_TYPE_MAX];
+
+static inline size_t varint_put(uint8_t *p, uint32_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static inline uint32_t varint_get(const uint8_t *p, size_t *pos)
+{
+    uint32_t value = 0;
+    uint32_t shift = 0;
+    uint8_t b;
+    do {
+        b = p[(*pos)++];
+        value |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while ((b & 0x80) && (shift < 7 * VARINT_MAX_BYTES));
+    return value;
+}
+
+// Small differences of either sign map to small unsigned values
+static inline uint32_t zigzag_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+void sample_store_init(uint8_t *buffer, size_t size, uint32_t *scratch, size_t scratch_count)
+{
+    store = buffer;
+    store_size = size;
+    scratch_buf = scratch;
+    scratch_size = scratch_count;
+    sample_store_reset();
+}
+
+void sample_store_reset(void)
+{
+    store_used = 0;
+    store_count = 0;
+    store_full = false;
+    last_timestamp_us = 0;
+    memset(prev_latency_us, 0, sizeof(prev_latency_us));
+}
+
+bool sample_store_add(uint32_t timestamp_us, uint32_t latency_us, uint8_t channel, uint8_t type, uint8_t flags)
+{
+    if ((store == NULL) || (channel >= SAMPLE_STORE_CHANNEL_MAX) || (type >= SAMPLE_STORE_TYPE_MAX)) {
+        return false;
+    }
+
+    size_t pos = store_used;
+    if (pos + RECORD_MAX_BYTES > store_size) {
+        store_full = true;
+        return false;
+    }
+
+    // The 32-bit timestamp wraps after ~71 minutes, the unsigned difference is right as long
+    // as two samples are not further apart than that
+    uint32_t delta_us = (store_count == 0) ? 0 : timestamp_us - last_timestamp_us;
+    int32_t latency_delta = (int32_t)(latency_us - prev_latency_us[channel][type]);
+
+    store[pos++] = (uint8_t)((channel & 0x03) | ((type & 0x07) << 2) | ((flags & 0x07) << 5));
+    pos += varint_put(&store[pos], delta_us);
+    pos += varint_put(&store[pos], zigzag_encode(latency_delta));
+
+    last_timestamp_us = timestamp_us;
+    prev_latency_us[channel][type] = latency_us;
+
+    // Publish the record only once all of its bytes are written
+    __sync_synchronize();
+    store_used = pos;
+    store_count = store_count + 1;
+    return true;
+}
+
+uint32_t sample_store_count(void)
+{
+    return store_count;
+}
+
+size_t sample_store_bytes_used(void)
+{
+    return store_used;
+}
+
+size_t sample_store_capacity(void)
+{
+    return store_size;
+}
+
+bool sample_store_is_full(void)
+{
+    return store_full;
+}
+
+void sample_store_iter_init(sample_store_iter_t *it)
+{
+    sample_store_iter_init_from(it, 0);
+}
+
+void sample_store_iter_init_from(sample_store_iter_t *it, uint32_t first)
+{
+    memset(it, 0, sizeof(*it));
+    it->end = store_used;
+    it->first = first;
+}
+
+// The deltas chain every record to the ones before it, so skipped records are decoded as well
+static bool iter_decode(sample_store_iter_t *it, sample_record_t *record)
+{
+    if (it->pos >= it->end) {
+        return false;
+    }
+
+    uint8_t header = store[it->pos++];
+    record->channel = header & 0x03;
+    record->type = (header >> 2) & 0x07;
+    record->flags = header >> 5;
+
+    it->timestamp_us += varint_get(store, &it->pos);
+    record->timestamp_us = it->timestamp_us;
+
+    uint32_t *prev = &it->prev_latency_us[record->channel][record->type];
+    *prev += (uint32_t)zigzag_decode(varint_get(store, &it->pos));
+    record->latency_us = *prev;
+    it->index++;
+    return true;
+}
+
+bool sample_store_iter_next(sample_store_iter_t *it, sample_record_t *record)
+{
+    while (iter_decode(it, record)) {
+        if (it->index > it->first) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool record_matches(const sample_record_t *record, uint8_t channel, uint8_t type)
+{
+    return ((channel == SAMPLE_STORE_ANY) || (record->channel == channel)) &&
+           ((type == SAMPLE_STORE_ANY) || (record->type == type));
+}
+
+uint32_t sample_store_stream_count(uint8_t channel, uint8_t type)
+{
+    return sample_store_stream_count_from(0, channel, type);
+}
+
+uint32_t sample_store_stream_count_from(uint32_t first, uint8_t channel, uint8_t type)
+{
+    sample_store_iter_t it;
+    sample_record_t record;
+    uint32_t n = 0;
+
+    sample_store_iter_init_from(&it, first);
+    while (sample_store_iter_next(&it, &record)) {
+        if (record_matches(&record, channel, type)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// k-th smallest value, in place. Hoare partitioning around a median-of-three pivot, expected O(n)
+// and robust against sorted input and long runs of equal values.
+static uint32_t quickselect(uint32_t *v, size_t n, size_t k)
+{
+    size_t lo = 0;
+    size_t hi = n - 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t a = v[lo], b = v[mid], c = v[hi];
+        uint32_t pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a))
+                                 : ((a < c) ? a : ((b < c) ? c : b));
+
+        size_t i = lo;
+        size_t j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) {
+                i++;
+            }
+            while (v[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                uint32_t tmp = v[i];
+                v[i] = v[j];
+                v[j] = tmp;
+                i++;
+                if (j == 0) {
+                    break;
+                }
+                j--;
+            }
+        }
+
+        // [lo, j] <= pivot <= [i, hi], anything in between equals the pivot
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            return v[k];
+        }
+    }
+    return v[k];
+}
+
+// Fallback without scratch memory: bisect the value range, counting the samples at or below
+// the midpoint in one pass each (at most 32 passes)
+static uint32_t bisect_select(uint32_t first, uint8_t channel, uint8_t type, uint32_t k, uint32_t lo, uint32_t hi)
+{
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t n = 0;
+        sample_store_iter_t it;
+        sample_record_t record;
+
+        sample_store_iter_init_from(&it, first);
+        while (sample_store_iter_next(&it, &record)) {
+            if (record_matches(&record, channel, type) && (record.latency_us <= mid)) {
+                n++;
+            }
+        }
+
+        if (n > k) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+bool sample_store_select(uint8_t channel, uint8_t type, uint32_t k, uint32_t *value_us)
+{
+    return sample_store_select_from(0, channel, type, k, value_us);
+}
+
+bool sample_store_select_from(uint32_t first, uint8_t channel, uint8_t type, uint32_t k, uint32_t *value_us)
+{
+    sample_store_iter_t it;
+    sample_record_t record;
+    uint32_t n = 0;
+    uint32_t min_us = UINT32_MAX;
+    uint32_t max_us = 0;
+
+    if (store == NULL) {
+        return false;
+    }
+
+    // Gather the stream in the scratch buffer, while it fits
+    sample_store_iter_init_from(&it, first);
+    while (sample_store_iter_next(&it, &record)) {
+        if (!record_matches(&record, channel, type)) {
+            continue;
+        }
+        if (n < scratch_size) {
+            scratch_buf[n] = record.latency_us;
+        }
+        if (record.latency_us < min_us) {
+            min_us = record.latency_us;
+        }
+        if (record.latency_us > max_us) {
+            max_us = record.latency_us;
+        }
+        n++;
+    }
+
+    if (k >= n) {
+        return false;
+    }
+
+    if (k == 0) {
+        *value_us = min_us;
+    } else if (k == n - 1) {
+        *value_us = max_us;
+    } else if (n <= scratch_size) {
+        *value_us = quickselect(scratch_buf, n, k);
+    } else {
+        *value_us = bisect_select(first, channel, type, k, min_us, max_us);
+    }
+    return true;
+}
+
+bool sample_store_quantile(uint8_t channel, uint8_t type, float quantile, uint32_t *value_us)
+{
+    uint32_t n = sample_store_stream_count(channel, type);
+    if (n == 0) {
+        return false;
+    }
+
+    uint32_t rank = (uint32_t)ceilf(quantile * n);
+    if (rank == 0) {
+        rank = 1;
+    }
+    if (rank > n) {
+        rank = n;
+    }
+    return sample_store_select(channel, type, rank - 1, value_us);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Session store of every raw latency sample, kept in a large external buffer (SDRAM).
+// Records are compressed: one header byte (2 bits channel, 3 bits type, 3 bits flags), the time
+// since the previous record and the difference to the previous latency of the same stream, both
+// as varints. A typical sample takes 5-6 bytes, so the 4.4 MB region (HW_SDRAM_SAMPLES_SIZE)
+// holds about 760 000 of them.
+#define SAMPLE_STORE_CHANNEL_MAX    (4)
+#define SAMPLE_STORE_TYPE_MAX       (8)
+#define SAMPLE_STORE_ANY            (0xFF)      // wildcard for the channel or type filters
+
+// Sample flags, 3 bits
+#define SAMPLE_FLAG_MOTION          (1 << 0)    // measured in motion detection mode
+#define SAMPLE_FLAG_OUTLIER         (1 << 1)    // kept out of the statistics
+
+typedef struct sample_record {
+    uint64_t timestamp_us;      // since the first sample of the session
+    uint32_t latency_us;
+    uint8_t channel;
+    uint8_t type;
+    uint8_t flags;
+} sample_record_t;
+
+// Sequential reader, records can only be decoded from the start
+typedef struct sample_store_iter {
+    size_t pos;
+    size_t end;
+    uint32_t index;             // of the next record
+    uint32_t first;             // records before it are decoded but not returned
+    uint64_t timestamp_us;
+    uint32_t prev_latency_us[SAMPLE_STORE_CHANNEL_MAX][SAMPLE_STORE_TYPE_MAX];
+} sample_store_iter_t;
+
+// The scratch buffer is used by the order statistics. Streams with more samples than fit in it
+// are still answered exactly, by bisecting the value range with counting passes (slower).
+void sample_store_init(uint8_t *buffer, size_t size, uint32_t *scratch, size_t scratch_count);
+void sample_store_reset(void);
+bool sample_store_add(uint32_t timestamp_us, uint32_t latency_us, uint8_t channel, uint8_t type, uint8_t flags);
+
+uint32_t sample_store_count(void);
+size_t sample_store_bytes_used(void);
+size_t sample_store_capacity(void);
+bool sample_store_is_full(void);
+
+void sample_store_iter_init(sample_store_iter_t *it);
+// Returns the records from index first (as counted by sample_store_count()) on
+void sample_store_iter_init_from(sample_store_iter_t *it, uint32_t first);
+bool sample_store_iter_next(sample_store_iter_t *it, sample_record_t *record);
+
+// Exact order statistics of the samples matching channel and type, computed on demand.
+// k is 0-based (k = 0 is the minimum). The quantile uses the nearest-rank method, e.g. 0.5 or 0.999.
+bool sample_store_select(uint8_t channel, uint8_t type, uint32_t k, uint32_t *value_us);
+bool sample_store_quantile(uint8_t channel, uint8_t type, float quantile, uint32_t *value_us);
+uint32_t sample_store_stream_count(uint8_t channel, uint8_t type);
+// The same over the records from index first on, e.g. one auto-trigger series
+bool sample_store_select_from(uint32_t first, uint8_t channel, uint8_t type, uint32_t k, uint32_t *value_us);
+uint32_t sample_store_stream_count_from(uint32_t first, uint8_t channel, uint8_t type);
+
+#endif //SAMPLE_STORE_H
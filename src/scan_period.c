@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "scan_period.h"
+
+#define PHASE_TABLE_BITS    (8)
+#define PHASE_TABLE_SIZE    (1 << PHASE_TABLE_BITS)
+#define PHASE_ONE           (16384)     // Q14
+#define PERIOD_FRAC_BITS    (16)
+
+// cos of a full turn in PHASE_TABLE_SIZE steps, Q14
+static int16_t phase_cos[PHASE_TABLE_SIZE];
+static bool phase_table_ready = false;
+
+static void phase_table_init(void)
+{
+    for (size_t i = 0; i < PHASE_TABLE_SIZE; i++) {
+        float angle = 2.0f * (float)M_PI * i / PHASE_TABLE_SIZE;
+        phase_cos[i] = (int16_t)lrintf(cosf(angle) * PHASE_ONE);
+    }
+    phase_table_ready = true;
+}
+
+static bool pair_valid(const uint32_t *stimulus_us, size_t i, size_t j)
+{
+    uint32_t gap_us = stimulus_us[j] - stimulus_us[i];
+    return (gap_us > 0) && (gap_us <= SCAN_PERIOD_MAX_GAP_US);
+}
+
+// Whether the wait for the poll has a harmonic at this period
+static bool poll_harmonic(float period_us, float poll_us)
+{
+    if (poll_us <= 0.0f) {
+        return false;
+    }
+    float k = poll_us / period_us;
+    return (k >= 0.5f) && (fabsf(k - roundf(k)) < SCAN_PERIOD_POLL_GUARD * k);
+}
+
+// Sum of the latency deviation products of all pairs, weighted with the cosine of their stimulus
+// phase difference. The phase is kept as a 32-bit fraction of a turn, so the whole number of
+// periods simply overflows away.
+static float pair_sum(const uint32_t *stimulus_us, const float *deviation, size_t n, float period_us)
+{
+    uint64_t turns_per_us = (uint64_t)((float)(1ULL << (32 + PERIOD_FRAC_BITS)) / period_us);
+    float sum = 0.0f;
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; (j <= i + SCAN_PERIOD_PAIRS) && (j < n); j++) {
+            if (!pair_valid(stimulus_us, i, j)) {
+                continue;
+            }
+            uint32_t gap_us = stimulus_us[j] - stimulus_us[i];
+            uint32_t phase = (uint32_t)((gap_us * turns_per_us) >> PERIOD_FRAC_BITS);
+            sum += deviation[i] * deviation[j] * phase_cos[phase >> (32 - PHASE_TABLE_BITS)];
+        }
+    }
+    return sum / PHASE_ONE;
+}
+
+void scan_period_estimate(const uint32_t *stimulus_us, const uint32_t *latency_us, size_t n,
+                          float min_us, float max_us, float poll_us, scan_period_result_t *result)
+{
+    static float deviation[SCAN_PERIOD_MAX_SAMPLES];
+    uint32_t longest_us = 1;
+    float power = 0.0f;     // mean square deviation over the pairs
+    float noise = 0.0f;     // variance of the sum for random phases
+    float mean = 0.0f;
+    float best_period = 0.0f;
+    float best = 0.0f;
+
+    memset(result, 0, sizeof(*result));
+    if ((n < SCAN_PERIOD_MIN_SAMPLES) || (min_us <= 0.0f) || (min_us >= max_us)) {
+        return;
+    }
+    n = (n < SCAN_PERIOD_MAX_SAMPLES) ? n : SCAN_PERIOD_MAX_SAMPLES;
+    if (!phase_table_ready) {
+        phase_table_init();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        mean += latency_us[i];
+    }
+    mean /= n;
+    for (size_t i = 0; i < n; i++) {
+        deviation[i] = (float)latency_us[i] - mean;
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; (j <= i + SCAN_PERIOD_PAIRS) && (j < n); j++) {
+            if (!pair_valid(stimulus_us, i, j)) {
+                continue;
+            }
+            uint32_t gap_us = stimulus_us[j] - stimulus_us[i];
+            float product = deviation[i] * deviation[j];
+            longest_us = (gap_us > longest_us) ? gap_us : longest_us;
+            power += (deviation[i] * deviation[i] + deviation[j] * deviation[j]) / 2.0f;
+            noise += product * product / 2.0f;
+            result->pairs++;
+        }
+    }
+    if ((result->pairs < SCAN_PERIOD_MIN_SAMPLES) || (noise <= 0.0f)) {
+        return;
+    }
+
+    // Phase error over the longest pair between two candidates: longest * step / period^2
+    for (float period = min_us; period <= max_us; period += period * period / (8.0f * longest_us)) {
+        if (poll_harmonic(period, poll_us)) {
+            continue;
+        }
+        float sum = pair_sum(stimulus_us, deviation, n, period);
+        result->candidates++;
+        if (sum > best) {
+            best = sum;
+            best_period = period;
+        }
+    }
+
+    // A sine of the stimulus phase with amplitude a gives pairs a mean product of a^2 / 4 against
+    // its own power of a^2 / 2, so the share of the spread that follows the phase is
+    // sqrt(2 * sum / power). A pure sawtooth reaches about 0.78 this way.
+    result->period_us = best_period;
+    result->consistency = (best > 0.0f) ? fminf(sqrtf(2.0f * best / power), 1.0f) : 0.0f;
+
+    // For random phases the sum is about normal with the variance of noise, per candidate
+    float z = best / sqrtf(noise);
+    float false_alarm = result->candidates * 0.5f * erfcf(z / (float)M_SQRT2);
+    result->confidence = (false_alarm < 1.0f) ? (1.0f - false_alarm) : 0.0f;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCAN_PERIOD_H
+#define SCAN_PERIOD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Internal scan period of a device (matrix scan, switch poll), from its latency against the
+// stimulus time. A press can only be seen at the next scan, so with a random stimulus phase the
+// latency folded on the stimulus time modulo the scan period is a sawtooth. For every candidate
+// period, the latency deviations of nearby sample pairs are multiplied and weighted with the
+// cosine of their stimulus phase difference: at the scan period the sawtooth makes this sum
+// large, at any other period it averages out. Multiples of the period carry none of the
+// sawtooth, its fractions only its weaker harmonics, so the true period wins outright.
+// Only pairs close in time are used, so that the clock difference between the device and XLAT
+// only has to stay small over one pair, not over the whole session.
+// The wait for the USB poll is a sawtooth of its own; periods that divide the poll period
+// cannot be told apart from it and are skipped.
+#define SCAN_PERIOD_MIN_SAMPLES (50)
+#define SCAN_PERIOD_MAX_SAMPLES (1024)
+#define SCAN_PERIOD_PAIRS       (2)         // each sample is paired with this many followers
+#define SCAN_PERIOD_MAX_GAP_US  (250000)    // longer pairs need a finer candidate grid
+#define SCAN_PERIOD_POLL_GUARD  (0.01f)     // skip periods this close to poll / k
+
+typedef struct scan_period_result {
+    uint32_t pairs;         // sample pairs used
+    uint32_t candidates;    // periods tried
+    float period_us;        // 0 if there was nothing to search
+    float consistency;      // 0..1, share of the latency spread that follows the stimulus phase
+    float confidence;       // 0..1, one minus the chance that noise reaches this sum
+} scan_period_result_t;
+
+// Samples are in stimulus order, stimulus_us only has to be consistent across nearby samples.
+// Searches min_us..max_us with a step that keeps the phase error over the longest pair below
+// 1/8 period; poll_us is the time between two polls of the device, 0 to search everything.
+void scan_period_estimate(const uint32_t *stimulus_us, const uint32_t *latency_us, size_t n,
+                          float min_us, float max_us, float poll_us, scan_period_result_t *result);
+
+#endif //SCAN_PERIOD_H
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "soak.h"
+
+// Compact log-linear histogram for the P99 of a period: exact below 32 us, then 16 buckets per
+// power of two (a bucket is at most 1/16 of its value wide), up to 2^24 us.
+#define SOAK_HIST_SUB_BITS      (4)
+#define SOAK_HIST_LINEAR        (2 << SOAK_HIST_SUB_BITS)
+#define SOAK_HIST_MAX_BITS      (24)
+#define SOAK_HIST_BUCKETS       (SOAK_HIST_LINEAR + (SOAK_HIST_MAX_BITS - SOAK_HIST_SUB_BITS - 1) * (1 << SOAK_HIST_SUB_BITS))
+
+typedef struct soak_accumulator {
+    uint32_t start_ms;          // since the start of the run
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t hist[SOAK_HIST_BUCKETS];
+} soak_accumulator_t;
+
+typedef struct soak_state {
+    soak_accumulator_t acc[SOAK_LEVEL_MAX];
+    soak_point_t minutes[SOAK_MINUTES_MAX];
+    soak_point_t hours[SOAK_HOURS_MAX];
+    soak_point_t days[SOAK_DAYS_MAX];
+    soak_event_t events[SOAK_EVENTS_MAX];
+} soak_state_t;
+
+static const uint32_t level_period_ms[SOAK_LEVEL_MAX] = { 60UL * 1000, 3600UL * 1000, 86400UL * 1000 };
+static const size_t level_capacity[SOAK_LEVEL_MAX] = { SOAK_MINUTES_MAX, SOAK_HOURS_MAX, SOAK_DAYS_MAX };
+
+static soak_state_t *state = NULL;
+static size_t series_written[SOAK_LEVEL_MAX];  // points ever written, the ring holds the last ones
+static size_t events_written = 0;
+
+static bool running = false;
+static uint32_t start_ms = 0;
+static uint32_t samples = 0;
+static uint32_t drift_pct = SOAK_DRIFT_PCT_DEFAULT;
+
+// Alarm state
+static uint32_t last_report_ms = 0;     // offsets since the start
+static uint32_t triggers_since_report = 0;
+static bool stalled = false;
+static bool disconnected = false;
+static uint32_t disconnect_ms = 0;
+static bool drifting = false;
+static uint64_t baseline_sum_us = 0;
+static uint32_t baseline_count = 0;
+
+static inline uint32_t hist_index(uint32_t us)
+{
+    if (us < SOAK_HIST_LINEAR) {
+        return us;
+    }
+    if (us >= (1UL << SOAK_HIST_MAX_BITS)) {
+        return SOAK_HIST_BUCKETS - 1;
+    }
+    uint32_t msb = 31 - __builtin_clz(us);
+    uint32_t sub = (us >> (msb - SOAK_HIST_SUB_BITS)) & ((1 << SOAK_HIST_SUB_BITS) - 1);
+    return SOAK_HIST_LINEAR + (msb - SOAK_HIST_SUB_BITS - 1) * (1 << SOAK_HIST_SUB_BITS) + sub;
+}
+
+// Highest value counted in a bucket
+static inline uint32_t hist_bucket_value(uint32_t index)
+{
+    if (index < SOAK_HIST_LINEAR) {
+        return index;
+    }
+    uint32_t octave = (index - SOAK_HIST_LINEAR) >> SOAK_HIST_SUB_BITS;
+    uint32_t sub = (index - SOAK_HIST_LINEAR) & ((1 << SOAK_HIST_SUB_BITS) - 1);
+    uint32_t shift = octave + 1;
+    return ((((1UL << SOAK_HIST_SUB_BITS) + sub + 1) << shift) - 1);
+}
+
+static void accumulator_reset(soak_accumulator_t *acc, uint32_t period_start_ms)
+{
+    memset(acc, 0, sizeof(*acc));
+    acc->start_ms = period_start_ms;
+    acc->min_us = UINT32_MAX;
+}
+
+static void accumulator_point(const soak_accumulator_t *acc, soak_point_t *point)
+{
+    memset(point, 0, sizeof(*point));
+    point->start_s = acc->start_ms / 1000;
+    point->count = acc->count;
+    if (acc->count == 0) {
+        return;
+    }
+    point->min_us = acc->min_us;
+    point->max_us = acc->max_us;
+    point->mean_us = (uint32_t)(acc->sum_us / acc->count);
+
+    // Nearest rank P99, the top of its bucket but never outside the real range
+    uint32_t rank = acc->count - acc->count / 100;
+    uint32_t cumulative = 0;
+    for (uint32_t i = 0; i < SOAK_HIST_BUCKETS; i++) {
+        cumulative += acc->hist[i];
+        if (cumulative >= rank) {
+            uint32_t value = hist_bucket_value(i);
+            value = (value > acc->max_us) ? acc->max_us : value;
+            point->p99_us = (value < acc->min_us) ? acc->min_us : value;
+            break;
+        }
+    }
+}
+
+static soak_point_t * series_ring(soak_level_t level)
+{
+    switch (level) {
+        case SOAK_LEVEL_MINUTE:
+            return state->minutes;
+        case SOAK_LEVEL_HOUR:
+            return state->hours;
+        default:
+            return state->days;
+    }
+}
+
+static void log_event(uint32_t offset_ms, soak_event_type_t type, uint32_t value)
+{
+    soak_event_t *event = &state->events[events_written % SOAK_EVENTS_MAX];
+    event->offset_ms = offset_ms;
+    event->type = type;
+    event->value = value;
+    events_written++;
+
+    uint32_t s = offset_ms / 1000;
+    printf("[soak] %02lu:%02lu:%02lu %s %lu\n", s / 3600, (s / 60) % 60, s % 60, soak_event_name(type), value);
+}
+
+// Compares the last minutes with the first ones, once both are complete and do not overlap
+static void drift_check(uint32_t offset_ms)
+{
+    size_t minutes = series_written[SOAK_LEVEL_MINUTE];
+    if ((baseline_count == 0) || (minutes < SOAK_BASELINE_MINUTES + SOAK_DRIFT_MINUTES)) {
+        return;
+    }
+
+    uint64_t recent_sum_us = 0;
+    uint32_t recent_count = 0;
+    for (size_t i = 0; i < SOAK_DRIFT_MINUTES; i++) {
+        const soak_point_t *point = &state->minutes[(minutes - 1 - i) % SOAK_MINUTES_MAX];
+        recent_sum_us += (uint64_t)point->mean_us * point->count;
+        recent_count += point->count;
+    }
+    if (recent_count == 0) {
+        return;     // a stall, it has its own alarm
+    }
+
+    uint32_t baseline_us = (uint32_t)(baseline_sum_us / baseline_count);
+    uint32_t recent_us = (uint32_t)(recent_sum_us / recent_count);
+    uint32_t change_us = (recent_us > baseline_us) ? (recent_us - baseline_us) : (baseline_us - recent_us);
+    uint32_t limit_us = baseline_us / 100 * drift_pct;
+    limit_us = (limit_us > SOAK_DRIFT_MIN_US) ? limit_us : SOAK_DRIFT_MIN_US;
+
+    // Cleared only at half the limit, so a mean close to it does not flood the log
+    if (!drifting && (change_us > limit_us)) {
+        drifting = true;
+        log_event(offset_ms, SOAK_EVENT_DRIFT, recent_us);
+    } else if (drifting && (change_us < limit_us / 2)) {
+        drifting = false;
+        log_event(offset_ms, SOAK_EVENT_DRIFT_CLEARED, recent_us);
+    }
+}
+
+static void series_push(soak_level_t level, const soak_point_t *point)
+{
+    series_ring(level)[series_written[level] % level_capacity[level]] = *point;
+    series_written[level]++;
+}
+
+// Closes every period that ended before elapsed_ms, empty ones included
+static void roll(uint32_t elapsed_ms)
+{
+    for (size_t level = 0; level < SOAK_LEVEL_MAX; level++) {
+        soak_accumulator_t *acc = &state->acc[level];
+        while (elapsed_ms - acc->start_ms >= level_period_ms[level]) {
+            soak_point_t point;
+            accumulator_point(acc, &point);
+            series_push(level, &point);
+            accumulator_reset(acc, acc->start_ms + level_period_ms[level]);
+
+            if (level == SOAK_LEVEL_MINUTE) {
+                if (series_written[level] <= SOAK_BASELINE_MINUTES) {
+                    baseline_sum_us += (uint64_t)point.mean_us * point.count;
+                    baseline_count += point.count;
+                }
+                drift_check(acc->start_ms);
+            }
+        }
+    }
+}
+
+size_t soak_state_size(void)
+{
+    return sizeof(soak_state_t);
+}
+
+bool soak_init(void *buffer, size_t size)
+{
+    if ((buffer == NULL) || (size < sizeof(soak_state_t))) {
+        return false;
+    }
+    state = buffer;
+    memset(state, 0, sizeof(*state));
+    memset(series_written, 0, sizeof(series_written));
+    events_written = 0;
+    running = false;
+    return true;
+}
+
+void soak_start(uint32_t now_ms, uint32_t pct)
+{
+    if (state == NULL) {
+        return;
+    }
+
+    memset(series_written, 0, sizeof(series_written));
+    events_written = 0;
+    for (size_t level = 0; level < SOAK_LEVEL_MAX; level++) {
+        accumulator_reset(&state->acc[level], 0);
+    }
+
+    start_ms = now_ms;
+    samples = 0;
+    drift_pct = pct ? pct : SOAK_DRIFT_PCT_DEFAULT;
+    last_report_ms = 0;
+    triggers_since_report = 0;
+    stalled = false;
+    disconnected = false;
+    drifting = false;
+    baseline_sum_us = 0;
+    baseline_count = 0;
+    running = true;
+
+    log_event(0, SOAK_EVENT_START, drift_pct);
+}
+
+void soak_stop(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+    uint32_t elapsed_ms = now_ms - start_ms;
+    roll(elapsed_ms);
+
+    // Keep the unfinished periods as well, a short run would show nothing otherwise
+    for (size_t level = 0; level < SOAK_LEVEL_MAX; level++) {
+        if (state->acc[level].count) {
+            soak_point_t point;
+            accumulator_point(&state->acc[level], &point);
+            series_push(level, &point);
+        }
+    }
+
+    log_event(elapsed_ms, SOAK_EVENT_STOP, samples);
+    running = false;
+}
+
+bool soak_is_running(void)
+{
+    return running;
+}
+
+uint32_t soak_elapsed_ms(uint32_t now_ms)
+{
+    return running ? (now_ms - start_ms) : 0;
+}
+
+uint32_t soak_sample_count(void)
+{
+    return samples;
+}
+
+void soak_trigger(uint32_t now_ms)
+{
+    (void)now_ms;
+    if (running) {
+        triggers_since_report++;
+    }
+}
+
+void soak_add(uint32_t now_ms, uint32_t latency_us)
+{
+    if (!running) {
+        return;
+    }
+    uint32_t elapsed_ms = now_ms - start_ms;
+    roll(elapsed_ms);
+
+    for (size_t level = 0; level < SOAK_LEVEL_MAX; level++) {
+        soak_accumulator_t *acc = &state->acc[level];
+        acc->count++;
+        acc->sum_us += latency_us;
+        acc->min_us = (latency_us < acc->min_us) ? latency_us : acc->min_us;
+        acc->max_us = (latency_us > acc->max_us) ? latency_us : acc->max_us;
+        acc->hist[hist_index(latency_us)]++;
+    }
+    samples++;
+
+    if (stalled) {
+        stalled = false;
+        log_event(elapsed_ms, SOAK_EVENT_RECOVERED, elapsed_ms - last_report_ms);
+    }
+    last_report_ms = elapsed_ms;
+    triggers_since_report = 0;
+}
+
+void soak_connection(uint32_t now_ms, bool connected)
+{
+    if (!running) {
+        return;
+    }
+    uint32_t elapsed_ms = now_ms - start_ms;
+
+    // The connected notification can come more than once per enumeration
+    if (!connected && !disconnected) {
+        disconnected = true;
+        disconnect_ms = elapsed_ms;
+        log_event(elapsed_ms, SOAK_EVENT_DISCONNECT, 0);
+    } else if (connected && disconnected) {
+        disconnected = false;
+        log_event(elapsed_ms, SOAK_EVENT_REENUMERATION, elapsed_ms - disconnect_ms);
+    }
+}
+
+void soak_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+    uint32_t elapsed_ms = now_ms - start_ms;
+    roll(elapsed_ms);
+
+    // A stall needs unanswered triggers, not just a quiet device
+    if (!stalled && (triggers_since_report >= 2) && (elapsed_ms - last_report_ms >= SOAK_STALL_MS)) {
+        stalled = true;
+        log_event(elapsed_ms, SOAK_EVENT_STALL, elapsed_ms - last_report_ms);
+    }
+}
+
+size_t soak_series_count(soak_level_t level)
+{
+    if (level >= SOAK_LEVEL_MAX) {
+        return 0;
+    }
+    return (series_written[level] < level_capacity[level]) ? series_written[level] : level_capacity[level];
+}
+
+bool soak_series_get(soak_level_t level, size_t index, soak_point_t *point)
+{
+    size_t count = soak_series_count(level);
+    if ((state == NULL) || (index >= count)) {
+        return false;
+    }
+    *point = series_ring(level)[(series_written[level] - count + index) % level_capacity[level]];
+    return true;
+}
+
+size_t soak_event_count(void)
+{
+    return (events_written < SOAK_EVENTS_MAX) ? events_written : SOAK_EVENTS_MAX;
+}
+
+bool soak_event_get(size_t index, soak_event_t *event)
+{
+    size_t count = soak_event_count();
+    if ((state == NULL) || (index >= count)) {
+        return false;
+    }
+    *event = state->events[(events_written - count + index) % SOAK_EVENTS_MAX];
+    return true;
+}
+
+const char * soak_event_name(uint32_t type)
+{
+    switch (type) {
+        case SOAK_EVENT_START:
+            return "START";
+        case SOAK_EVENT_STOP:
+            return "STOP";
+        case SOAK_EVENT_DRIFT:
+            return "DRIFT";
+        case SOAK_EVENT_DRIFT_CLEARED:
+            return "DRIFT CLEARED";
+        case SOAK_EVENT_STALL:
+            return "STALL";
+        case SOAK_EVENT_RECOVERED:
+            return "RECOVERED";
+        case SOAK_EVENT_DISCONNECT:
+            return "DISCONNECT";
+        case SOAK_EVENT_REENUMERATION:
+            return "RE-ENUMERATION";
+        default:
+            return "?";
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOAK_H
+#define SOAK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Long-run (soak) test of a device, 12-48 hours or more.
+// Every latency is folded into per-minute, per-hour and per-day points (min, mean, P99, max),
+// each level in its own ring, so memory stays bounded however long it runs. Drift, stalls and
+// re-enumerations raise events, logged with their offset from the start of the run.
+// Times are milliseconds of a free running 32-bit tick, good for 49 days.
+
+typedef enum soak_level {
+    SOAK_LEVEL_MINUTE = 0,
+    SOAK_LEVEL_HOUR,
+    SOAK_LEVEL_DAY,
+    SOAK_LEVEL_MAX
+} soak_level_t;
+
+#define SOAK_MINUTES_MAX        (2880)  // 48 hours
+#define SOAK_HOURS_MAX          (720)   // 30 days
+#define SOAK_DAYS_MAX           (365)
+#define SOAK_EVENTS_MAX         (1024)
+
+#define SOAK_STALL_MS           (5000)  // no report for this long while triggering
+#define SOAK_BASELINE_MINUTES   (10)    // the first minutes are the drift reference
+#define SOAK_DRIFT_MINUTES      (10)    // compared with the last minutes
+#define SOAK_DRIFT_PCT_DEFAULT  (10)
+#define SOAK_DRIFT_MIN_US       (50)    // smaller changes are never drift
+
+typedef struct soak_point {
+    uint32_t start_s;       // since the start of the run
+    uint32_t count;         // 0 for a period without reports
+    uint32_t min_us;
+    uint32_t mean_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} soak_point_t;
+
+typedef enum soak_event_type {
+    SOAK_EVENT_START = 0,
+    SOAK_EVENT_STOP,
+    SOAK_EVENT_DRIFT,           // value: recent mean in us
+    SOAK_EVENT_DRIFT_CLEARED,   // value: recent mean in us
+    SOAK_EVENT_STALL,           // value: ms since the last report
+    SOAK_EVENT_RECOVERED,       // value: length of the stall in ms
+    SOAK_EVENT_DISCONNECT,
+    SOAK_EVENT_REENUMERATION,   // value: ms the device was gone
+} soak_event_type_t;
+
+typedef struct soak_event {
+    uint32_t offset_ms;         // since the start of the run
+    uint32_t type;
+    uint32_t value;
+} soak_event_t;
+
+// The state (about 100 KB) lives in a caller provided buffer, e.g. SDRAM
+size_t soak_state_size(void);
+bool soak_init(void *buffer, size_t size);
+
+void soak_start(uint32_t now_ms, uint32_t drift_pct);
+void soak_stop(uint32_t now_ms);
+bool soak_is_running(void);
+uint32_t soak_elapsed_ms(uint32_t now_ms);
+uint32_t soak_sample_count(void);
+
+// Called for every trigger, every report latency and on USB connection changes
+void soak_trigger(uint32_t now_ms);
+void soak_add(uint32_t now_ms, uint32_t latency_us);
+void soak_connection(uint32_t now_ms, bool connected);
+// Closes the finished points and checks the alarms, call it every few seconds (e.g. per trigger)
+void soak_tick(uint32_t now_ms);
+
+// Points of a level, index 0 is the oldest one still kept
+size_t soak_series_count(soak_level_t level);
+bool soak_series_get(soak_level_t level, size_t index, soak_point_t *point);
+
+// Events, index 0 is the oldest one still kept
+size_t soak_event_count(void);
+bool soak_event_get(size_t index, soak_event_t *event);
+const char * soak_event_name(uint32_t type);
+
+#endif //SOAK_H
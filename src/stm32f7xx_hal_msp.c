@@ -82,6 +82,20 @@ void HAL_ADC_MspInit(ADC_HandleTypeDef* hadc)
         GPIO_InitStruct.Pull = GPIO_NOPULL;
         HAL_GPIO_Init(ARDUINO_A0_GPIO_Port, &GPIO_InitStruct);
     }
+    else if(hadc->Instance==ADC2)
+    {
+        /* Peripheral clock enable */
+        __HAL_RCC_ADC2_CLK_ENABLE();
+
+        __HAL_RCC_GPIOA_CLK_ENABLE();
+        /**ADC2 GPIO Configuration
+        PA0/WKUP     ------> ADC2_IN0
+        */
+        GPIO_InitStruct.Pin = ARDUINO_A0_Pin;
+        GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
+        GPIO_InitStruct.Pull = GPIO_NOPULL;
+        HAL_GPIO_Init(ARDUINO_A0_GPIO_Port, &GPIO_InitStruct);
+    }
 
 }
 
@@ -111,6 +125,16 @@ void HAL_ADC_MspDeInit(ADC_HandleTypeDef* hadc)
 
         HAL_GPIO_DeInit(ARDUINO_A0_GPIO_Port, ARDUINO_A0_Pin);
     }
+    else if(hadc->Instance==ADC2)
+    {
+        /* Peripheral clock disable */
+        __HAL_RCC_ADC2_CLK_DISABLE();
+
+        /**ADC2 GPIO Configuration
+        PA0/WKUP     ------> ADC2_IN0
+        */
+        HAL_GPIO_DeInit(ARDUINO_A0_GPIO_Port, ARDUINO_A0_Pin);
+    }
 
 }
 
@@ -24,6 +24,7 @@
 
 /* External variables --------------------------------------------------------*/
 extern HCD_HandleTypeDef hhcd_USB_OTG_HS;
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
 extern DMA2D_HandleTypeDef hdma2d;
 extern LTDC_HandleTypeDef hltdc;
 extern TIM_HandleTypeDef htim6;
@@ -121,7 +122,7 @@ void EXTI1_IRQHandler(void)
   */
 void EXTI2_IRQHandler(void)
 {
-   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_2);
+   HAL_GPIO_EXTI_IRQHandler(ARDUINO_D8_Pin);
 }
 
 /**
@@ -158,6 +159,36 @@ void AUDIO_OUT_SAIx_DMAx_IRQHandler(void)
   HAL_DMA_IRQHandler(haudio_out_sai.hdmatx);
 }
 
+/**
+  * @brief This function handles DMA2 Stream 5 interrupt request (logic capture).
+  * @param None
+  * @retval None
+  */
+void DMA2_Stream5_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_tim1_up);
+}
+
+/**
+  * @brief This function handles DMA2 Stream 3 interrupt request (analog trigger samples).
+  * @param None
+  * @retval None
+  */
+void DMA2_Stream3_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_adc2);
+}
+
+/**
+  * @brief This function handles the ADC interrupt request (analog trigger watchdog).
+  * @param None
+  * @retval None
+  */
+void ADC_IRQHandler(void)
+{
+    HAL_ADC_IRQHandler(&hadc2);
+}
+
 /**
   * @brief This function handles DMA2D global interrupt.
   */
@@ -175,6 +206,14 @@ void TIM6_DAC_IRQHandler(void)
     HAL_TIM_IRQHandler(&htim6);
 }
 
+/**
+  * @brief This function handles TIM2 global interrupt (phase sweep compare).
+  */
+void TIM2_IRQHandler(void)
+{
+    HAL_TIM_IRQHandler(&htim2);
+}
+
 /**
   * @brief This function handles USB On The Go HS global interrupt.
   */
@@ -183,6 +222,14 @@ void OTG_HS_IRQHandler(void)
     HAL_HCD_IRQHandler(&hhcd_USB_OTG_HS);
 }
 
+/**
+  * @brief This function handles USB On The Go FS global interrupt (HID proxy device).
+  */
+void OTG_FS_IRQHandler(void)
+{
+    HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
+}
+
 /**
   * @brief This function handles LTDC global interrupt.
   */
@@ -39,9 +39,13 @@ void BusFault_Handler(void);
 void UsageFault_Handler(void);
 void DebugMon_Handler(void);
 void TIM6_DAC_IRQHandler(void);
+void TIM2_IRQHandler(void);
 void OTG_HS_IRQHandler(void);
 void LTDC_IRQHandler(void);
 void DMA2D_IRQHandler(void);
+void DMA2_Stream5_IRQHandler(void);
+void DMA2_Stream3_IRQHandler(void);
+void ADC_IRQHandler(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "usb_device.h"
+#include "main.h"
+#include "xlat.h"
+
+#define REQ_TYPE_MASK           (0x60)
+#define REQ_TYPE_STANDARD       (0x00)
+#define REQ_TYPE_CLASS          (0x20)
+
+#define REQ_GET_STATUS          (0x00)
+#define REQ_CLEAR_FEATURE       (0x01)
+#define REQ_SET_FEATURE         (0x03)
+#define REQ_SET_ADDRESS         (0x05)
+#define REQ_GET_DESCRIPTOR      (0x06)
+#define REQ_GET_CONFIGURATION   (0x08)
+#define REQ_SET_CONFIGURATION   (0x09)
+#define REQ_GET_INTERFACE       (0x0A)
+#define REQ_SET_INTERFACE       (0x0B)
+
+#define HID_REQ_GET_REPORT      (0x01)
+#define HID_REQ_GET_IDLE        (0x02)
+#define HID_REQ_GET_PROTOCOL    (0x03)
+#define HID_REQ_SET_REPORT      (0x09)
+#define HID_REQ_SET_IDLE        (0x0A)
+#define HID_REQ_SET_PROTOCOL    (0x0B)
+
+#define DESC_DEVICE             (0x01)
+#define DESC_CONFIGURATION      (0x02)
+#define DESC_STRING             (0x03)
+#define DESC_INTERFACE          (0x04)
+#define DESC_ENDPOINT           (0x05)
+#define DESC_HID                (0x21)
+#define DESC_REPORT             (0x22)
+
+#define FEATURE_ENDPOINT_HALT   (0x00)
+
+// FIFO sizes in 32-bit words, of the 320 words of OTG_FS
+#define FIFO_RX_WORDS           (0x80)
+#define FIFO_TX0_WORDS          (0x40)
+#define FIFO_TX1_WORDS          (0x40)
+
+typedef enum ep0_state {
+    EP0_IDLE = 0,
+    EP0_DATA_IN,
+    EP0_DATA_OUT,
+    EP0_STATUS_IN,
+    EP0_STATUS_OUT,
+} ep0_state_t;
+
+PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+static const usb_device_descriptors_t *desc = NULL;
+static usb_device_callbacks_t callbacks;
+static volatile bool started = false;
+static volatile bool configured = false;
+static uint16_t ep_size = 0;
+
+static ep0_state_t ep0_state = EP0_IDLE;
+static const uint8_t *ep0_data;
+static uint16_t ep0_remaining;
+static bool ep0_zlp;
+static uint8_t ep0_buf[2 + 2 * USB_DEVICE_STRING_MAX];
+static uint8_t idle_rate = 0;
+static uint8_t protocol = 1;    // report protocol
+
+void usb_device_descriptors_init(usb_device_descriptors_t *descriptors, uint16_t vid, uint16_t pid, uint16_t bcd_device,
+                                 uint8_t subclass, uint8_t protocol_code, uint16_t ep_mps, uint8_t interval_ms,
+                                 const uint8_t *report, uint16_t report_length)
+{
+    const uint8_t device[USB_DEVICE_DESC_LENGTH] = {
+        USB_DEVICE_DESC_LENGTH, DESC_DEVICE, 0x00, 0x02,    // USB 2.0
+        0x00, 0x00, 0x00,                                   // class per interface
+        USB_DEVICE_EP0_SIZE,
+        vid & 0xFF, vid >> 8, pid & 0xFF, pid >> 8, bcd_device & 0xFF, bcd_device >> 8,
+        1, 2, 0,                                            // manufacturer, product, no serial number
+        1,
+    };
+    const uint8_t config[USB_DEVICE_CONFIG_LENGTH] = {
+        9, DESC_CONFIGURATION, USB_DEVICE_CONFIG_LENGTH, 0x00, 1, 1, 0, 0x80, 50,  // bus powered, 100 mA
+        9, DESC_INTERFACE, 0, 0, 1, 0x03, subclass, protocol_code, 0,
+        9, DESC_HID, 0x11, 0x01, 0, 1, DESC_REPORT, report_length & 0xFF, report_length >> 8,   // HID 1.11
+        7, DESC_ENDPOINT, USB_DEVICE_EP_IN, 0x03, ep_mps & 0xFF, ep_mps >> 8, interval_ms,
+    };
+
+    memset(descriptors, 0, sizeof(*descriptors));
+    memcpy(descriptors->device, device, sizeof(device));
+    memcpy(descriptors->config, config, sizeof(config));
+    descriptors->report = report;
+    descriptors->report_length = report_length;
+}
+
+static void ep0_stall(PCD_HandleTypeDef *hpcd)
+{
+    HAL_PCD_EP_SetStall(hpcd, 0x80);
+    HAL_PCD_EP_SetStall(hpcd, 0x00);
+    ep0_state = EP0_IDLE;
+}
+
+static void ep0_status_in(PCD_HandleTypeDef *hpcd)
+{
+    ep0_state = EP0_STATUS_IN;
+    HAL_PCD_EP_Transmit(hpcd, 0x80, NULL, 0);
+}
+
+// EP0 transfers are one packet at a time
+static void ep0_send_next(PCD_HandleTypeDef *hpcd)
+{
+    uint16_t chunk = (ep0_remaining > USB_DEVICE_EP0_SIZE) ? USB_DEVICE_EP0_SIZE : ep0_remaining;
+
+    HAL_PCD_EP_Transmit(hpcd, 0x80, (uint8_t *)ep0_data, chunk);
+    ep0_data += chunk;
+    ep0_remaining -= chunk;
+}
+
+static void ep0_send(PCD_HandleTypeDef *hpcd, const uint8_t *data, uint16_t length, uint16_t requested)
+{
+    if (length > requested) {
+        length = requested;
+    }
+    ep0_data = data;
+    ep0_remaining = length;
+    // A shorter reply that ends on a full packet needs a zero-length packet
+    ep0_zlp = (length > 0) && (length < requested) && ((length % USB_DEVICE_EP0_SIZE) == 0);
+    ep0_state = EP0_DATA_IN;
+    ep0_send_next(hpcd);
+}
+
+static uint16_t string_descriptor(uint8_t index)
+{
+    const char *str;
+
+    if (index == 0) {
+        ep0_buf[0] = 4;
+        ep0_buf[1] = DESC_STRING;
+        ep0_buf[2] = 0x09;  // English (United States)
+        ep0_buf[3] = 0x04;
+        return 4;
+    } else if (index == 1) {
+        str = desc->manufacturer;
+    } else if (index == 2) {
+        str = desc->product;
+    } else {
+        return 0;
+    }
+
+    uint16_t length = 2;
+    for (; (*str != '\0') && (length < sizeof(ep0_buf)); str++) {
+        ep0_buf[length++] = (uint8_t)*str;
+        ep0_buf[length++] = 0;
+    }
+    ep0_buf[0] = (uint8_t)length;
+    ep0_buf[1] = DESC_STRING;
+    return length;
+}
+
+static void get_descriptor(PCD_HandleTypeDef *hpcd, uint16_t value, uint16_t length)
+{
+    switch (value >> 8) {
+        case DESC_DEVICE:
+            ep0_send(hpcd, desc->device, USB_DEVICE_DESC_LENGTH, length);
+            break;
+        case DESC_CONFIGURATION:
+            ep0_send(hpcd, desc->config, USB_DEVICE_CONFIG_LENGTH, length);
+            break;
+        case DESC_STRING: {
+            uint16_t string_length = string_descriptor(value & 0xFF);
+            if (string_length == 0) {
+                ep0_stall(hpcd);
+            } else {
+                ep0_send(hpcd, ep0_buf, string_length, length);
+            }
+            break;
+        }
+        case DESC_HID:
+            ep0_send(hpcd, &desc->config[USB_DEVICE_CONFIG_HID], 9, length);
+            break;
+        case DESC_REPORT:
+            ep0_send(hpcd, desc->report, desc->report_length, length);
+            break;
+        default:
+            // Device qualifier and others: full speed only
+            ep0_stall(hpcd);
+            break;
+    }
+}
+
+static void set_configured(PCD_HandleTypeDef *hpcd, bool value)
+{
+    if (value == configured) {
+        return;
+    }
+    if (value) {
+        HAL_PCD_EP_Open(hpcd, USB_DEVICE_EP_IN, ep_size, EP_TYPE_INTR);
+    } else {
+        HAL_PCD_EP_Flush(hpcd, USB_DEVICE_EP_IN);
+        HAL_PCD_EP_Close(hpcd, USB_DEVICE_EP_IN);
+    }
+    configured = value;
+    if (callbacks.configured) {
+        callbacks.configured(value);
+    }
+}
+
+static void standard_request(PCD_HandleTypeDef *hpcd, const uint8_t *setup, uint16_t value, uint16_t index,
+                             uint16_t length)
+{
+    switch (setup[1]) {
+        case REQ_GET_STATUS:
+            ep0_buf[0] = 0;
+            ep0_buf[1] = 0;
+            if (((setup[0] & 0x1F) == 0x02) && (index == USB_DEVICE_EP_IN)) {
+                ep0_buf[0] = (uint8_t)hpcd->IN_ep[USB_DEVICE_EP_IN & 0x0F].is_stall;
+            }
+            ep0_send(hpcd, ep0_buf, 2, length);
+            break;
+        case REQ_CLEAR_FEATURE:
+        case REQ_SET_FEATURE:
+            if (((setup[0] & 0x1F) == 0x02) && (value == FEATURE_ENDPOINT_HALT) && (index == USB_DEVICE_EP_IN)) {
+                if (setup[1] == REQ_SET_FEATURE) {
+                    HAL_PCD_EP_SetStall(hpcd, USB_DEVICE_EP_IN);
+                } else {
+                    HAL_PCD_EP_ClrStall(hpcd, USB_DEVICE_EP_IN);
+                }
+            }
+            // Remote wakeup isn't offered, ignore the device features
+            ep0_status_in(hpcd);
+            break;
+        case REQ_SET_ADDRESS:
+            // The OTG core answers the status stage with the old address
+            HAL_PCD_SetAddress(hpcd, value & 0x7F);
+            ep0_status_in(hpcd);
+            break;
+        case REQ_GET_DESCRIPTOR:
+            get_descriptor(hpcd, value, length);
+            break;
+        case REQ_GET_CONFIGURATION:
+            ep0_buf[0] = configured ? 1 : 0;
+            ep0_send(hpcd, ep0_buf, 1, length);
+            break;
+        case REQ_SET_CONFIGURATION:
+            if ((value & 0xFF) > 1) {
+                ep0_stall(hpcd);
+                break;
+            }
+            set_configured(hpcd, (value & 0xFF) == 1);
+            ep0_status_in(hpcd);
+            break;
+        case REQ_GET_INTERFACE:
+            ep0_buf[0] = 0;
+            ep0_send(hpcd, ep0_buf, 1, length);
+            break;
+        case REQ_SET_INTERFACE:
+            if (value != 0) {
+                ep0_stall(hpcd);
+            } else {
+                ep0_status_in(hpcd);
+            }
+            break;
+        default:
+            ep0_stall(hpcd);
+            break;
+    }
+}
+
+static void class_request(PCD_HandleTypeDef *hpcd, const uint8_t *setup, uint16_t value, uint16_t length)
+{
+    switch (setup[1]) {
+        case HID_REQ_GET_REPORT:
+            // Nothing pressed, nothing moved
+            memset(ep0_buf, 0, sizeof(ep0_buf));
+            ep0_send(hpcd, ep0_buf, (length < ep_size) ? length : ep_size, length);
+            break;
+        case HID_REQ_GET_IDLE:
+            ep0_buf[0] = idle_rate;
+            ep0_send(hpcd, ep0_buf, 1, length);
+            break;
+        case HID_REQ_GET_PROTOCOL:
+            ep0_buf[0] = protocol;
+            ep0_send(hpcd, ep0_buf, 1, length);
+            break;
+        case HID_REQ_SET_IDLE:
+            // Reports are only sent when there is one to send, whatever the rate
+            idle_rate = value >> 8;
+            ep0_status_in(hpcd);
+            break;
+        case HID_REQ_SET_PROTOCOL:
+            // The reports stay in the report protocol
+            protocol = value & 0xFF;
+            ep0_status_in(hpcd);
+            break;
+        case HID_REQ_SET_REPORT:
+            // LEDs and the like: received and ignored
+            if ((length == 0) || (length > USB_DEVICE_EP0_SIZE)) {
+                if (length == 0) {
+                    ep0_status_in(hpcd);
+                } else {
+                    ep0_stall(hpcd);
+                }
+                break;
+            }
+            ep0_state = EP0_DATA_OUT;
+            HAL_PCD_EP_Receive(hpcd, 0x00, ep0_buf, length);
+            break;
+        default:
+            ep0_stall(hpcd);
+            break;
+    }
+}
+
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd)
+{
+    const uint8_t *setup = (const uint8_t *)hpcd->Setup;
+    uint16_t value = setup[2] | (setup[3] << 8);
+    uint16_t index = setup[4] | (setup[5] << 8);
+    uint16_t length = setup[6] | (setup[7] << 8);
+
+    if (desc == NULL) {
+        ep0_stall(hpcd);
+        return;
+    }
+
+    switch (setup[0] & REQ_TYPE_MASK) {
+        case REQ_TYPE_STANDARD:
+            standard_request(hpcd, setup, value, index, length);
+            break;
+        case REQ_TYPE_CLASS:
+            class_request(hpcd, setup, value, length);
+            break;
+        default:
+            ep0_stall(hpcd);
+            break;
+    }
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+    if (epnum == (USB_DEVICE_EP_IN & 0x0F)) {
+        if (callbacks.in_complete) {
+            callbacks.in_complete(xlat_counter_1mhz_get());
+        }
+        return;
+    }
+    if (epnum != 0) {
+        return;
+    }
+
+    if (ep0_state == EP0_DATA_IN) {
+        if (ep0_remaining > 0) {
+            ep0_send_next(hpcd);
+        } else if (ep0_zlp) {
+            ep0_zlp = false;
+            HAL_PCD_EP_Transmit(hpcd, 0x80, NULL, 0);
+        } else {
+            ep0_state = EP0_STATUS_OUT;
+            HAL_PCD_EP_Receive(hpcd, 0x00, NULL, 0);
+        }
+    } else if (ep0_state == EP0_STATUS_IN) {
+        ep0_state = EP0_IDLE;
+    }
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+    if (epnum != 0) {
+        return;
+    }
+    if (ep0_state == EP0_DATA_OUT) {
+        ep0_status_in(hpcd);
+    } else if (ep0_state == EP0_STATUS_OUT) {
+        ep0_state = EP0_IDLE;
+    }
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
+{
+    HAL_PCD_EP_Open(hpcd, 0x00, USB_DEVICE_EP0_SIZE, EP_TYPE_CTRL);
+    HAL_PCD_EP_Open(hpcd, 0x80, USB_DEVICE_EP0_SIZE, EP_TYPE_CTRL);
+    ep0_state = EP0_IDLE;
+    idle_rate = 0;
+    protocol = 1;
+    set_configured(hpcd, false);
+}
+
+void HAL_PCD_MspInit(PCD_HandleTypeDef *hpcd)
+{
+    if (hpcd->Instance == USB_OTG_FS) {
+        // The data pins (PA11, PA12) and ID (PA10) are already in AF10 from MX_GPIO_Init() in
+        // hardware_config.c, only the clock and interrupt are left
+        __HAL_RCC_USB_OTG_FS_CLK_ENABLE();
+
+        HAL_NVIC_SetPriority(OTG_FS_IRQn, 5, 0);
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+    }
+}
+
+void HAL_PCD_MspDeInit(PCD_HandleTypeDef *hpcd)
+{
+    if (hpcd->Instance == USB_OTG_FS) {
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+        __HAL_RCC_USB_OTG_FS_CLK_DISABLE();
+    }
+}
+
+bool usb_device_start(const usb_device_descriptors_t *descriptors, const usb_device_callbacks_t *device_callbacks)
+{
+    if (started) {
+        usb_device_stop();
+    }
+
+    desc = descriptors;
+    callbacks = *device_callbacks;
+    ep_size = desc->config[USB_DEVICE_CONFIG_EP + 4] | (desc->config[USB_DEVICE_CONFIG_EP + 5] << 8);
+    configured = false;
+    ep0_state = EP0_IDLE;
+
+    hpcd_USB_OTG_FS.Instance = USB_OTG_FS;
+    hpcd_USB_OTG_FS.Init.dev_endpoints = 6;
+    hpcd_USB_OTG_FS.Init.speed = PCD_SPEED_FULL;
+    hpcd_USB_OTG_FS.Init.dma_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
+    hpcd_USB_OTG_FS.Init.Sof_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.low_power_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.lpm_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.vbus_sensing_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.use_dedicated_ep1 = DISABLE;
+    if (HAL_PCD_Init(&hpcd_USB_OTG_FS) != HAL_OK) {
+        printf("[usb_device] OTG_FS init failed\n");
+        desc = NULL;
+        return false;
+    }
+    HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, FIFO_RX_WORDS);
+    HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, FIFO_TX0_WORDS);
+    HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 1, FIFO_TX1_WORDS);
+
+    // Pulls up D+, the PC enumerates the device
+    HAL_PCD_Start(&hpcd_USB_OTG_FS);
+    started = true;
+    printf("[usb_device] started, %04X:%04X, %u byte reports every %u ms\n",
+           desc->device[8] | (desc->device[9] << 8), desc->device[10] | (desc->device[11] << 8), ep_size,
+           desc->config[USB_DEVICE_CONFIG_EP + 6]);
+    return true;
+}
+
+void usb_device_stop(void)
+{
+    if (!started) {
+        return;
+    }
+    HAL_PCD_Stop(&hpcd_USB_OTG_FS);
+    HAL_PCD_DeInit(&hpcd_USB_OTG_FS);
+    started = false;
+    configured = false;
+    desc = NULL;
+    printf("[usb_device] stopped\n");
+}
+
+bool usb_device_is_started(void)
+{
+    return started;
+}
+
+bool usb_device_is_configured(void)
+{
+    return configured;
+}
+
+uint16_t usb_device_ep_size(void)
+{
+    return ep_size;
+}
+
+bool usb_device_send(const uint8_t *report, uint16_t length)
+{
+    if (!configured || (length > ep_size)) {
+        return false;
+    }
+    return HAL_PCD_EP_Transmit(&hpcd_USB_OTG_FS, USB_DEVICE_EP_IN, (uint8_t *)report, length) == HAL_OK;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_DEVICE_H
+#define USB_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "stm32f7xx_hal.h"
+
+// Minimal HID device on the OTG_FS port (CN13), full speed with the embedded PHY: control requests
+// on EP0 and one interrupt IN endpoint. The board doesn't supply VBUS on CN13 (OTG_FS_PowerSwitchOn
+// stays high), and VBUS sensing is off, the PC sees the device when it is started.
+#define USB_DEVICE_EP0_SIZE         (64)
+#define USB_DEVICE_EP_IN            (0x81)
+#define USB_DEVICE_DESC_LENGTH      (18)
+// Configuration with one HID interface: configuration, interface, HID and endpoint descriptors
+#define USB_DEVICE_CONFIG_LENGTH    (9 + 9 + 9 + 7)
+#define USB_DEVICE_CONFIG_HID       (9 + 9)     // offset of the HID descriptor
+#define USB_DEVICE_CONFIG_EP        (9 + 9 + 9) // offset of the endpoint descriptor
+#define USB_DEVICE_STRING_MAX       (63)        // characters, sent as UTF-16LE
+
+typedef struct usb_device_descriptors {
+    uint8_t device[USB_DEVICE_DESC_LENGTH];
+    uint8_t config[USB_DEVICE_CONFIG_LENGTH];
+    const uint8_t *report;
+    uint16_t report_length;
+    char manufacturer[USB_DEVICE_STRING_MAX + 1];   // string 1
+    char product[USB_DEVICE_STRING_MAX + 1];        // string 2
+} usb_device_descriptors_t;
+
+// Called from the OTG_FS interrupt
+typedef struct usb_device_callbacks {
+    void (*configured)(bool configured);    // SET_CONFIGURATION, or a bus reset
+    void (*in_complete)(uint32_t timestamp);// the IN transfer on USB_DEVICE_EP_IN was polled by the PC
+} usb_device_callbacks_t;
+
+// Builds the device and configuration descriptors of a HID device, the strings are filled in by the caller
+void usb_device_descriptors_init(usb_device_descriptors_t *descriptors, uint16_t vid, uint16_t pid, uint16_t bcd_device,
+                                 uint8_t subclass, uint8_t protocol, uint16_t ep_size, uint8_t interval_ms,
+                                 const uint8_t *report, uint16_t report_length);
+
+// The descriptors must stay valid until usb_device_stop()
+bool usb_device_start(const usb_device_descriptors_t *descriptors, const usb_device_callbacks_t *callbacks);
+void usb_device_stop(void);
+bool usb_device_is_started(void);
+bool usb_device_is_configured(void);
+uint16_t usb_device_ep_size(void);
+// Arms the IN endpoint with one report, the buffer must stay valid until in_complete
+bool usb_device_send(const uint8_t *report, uint16_t length);
+
+#endif //USB_DEVICE_H
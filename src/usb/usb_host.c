@@ -23,6 +23,7 @@
 #include "usbh_hid.h"
 #include "gfx_main.h"
 #include "xlat.h"
+#include "usb_proxy.h"
 
 /* Private variables ---------------------------------------------------------*/
 
@@ -73,6 +74,7 @@ static void USBH_UserProcess  (USBH_HandleTypeDef *phost, uint8_t id)
         case HOST_USER_DISCONNECTION: {
             // Clear offsets
             xlat_clear_locations();
+            usb_proxy_host_disconnected();
             // Send a message to the gfx thread, to refresh the device info
             struct gfx_event *evt;
             evt = osPoolAlloc(gfxevt_pool); // Allocate memory for the message
@@ -90,6 +92,7 @@ static void USBH_UserProcess  (USBH_HandleTypeDef *phost, uint8_t id)
             memset(vidpid_string, 0, sizeof(vidpid_string));
             snprintf(vidpid_string, sizeof(vidpid_string), "0x%04X:%04X", vid, pid);
             vidpid_string[sizeof(vidpid_string) - 1] = '\0';
+            usb_proxy_host_connected(phost);
 
             // Send a message to the gfx thread, to refresh the device info
             struct gfx_event *evt;
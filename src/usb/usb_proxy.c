@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "usb_proxy.h"
+#include "usb_device.h"
+#include "usb_host.h"
+#include "main.h"
+#include "xlat.h"
+
+typedef struct proxy_report {
+    uint8_t data[USB_PROXY_REPORT_MAX];
+    uint16_t length;
+    uint32_t urb_timestamp;
+    uint32_t armed_timestamp;
+} proxy_report_t;
+
+static volatile bool enabled = false;
+static volatile bool clone_ready = false;
+static usb_device_descriptors_t descriptors;
+static uint8_t report_desc[USB_PROXY_REPORT_DESC_MAX];
+static uint16_t report_desc_length = 0;
+static HID_DescTypeDef hid_desc_copy;
+
+// The queue head is the report in flight while the endpoint is busy
+static proxy_report_t queue[USB_PROXY_QUEUE_SIZE];
+static volatile uint32_t queue_head = 0;
+static volatile uint32_t queue_tail = 0;
+static volatile bool ep_busy = false;
+
+static usb_proxy_stats_t stats;
+static uint32_t printed_forwarded = 0;
+
+static void queue_clear(void)
+{
+    queue_head = queue_tail;
+    ep_busy = false;
+}
+
+// Interrupt, or the host thread in a critical section
+static void arm_next(void)
+{
+    proxy_report_t *report = &queue[queue_head % USB_PROXY_QUEUE_SIZE];
+
+    report->armed_timestamp = xlat_counter_1mhz_get();
+    ep_busy = usb_device_send(report->data, report->length);
+    if (!ep_busy) {
+        // Unconfigured in the meantime
+        queue_clear();
+    }
+}
+
+static void proxy_configured(bool configured)
+{
+    (void)configured;
+    queue_clear();
+}
+
+static void proxy_in_complete(uint32_t timestamp)
+{
+    if (!ep_busy) {
+        return;
+    }
+
+    const proxy_report_t *report = &queue[queue_head % USB_PROXY_QUEUE_SIZE];
+    latency_stats_add(&stats.total, timestamp - report->urb_timestamp);
+    latency_stats_add(&stats.board, report->armed_timestamp - report->urb_timestamp);
+    latency_stats_add(&stats.poll, timestamp - report->armed_timestamp);
+    stats.forwarded++;
+
+    queue_head++;
+    ep_busy = false;
+    if (queue_tail != queue_head) {
+        arm_next();
+    }
+}
+
+static const usb_device_callbacks_t proxy_callbacks = {
+    .configured = proxy_configured,
+    .in_complete = proxy_in_complete,
+};
+
+static void attach(void)
+{
+    if (!enabled || !clone_ready || usb_device_is_started()) {
+        return;
+    }
+    queue_clear();
+    usb_device_start(&descriptors, &proxy_callbacks);
+}
+
+void usb_proxy_start(void)
+{
+    // The port is taken by the reference mouse
+    if (!enabled && usb_device_is_started()) {
+        return;
+    }
+    if (!enabled) {
+        usb_proxy_reset_stats();
+    }
+    enabled = true;
+    attach();
+}
+
+void usb_proxy_stop(void)
+{
+    if (!enabled) {
+        return;
+    }
+    enabled = false;
+    usb_device_stop();
+    queue_clear();
+}
+
+usb_proxy_state_t usb_proxy_get_state(void)
+{
+    if (!enabled) {
+        return USB_PROXY_OFF;
+    }
+    if (!usb_device_is_started()) {
+        return USB_PROXY_WAITING;
+    }
+    return usb_device_is_configured() ? USB_PROXY_CONFIGURED : USB_PROXY_ATTACHED;
+}
+
+const char * usb_proxy_state_name(usb_proxy_state_t state)
+{
+    switch (state) {
+        case USB_PROXY_WAITING:
+            return "Waiting for a mouse";
+        case USB_PROXY_ATTACHED:
+            return "Attached, not configured by the PC";
+        case USB_PROXY_CONFIGURED:
+            return "Forwarding";
+        case USB_PROXY_OFF:
+        default:
+            return "Off";
+    }
+}
+
+void usb_proxy_get_stats(usb_proxy_stats_t *copy)
+{
+    taskENTER_CRITICAL();
+    *copy = stats;
+    taskEXIT_CRITICAL();
+}
+
+void usb_proxy_reset_stats(void)
+{
+    taskENTER_CRITICAL();
+    memset(&stats, 0, sizeof(stats));
+    latency_stats_reset(&stats.total);
+    latency_stats_reset(&stats.board);
+    latency_stats_reset(&stats.poll);
+    printed_forwarded = 0;
+    taskEXIT_CRITICAL();
+}
+
+void usb_proxy_host_report_descriptor(const HID_DescTypeDef *hid_desc, const uint8_t *desc)
+{
+    clone_ready = false;
+    if (hid_desc->wItemLength > sizeof(report_desc)) {
+        printf("[proxy] report descriptor of %u bytes too long to clone\n", hid_desc->wItemLength);
+        report_desc_length = 0;
+        return;
+    }
+    memcpy(report_desc, desc, hid_desc->wItemLength);
+    report_desc_length = hid_desc->wItemLength;
+    hid_desc_copy = *hid_desc;
+}
+
+void usb_proxy_host_connected(USBH_HandleTypeDef *phost)
+{
+    if (report_desc_length == 0) {
+        return;
+    }
+
+    const USBH_InterfaceDescTypeDef *itf = &phost->device.CfgDesc.Itf_Desc[phost->device.current_interface];
+    uint16_t ep_mps = 0;
+    for (uint8_t i = 0; (i < itf->bNumEndpoints) && (i < USBH_MAX_NUM_ENDPOINTS); i++) {
+        if (itf->Ep_Desc[i].bEndpointAddress & 0x80) {
+            ep_mps = itf->Ep_Desc[i].wMaxPacketSize & 0x7FF;
+            break;
+        }
+    }
+    if ((ep_mps == 0) || (ep_mps > USB_PROXY_REPORT_MAX)) {
+        // Longer reports can't be sent as one full speed packet
+        printf("[proxy] IN endpoint of %u bytes, not cloned\n", ep_mps);
+        return;
+    }
+
+    usb_device_descriptors_init(&descriptors, phost->device.DevDesc.idVendor, phost->device.DevDesc.idProduct,
+                                phost->device.DevDesc.bcdDevice, itf->bInterfaceSubClass, itf->bInterfaceProtocol,
+                                ep_mps, USB_PROXY_INTERVAL_MS, report_desc, report_desc_length);
+    descriptors.config[USB_DEVICE_CONFIG_HID + 2] = hid_desc_copy.bcdHID & 0xFF;
+    descriptors.config[USB_DEVICE_CONFIG_HID + 3] = hid_desc_copy.bcdHID >> 8;
+    descriptors.config[USB_DEVICE_CONFIG_HID + 4] = hid_desc_copy.bCountryCode;
+    snprintf(descriptors.manufacturer, sizeof(descriptors.manufacturer), "%s", usb_host_get_manuf_string());
+    snprintf(descriptors.product, sizeof(descriptors.product), "%s", usb_host_get_product_string());
+
+    printf("[proxy] cloned %04X:%04X \"%s\", %u byte reports, %u byte report descriptor\n",
+           phost->device.DevDesc.idVendor, phost->device.DevDesc.idProduct, descriptors.product, ep_mps,
+           report_desc_length);
+    clone_ready = true;
+    attach();
+}
+
+void usb_proxy_host_disconnected(void)
+{
+    clone_ready = false;
+    report_desc_length = 0;
+    // The PC sees the clone unplugged too
+    if (enabled) {
+        usb_device_stop();
+        queue_clear();
+    }
+}
+
+static void print_stats(void)
+{
+    usb_proxy_stats_t copy;
+
+    usb_proxy_get_stats(&copy);
+    printf("[proxy] %lu forwarded, %lu dropped, %lu before configured, queue up to %lu\n", copy.forwarded,
+           copy.dropped, copy.not_configured, copy.queue_max);
+    printf("[proxy] delay %lu us (stdev %lu, %lu .. %lu), on the board %lu us (max %lu), PC poll %lu us\n",
+           copy.total.mean_us, copy.total.stdev_us, copy.total.min_us, copy.total.max_us, copy.board.mean_us,
+           copy.board.max_us, copy.poll.mean_us);
+}
+
+void usb_proxy_forward(const uint8_t *report, uint16_t length, uint32_t urb_timestamp)
+{
+    if (!enabled || !clone_ready) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    if (!usb_device_is_configured()) {
+        stats.not_configured++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+    uint32_t queued = queue_tail - queue_head;
+    if ((length > usb_device_ep_size()) || (queued >= USB_PROXY_QUEUE_SIZE)) {
+        stats.dropped++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    proxy_report_t *slot = &queue[queue_tail % USB_PROXY_QUEUE_SIZE];
+    memcpy(slot->data, report, length);
+    slot->length = length;
+    slot->urb_timestamp = urb_timestamp;
+    queue_tail++;
+    if (queued + 1 > stats.queue_max) {
+        stats.queue_max = queued + 1;
+    }
+    if (!ep_busy) {
+        arm_next();
+    }
+    bool print = (stats.forwarded - printed_forwarded) >= USB_PROXY_PRINT_INTERVAL;
+    if (print) {
+        printed_forwarded = stats.forwarded;
+    }
+    taskEXIT_CRITICAL();
+
+    // After the report is on its way
+    if (print) {
+        print_stats();
+    }
+}
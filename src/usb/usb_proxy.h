@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_PROXY_H
+#define USB_PROXY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "usbh_core.h"
+#include "usbh_hid.h"
+#include "latency_stats.h"
+
+// HID passthrough: the OTG_FS port (CN13) enumerates on a PC as a clone of the mouse on OTG_HS, and
+// each report the host side receives is forwarded to it, while the measurements go on as usual.
+// Only the polled HID interface is cloned, with a full speed interrupt IN endpoint polled every frame.
+// The forwarding delay is the transfer interrupt of a report on OTG_HS to the completion of the IN
+// transfer that carries it to the PC, split in the part spent on the board (host thread, copy, queue)
+// and the wait for the PC's next poll.
+#define USB_PROXY_REPORT_MAX        (64)    // full speed interrupt endpoint
+#define USB_PROXY_REPORT_DESC_MAX   (512)
+#define USB_PROXY_INTERVAL_MS       (1)
+#define USB_PROXY_QUEUE_SIZE        (16)    // relative motion can't be dropped, a PC may poll late
+#define USB_PROXY_PRINT_INTERVAL    (1000)  // forwarded reports
+
+typedef enum usb_proxy_state {
+    USB_PROXY_OFF = 0,
+    USB_PROXY_WAITING,      // no mouse to clone yet
+    USB_PROXY_ATTACHED,     // pulled up on OTG_FS, not configured by the PC
+    USB_PROXY_CONFIGURED,   // forwarding
+} usb_proxy_state_t;
+
+typedef struct usb_proxy_stats {
+    uint32_t forwarded;     // IN transfers completed
+    uint32_t dropped;       // queue full or too long
+    uint32_t not_configured;// received while the PC had not configured the clone
+    uint32_t queue_max;
+    latency_stats_t total;  // transfer interrupt on OTG_HS to IN transfer complete on OTG_FS
+    latency_stats_t board;  // transfer interrupt to the IN endpoint armed
+    latency_stats_t poll;   // IN endpoint armed to the transfer complete, the PC's polling
+} usb_proxy_stats_t;
+
+void usb_proxy_start(void);
+void usb_proxy_stop(void);
+usb_proxy_state_t usb_proxy_get_state(void);
+const char * usb_proxy_state_name(usb_proxy_state_t state);
+// Copy, consistent with the interrupt updating it
+void usb_proxy_get_stats(usb_proxy_stats_t *stats);
+void usb_proxy_reset_stats(void);
+
+// USB host thread: the descriptors to clone, and the reports to forward
+void usb_proxy_host_report_descriptor(const HID_DescTypeDef *hid_desc, const uint8_t *desc);
+void usb_proxy_host_connected(USBH_HandleTypeDef *phost);
+void usb_proxy_host_disconnected(void);
+void usb_proxy_forward(const uint8_t *report, uint16_t length, uint32_t urb_timestamp);
+
+#endif //USB_PROXY_H
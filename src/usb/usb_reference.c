@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_reference.h"
+#include "usb_device.h"
+#include "main.h"
+#include "hardware_config.h"
+#include "xlat.h"
+#include "phase_sweep.h"
+#include "calibration.h"
+#include "bounce_capture.h"
+
+typedef enum reference_state {
+    REFERENCE_WAITING = 0,  // for the host to configure the reference mouse
+    REFERENCE_IDLE,         // gap before the next press
+    REFERENCE_PRESSED,      // D11 pressed, the report scheduled or sent
+} reference_state_t;
+
+typedef enum report_state {
+    REPORT_NONE = 0,
+    REPORT_SCHEDULED,       // TIM2 compare pending
+    REPORT_ARMED,           // on the IN endpoint, waiting for the host's poll
+    REPORT_SENT,
+    REPORT_RELEASE,
+} report_state_t;
+
+// Boot protocol compatible mouse: 3 buttons, X, Y and wheel
+static const uint8_t report_desc[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x03, 0x81, 0x06,
+    0xC0, 0xC0,
+};
+static const uint8_t press_report[4] = { 0x01, 0, 0, 0 };
+static const uint8_t release_report[4] = { 0x00, 0, 0, 0 };
+
+static usb_device_descriptors_t descriptors;
+static usb_reference_config_t config;
+static usb_reference_result_t result;
+static bool running = false;
+static reference_state_t state = REFERENCE_WAITING;
+static uint32_t state_ms = 0;
+static uint32_t configured_ms = 0;
+static uint32_t press_timeout_ms = 0;
+
+// Written by the interrupts
+static volatile report_state_t report_state = REPORT_NONE;
+static volatile uint32_t edge_us;
+static volatile uint32_t target_us;
+static volatile uint32_t armed_us;
+static volatile uint32_t sent_us;
+static volatile bool awaiting_measurement = false;
+
+static uint32_t next_delay_us(void)
+{
+    switch (config.distribution) {
+        case USB_REFERENCE_UNIFORM:
+            return config.delay_us + (uint32_t)rand() % (config.delay2_us - config.delay_us + 1);
+        case USB_REFERENCE_BIMODAL:
+            return ((uint32_t)(rand() % 100) < config.percent) ? config.delay_us : config.delay2_us;
+        case USB_REFERENCE_FIXED:
+        default:
+            return config.delay_us;
+    }
+}
+
+int32_t usb_reference_bias_ns(const offset_stats_t *error)
+{
+    return offset_stats_mean_ns(error, 1000);
+}
+
+uint32_t usb_reference_stdev_ns(const offset_stats_t *error)
+{
+    return offset_stats_stdev_ns(error, 1000);
+}
+
+bool usb_reference_passed(const usb_reference_result_t *res)
+{
+    int32_t bias = usb_reference_bias_ns(&res->error);
+    return (res->error.count >= USB_REFERENCE_SAMPLES_MIN) && (abs(bias) <= USB_REFERENCE_BIAS_LIMIT_NS) &&
+           (2 * usb_reference_stdev_ns(&res->error) <= USB_REFERENCE_SPREAD_LIMIT_NS);
+}
+
+// Interrupt, or with the interrupts disabled
+static void arm_report(uint32_t now_us)
+{
+    armed_us = now_us;
+    report_state = usb_device_send(press_report, sizeof(press_report)) ? REPORT_ARMED : REPORT_NONE;
+}
+
+static void compare_stop(void)
+{
+    __HAL_TIM_DISABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+}
+
+void usb_reference_compare(void)
+{
+    if (report_state != REPORT_SCHEDULED) {
+        return;
+    }
+    compare_stop();
+    arm_report(xlat_counter_1mhz_get());
+}
+
+static void reference_in_complete(uint32_t timestamp)
+{
+    if (report_state == REPORT_ARMED) {
+        sent_us = timestamp;
+        report_state = REPORT_SENT;
+        awaiting_measurement = true;
+    } else if (report_state == REPORT_RELEASE) {
+        report_state = REPORT_NONE;
+    }
+}
+
+static void reference_configured(bool configured)
+{
+    if (!configured) {
+        report_state = REPORT_NONE;
+    }
+}
+
+static const usb_device_callbacks_t reference_callbacks = {
+    .configured = reference_configured,
+    .in_complete = reference_in_complete,
+};
+
+static void press(uint32_t now_ms)
+{
+    uint32_t delay_us = next_delay_us();
+
+    if (awaiting_measurement) {
+        // The previous press was sent but never measured
+        awaiting_measurement = false;
+        result.missed++;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    xlat_auto_trigger_set(true);
+    edge_us = xlat_counter_1mhz_get();
+    target_us = edge_us + delay_us;
+    report_state = REPORT_SCHEDULED;
+    if (delay_us < 2) {
+        arm_report(edge_us);
+    } else {
+        __HAL_TIM_SET_COMPARE(&XLAT_TIMx_handle, TIM_CHANNEL_4, target_us);
+        __HAL_TIM_CLEAR_FLAG(&XLAT_TIMx_handle, TIM_FLAG_CC4);
+        __HAL_TIM_ENABLE_IT(&XLAT_TIMx_handle, TIM_IT_CC4);
+    }
+    __set_PRIMASK(primask);
+
+    // Up to 4 polls late, then it is lost
+    press_timeout_ms = USB_REFERENCE_PRESS_MS + delay_us / 1000 + 4 * config.interval_ms + 10;
+    state_ms = now_ms;
+    state = REFERENCE_PRESSED;
+}
+
+static void release(uint32_t now_ms)
+{
+    compare_stop();
+    xlat_auto_trigger_set(false);
+    result.cycles++;
+
+    if (report_state == REPORT_SENT) {
+        uint32_t late_us = armed_us - target_us;
+        if (((int32_t)late_us > 0) && (late_us > result.late_max_us)) {
+            result.late_max_us = late_us;
+        }
+        latency_stats_add(&result.delay, armed_us - edge_us);
+        latency_stats_add(&result.truth, sent_us - edge_us);
+        report_state = REPORT_RELEASE;
+        if (!usb_device_send(release_report, sizeof(release_report))) {
+            report_state = REPORT_NONE;
+        }
+    } else {
+        result.missed++;
+        if (report_state == REPORT_SCHEDULED) {
+            report_state = REPORT_NONE;
+        }
+    }
+    state_ms = now_ms;
+    state = REFERENCE_IDLE;
+}
+
+static void finish(void)
+{
+    const usb_reference_result_t *res = &result;
+
+    compare_stop();
+    xlat_auto_trigger_set(false);
+    running = false;
+    if (awaiting_measurement) {
+        awaiting_measurement = false;
+        result.missed++;
+    }
+    usb_device_stop();
+
+    printf("[reference] %lu presses, %lu missed, bInterval %u ms, compare up to %lu us late\n", res->cycles,
+           res->missed, config.interval_ms, res->late_max_us);
+    printf("[reference] programmed %lu us (%lu .. %lu), true %lu us (%lu .. %lu), measured %lu us (%lu .. %lu)\n",
+           res->delay.mean_us, res->delay.min_us, res->delay.max_us, res->truth.mean_us, res->truth.min_us,
+           res->truth.max_us, res->measured.mean_us, res->measured.min_us, res->measured.max_us);
+    printf("[reference] error: bias %ld ns, stdev %lu ns, %ld .. %ld us, %s, %s\n", usb_reference_bias_ns(&res->error),
+           usb_reference_stdev_ns(&res->error), res->error.min, res->error.max,
+           (xlat_get_calibration() != NULL) ? "calibrated" : "not calibrated",
+           usb_reference_passed(res) ? "PASS" : "FAIL");
+}
+
+bool usb_reference_start(const usb_reference_config_t *new_config)
+{
+    // TIM2 channel 4, D11 and the OTG_FS port are shared
+    if (running || phase_sweep_is_running() || calibration_is_running() || bounce_capture_is_running() ||
+        usb_device_is_started()) {
+        return false;
+    }
+    if ((new_config->delay_us > USB_REFERENCE_DELAY_MAX_US) || (new_config->delay2_us > USB_REFERENCE_DELAY_MAX_US) ||
+        ((new_config->distribution == USB_REFERENCE_UNIFORM) && (new_config->delay2_us < new_config->delay_us)) ||
+        (new_config->interval_ms == 0)) {
+        return false;
+    }
+
+    config = *new_config;
+    if (config.cycles == 0) {
+        config.cycles = 1;
+    }
+    memset(&result, 0, sizeof(result));
+    latency_stats_reset(&result.delay);
+    latency_stats_reset(&result.truth);
+    latency_stats_reset(&result.measured);
+    report_state = REPORT_NONE;
+    awaiting_measurement = false;
+
+    usb_device_descriptors_init(&descriptors, USB_REFERENCE_VID, USB_REFERENCE_PID, 0x0100, 0x01, 0x02,
+                                sizeof(press_report), config.interval_ms, report_desc, sizeof(report_desc));
+    snprintf(descriptors.manufacturer, sizeof(descriptors.manufacturer), "XLAT");
+    snprintf(descriptors.product, sizeof(descriptors.product), "XLAT reference mouse");
+    if (!usb_device_start(&descriptors, &reference_callbacks)) {
+        return false;
+    }
+
+    state = REFERENCE_WAITING;
+    configured_ms = 0;
+    running = true;
+    printf("Reference mouse: %lu presses, delay %lu / %lu us (%d), bInterval %u ms, USB FS to USB HS, D11 to D12\n",
+           config.cycles, config.delay_us, config.delay2_us, config.distribution, config.interval_ms);
+    return true;
+}
+
+void usb_reference_stop(void)
+{
+    if (!running) {
+        return;
+    }
+    finish();
+}
+
+bool usb_reference_is_running(void)
+{
+    return running;
+}
+
+bool usb_reference_is_waiting(void)
+{
+    return running && (state == REFERENCE_WAITING);
+}
+
+const usb_reference_config_t * usb_reference_config(void)
+{
+    return &config;
+}
+
+const usb_reference_result_t * usb_reference_result(void)
+{
+    return &result;
+}
+
+void usb_reference_tick(uint32_t now_ms)
+{
+    if (!running) {
+        return;
+    }
+
+    switch (state) {
+        case REFERENCE_WAITING:
+            // The host enumerates the mouse and starts polling it
+            if (!usb_device_is_configured()) {
+                configured_ms = 0;
+                break;
+            }
+            if (configured_ms == 0) {
+                configured_ms = now_ms ? now_ms : 1;
+            }
+            if (now_ms - configured_ms >= USB_REFERENCE_SETTLE_MS) {
+                state_ms = now_ms;
+                state = REFERENCE_IDLE;
+            }
+            break;
+
+        case REFERENCE_IDLE:
+            if (!usb_device_is_configured()) {
+                state = REFERENCE_WAITING;
+                break;
+            }
+            // The release report has gone, and the next press comes after the hold-off of D12
+            if (now_ms - state_ms < xlat_get_gpio_irq_holdoff_us(0) / 1000 + USB_REFERENCE_GAP_MS +
+                                    4 * config.interval_ms) {
+                break;
+            }
+            if (result.cycles >= config.cycles) {
+                finish();
+                break;
+            }
+            press(now_ms);
+            break;
+
+        case REFERENCE_PRESSED:
+            if ((now_ms - state_ms >= USB_REFERENCE_PRESS_MS) &&
+                ((report_state == REPORT_SENT) || (now_ms - state_ms >= press_timeout_ms))) {
+                release(now_ms);
+            }
+            break;
+    }
+}
+
+void usb_reference_add(int32_t latency_us)
+{
+    if (!running || !awaiting_measurement) {
+        return;
+    }
+    awaiting_measurement = false;
+
+    uint32_t truth_us = sent_us - edge_us;
+    latency_stats_add(&result.measured, (latency_us > 0) ? (uint32_t)latency_us : 0);
+    offset_stats_add(&result.error, latency_us - (int32_t)truth_us);
+}
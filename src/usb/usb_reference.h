@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_REFERENCE_H
+#define USB_REFERENCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "latency_stats.h"
+#include "offset_stats.h"
+
+// Reference mouse for a self-test of the whole measurement chain: the USB FS port (CN13) is cabled
+// to the USB HS host port (CN12), and D11 is wired to D12 as for the auto-trigger. Each cycle presses
+// D11, and a TIM2 compare arms the button 1 report a programmed delay after it. Both ends are on the
+// time base: the true latency is the D11 edge to the completion of the IN transfer that carried the
+// report, the wait for the host's poll at bInterval included. The error is the latency XLAT measures
+// on channel 0 minus the true one, in us: its mean (in ns) is the bias of the instrument.
+#define USB_REFERENCE_VID           (0x0483)
+#define USB_REFERENCE_PID           (0x5710)
+#define USB_REFERENCE_PRESS_MS      (20)
+#define USB_REFERENCE_GAP_MS        (30)    // after the hold-off of D12 and the release report
+#define USB_REFERENCE_SETTLE_MS     (500)   // after the host configured the device, before the first press
+#define USB_REFERENCE_DELAY_MAX_US  (50000)
+// Self-test limits, for a calibrated instrument (a raw one is off by the timestamp offsets)
+#define USB_REFERENCE_BIAS_LIMIT_NS     (2000)
+#define USB_REFERENCE_SPREAD_LIMIT_NS   (10000) // 2 sigma of the error
+#define USB_REFERENCE_SAMPLES_MIN       (100)
+
+typedef enum usb_reference_distribution {
+    USB_REFERENCE_FIXED = 0,    // delay_us
+    USB_REFERENCE_UNIFORM,      // delay_us .. delay2_us
+    USB_REFERENCE_BIMODAL,      // delay_us for percent of the presses, delay2_us for the others
+} usb_reference_distribution_t;
+
+typedef struct usb_reference_config {
+    usb_reference_distribution_t distribution;
+    uint32_t delay_us;
+    uint32_t delay2_us;
+    uint8_t percent;
+    uint8_t interval_ms;        // bInterval of the reference mouse
+    uint32_t cycles;
+} usb_reference_config_t;
+
+typedef struct usb_reference_result {
+    uint32_t cycles;            // presses made
+    uint32_t missed;            // report not sent, or not measured
+    uint32_t late_max_us;       // compare interrupt after the programmed time
+    latency_stats_t delay;      // D11 edge to the report armed, as fired
+    latency_stats_t truth;      // D11 edge to the IN transfer complete
+    latency_stats_t measured;   // channel 0 latencies matched to a press
+    offset_stats_t error;       // measured - true, us
+} usb_reference_result_t;
+
+bool usb_reference_start(const usb_reference_config_t *config);
+void usb_reference_stop(void);
+bool usb_reference_is_running(void);
+// Waiting for the host to enumerate the reference mouse
+bool usb_reference_is_waiting(void);
+const usb_reference_config_t * usb_reference_config(void);
+const usb_reference_result_t * usb_reference_result(void);
+
+int32_t usb_reference_bias_ns(const offset_stats_t *error);
+uint32_t usb_reference_stdev_ns(const offset_stats_t *error);
+// Within the self-test limits, with enough samples
+bool usb_reference_passed(const usb_reference_result_t *result);
+
+// Gfx task: presses and releases, call it every 10 ms
+void usb_reference_tick(uint32_t now_ms);
+// Gfx task: the latency measured on channel 0
+void usb_reference_add(int32_t latency_us);
+// Interrupt hook: TIM2 channel 4 compare
+void usb_reference_compare(void);
+
+#endif //USB_REFERENCE_H
@@ -18,6 +18,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "src/usb/usbh_core.h"
+#include "xlat.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -26,6 +27,7 @@
 /* Private variables ---------------------------------------------------------*/
 
 HCD_HandleTypeDef hhcd_USB_OTG_HS;
+volatile uint32_t usbh_urb_timestamp = 0;
 void Error_Handler(void);
 
 /* Private function prototypes -----------------------------------------------*/
@@ -196,6 +198,8 @@ void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd)
   */
 void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd, uint8_t chnum, HCD_URBStateTypeDef urb_state)
 {
+  /* Time of the transfer interrupt, the HID process takes its timestamp later in the host thread */
+  usbh_urb_timestamp = xlat_counter_1mhz_get();
   /* To be used with OS to sync URB state with the global state machine */
 #if (USBH_USE_OS == 1)
   USBH_LL_NotifyURBChange(hhcd->pData);
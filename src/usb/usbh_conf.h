@@ -47,6 +47,9 @@
   * @{
   */
 
+/* Time of the last URB change interrupt, on the XLAT time base */
+extern volatile uint32_t usbh_urb_timestamp;
+
 /**
   * @}
   */
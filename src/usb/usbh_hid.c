@@ -20,6 +20,8 @@
 #include "usbh_hid_parser.h"
 #include "xlat.h"
 #include "usbh_hid_mouse.h"
+#include "phase_sweep.h"
+#include "usb_proxy.h"
 
 
 static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost);
@@ -133,6 +135,19 @@ static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
         HID_Handle->poll = HID_MIN_POLL;
     }
 
+    // bInterval is in frames for full/low speed, and 2^(bInterval-1) microframes for high speed
+    if (phost->device.speed == USBH_SPEED_HIGH) {
+        HID_Handle->poll_frames = 1U << ((HID_Handle->poll > 16U ? 16U : HID_Handle->poll) - 1U);
+        xlat_set_usb_poll_interval_us(125U * HID_Handle->poll_frames);
+        xlat_set_usb_frame_us(125U);
+    } else {
+        HID_Handle->poll_frames = HID_Handle->poll;
+        xlat_set_usb_poll_interval_us(1000U * HID_Handle->poll_frames);
+        xlat_set_usb_frame_us(1000U);
+    }
+    HID_Handle->last_poll_timestamp = 0;
+    HID_Handle->prev_poll_timestamp = 0;
+
     /* Check of available number of endpoints */
     /* Find the number of EPs in the Interface Descriptor */
     /* Choose the lower number in order not to overrun the buffer allocated */
@@ -231,6 +246,7 @@ static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
             if (classReqStatus == USBH_OK) {
                 /* The descriptor is available in phost->device.Data */
                 xlat_parse_hid_descriptor(phost->device.Data, HID_Handle->HID_Desc.wItemLength);
+                usb_proxy_host_report_descriptor(&HID_Handle->HID_Desc, phost->device.Data);
                 HID_Handle->ctl_state = USBH_HID_REQ_SET_IDLE;
             } else if (classReqStatus == USBH_NOT_SUPPORTED) {
                 USBH_ErrLog("Control error: HID: Device Get Report Descriptor request failed");
@@ -356,6 +372,14 @@ static inline void trigger_thread_by_os_message(USBH_HandleTypeDef *phost)
             break;
 
         case USBH_HID_GET_DATA:
+            // PC-like polling: one IN transaction per bInterval, the way a PC schedules it.
+            // Otherwise the next IN token goes out right away (back-to-back).
+            if ((xlat_get_usb_polling() == XLAT_POLLING_INTERVAL) &&
+                ((phost->Timer - HID_Handle->timer) < HID_Handle->poll_frames)) {
+                // USBH_HID_SOFProcess() wakes the thread again on the next (micro)frame
+                break;
+            }
+            HID_Handle->timer = phost->Timer;
 
             HAL_GPIO_WritePin(ARDUINO_D3_GPIO_Port, ARDUINO_D3_Pin, GPIO_PIN_SET);
             HAL_GPIO_WritePin(ARDUINO_D3_GPIO_Port, ARDUINO_D3_Pin, GPIO_PIN_RESET);
@@ -384,8 +408,15 @@ static inline void trigger_thread_by_os_message(USBH_HandleTypeDef *phost)
                 HAL_GPIO_WritePin(ARDUINO_D4_GPIO_Port, ARDUINO_D4_Pin, GPIO_PIN_SET);
                 HAL_GPIO_WritePin(ARDUINO_D4_GPIO_Port, ARDUINO_D4_Pin, GPIO_PIN_RESET);
 
+                // The report was not there yet at the IN transaction before this one
+                HID_Handle->prev_poll_timestamp = HID_Handle->last_poll_timestamp;
+                HID_Handle->last_poll_timestamp = timestamp;
+                HID_Handle->urb_timestamp = usbh_urb_timestamp;
+
                 //if ((HID_Handle->DataReady == 0U) && (XferSize != 0U)) {
                 if (XferSize != 0U) {
+                    // First, the PC behind the proxy waits for it
+                    usb_proxy_forward(HID_Handle->pData, (uint16_t)XferSize, HID_Handle->urb_timestamp);
                     (void)USBH_HID_FifoWrite(&HID_Handle->fifo, HID_Handle->pData, HID_Handle->length);
                     USBH_HID_EventCallback(phost, timestamp); // triggers the main thread with the timestamp of this event
                     HID_Handle->state = USBH_HID_GET_DATA;
@@ -409,6 +440,7 @@ static inline void trigger_thread_by_os_message(USBH_HandleTypeDef *phost)
                 } else if (USBH_LL_GetURBState(phost, HID_Handle->InPipe) == USBH_URB_NOTREADY) {
                     // NAK or ERROR: Not ready;
                     // HCD_HC_IN_IRQHandler() should be called soon, and trigger the thread again
+                    HID_Handle->last_poll_timestamp = timestamp;
                     HID_Handle->state = USBH_HID_GET_DATA;
                     trigger_thread_by_os_message(phost); // trigger thread -> proceed to next state immediately
                     //printf("NotReady\n");
@@ -438,13 +470,18 @@ static inline void trigger_thread_by_os_message(USBH_HandleTypeDef *phost)
   */
 USBH_StatusTypeDef USBH_HID_SOFProcess(USBH_HandleTypeDef *phost)
 {
-    //HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+    HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
 
 #if 1
     HAL_GPIO_WritePin(ARDUINO_D6_GPIO_Port, ARDUINO_D6_Pin, 1);
     HAL_GPIO_WritePin(ARDUINO_D6_GPIO_Port, ARDUINO_D6_Pin, 0);
 #endif
 
+    // Phase sweep clicks are timed from the SOF of a frame that carries a poll
+    bool poll_due = (xlat_get_usb_polling() != XLAT_POLLING_INTERVAL) ||
+                    ((phost->Timer - HID_Handle->timer) >= HID_Handle->poll_frames);
+    phase_sweep_sof(poll_due);
+
     // Get the state machine movin'
     trigger_thread_by_os_message(phost);
 
@@ -217,7 +217,11 @@ typedef struct _HID_Process
   uint16_t             length;
   uint8_t              ep_addr;
   uint16_t             poll;
+  uint16_t             poll_frames;           /* bInterval in (micro)frames, for PC-like polling */
   uint32_t             timer;
+  uint32_t             last_poll_timestamp;   /* last IN transaction (data or NAK), 1 MHz timebase */
+  uint32_t             prev_poll_timestamp;   /* IN transaction before the last data report */
+  uint32_t             urb_timestamp;         /* transfer interrupt of the last data report */
   uint8_t              DataReady;
   HID_DescTypeDef      HID_Desc;
   USBH_StatusTypeDef(* Init)(USBH_HandleTypeDef *phost);
@@ -17,6 +17,8 @@
 
 /* For LVGL / GFX */
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "touchpad/touchpad.h"
 #include "gfx_main.h"
 
@@ -26,27 +28,126 @@
 #include "stm32f7xx_hal_tim.h"
 #include "hardware_config.h"
 #include "stdio_glue.h"
+#include "latency_stats.h"
+#include "latency_histogram.h"
+#include "sample_store.h"
+#include "latency_window.h"
+#include "outlier_filter.h"
+#include "latency_modes.h"
+#include "scan_period.h"
+#include "soak.h"
+#include "pattern_gen.h"
+#include "logic_capture.h"
+#include "bounce_capture.h"
+#include "analog_trigger.h"
+#include "audio_onset.h"
+#include "calibration.h"
 
 // LUFA HID Parser
 #define __INCLUDE_FROM_USB_DRIVER // NOLINT(*-reserved-identifier)
 #define __INCLUDE_FROM_HID_DRIVER // NOLINT(*-reserved-identifier)
 #include "Drivers/USB/Class/Common/HIDParser.h"
 
-static uint32_t last_btn_gpio_timestamp = 0;
 static uint32_t last_usb_timestamp_us = 0;
-static uint32_t last_latency_us[LATENCY_TYPE_MAX];
-static uint64_t average_latency_us_sum[LATENCY_TYPE_MAX]; // sum of all measurements
-static uint64_t average_latency_us_sum_sq[LATENCY_TYPE_MAX]; // sum of squares, for variance
-static uint32_t average_latency_us_count[LATENCY_TYPE_MAX];
-
-static volatile uint_fast8_t gpio_irq_producer = 0;
-static volatile uint_fast8_t gpio_irq_consumer = 0;
+static uint32_t last_usb_prev_poll_us = 0;  // IN transaction before that report, it was not ready then
+
+// Click onsets from the audio input, for the audio -> USB latency of channel 0
+#define AUDIO_ONSET_MAX_AGE_US  (1000000)   // older onsets belong to no report
+static volatile uint32_t audio_onset_timestamp = 0;
+static volatile uint_fast8_t audio_onset_producer = 0;
+static uint_fast8_t audio_onset_consumer = 0;
+
+// Screen changes seen by the photodiode, for the click -> photon latency of channel 0
+#define PHOTON_MAX_AGE_US       (1000000)   // older presses belong to no screen change
+static uint32_t photon_timestamp_us = 0;
+static uint32_t photon_press_seen = 0;      // press count of channel 0 at the last photon
+
+static xlat_calibration_t calibration;
+static bool calibrated = false;
+
+// Time between the IN transaction before a report and the report itself: the effective poll period
+static latency_stats_t poll_bracket_stats;
+static uint32_t last_device_us[XLAT_CHANNEL_MAX];
+static uint32_t usb_poll_interval_us = 1000;
+static uint32_t usb_frame_us = 1000;        // 125 for high speed microframes
+static xlat_usb_polling_t usb_polling = XLAT_POLLING_BACK_TO_BACK;
+static latency_stats_t latency_stats[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+
+// Outlier detection: the primary statistics above only take the clean samples, the raw ones
+// take every sample. Outliers are still kept in the sample store, with SAMPLE_FLAG_OUTLIER.
+static latency_stats_t raw_latency_stats[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+// Clean samples of the current auto-trigger series, and its first record in the sample store
+static latency_stats_t series_stats[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+static uint32_t series_first_record = 0;
+static outlier_filter_t outlier_filters[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+static uint32_t outlier_sensitivity = XLAT_OUTLIER_SENSITIVITY_DEFAULT;
+static xlat_outlier_t outlier_log[XLAT_OUTLIER_LOG_MAX];
+static uint32_t outlier_log_count = 0;
+static uint32_t last_sample_timestamp_us[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+static bool last_sample_outlier[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+
+// Press latency, split by how long the device was idle before the press
+static uint32_t last_idle_ms[XLAT_CHANNEL_MAX];
+static latency_stats_t idle_latency_stats[XLAT_CHANNEL_MAX][XLAT_IDLE_BUCKET_MAX];
+
+// Latency histograms for the percentiles, one per statistics stream. They are too large for the
+// internal RAM (~8 KB each), so they live in their own region of the external SDRAM.
+typedef struct xlat_histograms {
+    latency_histogram_t latency[XLAT_CHANNEL_MAX][LATENCY_TYPE_MAX];
+    latency_histogram_t idle[XLAT_CHANNEL_MAX][XLAT_IDLE_BUCKET_MAX];
+} xlat_histograms_t;
+
+_Static_assert(sizeof(xlat_histograms_t) <= HW_SDRAM_HISTOGRAM_SIZE, "latency histograms do not fit in their SDRAM region");
+_Static_assert((XLAT_CHANNEL_MAX <= SAMPLE_STORE_CHANNEL_MAX) && (LATENCY_TYPE_MAX <= SAMPLE_STORE_TYPE_MAX),
+               "sample records cannot hold all channels and latency types");
+
+static xlat_histograms_t * const histograms = (xlat_histograms_t *)HW_SDRAM_HISTOGRAM_ADDR;
+
+static bool sample_store_full_reported = false;
+
+// Sliding windows per statistics stream, also in SDRAM (~32 KB each)
+static latency_window_t (* const windows)[LATENCY_TYPE_MAX] = (latency_window_t (*)[LATENCY_TYPE_MAX])HW_SDRAM_WINDOW_ADDR;
+
+_Static_assert(sizeof(latency_window_t) * XLAT_CHANNEL_MAX * LATENCY_TYPE_MAX <= HW_SDRAM_WINDOW_SIZE,
+               "sliding windows do not fit in their SDRAM region");
+
+static uint32_t window_samples = XLAT_WINDOW_SAMPLES_DEFAULT;
+static uint32_t window_seconds = XLAT_WINDOW_SECONDS_DEFAULT;
+
+// A window only counts as diverging when its mean is off by more than TREND_SIGMA standard errors
+// and by more than TREND_MIN_PERCENT of the baseline
+#define TREND_MIN_SAMPLES   (20)
+#define TREND_SIGMA         (3.0f)
+#define TREND_MIN_PERCENT   (2)
+
+static const float xlat_percentiles[XLAT_PERCENTILE_MAX] = { 50.0f, 90.0f, 99.0f, 99.9f };
+
+// Upper limits of the idle buckets, the last bucket has no limit
+static uint32_t idle_bucket_limit_ms[XLAT_IDLE_BUCKET_MAX - 1] = { 100, 1000, 10000 };
+
+// Timestamps of the last two HID reports, the previous one gives the idle time before a press
+static uint32_t report_last_timestamp = 0;
+static uint32_t report_prev_timestamp = 0;
+static TickType_t report_last_tick = 0;
+static TickType_t report_prev_tick = 0;
+static uint_fast8_t report_count = 0;   // saturates at 2
 
 // SETTINGS
 volatile bool       xlat_initialized = false;
 static xlat_mode_t  xlat_mode = XLAT_MODE_CLICK;
 static bool         hid_using_reportid = false;
 static bool         auto_trigger_level_high = false;
+static bool         auto_trigger_idle_gaps = false;
+static size_t       auto_trigger_gap_index = 0;
+static xlat_early_stop_t early_stop = {
+    .target_us = 0,
+    .statistic = CI_STATISTIC_MEAN,
+    .confidence_pct = 95,
+    .min_samples = XLAT_EARLY_STOP_MIN_SAMPLES,
+    .max_samples = AUTO_TRIGGER_COUNT,
+};
+static uint32_t     motion_threshold = 1;       // counts, along motion_direction
+static motion_direction_t motion_direction = MOTION_DIR_ANY;
 
 // The Razer optical switches will constantly trigger the GPIO interrupt, while pressed
 // Waveform looks like this in ASCII art:
@@ -57,8 +158,29 @@ static bool         auto_trigger_level_high = false;
 //
 // Therefore, take a large enough time window to debounce the GPIO interrupt.
 #define GPIO_IRQ_HOLDOFF_US (50 * 1000)  // 20ms;
-static uint32_t gpio_irq_holdoff_us = GPIO_IRQ_HOLDOFF_US;
-static TimerHandle_t xlat_timer_handle;
+
+// Above this, the idle time is taken from the tick count, as the 1 MHz counter wraps after ~71 minutes
+#define IDLE_COUNTER_RANGE_MS   (60 * 1000)
+
+// A motion run ends when the next report takes longer than this
+#define MOTION_RUN_GAP_US       (20 * 1000)
+
+// Motion onset detection: signed counts accumulated over consecutive reports,
+// while a stimulus is pending. The run start is the onset once it crosses the threshold.
+typedef struct motion_run {
+    bool     active;
+    uint32_t start_timestamp;   // USB timestamp of the first report of the run
+    uint32_t start_prev_poll;   // IN transaction before that report
+    uint32_t last_timestamp;
+    int32_t  first_dx;          // counts in the first report of the run
+    int32_t  first_dy;
+    int32_t  acc_x;
+    int32_t  acc_y;
+} motion_run_t;
+
+static motion_run_t motion_run;
+static int32_t motion_onset_dx = 0; // counts in the first report of the last onset
+static int32_t motion_onset_dy = 0;
 
 
 ///////////////////////
@@ -70,6 +192,47 @@ hid_data_location_t button_location;
 hid_data_location_t x_location;
 hid_data_location_t y_location;
 
+// All Input items found in the HID report descriptor, used by the usage picker
+static hid_input_item_t hid_items[XLAT_HID_ITEMS_MAX];
+static size_t hid_item_count = 0;
+static int trigger_item_index = -1; // -1: all buttons (default)
+
+// The selected trigger source, compiled down to a single masked word read for the per-report hot path
+typedef struct hid_trigger {
+    bool     valid;
+    bool     bitfield;      // true: press = any new bit set, false: press = value leaves zero
+    uint8_t  report_id;
+    uint8_t  shift;
+    uint8_t  byte_count;    // bytes the field spans, 1..4
+    size_t   byte_offset;   // includes the reportId byte, if any
+    uint32_t mask;
+} hid_trigger_t;
+
+// Per input channel state: hold-off, edge timestamps and the HID usage the channel is wired to
+typedef struct xlat_channel {
+    uint32_t      holdoff_us;
+    uint16_t      button_usage;     // Button page usage (1: left, 2: right, ...), 0: follow the usage picker
+    TimerHandle_t timer;            // re-enables the EXTI line after the hold-off
+
+    volatile uint32_t      press_timestamp;
+    volatile uint32_t      release_timestamp;
+    volatile uint_fast8_t  press_producer;
+    volatile uint_fast8_t  press_consumer;
+    volatile uint_fast8_t  release_producer;
+    volatile uint_fast8_t  release_consumer;
+
+    hid_trigger_t trigger;
+    uint32_t      trigger_prev_value;
+} xlat_channel_t;
+
+// Channel 0 follows the usage picker, the others default to right, back and forward
+static xlat_channel_t channels[XLAT_CHANNEL_MAX] = {
+    { .holdoff_us = GPIO_IRQ_HOLDOFF_US, .button_usage = 0 },
+    { .holdoff_us = GPIO_IRQ_HOLDOFF_US, .button_usage = 2 },
+    { .holdoff_us = GPIO_IRQ_HOLDOFF_US, .button_usage = 4 },
+    { .holdoff_us = GPIO_IRQ_HOLDOFF_US, .button_usage = 5 },
+};
+
 static inline void hidreport_print_item(HID_ReportItem_t *item)
 {
     printf("  BitOffset: %d\n", item->BitOffset);
@@ -155,8 +318,34 @@ static inline void hidreport_print_item(HID_ReportItem_t *item)
     printf("\n");
 }
 
+static void hidreport_store_item(HID_ReportItem_t *item)
+{
+    if (item->ItemType != HID_REPORT_ITEM_In) {
+        return;
+    }
+
+    if (hid_item_count >= XLAT_HID_ITEMS_MAX) {
+        printf("[!] Too many HID input items, ignoring 0x%04x:0x%04x\n",
+               item->Attributes.Usage.Page, item->Attributes.Usage.Usage);
+        return;
+    }
+
+    hid_input_item_t *entry = &hid_items[hid_item_count++];
+    entry->usage_page = item->Attributes.Usage.Page;
+    entry->usage = item->Attributes.Usage.Usage;
+    entry->bit_index = item->BitOffset;
+    entry->bit_size = item->Attributes.BitSize;
+    entry->report_id = item->ReportID;
+}
+
 static void hidreport_check_item(HID_ReportItem_t *item)
 {
+    hidreport_store_item(item);
+
+    if (item->ItemType != HID_REPORT_ITEM_In) {
+        return;
+    }
+
     switch (item->Attributes.Usage.Page) {
         case 0x01:
             switch (item->Attributes.Usage.Usage) {
@@ -166,6 +355,7 @@ static void hidreport_check_item(HID_ReportItem_t *item)
                         x_location.found = true;
                         x_location.bit_index = item->BitOffset;
                         x_location.bit_size = item->Attributes.BitSize;
+                        x_location.report_id = item->ReportID;
                     }
                     break;
 
@@ -175,6 +365,7 @@ static void hidreport_check_item(HID_ReportItem_t *item)
                         y_location.found = true;
                         y_location.bit_index = item->BitOffset;
                         y_location.bit_size = item->Attributes.BitSize;
+                        y_location.report_id = item->ReportID;
                     }
                     break;
             }
@@ -185,6 +376,8 @@ static void hidreport_check_item(HID_ReportItem_t *item)
             if (!button_location.found) {
                 button_location.found = true;
                 button_location.bit_index = item->BitOffset;
+                button_location.bit_size = item->Attributes.BitSize;
+                button_location.report_id = item->ReportID;
             }
             break;
 
@@ -219,33 +412,217 @@ static USBH_StatusTypeDef USBH_HID_GetRawData(USBH_HandleTypeDef *phost, uint8_t
 }
 
 
-static int calculate_gpio_to_usb_time(void)
+// Edge column of the console output
+static const char * latency_type_name(enum latency_type type)
+{
+    switch (type) {
+        case LATENCY_GPIO_TO_USB_RELEASE:
+            return "release";
+        case LATENCY_AUDIO_TO_USB:
+            return "audio";
+        case LATENCY_CLICK_TO_PHOTON:
+            return "photon";
+        default:
+            return "press";
+    }
+}
+
+
+// Latency with the calibrated timestamp offsets of its ends taken out, once a calibration exists
+static int32_t calibrated_us(int32_t us, bool gpio_start, bool usb_end)
+{
+    if (!calibrated) {
+        return us;
+    }
+    int64_t ns = (int64_t)us * 1000;
+    if (gpio_start) {
+        ns += calibration.gpio_offset_ns;
+    }
+    if (usb_end) {
+        ns -= calibration.usb_offset_ns;
+    }
+    return (int32_t)((ns >= 0) ? (ns + 500) / 1000 : (ns - 500) / 1000);
+}
+
+// Idle time of the device before a GPIO edge, in ms
+static uint32_t idle_ms_before(uint32_t gpio_timestamp)
+{
+    if (report_count < 2) {
+        // No report since the device was connected: as deep as it gets
+        return UINT32_MAX;
+    }
+
+    TickType_t ticks = report_last_tick - report_prev_tick;
+    if (ticks > pdMS_TO_TICKS(IDLE_COUNTER_RANGE_MS)) {
+        return ticks * portTICK_PERIOD_MS;
+    }
+
+    int32_t us = gpio_timestamp - report_prev_timestamp;
+    return (us > 0) ? (uint32_t)us / 1000 : 0;
+}
+
+// The report was not ready at the IN transaction before it, so the device finished processing
+// somewhere between the two: in [us - bracket, us]. Without knowing where, the middle of the bracket
+// is the unbiased estimate, and it takes out the wait for the poll (half a poll period on average).
+// This works the same for back-to-back polling (bracket = one (micro)frame) and for PC-like
+// polling at bInterval (bracket = the interval).
+static bool device_processing_estimate(uint32_t us, uint32_t *estimate_us)
+{
+    // Both ends are host thread timestamps, their offsets cancel
+    uint32_t bracket_us = last_usb_timestamp_us - last_usb_prev_poll_us;
+
+    // No usable bracket: the first report after a connect, or the host thread was held up
+    if ((last_usb_prev_poll_us == 0) || (bracket_us > 4 * usb_poll_interval_us + 1000)) {
+        return false;
+    }
+    latency_stats_add(&poll_bracket_stats, bracket_us);
+
+    uint32_t lower_us = (bracket_us < us) ? us - bracket_us : 0;
+    *estimate_us = (lower_us + us) / 2;
+    return true;
+}
+
+static int calculate_gpio_to_usb_time(size_t channel)
 {
+    xlat_channel_t *c = &channels[channel];
+    uint32_t pattern_us;
+    bool from_gpio = (channel != ANALOG_TRIGGER_CHANNEL) || !analog_trigger_is_gpio_source();
+
+    // A press from the pattern generator is timed by its schedule, otherwise
     // only accept if there was a gpio irq first
-    if (gpio_irq_producer == gpio_irq_consumer) {
+    if (pattern_gen_take_step(channel, true, last_usb_timestamp_us, &pattern_us)) {
+        c->press_timestamp = pattern_us;
+        from_gpio = false;
+    } else if (c->press_producer == c->press_consumer) {
         return -1;
     }
-    gpio_irq_consumer = gpio_irq_producer;
+    c->press_consumer = c->press_producer;
 
-    xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
-    gfx_set_trigger_ready(false);
-    xSemaphoreGive(lvgl_mutex);
+    if (channel == 0) {
+        xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
+        gfx_set_trigger_ready(false);
+        xSemaphoreGive(lvgl_mutex);
+    }
 
     // gpio -> usb stats
-    int32_t us = last_usb_timestamp_us - last_btn_gpio_timestamp;
-    printf("[gpio -> usb] diff: us: %5ld\n", us);
+    int32_t us = calibrated_us(last_usb_timestamp_us - c->press_timestamp, from_gpio, true);
+    printf("[gpio -> usb] ch%d diff: us: %5ld\n", channel, us);
 
     // drop negative values
     if (us < 0) {
         return -1;
     }
 
-    xlat_add_latency_measurement(us, LATENCY_GPIO_TO_USB);
+    bool clean = xlat_add_latency_measurement(channel, us, LATENCY_GPIO_TO_USB);
+
+    // Device processing, without the wait for the host's poll
+    uint32_t device_us = 0;
+    if (device_processing_estimate(us, &device_us)) {
+        xlat_add_latency_measurement(channel, device_us, LATENCY_DEVICE_PROCESSING);
+    }
+    last_device_us[channel] = device_us;
+
+    // Wake-from-idle statistics, outliers stay out of them too
+    uint32_t idle_ms = idle_ms_before(c->press_timestamp);
+    size_t bucket = xlat_get_idle_bucket(idle_ms);
+    last_idle_ms[channel] = idle_ms;
+    if (clean) {
+        latency_stats_add(&idle_latency_stats[channel][bucket], us);
+        latency_histogram_add(&histograms->idle[channel][bucket], (uint64_t)us * 1000);
+    }
 
     // send a message to the gfx thread, to refresh the plot
     struct gfx_event *evt;
     evt = osPoolAlloc(gfxevt_pool); // Allocate memory for the message
     evt->type = GFX_EVENT_MEASUREMENT;
+    evt->channel = channel;
+    evt->value = us;
+    osMessagePut(msgQGfxTask, (uint32_t)evt, 0U);
+
+    return 0;
+}
+
+static int calculate_audio_to_usb_time(void)
+{
+    // only accept if there was an onset since the last press report
+    if (audio_onset_producer == audio_onset_consumer) {
+        return -1;
+    }
+    audio_onset_consumer = audio_onset_producer;
+
+    int32_t us = calibrated_us(last_usb_timestamp_us - audio_onset_timestamp, false, true);
+    printf("[audio -> usb] diff: us: %5ld\n", us);
+
+    // drop negative values, and onsets from some other noise long before
+    if ((us < 0) || (us > AUDIO_ONSET_MAX_AGE_US)) {
+        return -1;
+    }
+    xlat_add_latency_measurement(0, us, LATENCY_AUDIO_TO_USB);
+    return 0;
+}
+
+static int calculate_click_to_photon_time(uint32_t timestamp_us)
+{
+    xlat_channel_t *c = &channels[0];
+
+    // only accept the first screen change after a press
+    if (c->press_producer == photon_press_seen) {
+        return -1;
+    }
+    photon_press_seen = c->press_producer;
+
+    int32_t us = calibrated_us(timestamp_us - c->press_timestamp, true, false);
+    printf("[gpio -> photon] diff: us: %5ld\n", us);
+
+    // drop negative values, and presses the screen did not answer
+    if ((us < 0) || (us > PHOTON_MAX_AGE_US)) {
+        return -1;
+    }
+    photon_timestamp_us = timestamp_us;
+    xlat_add_latency_measurement(0, us, LATENCY_CLICK_TO_PHOTON);
+    xlat_print_measurement(0, LATENCY_CLICK_TO_PHOTON);
+    return 0;
+}
+
+static int calculate_gpio_to_usb_release_time(size_t channel)
+{
+    xlat_channel_t *c = &channels[channel];
+    uint32_t release_timestamp;
+    bool from_gpio = (channel != ANALOG_TRIGGER_CHANNEL) || !analog_trigger_is_gpio_source();
+
+    // only accept if there was a release edge (or pattern step) since the last release report
+    if (pattern_gen_take_step(channel, false, last_usb_timestamp_us, &release_timestamp)) {
+        c->release_consumer = c->release_producer;
+        from_gpio = false;
+    } else if (c->release_producer == c->release_consumer) {
+        return -1;
+    } else {
+        c->release_consumer = c->release_producer;
+        // The latest release edge is used (optical switches pulse while pressed, and the last
+        // edge is the real release)
+        release_timestamp = c->release_timestamp;
+    }
+
+    // It has to belong to the current press
+    if ((int32_t)(release_timestamp - c->press_timestamp) < 0) {
+        return -1;
+    }
+
+    int32_t us = calibrated_us(last_usb_timestamp_us - release_timestamp, from_gpio, true);
+    printf("[gpio -> usb] ch%d release diff: us: %5ld\n", channel, us);
+
+    // drop negative values
+    if (us < 0) {
+        return -1;
+    }
+
+    xlat_add_latency_measurement(channel, us, LATENCY_GPIO_TO_USB_RELEASE);
+
+    // send a message to the gfx thread, to refresh the release numbers
+    struct gfx_event *evt;
+    evt = osPoolAlloc(gfxevt_pool); // Allocate memory for the message
+    evt->type = GFX_EVENT_RELEASE_MEASUREMENT;
+    evt->channel = channel;
     evt->value = us;
     osMessagePut(msgQGfxTask, (uint32_t)evt, 0U);
 
@@ -253,6 +630,187 @@ static int calculate_gpio_to_usb_time(void)
 }
 
 
+// Reads only the bytes the field spans, so a field at the end of the report can be used
+static inline uint32_t hid_read_bytes(const uint8_t *p, size_t count)
+{
+    uint32_t word = 0;
+    for (size_t i = 0; i < count; i++) {
+        word |= (uint32_t)p[i] << (8 * i);
+    }
+    return word;
+}
+
+static inline uint32_t hid_trigger_read(const hid_trigger_t *trig, const uint8_t *data)
+{
+    uint32_t word = hid_read_bytes(&data[trig->byte_offset], trig->byte_count);
+    return (word >> trig->shift) & trig->mask;
+}
+
+static inline bool hid_trigger_is_press(const hid_trigger_t *trig, uint32_t value, uint32_t prev_value)
+{
+    if (trig->bitfield) {
+        return (value & ~prev_value) != 0;
+    }
+    return (value != 0) && (prev_value == 0);
+}
+
+static void hid_trigger_from_item(hid_trigger_t *trig, const hid_input_item_t *item)
+{
+    trig->report_id = item->report_id;
+    trig->byte_offset = item->bit_index / 8 + (size_t)hid_using_reportid;
+    trig->shift = item->bit_index % 8;
+    trig->mask = (item->bit_size >= 32) ? 0xFFFFFFFF : ((1UL << item->bit_size) - 1);
+    trig->bitfield = (item->bit_size == 1);
+    trig->valid = (trig->shift + item->bit_size) <= 32;
+    trig->byte_count = (trig->shift + item->bit_size + 7) / 8;
+}
+
+static hid_trigger_t hid_trigger_compile_channel(size_t channel)
+{
+    hid_trigger_t trig = {0};
+    uint16_t button_usage = channels[channel].button_usage;
+
+    if (button_usage != 0) {
+        // A fixed Button page usage, for the extra input channels
+        for (size_t i = 0; i < hid_item_count; i++) {
+            if ((hid_items[i].usage_page == 0x09) && (hid_items[i].usage == button_usage)) {
+                hid_trigger_from_item(&trig, &hid_items[i]);
+                break;
+            }
+        }
+    } else if ((trigger_item_index >= 0) && ((size_t)trigger_item_index < hid_item_count)) {
+        // A single item, selected with the usage picker
+        hid_trigger_from_item(&trig, &hid_items[trigger_item_index]);
+    } else {
+        // Default: all buttons that fit in the 32-bit word starting at the first button's byte
+        size_t base_bit = 0;
+
+        for (size_t i = 0; i < hid_item_count; i++) {
+            const hid_input_item_t *item = &hid_items[i];
+            if (item->usage_page != 0x09) {
+                continue;
+            }
+
+            if (!trig.valid) {
+                trig.valid = true;
+                trig.bitfield = true;
+                trig.report_id = item->report_id;
+                base_bit = item->bit_index & ~7U;
+                trig.byte_offset = base_bit / 8 + (size_t)hid_using_reportid;
+            }
+
+            if ((item->report_id == trig.report_id) && (item->bit_index + item->bit_size <= base_bit + 32)) {
+                uint32_t bits = (item->bit_size >= 32) ? 0xFFFFFFFF : ((1UL << item->bit_size) - 1);
+                trig.mask |= bits << (item->bit_index - base_bit);
+            }
+        }
+        if (trig.valid) {
+            // Up to the highest button bit
+            trig.byte_count = (32 - __builtin_clz(trig.mask) + 7) / 8;
+        }
+    }
+
+    if (trig.valid && (trig.byte_offset + trig.byte_count > XLAT_HID_REPORT_MAX)) {
+        trig.valid = false;
+    }
+
+    if (trig.valid) {
+        printf("[*] Trigger ch%d: reportId %d, byte %d, shift %d, mask 0x%08lx\n",
+               channel, trig.report_id, trig.byte_offset, trig.shift, trig.mask);
+    } else {
+        printf("[x] Trigger source for ch%d not usable\n", channel);
+    }
+
+    return trig;
+}
+
+static void hid_trigger_compile(void)
+{
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        hid_trigger_t trig = hid_trigger_compile_channel(ch);
+
+        taskENTER_CRITICAL();
+        channels[ch].trigger = trig;
+        channels[ch].trigger_prev_value = 0;
+        taskEXIT_CRITICAL();
+    }
+}
+
+// Sign-extended read of a field of up to 25 bits, at any bit position.
+// bit_index includes the reportId byte, if any.
+static inline int32_t hid_read_signed(const uint8_t *data, size_t bit_index, size_t bit_size)
+{
+    uint32_t word = hid_read_bytes(&data[bit_index / 8], (bit_index % 8 + bit_size + 7) / 8);
+    word >>= bit_index % 8;
+    return ((int32_t)(word << (32 - bit_size))) >> (32 - bit_size);
+}
+
+// Motion along the direction filter. For "any" direction this is the Manhattan length.
+static int32_t motion_project(int32_t x, int32_t y)
+{
+    switch (motion_direction) {
+        case MOTION_DIR_POS_X:
+            return x;
+        case MOTION_DIR_NEG_X:
+            return -x;
+        case MOTION_DIR_POS_Y:
+            return y;
+        case MOTION_DIR_NEG_Y:
+            return -y;
+        default:
+            return abs(x) + abs(y);
+    }
+}
+
+static void motion_process(int32_t dx, int32_t dy, uint32_t timestamp, uint32_t prev_poll)
+{
+    // Only look for an onset while a stimulus on channel 0 is waiting for its report
+    if (channels[0].press_producer == channels[0].press_consumer) {
+        motion_run.active = false;
+        return;
+    }
+
+    // A report without motion along the filter, or a gap, ends the run
+    bool moved = (motion_direction == MOTION_DIR_ANY) ? (dx || dy) : (motion_project(dx, dy) > 0);
+    if (motion_run.active && (!moved || (timestamp - motion_run.last_timestamp > MOTION_RUN_GAP_US))) {
+        motion_run.active = false;
+    }
+    if (!moved) {
+        return;
+    }
+
+    if (!motion_run.active) {
+        motion_run.active = true;
+        motion_run.start_timestamp = timestamp;
+        motion_run.start_prev_poll = prev_poll;
+        motion_run.first_dx = dx;
+        motion_run.first_dy = dy;
+        motion_run.acc_x = 0;
+        motion_run.acc_y = 0;
+    }
+    motion_run.last_timestamp = timestamp;
+
+    // Signed accumulation, so sensor jitter back and forth cancels out
+    motion_run.acc_x += dx;
+    motion_run.acc_y += dy;
+
+    if (motion_project(motion_run.acc_x, motion_run.acc_y) >= (int32_t)motion_threshold) {
+        motion_run.active = false;
+        motion_onset_dx = motion_run.first_dx;
+        motion_onset_dy = motion_run.first_dy;
+
+        // The onset is the first report of the run
+        last_usb_timestamp_us = motion_run.start_timestamp;
+        last_usb_prev_poll_us = motion_run.start_prev_poll;
+
+        printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), timestamp);
+        printf("Motion onset: X=%ld, Y=%ld (total %ld, %ld) @ %lu\n",
+               motion_onset_dx, motion_onset_dy, motion_run.acc_x, motion_run.acc_y, motion_run.start_timestamp);
+
+        calculate_gpio_to_usb_time(0);
+    }
+}
+
 static void check_offsets(void)
 {
     printf("\n");
@@ -261,24 +819,23 @@ static void check_offsets(void)
         printf("[*] Using reportId, so actual report data is starting at index [1]\n");
     }
 
+    // The click trigger is read with a mask and shift, so buttons do not need to be byte aligned
     if (button_location.found) {
-        if (button_location.bit_index % 8) {
-            printf("[!] Button found at bit index %d, which is not a multiple of 8. Currently not supported by XLAT.\n", button_location.bit_index);
-            button_location.found = false;
-        } else {
-            button_location.byte_offset = button_location.bit_index / 8 + (size_t)hid_using_reportid;
-            printf("[*] Button found at bit index %d, which is byte %d\n", button_location.bit_index, button_location.bit_index / 8);
-            printf("    Button byte offset: %d\n", button_location.byte_offset);
-        }
+        button_location.byte_offset = button_location.bit_index / 8 + (size_t)hid_using_reportid;
+        printf("[*] Button found at bit index %d, which is byte %d\n", button_location.bit_index, button_location.bit_index / 8);
+        printf("    Button byte offset: %d\n", button_location.byte_offset);
     } else {
         button_location.found = false;
         printf("[x] Button not found\n");
     }
 
-    // X offset has to start at a byte boundary
+    // X and Y are read with a sign-extending shift, so they can be at any bit position,
+    // only the bytes they span have to be in the report
     if (x_location.found) {
-        if (x_location.bit_index % 8) {
-            printf("[!] X found at bit index %d, which is not a multiple of 8. Currently not supported by XLAT.\n", x_location.bit_index);
+        if ((x_location.bit_size < 2) || (x_location.bit_size > 24) ||
+                ((x_location.bit_index + x_location.bit_size + 7) / 8 + (size_t)hid_using_reportid > XLAT_HID_REPORT_MAX)) {
+            printf("[!] X found at bit index %d with %d bits. Currently not supported by XLAT.\n",
+                   x_location.bit_index, x_location.bit_size);
             x_location.found = false;
         } else {
             x_location.byte_offset = x_location.bit_index / 8 + (size_t)hid_using_reportid;
@@ -291,14 +848,12 @@ static void check_offsets(void)
         printf("[x] X not found\n");
     }
 
-    // Y offset does NOT have to start at a byte boundary,
-    // but it has to be contiguous to X
-    // and their total size has to be a multiple of 8
     if (y_location.found) {
-        if ((y_location.bit_index % 8) &&
-                ((y_location.bit_index - x_location.bit_index) != x_location.bit_size)) {
-            printf("[!] Y found at bit index %d, which is not a multiple of 8, and not contiguous to X. Currently not supported by XLAT.\n",
-                   y_location.bit_index);
+        if ((y_location.bit_size < 2) || (y_location.bit_size > 24) ||
+                ((y_location.bit_index + y_location.bit_size + 7) / 8 + (size_t)hid_using_reportid > XLAT_HID_REPORT_MAX) ||
+                (y_location.report_id != x_location.report_id)) {
+            printf("[!] Y found at bit index %d with %d bits. Currently not supported by XLAT.\n",
+                   y_location.bit_index, y_location.bit_size);
             y_location.found = false;
         } else {
             y_location.byte_offset = y_location.bit_index / 8 + (size_t)hid_using_reportid;
@@ -311,6 +866,9 @@ static void check_offsets(void)
         printf("[x] Y not found\n");
     }
 
+    printf("[*] %d input items found\n", hid_item_count);
+    hid_trigger_compile();
+
     printf("\n");
 }
 
@@ -319,17 +877,52 @@ static void check_offsets(void)
 // PUBLIC FUNCTIONS //
 //////////////////////
 
-// gpio_irq_holdoff_us setter
-void xlat_set_gpio_irq_holdoff_us(uint32_t us)
+// holdoff_us setter
+void xlat_set_gpio_irq_holdoff_us(size_t channel, uint32_t us)
+{
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return;
+    }
+    printf("Setting GPIO IRQ holdoff of ch%d to %lu us\n", channel, us);
+    channels[channel].holdoff_us = us;
+}
+
+
+uint32_t xlat_get_gpio_irq_holdoff_us(size_t channel)
 {
-    printf("Setting GPIO IRQ holdoff to %lu us\n", us);
-    gpio_irq_holdoff_us = us;
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return 0;
+    }
+    return channels[channel].holdoff_us;
+}
+
+uint32_t xlat_get_gpio_press(size_t channel, uint32_t *timestamp_us)
+{
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return 0;
+    }
+    // The count first: a press in between shows up as a count the timestamp does not match
+    uint32_t count = channels[channel].press_producer;
+    *timestamp_us = channels[channel].press_timestamp;
+    return count;
 }
 
+void xlat_set_channel_usage(size_t channel, uint16_t button_usage)
+{
+    // Channel 0 always follows the usage picker
+    if ((channel == 0) || (channel >= XLAT_CHANNEL_MAX)) {
+        return;
+    }
+    channels[channel].button_usage = button_usage;
+    hid_trigger_compile();
+}
 
-uint32_t xlat_get_gpio_irq_holdoff_us(void)
+uint16_t xlat_get_channel_usage(size_t channel)
 {
-    return gpio_irq_holdoff_us;
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return 0;
+    }
+    return channels[channel].button_usage;
 }
 
 
@@ -350,16 +943,31 @@ void xlat_usb_hid_event(void)
     struct hid_event *hevt = evt.value.p;
     USBH_HandleTypeDef *phost = hevt->phost;
 
+    // Screen change from the photodiode, it has no report
+    if (phost == NULL) {
+        calculate_click_to_photon_time(hevt->timestamp);
+        goto out;
+    }
+
+    // The host thread delay of every report, while calibrating
+    if (calibration_is_running()) {
+        calibration_usb_report(hevt->timestamp, hevt->urb_timestamp);
+    }
+
     if (USBH_HID_GetDeviceType(phost) == HID_MOUSE)
     {  // if the HID is Mouse
         uint8_t hid_raw_data[64];
 
         if (USBH_HID_GetRawData(phost, hid_raw_data) == USBH_OK) {
-            // check reportId for ULX
-            if (hid_using_reportid && (hid_raw_data[0] != 0x01)) {
-                // ignore
-                goto out;
+            // Keep the previous report's time, for the idle time before the next press
+            report_prev_timestamp = report_last_timestamp;
+            report_prev_tick = report_last_tick;
+            report_last_timestamp = hevt->timestamp;
+            report_last_tick = xTaskGetTickCount();
+            if (report_count < 2) {
+                report_count++;
             }
+
 #if 0
             printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), hevt->timestamp);
             for (int i = 0; i < 8 /*sizeof(hid_raw_data) */; i++) {
@@ -369,33 +977,54 @@ void xlat_usb_hid_event(void)
 #endif
             if (xlat_mode == XLAT_MODE_CLICK) {
                 // FOR BUTTONS/CLICKS:
-                // The correct location of button data is determined by parsing the HID descriptor
-                // This information is available in the button_location struct
-
-                // First, check if the location was found
-                if (!button_location.found) {
-                    return;
-                }
-
-                static uint8_t prev_button = 0;
-                uint8_t button = hid_raw_data[button_location.byte_offset];
-
-                // Check if the button state has changed
-                if (button != prev_button) {
-                    // Only measure on button PRESS, not on RELEASE
-                    if (button > prev_button) {
-                        // Save the captured USB event timestamp
-                        last_usb_timestamp_us = hevt->timestamp;
-
-                        printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), hevt->timestamp);
-                        printf("Button: B=0x%02x @ %lu\n", button, hevt->timestamp);
+                // The trigger source of each channel is determined by parsing the HID descriptor
+                // (or picked by the user), and compiled into its hid_trigger struct: one masked read per report
+                for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+                    xlat_channel_t *c = &channels[ch];
+                    hid_trigger_t trig = c->trigger;
+
+                    // First, check if the channel is in use, its trigger source was found, and this report carries it
+                    if (!hw_config_input_channel_is_enabled(ch) || !trig.valid) {
+                        continue;
+                    }
+                    if (hid_using_reportid && (hid_raw_data[0] != trig.report_id)) {
+                        continue;
+                    }
 
-                        calculate_gpio_to_usb_time();
+                    uint32_t value = hid_trigger_read(&trig, hid_raw_data);
+
+                    // Check if the trigger state has changed
+                    if (value != c->trigger_prev_value) {
+                        if (hid_trigger_is_press(&trig, value, c->trigger_prev_value)) {
+                            // Save the captured USB event timestamp
+                            last_usb_timestamp_us = hevt->timestamp;
+                            last_usb_prev_poll_us = hevt->prev_poll_timestamp;
+
+                            printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), hevt->timestamp);
+                            printf("Trigger ch%d: V=0x%02lx @ %lu\n", ch, value, hevt->timestamp);
+
+                            calculate_gpio_to_usb_time(ch);
+                            if ((ch == 0) && audio_onset_is_running()) {
+                                calculate_audio_to_usb_time();
+                            }
+                        } else if ((hw_config_input_both_edges_is_enabled() || pattern_gen_is_running() ||
+                                    ((ch == ANALOG_TRIGGER_CHANNEL) && analog_trigger_is_gpio_source())) &&
+                                   hid_trigger_is_press(&trig, c->trigger_prev_value, value)) {
+                            // RELEASE: only measured when the release edge is captured as well,
+                            // or released by the pattern generator, or seen by the analog trigger
+                            last_usb_timestamp_us = hevt->timestamp;
+                            last_usb_prev_poll_us = hevt->prev_poll_timestamp;
+
+                            printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), hevt->timestamp);
+                            printf("Release ch%d: V=0x%02lx @ %lu\n", ch, value, hevt->timestamp);
+
+                            calculate_gpio_to_usb_release_time(ch);
+                        }
                     }
-                }
 
-                // Save previous state
-                prev_button = button;
+                    // Save previous state
+                    c->trigger_prev_value = value;
+                }
             }
             else if (xlat_mode == XLAT_MODE_MOTION) {
                 // FOR MOTION:
@@ -404,31 +1033,20 @@ void xlat_usb_hid_event(void)
 
                 // First, check if the locations were found
                 if ((!x_location.found) || (!y_location.found)) {
-                    return;
+                    goto out;
                 }
 
-                // Check X and Y data is contiguous
-                if ((x_location.byte_offset + x_location.bit_size / 8) != y_location.byte_offset) {
-                    return;
+                // check reportId
+                if (hid_using_reportid && (hid_raw_data[0] != x_location.report_id)) {
+                    goto out;
                 }
 
-                size_t start_idx = x_location.byte_offset;
-                size_t length = (x_location.bit_size + y_location.bit_size) / 8;
+                // Signed X and Y, at their real size
+                size_t report_offset_bits = 8 * (size_t)hid_using_reportid;
+                int32_t dx = hid_read_signed(hid_raw_data, x_location.bit_index + report_offset_bits, x_location.bit_size);
+                int32_t dy = hid_read_signed(hid_raw_data, y_location.bit_index + report_offset_bits, y_location.bit_size);
 
-                // Loop over the data and check for non-zero values
-                // In case there is non-zero data, call calculate_gpio_to_usb_tine();
-                for (size_t idx = start_idx; idx < start_idx + length; idx++) {
-                    if (hid_raw_data[idx]) {
-                        // Save the captured USB event timestamp
-                        last_usb_timestamp_us = hevt->timestamp;
-
-                        printf("[%5lu] hid@%lu: ", xTaskGetTickCount(), hevt->timestamp);
-                        printf("Motion: X=0x%02x, Y=0x%02x @ %lu\n", hid_raw_data[x_location.byte_offset], hid_raw_data[y_location.byte_offset], hevt->timestamp);
-
-                        calculate_gpio_to_usb_time();
-                        break; // stop at the first bit of motion in this report
-                    }
-                }
+                motion_process(dx, dy, hevt->timestamp, hevt->prev_poll_timestamp);
             }
         }
     }
@@ -456,21 +1074,90 @@ out:
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
     uint32_t cnt = xlat_counter_1mhz_get();
+    int ch = hw_input_channel_from_pin(GPIO_Pin);
+    if (ch < 0) {
+        return;
+    }
+    // The analog trigger replaces the GPIO input of its channel (the photodiode does not)
+    if ((ch == ANALOG_TRIGGER_CHANNEL) && analog_trigger_is_gpio_source()) {
+        return;
+    }
+    xlat_channel_t *c = &channels[ch];
+    bool both_edges = hw_config_input_both_edges_is_enabled();
+
+    // With both edges enabled, the pin level right after the edge tells press from release.
+    // Keep overwriting the release timestamp: the last edge before the USB release report wins.
+    if (both_edges && !hw_input_trigger_is_pressed(ch)) {
+        c->release_timestamp = cnt;
+        c->release_producer++;
+        return;
+    }
+
     // debounce X ms
-    if (cnt - last_btn_gpio_timestamp < gpio_irq_holdoff_us) {
+    if (cnt - c->press_timestamp < c->holdoff_us) {
         return;
     }
-    last_btn_gpio_timestamp = cnt;
-    gpio_irq_producer++;
+    c->press_timestamp = cnt;
+    c->press_producer++;
 
-    // disable the interrupt and re-enable later in a timer
-    hw_exti_interrupts_disable();
-    xTimerChangePeriodFromISR(xlat_timer_handle, pdMS_TO_TICKS(gpio_irq_holdoff_us / 1000), NULL);
-    xTimerStartFromISR(xlat_timer_handle, NULL);
+    // mask this channel's EXTI line and unmask it later in a timer
+    // (not when capturing releases, as the release edge usually falls inside the hold-off)
+    if (!both_edges) {
+        hw_exti_channel_mask(ch, true);
+    }
+    xTimerChangePeriodFromISR(c->timer, pdMS_TO_TICKS(c->holdoff_us / 1000), NULL);
+    xTimerStartFromISR(c->timer, NULL);
 
     // print the event
-    printf("[%5lu] GPIO interrupt for pin: %3d @ %lu\n", xTaskGetTickCountFromISR(), GPIO_Pin, cnt);
-    printf("GPIO irq 0x%x @ %lu\n", GPIO_Pin, cnt);
+    printf("[%5lu] GPIO interrupt for pin: %3d (ch%d) @ %lu\n", xTaskGetTickCountFromISR(), GPIO_Pin, ch, cnt);
+}
+
+
+// Press or release from a trigger source other than the GPIO inputs, in interrupt context.
+// Its EXTI line is not masked, the hold-off only applies to the press timestamps.
+void xlat_trigger_edge_from_isr(size_t channel, bool pressed, uint32_t timestamp_us)
+{
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return;
+    }
+    xlat_channel_t *c = &channels[channel];
+
+    if (!pressed) {
+        c->release_timestamp = timestamp_us;
+        c->release_producer++;
+        return;
+    }
+    if (timestamp_us - c->press_timestamp < c->holdoff_us) {
+        return;
+    }
+    c->press_timestamp = timestamp_us;
+    c->press_producer++;
+}
+
+
+// Click onset from the audio input, in interrupt context
+void xlat_audio_onset_from_isr(uint32_t timestamp_us)
+{
+    audio_onset_timestamp = timestamp_us;
+    audio_onset_producer++;
+}
+
+
+// Screen change from the photodiode, in interrupt context. It goes through the HID event queue,
+// without a device, so the measurement is made in the USB thread like the others.
+void xlat_photon_from_isr(uint32_t timestamp_us)
+{
+    struct hid_event *evt;
+
+    evt = osPoolAlloc(hidevt_pool);
+    if (evt == NULL) {
+        return;
+    }
+    evt->timestamp = timestamp_us;
+    evt->prev_poll_timestamp = timestamp_us;
+    evt->urb_timestamp = timestamp_us;
+    evt->phost = NULL;
+    osMessagePut(msgQUsbClick, (uint32_t)evt, 0U);
 }
 
 
@@ -489,6 +1176,8 @@ void USBH_HID_EventCallback(USBH_HandleTypeDef *phost, uint32_t timestamp)
 
     evt = osPoolAlloc(hidevt_pool);                     // Allocate memory for the message
     evt->timestamp = timestamp;
+    evt->prev_poll_timestamp = ((HID_HandleTypeDef *) phost->pActiveClass->pData)->prev_poll_timestamp;
+    evt->urb_timestamp = ((HID_HandleTypeDef *) phost->pActiveClass->pData)->urb_timestamp;
     evt->phost = phost;
     osMessagePut(msgQUsbClick, (uint32_t)evt, 0U);
 
@@ -496,103 +1185,407 @@ void USBH_HID_EventCallback(USBH_HandleTypeDef *phost, uint32_t timestamp)
 }
 
 
-uint32_t xlat_get_latency_us(enum latency_type type)
+const latency_stats_t * xlat_get_latency_stats(size_t channel, enum latency_type type)
 {
-    if (type >= LATENCY_TYPE_MAX) {
-        return 0;
+    static const latency_stats_t empty_stats;
+
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return &empty_stats;
     }
-    return last_latency_us[type];
+    return &latency_stats[channel][type];
 }
 
-uint32_t xlat_get_last_button_timestamp_us(void)
+uint32_t xlat_get_latency_us(size_t channel, enum latency_type type)
 {
-    return last_btn_gpio_timestamp;
+    // The last measurement, also when it was flagged as an outlier
+    return xlat_get_raw_latency_stats(channel, type)->last_us;
 }
 
-uint32_t xlat_get_average_latency(enum latency_type type)
+uint32_t xlat_get_last_button_timestamp_us(void)
 {
-    if (type >= LATENCY_TYPE_MAX) {
-        return 0;
-    }
-    return (uint32_t)(average_latency_us_sum[type] / average_latency_us_count[type]);
+    return channels[0].press_timestamp;
 }
 
-uint32_t xlat_get_latency_variance(enum latency_type type)
+uint32_t xlat_get_last_release_timestamp_us(void)
 {
-    if (type >= LATENCY_TYPE_MAX) {
-        return 0;
-    }
-    uint64_t avg = average_latency_us_sum[type] / average_latency_us_count[type];
-    uint64_t avg_sq = average_latency_us_sum_sq[type] / average_latency_us_count[type];
-    return (uint32_t)(avg_sq - avg * avg);
+    return channels[0].release_timestamp;
 }
 
-uint32_t xlat_get_latency_standard_deviation(enum latency_type type)
+uint32_t xlat_get_average_latency(size_t channel, enum latency_type type)
 {
-    return (uint32_t)sqrt(xlat_get_latency_variance(type));
+    return xlat_get_latency_stats(channel, type)->mean_us;
 }
 
-uint32_t xlat_get_last_usb_timestamp_us(void)
+uint32_t xlat_get_latency_variance(size_t channel, enum latency_type type)
 {
-    return last_usb_timestamp_us;
+    uint64_t variance = xlat_get_latency_stats(channel, type)->variance;
+    return (variance > UINT32_MAX) ? UINT32_MAX : (uint32_t)variance;
 }
 
-uint32_t xlat_get_latency_count(enum latency_type type)
+uint32_t xlat_get_latency_standard_deviation(size_t channel, enum latency_type type)
 {
-    if (type >= LATENCY_TYPE_MAX) {
-        return 0;
-    }
-    return average_latency_us_count[type];
+    return xlat_get_latency_stats(channel, type)->stdev_us;
 }
 
-void xlat_add_latency_measurement(uint32_t latency_us, enum latency_type type)
+uint32_t xlat_get_latency_min(size_t channel, enum latency_type type)
 {
-    if (type >= LATENCY_TYPE_MAX) {
-        return;
-    }
-    last_latency_us[type] = latency_us;
-    average_latency_us_sum[type] += latency_us;
-    average_latency_us_sum_sq[type] += latency_us * latency_us;
-    average_latency_us_count[type]++;
-
-//    printf(">>> GPIO->USB latency: %5lu us, ", last_gpio_to_usb_latency_us);
-//    printf("average latency: %5lu us\n", (uint32_t)(average_latency_us_sum / average_latency_us_count));
+    return xlat_get_latency_stats(channel, type)->min_us;
 }
 
-void xlat_reset_latency(void)
+uint32_t xlat_get_latency_max(size_t channel, enum latency_type type)
 {
-    for (int i = 0; i < LATENCY_TYPE_MAX; i++) {
-        last_latency_us[i] = 0;
-        average_latency_us_sum[i] = 0;
-        average_latency_us_sum_sq[i] = 0;
-        average_latency_us_count[i] = 0;
-    }
+    return xlat_get_latency_stats(channel, type)->max_us;
 }
 
-void xlat_set_using_reportid(bool use_reportid)
+uint32_t xlat_get_last_usb_timestamp_us(void)
 {
-    hid_using_reportid = use_reportid;
+    return last_usb_timestamp_us;
 }
 
-bool xlat_get_using_reportid(void)
+uint32_t xlat_get_latency_count(size_t channel, enum latency_type type)
 {
-    return hid_using_reportid;
+    return xlat_get_latency_stats(channel, type)->count;
 }
 
-static void xlat_timer_callback(TimerHandle_t xTimer)
+bool xlat_add_latency_measurement(size_t channel, uint32_t latency_us, enum latency_type type)
 {
-    // re-enable GPIO interrupts
-    hw_exti_interrupts_enable();
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return false;
+    }
+
+    // Timestamp of the HID report that completed the measurement, to find it in USB traces
+    // (of the screen change for the photon latency)
+    uint32_t timestamp_us = (type == LATENCY_CLICK_TO_PHOTON) ? photon_timestamp_us : last_usb_timestamp_us;
+    outlier_filter_t *filter = &outlier_filters[channel][type];
+    bool outlier = outlier_filter_add(filter, latency_us, outlier_sensitivity);
+
+    latency_stats_add(&raw_latency_stats[channel][type], latency_us);
+    last_sample_timestamp_us[channel][type] = timestamp_us;
+    last_sample_outlier[channel][type] = outlier;
+
+    // Keep the raw sample for the exact order statistics of the session
+    uint8_t flags = (xlat_mode == XLAT_MODE_MOTION) ? SAMPLE_FLAG_MOTION : 0;
+    if (outlier) {
+        flags |= SAMPLE_FLAG_OUTLIER;
+    }
+    if (!sample_store_add(timestamp_us, latency_us, channel, type, flags) && !sample_store_full_reported) {
+        printf("Sample store full after %lu samples\n", sample_store_count());
+        sample_store_full_reported = true;
+    }
+
+    if (outlier) {
+        xlat_outlier_t *entry = &outlier_log[outlier_log_count % XLAT_OUTLIER_LOG_MAX];
+        entry->timestamp_us = timestamp_us;
+        entry->latency_us = latency_us;
+        entry->channel = channel;
+        entry->type = type;
+        outlier_log_count++;
+        printf("[outlier] ch%d %s: %lu us at %lu us (median %lu us, MAD %lu us)\n", channel,
+               latency_type_name(type), latency_us, timestamp_us, filter->median_us, filter->mad_us);
+        return false;
+    }
+
+    latency_stats_add(&latency_stats[channel][type], latency_us);
+    latency_stats_add(&series_stats[channel][type], latency_us);
+    latency_histogram_add(&histograms->latency[channel][type], (uint64_t)latency_us * 1000);
+    latency_window_add(&windows[channel][type], xTaskGetTickCount() * portTICK_PERIOD_MS, latency_us);
+    return true;
+}
+
+const latency_stats_t * xlat_get_raw_latency_stats(size_t channel, enum latency_type type)
+{
+    static const latency_stats_t empty_stats;
+
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return &empty_stats;
+    }
+    return &raw_latency_stats[channel][type];
+}
+
+uint32_t xlat_get_outlier_count(size_t channel, enum latency_type type)
+{
+    const latency_stats_t *raw = xlat_get_raw_latency_stats(channel, type);
+    const latency_stats_t *clean = xlat_get_latency_stats(channel, type);
+    return raw->count - clean->count;
+}
+
+uint32_t xlat_get_outlier_log(const xlat_outlier_t **log)
+{
+    *log = outlier_log;
+    return outlier_log_count;
+}
+
+void xlat_set_outlier_sensitivity(uint32_t sensitivity)
+{
+    outlier_sensitivity = sensitivity;
+}
+
+uint32_t xlat_get_outlier_sensitivity(void)
+{
+    return outlier_sensitivity;
+}
+
+static void xlat_configure_windows(void)
+{
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        for (size_t type = 0; type < LATENCY_TYPE_MAX; type++) {
+            latency_window_configure(&windows[ch][type], window_samples, window_seconds * 1000);
+        }
+    }
+}
+
+void xlat_set_window_samples(uint32_t samples)
+{
+    window_samples = (samples > LATENCY_WINDOW_CAPACITY) ? LATENCY_WINDOW_CAPACITY : samples;
+    xlat_configure_windows();
+}
+
+uint32_t xlat_get_window_samples(void)
+{
+    return window_samples;
+}
+
+void xlat_set_window_seconds(uint32_t seconds)
+{
+    window_seconds = seconds;
+    xlat_configure_windows();
+}
+
+uint32_t xlat_get_window_seconds(void)
+{
+    return window_seconds;
+}
+
+void xlat_get_window_stats(size_t channel, enum latency_type type, enum latency_window_kind kind, latency_window_result_t *result)
+{
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        memset(result, 0, sizeof(*result));
+        return;
+    }
+    latency_window_get(&windows[channel][type], kind, result);
+}
+
+enum latency_trend xlat_get_window_trend(size_t channel, enum latency_type type, enum latency_window_kind kind)
+{
+    latency_window_result_t window;
+    const latency_stats_t *baseline = xlat_get_latency_stats(channel, type);
+
+    xlat_get_window_stats(channel, type, kind, &window);
+
+    // The window must be a real part of the session, not all of it
+    if ((window.count < TREND_MIN_SAMPLES) || (baseline->count < 2 * window.count)) {
+        return LATENCY_TREND_UNKNOWN;
+    }
+
+    int32_t delta = (int32_t)window.mean_us - (int32_t)baseline->mean_us;
+    float window_var = (float)window.variance / window.count;
+    float baseline_var = (float)baseline->variance / baseline->count;
+    int32_t threshold = (int32_t)(TREND_SIGMA * sqrtf(window_var + baseline_var));
+    int32_t min_delta = (int32_t)(baseline->mean_us * TREND_MIN_PERCENT / 100);
+    if (threshold < min_delta) {
+        threshold = min_delta;
+    }
+
+    if (delta > threshold) {
+        return LATENCY_TREND_SLOWER;
+    }
+    if (delta < -threshold) {
+        return LATENCY_TREND_FASTER;
+    }
+    return LATENCY_TREND_STABLE;
+}
+
+const char * xlat_get_trend_name(enum latency_trend trend)
+{
+    switch (trend) {
+        case LATENCY_TREND_STABLE:
+            return "stable";
+        case LATENCY_TREND_SLOWER:
+            return "SLOWER";
+        case LATENCY_TREND_FASTER:
+            return "FASTER";
+        default:
+            return "-";
+    }
+}
+
+bool xlat_get_exact_latency_quantile(size_t channel, enum latency_type type, float quantile, uint32_t *latency_us)
+{
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return false;
+    }
+    return sample_store_quantile(channel, type, quantile, latency_us);
+}
+
+const latency_histogram_t * xlat_get_latency_histogram(size_t channel, enum latency_type type)
+{
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return NULL;
+    }
+    return &histograms->latency[channel][type];
+}
+
+uint32_t xlat_get_latency_percentile(size_t channel, enum latency_type type, float percentile)
+{
+    const latency_histogram_t *hist = xlat_get_latency_histogram(channel, type);
+    if (hist == NULL) {
+        return 0;
+    }
+    return (uint32_t)((latency_histogram_percentile(hist, percentile) + 500) / 1000);
+}
+
+void xlat_get_latency_percentiles(size_t channel, enum latency_type type, uint32_t percentiles_us[XLAT_PERCENTILE_MAX])
+{
+    uint64_t values_ns[XLAT_PERCENTILE_MAX] = { 0 };
+    const latency_histogram_t *hist = xlat_get_latency_histogram(channel, type);
+
+    if (hist != NULL) {
+        latency_histogram_percentiles(hist, xlat_percentiles, values_ns, XLAT_PERCENTILE_MAX);
+    }
+    for (size_t i = 0; i < XLAT_PERCENTILE_MAX; i++) {
+        percentiles_us[i] = (uint32_t)((values_ns[i] + 500) / 1000);
+    }
+}
+
+bool xlat_get_latency_distribution(size_t channel, enum latency_type type, uint32_t *bins, size_t n,
+                                   uint32_t *lo_us, uint32_t *hi_us)
+{
+    static const float range[2] = { 0.1f, 99.9f };
+    uint64_t range_ns[2];
+    const latency_histogram_t *hist = xlat_get_latency_histogram(channel, type);
+
+    if ((hist == NULL) || (hist->total == 0)) {
+        memset(bins, 0, n * sizeof(*bins));
+        *lo_us = *hi_us = 0;
+        return false;
+    }
+
+    // The tails would squeeze everything else into a few bins
+    latency_histogram_percentiles(hist, range, range_ns, 2);
+    *lo_us = (uint32_t)(range_ns[0] / 1000);
+    *hi_us = (uint32_t)((range_ns[1] + 999) / 1000);
+    if (*hi_us <= *lo_us + n) {
+        *lo_us = (*lo_us > n / 2) ? (*lo_us - n / 2) : 0;
+        *hi_us = *lo_us + n;
+    }
+    latency_histogram_rebin(hist, (uint64_t)*lo_us * 1000, (uint64_t)*hi_us * 1000, bins, n);
+    return true;
+}
+
+void xlat_get_latency_modes(size_t channel, enum latency_type type, latency_modes_t *modes)
+{
+    static uint32_t bins[XLAT_MODES_BINS];
+    uint32_t lo_us, hi_us;
+
+    if (!xlat_get_latency_distribution(channel, type, bins, XLAT_MODES_BINS, &lo_us, &hi_us)) {
+        memset(modes, 0, sizeof(*modes));
+        return;
+    }
+    latency_modes_fit(bins, XLAT_MODES_BINS, (float)lo_us, (float)(hi_us - lo_us) / XLAT_MODES_BINS, modes);
+}
 
-    // Update the trigger ready flag in the UI
-    xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
-    gfx_set_trigger_ready(true);
-    xSemaphoreGive(lvgl_mutex);
+void xlat_get_scan_period(size_t channel, enum latency_type type, scan_period_result_t *result)
+{
+    static uint32_t stimulus_us[SCAN_PERIOD_MAX_SAMPLES];
+    static uint32_t latency_us[SCAN_PERIOD_MAX_SAMPLES];
+    sample_store_iter_t it;
+    sample_record_t record;
+    size_t count = 0;
+
+    // The last SCAN_PERIOD_MAX_SAMPLES samples of the stream. The stimulus time is the report
+    // time in us less the latency, the constant timestamp offsets do not matter for its phase.
+    // Once the ring wraps, the pairs across the write position run backwards in time and are
+    // skipped by the estimate, so the ring is used as it is.
+    sample_store_iter_init(&it);
+    while (sample_store_iter_next(&it, &record)) {
+        if ((record.channel != channel) || (record.type != type)) {
+            continue;
+        }
+        stimulus_us[count % SCAN_PERIOD_MAX_SAMPLES] = (uint32_t)(record.timestamp_us - record.latency_us);
+        latency_us[count % SCAN_PERIOD_MAX_SAMPLES] = record.latency_us;
+        count++;
+    }
+
+    scan_period_estimate(stimulus_us, latency_us, (count < SCAN_PERIOD_MAX_SAMPLES) ? count : SCAN_PERIOD_MAX_SAMPLES,
+                         (float)XLAT_SCAN_PERIOD_MIN_US, (float)XLAT_SCAN_PERIOD_MAX_US,
+                         (float)xlat_get_usb_poll_period_us(), result);
+}
+
+void xlat_reset_latency(void)
+{
+    // A clear starts a new session
+    sample_store_reset();
+    series_first_record = 0;
+    sample_store_full_reported = false;
+    outlier_log_count = 0;
+    latency_stats_reset(&poll_bracket_stats);
+
+    for (int ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        for (int i = 0; i < LATENCY_TYPE_MAX; i++) {
+            latency_stats_reset(&latency_stats[ch][i]);
+            latency_stats_reset(&raw_latency_stats[ch][i]);
+            latency_stats_reset(&series_stats[ch][i]);
+            outlier_filter_reset(&outlier_filters[ch][i]);
+            latency_histogram_reset(&histograms->latency[ch][i]);
+            latency_window_reset(&windows[ch][i]);
+            latency_window_configure(&windows[ch][i], window_samples, window_seconds * 1000);
+        }
+        last_idle_ms[ch] = 0;
+        for (int i = 0; i < XLAT_IDLE_BUCKET_MAX; i++) {
+            latency_stats_reset(&idle_latency_stats[ch][i]);
+            latency_histogram_reset(&histograms->idle[ch][i]);
+        }
+    }
+}
+
+void xlat_set_using_reportid(bool use_reportid)
+{
+    hid_using_reportid = use_reportid;
+}
+
+bool xlat_get_using_reportid(void)
+{
+    return hid_using_reportid;
+}
+
+static void xlat_timer_callback(TimerHandle_t xTimer)
+{
+    size_t ch = (size_t)pvTimerGetTimerID(xTimer);
+
+    // re-enable the channel's GPIO interrupt
+    hw_exti_channel_mask(ch, false);
+
+    // Update the trigger ready flag in the UI, it follows the auto-triggered channel 0
+    if (ch == 0) {
+        xSemaphoreTake(lvgl_mutex, portMAX_DELAY);
+        gfx_set_trigger_ready(true);
+        xSemaphoreGive(lvgl_mutex);
+    }
+}
+
+static void xlat_print_csv_header(void)
+{
+    // The latencies below are corrected by the calibration
+    if (calibrated) {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "# calibrated over %lu cycles: gpio %+ld ns, usb %+ld ns, +-%lu ns (2 sigma)\r\n",
+                 calibration.cycles, calibration.gpio_offset_ns, calibration.usb_offset_ns, calibration.bound_ns);
+        vcp_writestr(buf);
+    }
+    if (xlat_mode == XLAT_MODE_MOTION) {
+        vcp_writestr("count;latency_us;avg_us;stdev_us;p50_us;p90_us;p99_us;p999_us;max_us;edge;channel;idle_ms;timestamp_us;outlier;device_us;dx;dy\r\n");
+    } else {
+        vcp_writestr("count;latency_us;avg_us;stdev_us;p50_us;p90_us;p99_us;p999_us;max_us;edge;channel;idle_ms;timestamp_us;outlier;device_us\r\n");
+    }
 }
 
 void xlat_set_mode(enum xlat_mode mode)
 {
-    xlat_mode = mode;
+    if (mode != xlat_mode) {
+        xlat_mode = mode;
+        motion_run.active = false;
+        xlat_print_csv_header();
+    }
 }
 
 enum xlat_mode xlat_get_mode(void)
@@ -600,11 +1593,36 @@ enum xlat_mode xlat_get_mode(void)
     return xlat_mode;
 }
 
+void xlat_set_calibration(const xlat_calibration_t *cal)
+{
+    calibration = *cal;
+    calibrated = true;
+    xlat_print_csv_header();
+}
+
+void xlat_clear_calibration(void)
+{
+    calibrated = false;
+    xlat_print_csv_header();
+}
+
+const xlat_calibration_t * xlat_get_calibration(void)
+{
+    return calibrated ? &calibration : NULL;
+}
+
 void xlat_auto_trigger_action(void)
 {
-    HAL_GPIO_WritePin(ARDUINO_D11_GPIO_Port, ARDUINO_D11_Pin, auto_trigger_level_high ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_Delay(20);
-    HAL_GPIO_WritePin(ARDUINO_D11_GPIO_Port, ARDUINO_D11_Pin, auto_trigger_level_high ? GPIO_PIN_RESET : GPIO_PIN_SET);
+    xlat_auto_trigger_set(true);
+    HAL_Delay(AUTO_TRIGGER_PRESS_MS);
+    xlat_auto_trigger_set(false);
+}
+
+// Drives the auto-trigger output, also from interrupt context
+void xlat_auto_trigger_set(bool pressed)
+{
+    bool high = (pressed == auto_trigger_level_high);
+    HAL_GPIO_WritePin(ARDUINO_D11_GPIO_Port, ARDUINO_D11_Pin, high ? GPIO_PIN_SET : GPIO_PIN_RESET);
 }
 
 void xlat_auto_trigger_level_set(bool high)
@@ -617,18 +1635,306 @@ bool xlat_auto_trigger_level_is_high(void)
     return auto_trigger_level_high;
 }
 
-void xlat_print_measurement(void)
+// Period until the next auto-trigger. With idle gaps enabled, the gaps cycle through
+// the idle buckets, aiming at the middle of each (the press itself is not idle time).
+uint32_t xlat_auto_trigger_period_ms(void)
+{
+    if (!auto_trigger_idle_gaps) {
+        return AUTO_TRIGGER_PERIOD_MS;
+    }
+
+    size_t bucket = auto_trigger_gap_index;
+    auto_trigger_gap_index = (auto_trigger_gap_index + 1) % XLAT_IDLE_BUCKET_MAX;
+
+    uint32_t lower = (bucket > 0) ? idle_bucket_limit_ms[bucket - 1] : 0;
+    uint32_t idle;
+    if (bucket < XLAT_IDLE_BUCKET_MAX - 1) {
+        idle = (lower + idle_bucket_limit_ms[bucket]) / 2;
+    } else {
+        idle = 2 * lower;
+    }
+    return idle + AUTO_TRIGGER_PRESS_MS;
+}
+
+void xlat_set_auto_trigger_idle_gaps(bool enable)
+{
+    auto_trigger_idle_gaps = enable;
+    auto_trigger_gap_index = 0;
+}
+
+bool xlat_get_auto_trigger_idle_gaps(void)
+{
+    return auto_trigger_idle_gaps;
+}
+
+void xlat_set_usb_polling(xlat_usb_polling_t polling)
+{
+    usb_polling = polling;
+}
+
+xlat_usb_polling_t xlat_get_usb_polling(void)
+{
+    return usb_polling;
+}
+
+void xlat_set_usb_poll_interval_us(uint32_t us)
+{
+    usb_poll_interval_us = us ? us : 1;
+    latency_stats_reset(&poll_bracket_stats);
+}
+
+uint32_t xlat_get_usb_poll_interval_us(void)
+{
+    return usb_poll_interval_us;
+}
+
+void xlat_set_usb_frame_us(uint32_t us)
+{
+    usb_frame_us = us ? us : 1;
+}
+
+// Time between two IN tokens: every (micro)frame when polling back-to-back, else bInterval
+uint32_t xlat_get_usb_poll_period_us(void)
+{
+    return (usb_polling == XLAT_POLLING_INTERVAL) ? usb_poll_interval_us : usb_frame_us;
+}
+
+const latency_stats_t * xlat_get_poll_bracket_stats(void)
+{
+    return &poll_bracket_stats;
+}
+
+void xlat_set_early_stop(const xlat_early_stop_t *config)
+{
+    early_stop = *config;
+    if (early_stop.min_samples < 2) {
+        early_stop.min_samples = 2;
+    }
+    if (early_stop.max_samples < early_stop.min_samples) {
+        early_stop.max_samples = early_stop.min_samples;
+    }
+}
+
+const xlat_early_stop_t * xlat_get_early_stop(void)
+{
+    return &early_stop;
+}
+
+// Two-sided standard normal quantile for the supported confidence levels
+static float ci_z_value(uint32_t confidence_pct)
+{
+    if (confidence_pct >= 99) {
+        return 2.576f;
+    }
+    if (confidence_pct >= 95) {
+        return 1.960f;
+    }
+    return 1.645f;
+}
+
+void xlat_series_start(void)
+{
+    series_first_record = sample_store_count();
+    for (int ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        for (int i = 0; i < LATENCY_TYPE_MAX; i++) {
+            latency_stats_reset(&series_stats[ch][i]);
+        }
+    }
+}
+
+// Half-width of the confidence interval of the mean or the median, over the current series.
+// Mean: Student's t interval of the clean samples, t from the Cornish-Fisher expansion of z,
+// which is close enough from ~10 degrees of freedom on.
+// Median: distribution-free interval between two order statistics of the raw samples, their
+// ranks are n/2 -+ z*sqrt(n)/2 (normal approximation of the binomial).
+bool xlat_get_confidence_interval(size_t channel, enum latency_type type, enum ci_statistic statistic,
+                                  uint32_t confidence_pct, uint32_t *half_width_us, uint32_t *samples)
+{
+    float z = ci_z_value(confidence_pct);
+
+    *samples = 0;
+    if ((channel >= XLAT_CHANNEL_MAX) || (type >= LATENCY_TYPE_MAX)) {
+        return false;
+    }
+
+    if (statistic == CI_STATISTIC_MEAN) {
+        const latency_stats_t *stats = &series_stats[channel][type];
+        *samples = stats->count;
+        if (stats->count < 2) {
+            return false;
+        }
+        float df = (float)(stats->count - 1);
+        float t = z + (z * z * z + z) / (4.0f * df);
+        *half_width_us = (uint32_t)(t * sqrtf((float)stats->variance / stats->count) + 0.5f);
+        return true;
+    }
+
+    uint32_t n = sample_store_stream_count_from(series_first_record, channel, type);
+    *samples = n;
+    if (n < 10) {
+        return false;
+    }
+    float spread = z * sqrtf((float)n) / 2.0f;
+    int32_t lower = (int32_t)floorf(n / 2.0f - spread);
+    int32_t upper = (int32_t)ceilf(n / 2.0f + spread);
+    if (lower < 0) {
+        lower = 0;
+    }
+    if (upper > (int32_t)n - 1) {
+        upper = n - 1;
+    }
+
+    uint32_t lower_us;
+    uint32_t upper_us;
+    if (!sample_store_select_from(series_first_record, channel, type, lower, &lower_us) ||
+        !sample_store_select_from(series_first_record, channel, type, upper, &upper_us)) {
+        return false;
+    }
+    *half_width_us = (upper_us - lower_us + 1) / 2;
+    return true;
+}
+
+bool xlat_set_idle_bucket_limit_ms(size_t bucket, uint32_t ms)
+{
+    if (bucket >= XLAT_IDLE_BUCKET_MAX - 1) {
+        return false;
+    }
+
+    // The limits have to stay in increasing order
+    if (((bucket > 0) && (ms <= idle_bucket_limit_ms[bucket - 1])) ||
+            ((bucket < XLAT_IDLE_BUCKET_MAX - 2) && (ms >= idle_bucket_limit_ms[bucket + 1]))) {
+        printf("[!] Idle bucket limit %lu ms out of order\n", ms);
+        return false;
+    }
+
+    idle_bucket_limit_ms[bucket] = ms;
+    return true;
+}
+
+uint32_t xlat_get_idle_bucket_limit_ms(size_t bucket)
+{
+    if (bucket >= XLAT_IDLE_BUCKET_MAX - 1) {
+        return UINT32_MAX;
+    }
+    return idle_bucket_limit_ms[bucket];
+}
+
+size_t xlat_get_idle_bucket(uint32_t idle_ms)
+{
+    size_t bucket = 0;
+    while ((bucket < XLAT_IDLE_BUCKET_MAX - 1) && (idle_ms >= idle_bucket_limit_ms[bucket])) {
+        bucket++;
+    }
+    return bucket;
+}
+
+uint32_t xlat_get_last_idle_ms(size_t channel)
+{
+    if (channel >= XLAT_CHANNEL_MAX) {
+        return 0;
+    }
+    return last_idle_ms[channel];
+}
+
+const latency_stats_t * xlat_get_idle_latency_stats(size_t channel, size_t bucket)
+{
+    static const latency_stats_t empty_stats;
+
+    if ((channel >= XLAT_CHANNEL_MAX) || (bucket >= XLAT_IDLE_BUCKET_MAX)) {
+        return &empty_stats;
+    }
+    return &idle_latency_stats[channel][bucket];
+}
+
+uint32_t xlat_get_idle_latency_count(size_t channel, size_t bucket)
+{
+    return xlat_get_idle_latency_stats(channel, bucket)->count;
+}
+
+uint32_t xlat_get_idle_average_latency(size_t channel, size_t bucket)
+{
+    return xlat_get_idle_latency_stats(channel, bucket)->mean_us;
+}
+
+uint32_t xlat_get_idle_latency_standard_deviation(size_t channel, size_t bucket)
+{
+    return xlat_get_idle_latency_stats(channel, bucket)->stdev_us;
+}
+
+uint32_t xlat_get_idle_latency_percentile(size_t channel, size_t bucket, float percentile)
+{
+    if ((channel >= XLAT_CHANNEL_MAX) || (bucket >= XLAT_IDLE_BUCKET_MAX)) {
+        return 0;
+    }
+    return (uint32_t)((latency_histogram_percentile(&histograms->idle[channel][bucket], percentile) + 500) / 1000);
+}
+
+void xlat_set_motion_threshold(uint32_t counts)
+{
+    motion_threshold = counts ? counts : 1;
+}
+
+uint32_t xlat_get_motion_threshold(void)
+{
+    return motion_threshold;
+}
+
+void xlat_set_motion_direction(enum motion_direction direction)
+{
+    motion_direction = direction;
+    motion_run.active = false;
+}
+
+enum motion_direction xlat_get_motion_direction(void)
+{
+    return motion_direction;
+}
+
+void xlat_print_measurement(size_t channel, enum latency_type type)
 {
     // print the new measurement to the console in csv format
-    char buf[50];
-    snprintf(buf, sizeof(buf), "%lu;%lu;%lu;%lu\r\n",
-             xlat_get_latency_count(LATENCY_GPIO_TO_USB),
-             xlat_get_latency_us(LATENCY_GPIO_TO_USB),
-             xlat_get_average_latency(LATENCY_GPIO_TO_USB),
-             xlat_get_latency_standard_deviation(LATENCY_GPIO_TO_USB));
+    uint32_t percentiles_us[XLAT_PERCENTILE_MAX];
+    xlat_get_latency_percentiles(channel, type, percentiles_us);
+
+    // The count includes the outliers, the statistics do not
+    char buf[192];
+    int len = snprintf(buf, sizeof(buf), "%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%s;%d;%lu;%lu;%d;%lu",
+                       xlat_get_raw_latency_stats(channel, type)->count,
+                       xlat_get_latency_us(channel, type),
+                       xlat_get_average_latency(channel, type),
+                       xlat_get_latency_standard_deviation(channel, type),
+                       percentiles_us[0], percentiles_us[1], percentiles_us[2], percentiles_us[3],
+                       xlat_get_latency_max(channel, type),
+                       latency_type_name(type),
+                       channel,
+                       (type == LATENCY_GPIO_TO_USB_RELEASE) ? 0 : xlat_get_last_idle_ms(channel),
+                       last_sample_timestamp_us[channel][type],
+                       last_sample_outlier[channel][type],
+                       (type == LATENCY_GPIO_TO_USB) ? last_device_us[channel] : 0);
+
+    // In motion mode, add the counts of the first report of the onset
+    if (xlat_mode == XLAT_MODE_MOTION) {
+        snprintf(buf + len, sizeof(buf) - len, ";%ld;%ld\r\n", motion_onset_dx, motion_onset_dy);
+    } else {
+        snprintf(buf + len, sizeof(buf) - len, "\r\n");
+    }
     vcp_writestr(buf);
 }
 
+enum debounce_scheme xlat_get_debounce_scheme(size_t channel, uint32_t *window_us)
+{
+    // Half the poll bracket is the mean wait for the poll, the poll period until there is one
+    uint32_t poll_wait_us = (poll_bracket_stats.count ? poll_bracket_stats.mean_us : xlat_get_usb_poll_period_us()) / 2;
+
+    return debounce_classify(xlat_get_latency_stats(channel, LATENCY_GPIO_TO_USB),
+                             xlat_get_latency_stats(channel, LATENCY_GPIO_TO_USB_RELEASE), poll_wait_us, window_us);
+}
+
+const char * xlat_get_debounce_scheme_name(enum debounce_scheme scheme)
+{
+    return debounce_scheme_name(scheme);
+}
+
 
 void xlat_parse_hid_descriptor(uint8_t *desc, size_t desc_size)
 {
@@ -636,6 +1942,9 @@ void xlat_parse_hid_descriptor(uint8_t *desc, size_t desc_size)
 
     printf("HID descriptor size: %d\n", desc_size);
 
+    // Forget the items of a previous descriptor
+    hid_item_count = 0;
+
     int err = USB_ProcessHIDReport(desc, desc_size, &report_info);
     printf("USB_ProcessHIDReport: %d\n", err);
     if (err != HID_PARSE_Successful) {
@@ -678,17 +1987,96 @@ void xlat_clear_locations(void)
     button_location.found = false;
     x_location.found = false;
     y_location.found = false;
+
+    // A different device may be connected next, so drop the item list and the picked trigger
+    hid_item_count = 0;
+    report_count = 0;
+    trigger_item_index = -1;
+    hid_trigger_compile();
+}
+
+size_t xlat_get_hid_item_count(void)
+{
+    return hid_item_count;
+}
+
+const hid_input_item_t * xlat_get_hid_item(size_t index)
+{
+    if (index >= hid_item_count) {
+        return NULL;
+    }
+    return &hid_items[index];
+}
+
+const char * xlat_get_hid_usage_name(uint16_t usage_page, uint16_t usage, char *buf, size_t len)
+{
+    switch (usage_page) {
+        case 0x01:
+            switch (usage) {
+                case 0x30: snprintf(buf, len, "X"); break;
+                case 0x31: snprintf(buf, len, "Y"); break;
+                case 0x32: snprintf(buf, len, "Z"); break;
+                case 0x38: snprintf(buf, len, "Wheel"); break;
+                default:   snprintf(buf, len, "Desktop 0x%02x", usage); break;
+            }
+            break;
+
+        case 0x07:
+            snprintf(buf, len, "Key 0x%02x", usage);
+            break;
+
+        case 0x09:
+            snprintf(buf, len, "Button %u", usage);
+            break;
+
+        case 0x0C:
+            if (usage == 0x238) {
+                snprintf(buf, len, "AC Pan");
+            } else {
+                snprintf(buf, len, "Consumer 0x%03x", usage);
+            }
+            break;
+
+        default:
+            snprintf(buf, len, "0x%04x:0x%04x", usage_page, usage);
+            break;
+    }
+    return buf;
+}
+
+void xlat_set_trigger_item(int index)
+{
+    if ((index < 0) || ((size_t)index >= hid_item_count)) {
+        index = -1;
+    }
+    trigger_item_index = index;
+    hid_trigger_compile();
+}
+
+int xlat_get_trigger_item(void)
+{
+    return trigger_item_index;
 }
 
 void xlat_init(void)
 {
-    // create timer
-    xlat_timer_handle = xTimerCreate("xlat_timer", pdMS_TO_TICKS(1000), pdFALSE, NULL, xlat_timer_callback);
+    // The histograms and the sample store are in SDRAM, which has random content after power up
+    sample_store_init((uint8_t *)HW_SDRAM_SAMPLES_ADDR, HW_SDRAM_SAMPLES_SIZE,
+                      (uint32_t *)HW_SDRAM_SCRATCH_ADDR, HW_SDRAM_SCRATCH_SIZE / sizeof(uint32_t));
+    if (!soak_init((void *)HW_SDRAM_SOAK_ADDR, HW_SDRAM_SOAK_SIZE)) {
+        printf("Soak test state (%lu bytes) does not fit in SDRAM\n", (uint32_t)soak_state_size());
+    }
+    logic_capture_init((void *)HW_SDRAM_CAPTURE_ADDR, HW_SDRAM_CAPTURE_SIZE);
+    bounce_capture_init((void *)HW_SDRAM_CAPTURE_ADDR, HW_SDRAM_CAPTURE_SIZE);
+    xlat_reset_latency();
+
+    // create one hold-off timer per input channel, the timer ID is the channel index
+    for (size_t ch = 0; ch < XLAT_CHANNEL_MAX; ch++) {
+        channels[ch].timer = xTimerCreate("xlat_timer", pdMS_TO_TICKS(1000), pdFALSE, (void *)ch, xlat_timer_callback);
+    }
     hw_exti_interrupts_enable();
     xlat_initialized = true;
     printf("XLAT initialized\n");
 
-    char buf[50];
-    snprintf(buf, sizeof(buf), "count;latency_us;avg_us;stdev_us\r\n");
-    vcp_writestr(buf);
+    xlat_print_csv_header();
 }
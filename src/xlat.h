@@ -21,55 +21,213 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "src/usb/usbh_def.h"
+#include "latency_stats.h"
+#include "latency_histogram.h"
+#include "sample_store.h"
+#include "latency_window.h"
+#include "latency_modes.h"
+#include "debounce.h"
+#include "scan_period.h"
 
 #define AUTO_TRIGGER_PERIOD_MS (150)
+#define AUTO_TRIGGER_PRESS_MS  (20)
+#define AUTO_TRIGGER_COUNT     (1000)
+
+// Auto-trigger early stop: the series ends once the confidence interval is narrow enough
+#define XLAT_EARLY_STOP_MIN_SAMPLES (30)
+
+// Independent GPIO input channels, see HW_INPUT_CHANNEL_MAX
+#define XLAT_CHANNEL_MAX (4)
+
+// Wake-from-idle buckets, by the time between the device's previous report and the press.
+// Each bucket has an upper limit, the last one is open ended (deep sleep).
+#define XLAT_IDLE_BUCKET_MAX (4)
+
+// Default sliding windows, next to the cumulative statistics
+#define XLAT_WINDOW_SAMPLES_DEFAULT (100)
+#define XLAT_WINDOW_SECONDS_DEFAULT (60)
+
+// Outlier detection, in scaled MADs from the median (0 = keep all samples)
+#define XLAT_OUTLIER_SENSITIVITY_DEFAULT (8)
+#define XLAT_OUTLIER_LOG_MAX (8)
+
+// Percentiles reported next to the average: P50, P90, P99 and P99.9
+#define XLAT_PERCENTILE_MAX (4)
+
+// Bins of the distribution the latency modes are fitted to, the maximum of latency_modes_fit()
+#define XLAT_MODES_BINS (128)
+
+// Internal scan period search range
+#define XLAT_SCAN_PERIOD_MIN_US (100)
+#define XLAT_SCAN_PERIOD_MAX_US (2000)
+
+// Trend of a sliding window against the cumulative baseline
+typedef enum latency_trend {
+    LATENCY_TREND_UNKNOWN = 0,  // not enough samples yet
+    LATENCY_TREND_STABLE,
+    LATENCY_TREND_SLOWER,
+    LATENCY_TREND_FASTER,
+} latency_trend_t;
+
+// A sample kept out of the statistics, with the time of its HID report
+typedef struct xlat_outlier {
+    uint32_t timestamp_us;
+    uint32_t latency_us;
+    uint8_t channel;
+    uint8_t type;
+} xlat_outlier_t;
+
+// Statistic whose confidence interval ends an auto-trigger series
+typedef enum ci_statistic {
+    CI_STATISTIC_MEAN = 0,
+    CI_STATISTIC_MEDIAN,
+} ci_statistic_t;
+
+typedef struct xlat_early_stop {
+    uint32_t target_us;         // half-width of the confidence interval, 0 = always run max_samples
+    enum ci_statistic statistic;
+    uint32_t confidence_pct;    // 90, 95 or 99
+    uint32_t min_samples;
+    uint32_t max_samples;
+} xlat_early_stop_t;
+
+// How the HID IN endpoint is polled
+typedef enum xlat_usb_polling {
+    XLAT_POLLING_BACK_TO_BACK = 0,  // next IN token right after the previous one (lowest latency)
+    XLAT_POLLING_INTERVAL,          // one IN token per bInterval, like a PC
+} xlat_usb_polling_t;
 
 typedef struct hid_event {
     USBH_HandleTypeDef *phost;
     uint32_t timestamp;
+    uint32_t prev_poll_timestamp;   // IN transaction before this report
+    uint32_t urb_timestamp;         // transfer interrupt of this report, before the host thread ran
 } hid_event_t;
 
+// Instrument calibration from the trigger output loopback. The offsets are how much later than the
+// event each timestamp is taken, they are taken out of the latencies that start or end with it.
+typedef struct xlat_calibration {
+    uint32_t cycles;
+    int32_t gpio_offset_ns;     // EXTI timestamp after the edge on the input pin
+    int32_t usb_offset_ns;      // report timestamp in the host thread after the transfer interrupt
+    uint32_t gpio_jitter_ns;    // standard deviations, without the time base quantisation
+    uint32_t usb_jitter_ns;
+    uint32_t bound_ns;          // 2 sigma of a corrected gpio -> usb latency, quantisation included
+} xlat_calibration_t;
+
+// Maximum number of HID input items remembered from the report descriptor
+#define XLAT_HID_ITEMS_MAX (64)
+// Size of the raw report buffer handed to the measurement code
+#define XLAT_HID_REPORT_MAX (64)
+
 typedef struct hid_data_location {
     bool found;
     size_t bit_index;
     size_t bit_size;
     size_t byte_offset;
+    uint8_t report_id;
 } hid_data_location_t;
 
+// Compact description of one Input item found in the HID report descriptor
+typedef struct hid_input_item {
+    uint16_t usage_page;
+    uint16_t usage;
+    uint16_t bit_index;     // bit offset within the report, excluding the reportId byte
+    uint8_t  bit_size;
+    uint8_t  report_id;
+} hid_input_item_t;
+
 typedef enum latency_type {
     LATENCY_GPIO_TO_USB = 0,
     LATENCY_AUDIO_TO_USB,
+    LATENCY_GPIO_TO_USB_RELEASE,
+    LATENCY_DEVICE_PROCESSING,      // press latency without the wait for the host's poll (estimate)
+    LATENCY_CLICK_TO_PHOTON,        // press to the screen change seen by the photodiode on A0
     LATENCY_TYPE_MAX,
 } latency_type_t;
 
 
+
 typedef enum xlat_mode {
     XLAT_MODE_CLICK,
     XLAT_MODE_MOTION,
 } xlat_mode_t;
 
+// Direction filter for the motion onset detection
+typedef enum motion_direction {
+    MOTION_DIR_ANY,
+    MOTION_DIR_POS_X,
+    MOTION_DIR_NEG_X,
+    MOTION_DIR_POS_Y,
+    MOTION_DIR_NEG_Y,
+} motion_direction_t;
+
 extern volatile bool xlat_initialized;
 
 void xlat_init(void);
 void xlat_usb_hid_event(void);
 
-uint32_t xlat_get_latency_us(enum latency_type type);
-uint32_t xlat_get_average_latency(enum latency_type type);
-uint32_t xlat_get_latency_count(enum latency_type type);
-uint32_t xlat_get_latency_variance(enum latency_type type);
-uint32_t xlat_get_latency_standard_deviation(enum latency_type type);
+uint32_t xlat_get_latency_us(size_t channel, enum latency_type type);
+uint32_t xlat_get_average_latency(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_count(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_variance(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_standard_deviation(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_min(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_max(size_t channel, enum latency_type type);
+const latency_stats_t * xlat_get_latency_stats(size_t channel, enum latency_type type);
+const latency_histogram_t * xlat_get_latency_histogram(size_t channel, enum latency_type type);
+uint32_t xlat_get_latency_percentile(size_t channel, enum latency_type type, float percentile);
+void xlat_get_latency_percentiles(size_t channel, enum latency_type type, uint32_t percentiles_us[XLAT_PERCENTILE_MAX]);
+void xlat_set_window_samples(uint32_t samples);
+uint32_t xlat_get_window_samples(void);
+void xlat_set_window_seconds(uint32_t seconds);
+uint32_t xlat_get_window_seconds(void);
+void xlat_get_window_stats(size_t channel, enum latency_type type, enum latency_window_kind kind, latency_window_result_t *result);
+enum latency_trend xlat_get_window_trend(size_t channel, enum latency_type type, enum latency_window_kind kind);
+const char * xlat_get_trend_name(enum latency_trend trend);
+bool xlat_get_exact_latency_quantile(size_t channel, enum latency_type type, float quantile, uint32_t *latency_us);
+// Binned distribution between P0.1 and P99.9, false when there are no samples
+bool xlat_get_latency_distribution(size_t channel, enum latency_type type, uint32_t *bins, size_t n,
+                                   uint32_t *lo_us, uint32_t *hi_us);
+// Fits the modes of the distribution, takes a few ms so do not call it for every sample
+void xlat_get_latency_modes(size_t channel, enum latency_type type, latency_modes_t *modes);
+// Estimates the internal scan period of the device from the session samples, takes up to a second
+void xlat_get_scan_period(size_t channel, enum latency_type type, scan_period_result_t *result);
 
 void xlat_reset_latency(void);
-void xlat_add_latency_measurement(uint32_t latency_us, enum latency_type type);
-void xlat_print_measurement(void);
+bool xlat_add_latency_measurement(size_t channel, uint32_t latency_us, enum latency_type type);
+const latency_stats_t * xlat_get_raw_latency_stats(size_t channel, enum latency_type type);
+uint32_t xlat_get_outlier_count(size_t channel, enum latency_type type);
+// Returns the number of outliers so far, the last XLAT_OUTLIER_LOG_MAX are in the log at n % XLAT_OUTLIER_LOG_MAX
+uint32_t xlat_get_outlier_log(const xlat_outlier_t **log);
+void xlat_set_outlier_sensitivity(uint32_t sensitivity);
+uint32_t xlat_get_outlier_sensitivity(void);
+void xlat_print_measurement(size_t channel, enum latency_type type);
+
+enum debounce_scheme xlat_get_debounce_scheme(size_t channel, uint32_t *window_us);
+const char * xlat_get_debounce_scheme_name(enum debounce_scheme scheme);
+
+void xlat_set_gpio_irq_holdoff_us(size_t channel, uint32_t us);
+uint32_t xlat_get_gpio_irq_holdoff_us(size_t channel);
+// Press count of a channel's GPIO input, and the timestamp of the last press
+uint32_t xlat_get_gpio_press(size_t channel, uint32_t *timestamp_us);
 
-void xlat_set_gpio_irq_holdoff_us(uint32_t us);
-uint32_t xlat_get_gpio_irq_holdoff_us(void);
+void xlat_set_calibration(const xlat_calibration_t *calibration);
+void xlat_clear_calibration(void);
+// NULL when not calibrated
+const xlat_calibration_t * xlat_get_calibration(void);
+
+void xlat_set_channel_usage(size_t channel, uint16_t button_usage);
+uint16_t xlat_get_channel_usage(size_t channel);
 
 uint32_t xlat_counter_1mhz_get(void);
+void xlat_trigger_edge_from_isr(size_t channel, bool pressed, uint32_t timestamp_us);
+void xlat_audio_onset_from_isr(uint32_t timestamp_us);
+void xlat_photon_from_isr(uint32_t timestamp_us);
 
 uint32_t xlat_get_last_usb_timestamp_us(void);
 uint32_t xlat_get_last_button_timestamp_us(void);
+uint32_t xlat_get_last_release_timestamp_us(void);
 
 
 void xlat_set_using_reportid(bool use_reportid);
@@ -80,13 +238,54 @@ void xlat_parse_hid_descriptor(uint8_t *desc, size_t desc_size);
 void xlat_set_mode(enum xlat_mode mode);
 enum xlat_mode xlat_get_mode(void);
 
+void xlat_set_motion_threshold(uint32_t counts);
+uint32_t xlat_get_motion_threshold(void);
+void xlat_set_motion_direction(enum motion_direction direction);
+enum motion_direction xlat_get_motion_direction(void);
+
+size_t xlat_get_hid_item_count(void);
+const hid_input_item_t * xlat_get_hid_item(size_t index);
+const char * xlat_get_hid_usage_name(uint16_t usage_page, uint16_t usage, char *buf, size_t len);
+void xlat_set_trigger_item(int index);
+int xlat_get_trigger_item(void);
+
 hid_data_location_t * xlat_get_button_location(void);
 hid_data_location_t * xlat_get_x_location(void);
 hid_data_location_t * xlat_get_y_location(void);
 void xlat_clear_locations(void);
 
 void xlat_auto_trigger_action(void);
+void xlat_auto_trigger_set(bool pressed);
 void xlat_auto_trigger_level_set(bool high);
 bool xlat_auto_trigger_level_is_high(void);
+uint32_t xlat_auto_trigger_period_ms(void);
+void xlat_set_auto_trigger_idle_gaps(bool enable);
+bool xlat_get_auto_trigger_idle_gaps(void);
+
+void xlat_set_usb_polling(xlat_usb_polling_t polling);
+xlat_usb_polling_t xlat_get_usb_polling(void);
+void xlat_set_usb_poll_interval_us(uint32_t us);
+uint32_t xlat_get_usb_poll_interval_us(void);
+void xlat_set_usb_frame_us(uint32_t us);
+uint32_t xlat_get_usb_poll_period_us(void);
+const latency_stats_t * xlat_get_poll_bracket_stats(void);
+
+void xlat_set_early_stop(const xlat_early_stop_t *early_stop);
+const xlat_early_stop_t * xlat_get_early_stop(void);
+// Starts an auto-trigger series: the confidence interval covers the samples from here on
+void xlat_series_start(void);
+// Of the current series; samples gets the number of samples it is built on
+bool xlat_get_confidence_interval(size_t channel, enum latency_type type, enum ci_statistic statistic,
+                                  uint32_t confidence_pct, uint32_t *half_width_us, uint32_t *samples);
+
+bool xlat_set_idle_bucket_limit_ms(size_t bucket, uint32_t ms);
+uint32_t xlat_get_idle_bucket_limit_ms(size_t bucket);
+size_t xlat_get_idle_bucket(uint32_t idle_ms);
+uint32_t xlat_get_last_idle_ms(size_t channel);
+const latency_stats_t * xlat_get_idle_latency_stats(size_t channel, size_t bucket);
+uint32_t xlat_get_idle_latency_count(size_t channel, size_t bucket);
+uint32_t xlat_get_idle_average_latency(size_t channel, size_t bucket);
+uint32_t xlat_get_idle_latency_standard_deviation(size_t channel, size_t bucket);
+uint32_t xlat_get_idle_latency_percentile(size_t channel, size_t bucket, float percentile);
 
 #endif //XLAT_H
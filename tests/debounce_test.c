@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2023 Finalmouse, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "debounce.h"
+
+#define POLL_US     (1000)  // full speed, bInterval 1
+#define SCAN_US     (1000)
+#define PROCESS_US  (300)
+#define WINDOW_US   (5000)
+
+static int failures = 0;
+
+// Latencies of one edge: the wait for the scan and for the poll are uniform, the window is added
+// when the edge is held back
+static void edge_fill(latency_stats_t *stats, uint32_t held_us, unsigned seed)
+{
+    srand(seed);
+    latency_stats_reset(stats);
+    for (int i = 0; i < 200; i++) {
+        uint32_t scan_us = (uint32_t)rand() % SCAN_US;
+        uint32_t poll_us = (uint32_t)rand() % POLL_US;
+        latency_stats_add(stats, scan_us + PROCESS_US + held_us + poll_us);
+    }
+}
+
+static void check(const char *name, uint32_t press_held_us, uint32_t release_held_us, debounce_scheme_t expected,
+                  uint32_t window_min_us, uint32_t window_max_us)
+{
+    latency_stats_t press;
+    latency_stats_t release;
+    uint32_t window_us;
+
+    edge_fill(&press, press_held_us, 1);
+    edge_fill(&release, release_held_us, 2);
+    debounce_scheme_t scheme = debounce_classify(&press, &release, POLL_US / 2, &window_us);
+    if ((scheme != expected) || (window_us < window_min_us) || (window_us > window_max_us)) {
+        printf("FAIL %s: %s, window %uus\n", name, debounce_scheme_name(scheme), (unsigned)window_us);
+        failures++;
+    } else {
+        printf("ok   %s: %s, window %uus\n", name, debounce_scheme_name(scheme), (unsigned)window_us);
+    }
+}
+
+int main(void)
+{
+    check("both eager", 0, 0, DEBOUNCE_SCHEME_EAGER, 0, 0);
+    check("both deferred", WINDOW_US, WINDOW_US, DEBOUNCE_SCHEME_DEFERRED, WINDOW_US, WINDOW_US + SCAN_US);
+    check("eager press", 0, WINDOW_US, DEBOUNCE_SCHEME_EAGER_PRESS, WINDOW_US - 200, WINDOW_US + 200);
+    check("eager release", WINDOW_US, 0, DEBOUNCE_SCHEME_EAGER_RELEASE, WINDOW_US - 200, WINDOW_US + 200);
+
+    // Too few samples
+    latency_stats_t press;
+    latency_stats_t release;
+    latency_stats_reset(&press);
+    latency_stats_reset(&release);
+    latency_stats_add(&press, 1000);
+    latency_stats_add(&release, 1000);
+    if (debounce_classify(&press, &release, POLL_US / 2, NULL) != DEBOUNCE_SCHEME_UNKNOWN) {
+        printf("FAIL too few samples\n");
+        failures++;
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}